@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "analyze.h"
+#include "fileio.h"
+#include "bmp.h"
+#include "parallel.h"
+#include "metrics.h"
+#include "types.h"
+
+// What an analysis found
+typedef enum
+{
+    e_analyze_clean,        // statistics of a clean image
+    e_analyze_suspect,      // a segment or the whole image above the thresholds (see analyze.h)
+    e_analyze_not_bmp,      // not a supported BMP image
+    e_analyze_unreadable    // could not be read
+} AnalyzeStatus;
+
+// One analyzed image
+typedef struct _AnalyzeResult
+{
+    char *path;
+    AnalyzeStatus status;
+    uint segment;           // segment that made the image SUSPECT, else the one with the highest RS estimate (from 1)
+    uint segments;
+    double chi_p;           // chi-square probability of embedding over that segment
+    double rs_segment;      // RS estimate of the share of colour bytes carrying embedded bits, same segment
+    double rs;              // same over the rows read
+    double read;            // share of the rows read, 1 unless a segment decided early
+} AnalyzeResult;
+
+// Counts of RS analysis for the masks M (flip LSB) and -M (shifted flip)
+typedef struct _RsCounts
+{
+    uint64_t regular;       // groups made noisier by M
+    uint64_t singular;      // groups made smoother by M
+    uint64_t neg_regular;   // same for -M
+    uint64_t neg_singular;
+} RsCounts;
+
+// Per thread buffers, reused from image to image
+typedef struct _AnalyzeWorker
+{
+    unsigned char *image;   // rows of one segment
+    size_t capacity;
+} AnalyzeWorker;
+
+// Images found and not yet printed
+typedef struct _AnalyzeList
+{
+    AnalyzeResult results[ANALYZE_BATCH];
+    size_t count;
+    uint jobs;
+    AnalyzeWorker *workers;
+    size_t total;           // images printed so far
+    size_t suspect;
+    size_t skipped;
+} AnalyzeList;
+
+
+/* --- Description for read_and_validate_analyze_args Function --->
+ * Input: argc, argv, analyzeInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -n <.bmp_file | directory>... [-j N]
+ * Every argument that is not an option is a path to analyze.
+ */
+Status read_and_validate_analyze_args(int argc, char *argv[], AnalyzeInfo *analyzeInfo)
+{
+    analyzeInfo->paths = malloc(argc * sizeof(char *));
+    analyzeInfo->npaths = 0;
+    analyzeInfo->jobs = 1;
+    if(analyzeInfo->paths == NULL)
+        return e_failure;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &analyzeInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)
+        {
+            if(parse_jobs(argv[i] + 2, &analyzeInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(argv[i][0] == '-')
+        {
+            return e_failure;
+        }
+        else
+        {
+            analyzeInfo->paths[analyzeInfo->npaths++] = argv[i];
+        }
+    }
+
+    return analyzeInfo->npaths > 0 ? e_success : e_failure;
+}
+
+
+/* --- Description for gamma_q Function --->
+ * Input: a, x
+ * Output: upper regularized incomplete gamma function Q(a, x)
+ * Description: Series for x < a + 1, continued fraction (modified Lentz)
+ * otherwise. 1 - Q(k / 2, chi / 2) is the chi-square distribution function
+ * with k degrees of freedom.
+ */
+static double gamma_q(double a, double x)
+{
+    if(x <= 0)
+        return 1.0;
+
+    double front = exp(-x + a * log(x) - lgamma(a));
+    if(x < a + 1)
+    {
+        double term = 1.0 / a, sum = term;
+        for(int n = 1; n < 1000 && fabs(term) > fabs(sum) * 1e-12; n++)
+        {
+            term *= x / (a + n);
+            sum += term;
+        }
+        return 1.0 - sum * front;
+    }
+
+    double b = x + 1 - a, c = 1e300, d = 1 / b, h = d;
+    for(int n = 1; n < 1000; n++)
+    {
+        double an = -n * (n - a);
+        b += 2;
+        d = an * d + b;
+        c = b + an / c;
+        d = 1 / (fabs(d) < 1e-300 ? 1e-300 : d);
+        c = fabs(c) < 1e-300 ? 1e-300 : c;
+        h *= d * c;
+        if(fabs(d * c - 1) < 1e-12)
+            break;
+    }
+    return h * front;
+}
+
+
+/* --- Description for chi_square_probability Function --->
+ * Input: hist (counts of the 256 byte values)
+ * Output: probability that the LSBs were replaced, 0 to 1
+ * Description: Embedding random bits makes the counts of 2k and 2k + 1
+ * equal on average. The statistic compares the count of 2k with the mean
+ * of the pair, over the pairs expected at least 5 times, and a value close
+ * to 1 means the pairs are as even as random bits would leave them.
+ */
+static double chi_square_probability(const uint64_t *hist)
+{
+    double chi = 0;
+    uint pairs = 0;
+
+    for(uint k = 0; k < 256; k += 2)
+    {
+        double expected = (hist[k] + hist[k + 1]) / 2.0;
+        if(expected < 5)
+            continue;
+        double diff = hist[k] - expected;
+        chi += diff * diff / expected;
+        pairs++;
+    }
+    return pairs < 2 ? 0 : gamma_q((pairs - 1) / 2.0, chi / 2);
+}
+
+
+/* --- Description for rs_smoothness Function --->
+ * Input: the 4 bytes of a group
+ * Output: sum of the differences between neighbours (higher is noisier)
+ */
+static inline int rs_smoothness(int a, int b, int c, int d)
+{
+    return abs(a - b) + abs(b - c) + abs(c - d);
+}
+
+
+/* --- Description for rs_in_range Function --->
+ * Input: the 2 masked bytes of a group
+ * Output: 1 if the shifted flip keeps them in 0 to 255 in the image and in
+ * the image with its LSBs flipped, so the group can be counted
+ */
+static inline int rs_in_range(int b, int c)
+{
+    return (uint)(b - 2) < 252 && (uint)(c - 2) < 252;
+}
+
+
+/* --- Description for rs_group Function --->
+ * Input: the 4 bytes of a group, rs
+ * Output: None, rs counts the group
+ * Description: Applies the mask [0 1 1 0] with the flip F1 (2k <-> 2k + 1)
+ * and with the shifted flip F-1 (2k - 1 <-> 2k) and counts whether each
+ * made the group noisier (regular) or smoother (singular).
+ */
+static inline void rs_group(int a, int b, int c, int d, RsCounts *rs)
+{
+    int f = rs_smoothness(a, b, c, d);
+    int pos = rs_smoothness(a, b ^ 1, c ^ 1, d);
+    int neg = rs_smoothness(a, ((b + 1) ^ 1) - 1, ((c + 1) ^ 1) - 1, d);
+
+    rs->regular += pos > f;
+    rs->singular += pos < f;
+    rs->neg_regular += neg > f;
+    rs->neg_singular += neg < f;
+}
+
+
+/* --- Description for rs_estimate Function --->
+ * Input: rs (counts for the image and for the image with its LSBs flipped), groups
+ * Output: estimated share of colour bytes carrying embedded bits, 0 to 1
+ * Description: With d0 / d1 the regular minus singular groups of M for the
+ * image / the flipped image, and n0 / n1 the same for -M, the root z of
+ * 2 (d1 + d0) z^2 + (n0 - n1 - d1 - 3 d0) z + d0 - n0 = 0
+ * smallest in absolute value gives the estimate z / (z - 1/2). Near full
+ * embedding the image and the flipped image become alike and the parabola
+ * has no real root: the estimate is then 1.
+ */
+static double rs_estimate(const RsCounts rs[2], uint64_t groups)
+{
+    if(groups == 0)
+        return 0;
+
+    double d0 = ((double)rs[0].regular - rs[0].singular) / groups;
+    double d1 = ((double)rs[1].regular - rs[1].singular) / groups;
+    double n0 = ((double)rs[0].neg_regular - rs[0].neg_singular) / groups;
+    double n1 = ((double)rs[1].neg_regular - rs[1].neg_singular) / groups;
+    double a = 2 * (d1 + d0), b = n0 - n1 - d1 - 3 * d0, c = d0 - n0;
+    double z;
+
+    if(fabs(a) < 1e-12)
+        z = b != 0 ? -c / b : 0;
+    else
+    {
+        double disc = b * b - 4 * a * c;
+        if(disc < 0)
+            return 1;
+        double root = sqrt(disc);
+        double z1 = (-b + root) / (2 * a), z2 = (-b - root) / (2 * a);
+        z = fabs(z1) < fabs(z2) ? z1 : z2;
+    }
+
+    double p = z / (z - 0.5);
+    return p < 0 ? 0 : p > 1 ? 1 : p;
+}
+
+
+/* --- Description for analyze_row Function --->
+ * Input: row (stored bytes of one row), info, hist (4 running histograms), rs, groups
+ * Output: None
+ * Description: Counts the colour bytes of the row into the histograms and
+ * every group of 4 neighbouring pixels of each channel within range (see
+ * rs_in_range) into rs, for the row as it is and with its LSBs flipped.
+ * Consecutive bytes are counted into different histograms, so the
+ * increments of repeated values don't wait on each other; the caller adds
+ * the 4 up. This split is the fast form on x86: a SIMD histogram needs a
+ * scatter with conflict detection and does no better.
+ */
+static void analyze_row(const unsigned char *row, const BmpInfo *info, uint32_t hist[4][256], RsCounts rs[2], uint64_t *groups)
+{
+    uint pixel = info->bpp / 8;
+    size_t i = 0;
+
+    if(pixel == 3)
+    {
+        for(; i + 4 <= info->row_bytes; i += 4)
+        {
+            hist[0][row[i]]++;
+            hist[1][row[i + 1]]++;
+            hist[2][row[i + 2]]++;
+            hist[3][row[i + 3]]++;
+        }
+        for(; i < info->row_bytes; i++)
+            hist[0][row[i]]++;
+    }
+    else
+    {
+        for(; i < info->width; i++)
+        {
+            hist[0][row[4 * i]]++;
+            hist[1][row[4 * i + 1]]++;
+            hist[2][row[4 * i + 2]]++;
+        }
+    }
+
+    for(uint channel = 0; channel < 3; channel++)
+    {
+        for(size_t x = 0; x + 4 <= info->width; x += 4)
+        {
+            const unsigned char *p = row + x * pixel + channel;
+            int a = p[0], b = p[pixel], c = p[2 * pixel], d = p[3 * pixel];
+            if(!rs_in_range(b, c))
+                continue;
+            rs_group(a, b, c, d, &rs[0]);
+            rs_group(a ^ 1, b ^ 1, c ^ 1, d ^ 1, &rs[1]);
+            (*groups)++;
+        }
+    }
+}
+
+
+/* --- Description for rs_add Function --->
+ * Input: total, part (counts for the image and for the image with its LSBs flipped)
+ * Output: None, part added to total
+ */
+static void rs_add(RsCounts total[2], const RsCounts part[2])
+{
+    for(int i = 0; i < 2; i++)
+    {
+        total[i].regular += part[i].regular;
+        total[i].singular += part[i].singular;
+        total[i].neg_regular += part[i].neg_regular;
+        total[i].neg_singular += part[i].neg_singular;
+    }
+}
+
+
+/* --- Description for analyze_read Function --->
+ * Input: fd, offset, buffer, size
+ * Output: Status (e_failure unless all size bytes were read)
+ */
+static Status analyze_read(int fd, uint64_t offset, unsigned char *buffer, size_t size)
+{
+    size_t done = 0;
+
+    while(done < size)
+    {
+        ssize_t got = pread(fd, buffer + done, size - done, offset + done);
+        if(got <= 0)
+            return e_failure;
+        done += got;
+    }
+    return e_success;
+}
+
+
+/* --- Description for analyze_image Function --->
+ * Input: result (path set), worker
+ * Output: None, result filled in
+ * Description: Parses the headers and reads the rows one segment at a
+ * time, in file order. Each segment gets its own chi-square probability
+ * and RS estimate and is added to the RS counts of the image. The first
+ * segment over the thresholds (see analyze.h) makes the image SUSPECT and
+ * the rest of the file is not read; otherwise the RS estimate over the
+ * whole image decides.
+ */
+static void analyze_image(AnalyzeResult *result, AnalyzeWorker *worker)
+{
+    unsigned char header[BMP_MAX_HEADER_SIZE];
+    int fd = open(result->path, O_RDONLY);
+    struct stat st;
+    BmpInfo info;
+
+    result->status = e_analyze_unreadable;
+    if(fd == -1)
+        return;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    size_t len = (uint64_t)st.st_size < sizeof(header) ? (size_t)st.st_size : sizeof(header);
+    if(analyze_read(fd, 0, header, len) == e_failure)
+    {
+        close(fd);
+        return;
+    }
+    if(bmp_parse_header(header, len, &info) == e_failure || info.image_size > (uint64_t)st.st_size)
+    {
+        result->status = e_analyze_not_bmp;
+        close(fd);
+        return;
+    }
+
+    uint64_t row_groups = 3 * (info.width / 4);
+    uint64_t segment_rows = (info.height + ANALYZE_SEGMENTS - 1) / ANALYZE_SEGMENTS;
+    if(row_groups > 0 && segment_rows * row_groups < ANALYZE_MIN_GROUPS)
+        segment_rows = (ANALYZE_MIN_GROUPS + row_groups - 1) / row_groups;
+    if(segment_rows > info.height)
+        segment_rows = info.height;
+    if(segment_rows * info.stride > worker->capacity)
+    {
+        unsigned char *grown = realloc(worker->image, segment_rows * info.stride);
+        if(grown == NULL)
+        {
+            close(fd);
+            return;
+        }
+        worker->image = grown;
+        worker->capacity = segment_rows * info.stride;
+    }
+
+    RsCounts rs[2] = { { 0 } };
+    uint64_t groups = 0, rows = 0;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    result->status = e_analyze_clean;
+    result->segments = (info.height + segment_rows - 1) / segment_rows;
+    result->rs_segment = -1;
+    for(uint s = 0; s < result->segments && result->status == e_analyze_clean; s++)
+    {
+        uint64_t count = info.height - rows < segment_rows ? info.height - rows : segment_rows;
+        uint32_t hist[4][256];
+        uint64_t counts[256];
+        RsCounts segment[2] = { { 0 } };
+        uint64_t segment_groups = 0;
+
+        if(analyze_read(fd, info.data_offset + rows * info.stride, worker->image, count * info.stride) == e_failure)
+        {
+            result->status = e_analyze_unreadable;
+            break;
+        }
+        memset(hist, 0, sizeof(hist));
+        for(uint64_t r = 0; r < count; r++)
+            analyze_row(worker->image + r * info.stride, &info, hist, segment, &segment_groups);
+        for(uint v = 0; v < 256; v++)
+            counts[v] = (uint64_t)hist[0][v] + hist[1][v] + hist[2][v] + hist[3][v];
+
+        double chi_p = chi_square_probability(counts);
+        double rs_segment = rs_estimate(segment, segment_groups);
+        if(rs_segment >= ANALYZE_RS_THRESHOLD || (chi_p >= ANALYZE_CHI_THRESHOLD && rs_segment >= ANALYZE_RS_SUPPORT))
+            result->status = e_analyze_suspect;
+        if(result->status == e_analyze_suspect || rs_segment > result->rs_segment)
+        {
+            result->segment = s + 1;
+            result->chi_p = chi_p;
+            result->rs_segment = rs_segment;
+        }
+        rs_add(rs, segment);
+        groups += segment_groups;
+        rows += count;
+    }
+    close(fd);
+    if(result->status == e_analyze_unreadable)
+        return;
+
+    result->read = rows / (double)info.height;
+    result->rs = rs_estimate(rs, groups);
+    if(result->rs >= ANALYZE_RS_IMAGE_THRESHOLD)
+        result->status = e_analyze_suspect;
+}
+
+
+/* --- Description for analyze_chunk Function --->
+ * Input: ctx (AnalyzeList), chunk (image index), worker
+ * Output: e_success, failures are recorded in the result
+ */
+static Status analyze_chunk(void *ctx, size_t chunk, uint worker)
+{
+    AnalyzeList *list = ctx;
+    analyze_image(&list->results[chunk], &list->workers[worker]);
+    return e_success;
+}
+
+
+/* --- Description for print_analyze_result Function --->
+ * Input: result
+ * Output: None
+ * Description: One line per image, or one JSON record with --json, with
+ * the figures of the segment that decided (the most suspect one for a
+ * clean image) and the RS estimate over the rows read.
+ */
+static void print_analyze_result(const AnalyzeResult *result)
+{
+    static const char *const names[] = { "clean", "suspect", "skipped", "skipped" };
+    FILE *out = job_stdout();
+
+    if(metrics_format() == e_report_json)
+    {
+        fprintf(out, "{\"op\":\"analyze\",\"input\":");
+        metrics_json_string(out, result->path);
+        if(result->status == e_analyze_clean || result->status == e_analyze_suspect)
+            fprintf(out, ",\"status\":\"%s\",\"segment\":%u,\"segments\":%u,\"chi_square_p\":%.4f,"
+                    "\"rs_segment_rate\":%.4f,\"rs_rate\":%.4f,\"rows_read\":%.4f}\n",
+                    names[result->status], result->segment, result->segments, result->chi_p, result->rs_segment,
+                    result->rs, result->read);
+        else
+            fprintf(out, ",\"status\":\"skipped\",\"reason\":\"%s\"}\n",
+                    result->status == e_analyze_not_bmp ? "not a supported BMP image" : "unable to open");
+    }
+    else if(result->status == e_analyze_suspect || result->status == e_analyze_clean)
+        fprintf(out, "%s %s  (segment %u of %u: chi-square %.3f, RS %.3f; RS %.3f over %.1f%% of the rows)\n",
+                result->status == e_analyze_suspect ? "SUSPECT" : "CLEAN  ", result->path, result->segment,
+                result->segments, result->chi_p, result->rs_segment, result->rs, 100 * result->read);
+    else
+        fprintf(out, "SKIPPED %s  (%s)\n", result->path,
+                result->status == e_analyze_not_bmp ? "not a supported BMP image" : "unable to open");
+}
+
+
+/* --- Description for analyze_flush Function --->
+ * Input: list
+ * Output: None
+ * Description: Analyzes the images of the batch with list->jobs threads,
+ * prints their lines in order and empties the batch.
+ */
+static void analyze_flush(AnalyzeList *list)
+{
+    parallel_for(list->jobs, list->count, analyze_chunk, list);
+
+    for(size_t i = 0; i < list->count; i++)
+    {
+        AnalyzeResult *result = &list->results[i];
+
+        print_analyze_result(result);
+        list->suspect += result->status == e_analyze_suspect;
+        list->skipped += result->status == e_analyze_not_bmp || result->status == e_analyze_unreadable;
+        free(result->path);
+    }
+    fflush(job_stdout());
+    list->total += list->count;
+    list->count = 0;
+}
+
+
+/* --- Description for analyze_list_add Function --->
+ * Input: ctx (AnalyzeList), path
+ * Output: Status
+ * Description: Queues an image, running the batch once it is full.
+ */
+static Status analyze_list_add(void *ctx, const char *path)
+{
+    AnalyzeList *list = ctx;
+    AnalyzeResult *result = &list->results[list->count];
+
+    memset(result, 0, sizeof(AnalyzeResult));
+    result->path = strdup(path);
+    if(result->path == NULL)
+        return e_failure;
+    if(++list->count == ANALYZE_BATCH)
+        analyze_flush(list);
+    return e_success;
+}
+
+
+/* --- Description for do_analyze Function --->
+ * Input: analyzeInfo
+ * Output: Status (e_failure if a path is missing or memory runs out)
+ * Description:
+ * 1. Collects the images: files given directly and *.bmp files below directories.
+ * 2. Analyzes them ANALYZE_BATCH at a time with analyzeInfo->jobs threads.
+ * 3. Prints one line per image as each batch is done, and a summary.
+ */
+Status do_analyze(AnalyzeInfo *analyzeInfo)
+{
+    AnalyzeList *list = calloc(1, sizeof(AnalyzeList));
+    Status ret = e_success;
+    struct stat st;
+
+    if(list == NULL || (list->workers = calloc(analyzeInfo->jobs, sizeof(AnalyzeWorker))) == NULL)
+    {
+        perror("calloc");
+        free(list);
+        free(analyzeInfo->paths);
+        return e_failure;
+    }
+    list->jobs = analyzeInfo->jobs;
+
+    for(int i = 0; i < analyzeInfo->npaths && ret == e_success; i++)
+    {
+        if(stat(analyzeInfo->paths[i], &st) == -1)
+        {
+            perror("stat");
+            fprintf(job_stderr(), "ERROR : Unable to open %s\n", analyzeInfo->paths[i]);
+            ret = e_failure;
+        }
+        else if(S_ISDIR(st.st_mode))
+            ret = walk_bmp_files(analyzeInfo->paths[i], analyze_list_add, list);
+        else
+            ret = analyze_list_add(list, analyzeInfo->paths[i]);
+    }
+    analyze_flush(list);
+
+    if(ret == e_success)
+        info_printf("INFO : %zu images, %zu suspect, %zu skipped\n", list->total, list->suspect, list->skipped);
+    for(uint i = 0; i < list->jobs; i++)
+        free(list->workers[i].image);
+    free(list->workers);
+    free(list);
+    free(analyzeInfo->paths);
+    return ret;
+}
@@ -0,0 +1,70 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Analyze mode: tells whether images show signs of LSB embedding from the
+ * statistics of their colour bytes alone, with or without a header:
+ *      -n <.bmp_file | directory>... [-j N]
+ * The rows are cut in ANALYZE_SEGMENTS segments in file order (fewer on
+ * small images, so that each holds ANALYZE_MIN_GROUPS RS groups), since a
+ * payload fills the first rows and stops anywhere. Two detectors run on
+ * every segment:
+ *  - chi-square attack (Westfeld and Pfitzmann): replacing LSBs with random
+ *    bits evens out the counts of each pair of values 2k, 2k + 1.
+ *  - RS analysis (Fridrich, Goljan and Du): counts the groups of 4
+ *    neighbouring bytes of a channel made smoother or noisier by flipping
+ *    their LSBs, for the image and for the image with every LSB flipped,
+ *    and estimates the share of colour bytes carrying embedded bits. Groups
+ *    touching the values 0, 1, 254 and 255 are left out: the shifted flip
+ *    would push them out of range, which reads as embedding on clipped
+ *    shadows and highlights.
+ * The chi-square test alone passes on many noisy clean segments, RS alone
+ * is confident from ANALYZE_RS_THRESHOLD. An image is SUSPECT as soon as a
+ * segment reaches ANALYZE_RS_THRESHOLD, or ANALYZE_CHI_THRESHOLD with an RS
+ * estimate of at least ANALYZE_RS_SUPPORT, or when the RS estimate over the
+ * whole image reaches ANALYZE_RS_IMAGE_THRESHOLD (payloads scattered over
+ * the image with --scatter). The file is read a segment at a time and the
+ * rest is skipped once a segment decides.
+ * Directories are walked recursively for *.bmp files. Images are analyzed
+ * ANALYZE_BATCH at a time by N threads, and the lines of a batch are printed
+ * in the order the images were found as soon as it is done, so results
+ * stream out of a large corpus.
+ */
+
+/* Images analyzed before their lines are printed */
+#define ANALYZE_BATCH 1024
+
+/* The rows are tested in ANALYZE_SEGMENTS segments of at least ANALYZE_MIN_GROUPS RS groups */
+#define ANALYZE_SEGMENTS 64
+#define ANALYZE_MIN_GROUPS 4096
+
+/* RS estimate of a segment that makes it SUSPECT on its own */
+#define ANALYZE_RS_THRESHOLD 0.6
+
+/* Chi-square probability of a segment, with the RS estimate backing it, that makes it SUSPECT */
+#define ANALYZE_CHI_THRESHOLD 0.99
+#define ANALYZE_RS_SUPPORT 0.4
+
+/* RS estimate over the whole image that makes it SUSPECT */
+#define ANALYZE_RS_IMAGE_THRESHOLD 0.25
+
+// Structure to hold analyze related information
+typedef struct _AnalyzeInfo
+{
+    char **paths;       // files and directories given on the command line
+    int npaths;
+    uint jobs;          // images analyzed at the same time (-j)
+} AnalyzeInfo;
+
+
+/* -- function prototypes for analyze mode */
+
+/* Read and validate analyze args from argv */
+Status read_and_validate_analyze_args(int argc, char *argv[], AnalyzeInfo *analyzeInfo);
+
+/* Analyze every image and print one line per image */
+Status do_analyze(AnalyzeInfo *analyzeInfo);
+
+#endif
@@ -0,0 +1,569 @@
+#define _GNU_SOURCE     // open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "encode.h"
+#include "decode.h"
+#include "container.h"
+#include "crc32c.h"
+#include "fileio.h"
+#include "metrics.h"
+#include "types.h"
+
+
+/* --- Description for read_and_validate_archive_args Function --->
+ * Input: argc, argv, archiveInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -a <.bmp_file> <output .bmp> <file>... [encode options]
+ * --depth, --compress, --key, --scatter, the I/O mode and -j are passed on
+ * to the encoder and checked the same way -e checks them.
+ */
+Status read_and_validate_archive_args(int argc, char *argv[], ArchiveInfo *archiveInfo)
+{
+    int count = 0, size;
+
+    archiveInfo->files = malloc(argc * sizeof(char *));
+    archiveInfo->nfiles = 0;
+    archiveInfo->noptions = 0;
+    archiveInfo->key_fname = NULL;
+    archiveInfo->output_dir = NULL;
+    if(archiveInfo->files == NULL)
+        return e_failure;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strncmp(argv[i], "-j", 2) == 0)
+            size = strcmp(argv[i], "-j") == 0 && i + 1 < argc ? 2 : 1;
+        else
+            size = encode_option_size(argc, argv, i);
+
+        if(size > 0)
+        {
+            if(archiveInfo->noptions + size > MAX_ARCHIVE_OPTIONS)
+                return e_failure;
+            for(int k = 0; k < size; k++)
+                archiveInfo->options[archiveInfo->noptions++] = argv[i + k];
+            i += size - 1;
+        }
+        else if(strncmp(argv[i], "--", 2) == 0)   // unknown option
+            return e_failure;
+        else if(count == 0)
+            archiveInfo->image_fname = argv[count++, i];
+        else if(count == 1)
+            archiveInfo->stego_fname = argv[count++, i];
+        else
+            archiveInfo->files[archiveInfo->nfiles++] = argv[i];
+    }
+
+    // every member is read by name, and their sizes must be known up front
+    if(archiveInfo->nfiles == 0 || strstr(archiveInfo->image_fname, ".bmp") == NULL)
+        return e_failure;
+    for(int i = 0; i < archiveInfo->nfiles; i++)
+        if(strcmp(archiveInfo->files[i], "-") == 0)
+            return e_failure;
+
+    // let the encoder check the options it is given
+    EncodeInfo encInfo;
+    char *check[5 + MAX_ARCHIVE_OPTIONS] = { argv[0], "-e", "cover.bmp", "archive.arc", "stego.bmp" };
+    memcpy(check + 5, archiveInfo->options, archiveInfo->noptions * sizeof(char *));
+    return read_and_validate_encode_args(5 + archiveInfo->noptions, check, &encInfo);
+}
+
+
+/* --- Description for read_and_validate_unpack_args Function --->
+ * Input: argc, argv, archiveInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -t <.bmp_file> [--key file]
+ *                     -u <.bmp_file> [member]... [-o directory] [--key file]
+ * Members are unpacked by seeking through the image, so it can't be a pipe.
+ */
+Status read_and_validate_unpack_args(int argc, char *argv[], ArchiveInfo *archiveInfo)
+{
+    archiveInfo->image_fname = NULL;
+    archiveInfo->files = malloc(argc * sizeof(char *));
+    archiveInfo->nfiles = 0;
+    archiveInfo->noptions = 0;
+    archiveInfo->key_fname = NULL;
+    archiveInfo->output_dir = ".";
+    if(archiveInfo->files == NULL)
+        return e_failure;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+            archiveInfo->key_fname = argv[++i];
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            archiveInfo->output_dir = argv[++i];
+        else if(strncmp(argv[i], "-", 1) == 0)      // unknown option, stdin
+            return e_failure;
+        else if(archiveInfo->image_fname == NULL)
+            archiveInfo->image_fname = argv[i];
+        else
+            archiveInfo->files[archiveInfo->nfiles++] = argv[i];
+    }
+
+    if(archiveInfo->image_fname == NULL || strstr(archiveInfo->image_fname, ".bmp") == NULL)
+        return e_failure;
+    return tolower(argv[1][1]) == 't' && archiveInfo->nfiles > 0 ? e_failure : e_success;
+}
+
+
+/* --- Description for archive_member_name Function --->
+ * Input: path
+ * Output: file name part of path
+ */
+static const char *archive_member_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+
+/* --- Description for archive_valid_name Function --->
+ * Input: name, len
+ * Output: 1 if name can be created inside the output directory, 0 otherwise
+ * Description: Rejects empty names, "." and "..", and names holding a '/'
+ * or a NUL, so a crafted table can't write outside the directory.
+ */
+static int archive_valid_name(const char *name, size_t len)
+{
+    if(len == 0 || len > ARCHIVE_MAX_NAME || memchr(name, '/', len) != NULL || memchr(name, '\0', len) != NULL)
+        return 0;
+    return !(len == 1 && name[0] == '.') && !(len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+
+/* --- Description for archive_write_payload Function --->
+ * Input: archiveInfo, members (name and length set), toc_size, fptr
+ * Output: Status
+ * Description: Writes the table of contents and the members to fptr. The
+ * member CRCs are taken while copying, so the table is written last, at
+ * the front. A file whose size changed since it was measured fails.
+ */
+static Status archive_write_payload(ArchiveInfo *archiveInfo, ArchiveMember *members, size_t toc_size, FILE *fptr)
+{
+    unsigned char *toc = calloc(1, toc_size);
+    unsigned char buffer[64 * 1024];
+    Status ret = e_success;
+    size_t len = 8;
+
+    if(toc == NULL)
+    {
+        perror("calloc");
+        return e_failure;
+    }
+
+    if(fwrite(toc, 1, toc_size, fptr) != toc_size)
+        ret = e_failure;
+    for(int i = 0; i < archiveInfo->nfiles && ret == e_success; i++)
+    {
+        FILE *member = fopen(archiveInfo->files[i], "rb");
+        uint64_t left = members[i].length;
+        size_t got = 0;
+
+        members[i].crc = 0;
+        while(member != NULL && left > 0 && (got = fread(buffer, 1, left < sizeof(buffer) ? left : sizeof(buffer), member)) > 0)
+        {
+            members[i].crc = crc32c(members[i].crc, buffer, got);
+            if(fwrite(buffer, 1, got, fptr) != got)
+                break;
+            left -= got;
+        }
+        if(member == NULL || left > 0 || fread(buffer, 1, 1, member) != 0)
+        {
+            fprintf(job_stderr(), "ERROR : Unable to read %s (or its size changed)\n", archiveInfo->files[i]);
+            ret = e_failure;
+        }
+        if(member != NULL)
+            fclose(member);
+    }
+
+    put_le(toc, toc_size, 4);
+    put_le(toc + 4, archiveInfo->nfiles, 4);
+    for(int i = 0; i < archiveInfo->nfiles; i++)
+    {
+        size_t name_len = strlen(members[i].name);
+        put_le(toc + len, members[i].offset, 8);
+        put_le(toc + len + 8, members[i].length, 8);
+        put_le(toc + len + 16, members[i].flags, 4);
+        put_le(toc + len + 20, members[i].crc, 4);
+        put_le(toc + len + 24, name_len, 2);
+        memcpy(toc + len + ARCHIVE_ENTRY_SIZE, members[i].name, name_len);
+        len += ARCHIVE_ENTRY_SIZE + name_len;
+    }
+    put_le(toc + len, crc32c(0, toc, len), 4);
+
+    if(ret == e_success && (fseeko(fptr, 0, SEEK_SET) != 0 || fwrite(toc, 1, toc_size, fptr) != toc_size || fflush(fptr) != 0))
+        ret = e_failure;
+    free(toc);
+    return ret;
+}
+
+
+/* --- Description for do_archive Function --->
+ * Input: archiveInfo
+ * Output: Status
+ * Description:
+ * 1. Measures the files: regular files only, names (without directories)
+ *    must be distinct.
+ * 2. Lays out the table of contents and the members in a temporary file.
+ * 3. Encodes it like -e does, flagged CONTAINER_ARCHIVE.
+ */
+Status do_archive(ArchiveInfo *archiveInfo)
+{
+    ArchiveMember *members = calloc(archiveInfo->nfiles, sizeof(ArchiveMember));
+    uint64_t toc_size = ARCHIVE_FIXED_SIZE;
+    Status ret = e_success;
+
+    if(members == NULL)
+    {
+        perror("calloc");
+        return e_failure;
+    }
+
+    info_printf("INFO : Measuring %d files\n", archiveInfo->nfiles);
+    for(int i = 0; i < archiveInfo->nfiles && ret == e_success; i++)
+    {
+        struct stat st;
+        members[i].name = (char *)archive_member_name(archiveInfo->files[i]);
+        if(stat(archiveInfo->files[i], &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            fprintf(job_stderr(), "ERROR : %s is not a regular file\n", archiveInfo->files[i]);
+            ret = e_failure;
+        }
+        else if(!archive_valid_name(members[i].name, strlen(members[i].name)))
+        {
+            fprintf(job_stderr(), "ERROR : %s can't be stored under its name\n", archiveInfo->files[i]);
+            ret = e_failure;
+        }
+        for(int k = 0; k < i && ret == e_success; k++)
+            if(strcmp(members[k].name, members[i].name) == 0)
+            {
+                fprintf(job_stderr(), "ERROR : Two files are named %s\n", members[i].name);
+                ret = e_failure;
+            }
+        members[i].length = st.st_size;
+        members[i].flags = st.st_mode & ARCHIVE_MODE_MASK;
+        toc_size += ARCHIVE_ENTRY_SIZE + strlen(members[i].name);
+    }
+
+    // members follow the table back to back
+    uint64_t offset = toc_size;
+    for(int i = 0; i < archiveInfo->nfiles; i++)
+    {
+        members[i].offset = offset;
+        offset += members[i].length;
+    }
+
+    char *payload_fname = NULL;
+    FILE *payload = NULL;
+    if(ret == e_success && toc_size > MAX_ARCHIVE_TOC)
+    {
+        fprintf(job_stderr(), "ERROR : Too many files for one table of contents\n");
+        ret = e_failure;
+    }
+    if(ret == e_success && (payload = create_temp_file(&payload_fname)) == NULL)
+    {
+        fprintf(job_stderr(), "ERROR : Unable to create a temporary file\n");
+        ret = e_failure;
+    }
+    if(ret == e_success)
+    {
+        info_printf("INFO : Packing %llu bytes with a %llu byte table of contents\n",
+                    (unsigned long long)(offset - toc_size), (unsigned long long)toc_size);
+        ret = archive_write_payload(archiveInfo, members, toc_size, payload);
+    }
+    if(payload != NULL)
+        fclose(payload);
+
+    if(ret == e_success)
+    {
+        EncodeInfo encInfo;
+        char *argv[7 + MAX_ARCHIVE_OPTIONS] = { "stego", "-e", archiveInfo->image_fname, payload_fname,
+                                                archiveInfo->stego_fname, "--extn", ARCHIVE_EXTN };
+
+        memcpy(argv + 7, archiveInfo->options, archiveInfo->noptions * sizeof(char *));
+        ret = read_and_validate_encode_args(7 + archiveInfo->noptions, argv, &encInfo);
+        if(ret == e_success)
+        {
+            encInfo.archive = 1;
+            ret = do_encoding(&encInfo);
+            close_files(&encInfo);
+        }
+    }
+
+    if(payload_fname != NULL)
+        unlink(payload_fname);
+    free(payload_fname);
+    free(members);
+    return ret;
+}
+
+
+/* --- Description for archive_read_bytes Function --->
+ * Input: decInfo (chunk table decoded), offset, len
+ * Output: malloc'ed len payload bytes, NULL on failure
+ * Description: Decodes a small part of the payload into memory.
+ */
+static unsigned char *archive_read_bytes(DecodeInfo *decInfo, uint64_t offset, size_t len)
+{
+    char *data = NULL;
+    size_t size = 0;
+    FILE *fptr = open_memstream(&data, &size);
+
+    if(fptr == NULL)
+    {
+        perror("open_memstream");
+        return NULL;
+    }
+    decInfo->fptr_secret = fptr;
+    Status ret = decode_secret_bytes(decInfo, offset, offset + len);
+    decInfo->fptr_secret = NULL;
+
+    if(fclose(fptr) != 0 || ret == e_failure || size != len)
+    {
+        free(data);
+        return NULL;
+    }
+    return (unsigned char *)data;
+}
+
+
+/* --- Description for archive_parse_toc Function --->
+ * Input: toc (toc_size bytes, CRC checked), toc_size, payload_size, members, count
+ * Output: Status (e_failure for an impossible table)
+ * Description: Every entry must lie inside the table, every member inside
+ * the payload after the table, and every name must be safe to create.
+ */
+static Status archive_parse_toc(const unsigned char *toc, size_t toc_size, uint64_t payload_size,
+                                ArchiveMember *members, uint count)
+{
+    size_t len = 8;
+
+    for(uint i = 0; i < count; i++)
+    {
+        if(toc_size - 4 - len < ARCHIVE_ENTRY_SIZE)
+            return e_failure;
+        size_t name_len = get_le(toc + len + 24, 2);
+        if(toc_size - 4 - len - ARCHIVE_ENTRY_SIZE < name_len ||
+           !archive_valid_name((const char *)toc + len + ARCHIVE_ENTRY_SIZE, name_len))
+            return e_failure;
+
+        members[i].offset = get_le(toc + len, 8);
+        members[i].length = get_le(toc + len + 8, 8);
+        members[i].flags = get_le(toc + len + 16, 4);
+        members[i].crc = get_le(toc + len + 20, 4);
+        members[i].name = strndup((const char *)toc + len + ARCHIVE_ENTRY_SIZE, name_len);
+        if(members[i].name == NULL || members[i].offset < toc_size || members[i].offset > payload_size ||
+           members[i].length > payload_size - members[i].offset || (members[i].flags & ~ARCHIVE_MODE_MASK))
+            return e_failure;
+        len += ARCHIVE_ENTRY_SIZE + name_len;
+    }
+    return len + 4 == toc_size ? e_success : e_failure;
+}
+
+
+/* --- Description for archive_open Function --->
+ * Input: archiveInfo, decInfo, members (set to the malloc'ed table), count
+ * Output: Status
+ * Description: Decodes the header with the decoder's own functions, checks
+ * the image holds an archive, then decodes the size and count fields at the
+ * front of the payload followed by the whole table of contents, whose CRC
+ * is checked before it is parsed.
+ */
+static Status archive_open(ArchiveInfo *archiveInfo, DecodeInfo *decInfo, ArchiveMember **members, uint *count)
+{
+    unsigned char *fields = NULL, *toc = NULL;
+    Status ret = e_failure;
+
+    decInfo->stego_image_fname = archiveInfo->image_fname;
+    decInfo->secret_fname = archiveInfo->image_fname;
+    decInfo->key_fname = archiveInfo->key_fname;
+    decInfo->jobs = 1;
+    *members = NULL;
+    *count = 0;
+
+    if(open_decode_files(decInfo) == e_failure)
+        return e_failure;
+    info_printf("INFO : Decoding Header\n");
+    if(decode_magic_string(decInfo) == e_failure || decode_file_extn_size(decInfo) == e_failure ||
+       decode_secret_file_extn(decInfo->extn_size, decInfo) == e_failure || decode_secret_file_size(decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed Decoding of the header\n");
+        return e_failure;
+    }
+    if(!(decInfo->flags & CONTAINER_ARCHIVE))
+    {
+        fprintf(job_stderr(), "ERROR : %s does not hold an archive, decode it with -d\n", archiveInfo->image_fname);
+        return e_failure;
+    }
+    if(decode_cipher_key(decInfo) == e_failure || decode_chunk_table(decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed Decoding of the header\n");
+        return e_failure;
+    }
+
+    info_printf("INFO : Decoding Table of Contents\n");
+    if(decInfo->size_secret_file >= ARCHIVE_FIXED_SIZE && (fields = archive_read_bytes(decInfo, 0, 8)) != NULL)
+    {
+        uint64_t toc_size = get_le(fields, 4);
+        *count = get_le(fields + 4, 4);
+
+        if(toc_size >= ARCHIVE_FIXED_SIZE && toc_size <= decInfo->size_secret_file && toc_size <= MAX_ARCHIVE_TOC &&
+           *count <= (toc_size - ARCHIVE_FIXED_SIZE) / ARCHIVE_ENTRY_SIZE &&
+           (toc = archive_read_bytes(decInfo, 0, toc_size)) != NULL &&
+           crc32c(0, toc, toc_size - 4) == get_le(toc + toc_size - 4, 4) &&
+           (*members = calloc(*count + 1, sizeof(ArchiveMember))) != NULL)
+            ret = archive_parse_toc(toc, toc_size, decInfo->size_secret_file, *members, *count);
+    }
+    if(ret == e_failure)
+        fprintf(job_stderr(), "ERROR : Table of contents is damaged\n");
+
+    free(fields);
+    free(toc);
+    return ret;
+}
+
+
+/* --- Description for archive_free_members Function --->
+ * Input: members, count
+ * Output: None
+ */
+static void archive_free_members(ArchiveMember *members, uint count)
+{
+    for(uint i = 0; members != NULL && i < count; i++)
+        free(members[i].name);
+    free(members);
+}
+
+
+/* --- Description for do_list Function --->
+ * Input: archiveInfo
+ * Output: Status
+ * Description: Prints one line per member (size, permissions, name) and a
+ * total. Only the header and the table of contents are decoded.
+ */
+Status do_list(ArchiveInfo *archiveInfo)
+{
+    DecodeInfo decInfo = { 0 };
+    ArchiveMember *members;
+    uint count;
+    uint64_t total = 0;
+
+    Status ret = archive_open(archiveInfo, &decInfo, &members, &count);
+    if(ret == e_success)
+    {
+        for(uint i = 0; i < count; i++)
+        {
+            fprintf(job_stdout(), "%12llu  %04o  %s\n", (unsigned long long)members[i].length, members[i].flags, members[i].name);
+            total += members[i].length;
+        }
+        info_printf("INFO : %u files, %llu bytes\n", count, (unsigned long long)total);
+    }
+
+    archive_free_members(members, count);
+    close_decode_files(&decInfo);
+    return ret;
+}
+
+
+/* --- Description for archive_unpack_member Function --->
+ * Input: archiveInfo, decInfo (table of contents decoded), member
+ * Output: Status
+ * Description: Decodes the member bytes straight into its file in the
+ * output directory, reads them back to check the member CRC and gives the
+ * file its permission bits.
+ */
+static Status archive_unpack_member(ArchiveInfo *archiveInfo, DecodeInfo *decInfo, const ArchiveMember *member)
+{
+    char *path = malloc(strlen(archiveInfo->output_dir) + strlen(member->name) + 2);
+    unsigned char buffer[64 * 1024];
+    Status ret = e_failure;
+    uint crc = 0;
+    size_t got;
+
+    if(path == NULL)
+        return e_failure;
+    sprintf(path, "%s/%s", archiveInfo->output_dir, member->name);
+
+    FILE *fptr = fopen(path, "w+b");
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", path);
+        free(path);
+        return e_failure;
+    }
+
+    decInfo->fptr_secret = fptr;
+    if(decode_secret_bytes(decInfo, member->offset, member->offset + member->length) == e_success &&
+       fflush(fptr) == 0 && fseeko(fptr, 0, SEEK_SET) == 0)
+    {
+        while((got = fread(buffer, 1, sizeof(buffer), fptr)) > 0)
+            crc = crc32c(crc, buffer, got);
+        if(crc == member->crc)
+            ret = e_success;
+        else
+            fprintf(job_stderr(), "ERROR : %s is corrupted\n", member->name);
+    }
+    decInfo->fptr_secret = NULL;
+
+    if(ret == e_success && fchmod(fileno(fptr), member->flags) != 0)
+        perror("fchmod");
+    if(fclose(fptr) != 0)
+        ret = e_failure;
+    if(ret == e_success)
+        info_printf("INFO : Unpacked %s (%llu bytes)\n", path, (unsigned long long)member->length);
+    free(path);
+    return ret;
+}
+
+
+/* --- Description for do_unpack Function --->
+ * Input: archiveInfo
+ * Output: Status (e_failure if a member failed or a name is not in the archive)
+ * Description: Decodes the table of contents, then every member named on
+ * the command line (all of them if none is), in table order. A damaged
+ * member doesn't stop the others from being unpacked.
+ */
+Status do_unpack(ArchiveInfo *archiveInfo)
+{
+    DecodeInfo decInfo = { 0 };
+    ArchiveMember *members;
+    uint count, failed = 0;
+
+    Status ret = archive_open(archiveInfo, &decInfo, &members, &count);
+    for(int k = 0; k < archiveInfo->nfiles && ret == e_success; k++)
+    {
+        uint i = 0;
+        while(i < count && strcmp(members[i].name, archiveInfo->files[k]) != 0)
+            i++;
+        if(i == count)
+        {
+            fprintf(job_stderr(), "ERROR : %s is not in the archive\n", archiveInfo->files[k]);
+            ret = e_failure;
+        }
+    }
+
+    for(uint i = 0; i < count && ret == e_success; i++)
+    {
+        int wanted = archiveInfo->nfiles == 0;
+        for(int k = 0; k < archiveInfo->nfiles && !wanted; k++)
+            wanted = strcmp(members[i].name, archiveInfo->files[k]) == 0;
+        if(wanted && archive_unpack_member(archiveInfo, &decInfo, &members[i]) == e_failure)
+            failed++;
+    }
+    if(failed > 0)
+    {
+        fprintf(job_stderr(), "ERROR : %u files could not be unpacked\n", failed);
+        ret = e_failure;
+    }
+
+    archive_free_members(members, count);
+    close_decode_files(&decInfo);
+    return ret;
+}
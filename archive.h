@@ -0,0 +1,88 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Archive mode: several files in one image.
+ *      -a <.bmp_file> <output .bmp> <file>... [encode options]
+ *      -t <.bmp_file> [--key file]
+ *      -u <.bmp_file> [member]... [-o directory] [--key file]
+ * The payload of an archive (flagged CONTAINER_ARCHIVE, see container.h)
+ * starts with a table of contents, followed by the members back to back:
+ *      le32 TOC size       bytes of the whole table, this field and the CRC included
+ *      le32 member count
+ *      members             le64 offset, le64 length, le32 flags, le32 CRC-32C of the member,
+ *                          le16 name length, name
+ *      le32 TOC CRC        CRC-32C of the table bytes before it
+ * Offsets count payload bytes, the first member starts right after the
+ * table. Names are file names without directories, and the low 12 bits of
+ * the flags hold the permission bits of the file.
+ * -t decodes the table only. -u seeks straight to the image bytes of each
+ * member unpacked (see decode_secret_bytes), so the others are not decoded.
+ */
+
+/* Extension stored in the header of an archive */
+#define ARCHIVE_EXTN ".arc"
+
+/* Table bytes besides the entries: size, count, CRC */
+#define ARCHIVE_FIXED_SIZE 12
+
+/* Entry bytes besides the name */
+#define ARCHIVE_ENTRY_SIZE 26
+
+/* Longest member name */
+#define ARCHIVE_MAX_NAME 255
+
+/* Largest table a decoder accepts */
+#define MAX_ARCHIVE_TOC (16 * 1024 * 1024)
+
+/* Member flags: permission bits */
+#define ARCHIVE_MODE_MASK 07777
+
+/* Encode options passed on to the encoder, with their values */
+#define MAX_ARCHIVE_OPTIONS 12
+
+// One member of the table of contents
+typedef struct _ArchiveMember
+{
+    char *name;
+    uint64_t offset;        // payload byte of the first member byte
+    uint64_t length;
+    uint flags;
+    uint crc;               // CRC-32C of the member bytes
+} ArchiveMember;
+
+// Structure to hold archive mode information
+typedef struct _ArchiveInfo
+{
+    char *image_fname;      // cover (-a) or stego image (-t, -u)
+    char *stego_fname;      // -a: stego image written
+    char **files;           // -a: files to store, -u: members to unpack (none: all of them)
+    int nfiles;
+    char *options[MAX_ARCHIVE_OPTIONS];  // -a: --depth, --compress, --key, --scatter, I/O mode, -j
+    int noptions;
+    char *key_fname;        // -t, -u: key of an encrypted archive (--key)
+    char *output_dir;       // -u: directory receiving the members (-o)
+} ArchiveInfo;
+
+
+/* -- function prototypes for archive mode */
+
+/* Read and validate -a args from argv */
+Status read_and_validate_archive_args(int argc, char *argv[], ArchiveInfo *archiveInfo);
+
+/* Read and validate -t / -u args from argv */
+Status read_and_validate_unpack_args(int argc, char *argv[], ArchiveInfo *archiveInfo);
+
+/* Store the files in the cover */
+Status do_archive(ArchiveInfo *archiveInfo);
+
+/* Print the table of contents */
+Status do_list(ArchiveInfo *archiveInfo);
+
+/* Unpack all members, or the ones named */
+Status do_unpack(ArchiveInfo *archiveInfo);
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <time.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "threadpool.h"
+#include "metrics.h"
+#include "types.h"
+
+// One manifest line
+typedef struct _BatchJob
+{
+    OperationType op;
+    char *args[3];          // cover secret output / stego output
+    uint line;              // manifest line number
+    Status status;
+    double seconds;
+    Metrics metrics;        // of do_encoding / do_decoding, for --json
+    sem_t *inflight;        // shared I/O slots
+} BatchJob;
+
+
+/* --- Description for read_and_validate_batch_args Function --->
+ * Input: argc, argv, batchInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -b <manifest> [-j N] [--inflight M]
+ * -j sets the number of worker threads (default 1), --inflight limits how
+ * many of them may run a job at once (default: all of them).
+ */
+Status read_and_validate_batch_args(int argc, char *argv[], BatchInfo *batchInfo)
+{
+    batchInfo->manifest_fname = NULL;
+    batchInfo->jobs = 1;
+    batchInfo->inflight = 0;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &batchInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)
+        {
+            if(parse_jobs(argv[i] + 2, &batchInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strcmp(argv[i], "--inflight") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &batchInfo->inflight) == e_failure)
+                return e_failure;
+        }
+        else if(argv[i][0] == '-' || batchInfo->manifest_fname != NULL)
+        {
+            return e_failure;
+        }
+        else
+        {
+            batchInfo->manifest_fname = argv[i];
+        }
+    }
+
+    if(batchInfo->manifest_fname == NULL)
+        return e_failure;
+    if(batchInfo->inflight == 0 || batchInfo->inflight > batchInfo->jobs)
+        batchInfo->inflight = batchInfo->jobs;
+    return e_success;
+}
+
+
+/* --- Description for parse_manifest_line Function --->
+ * Input: line (modified), job
+ * Output: Status (e_failure for malformed lines)
+ * Description: Splits a manifest line into paths and decides the operation
+ * from their count. Paths are copied so the line buffer can be reused.
+ */
+static Status parse_manifest_line(char *line, BatchJob *job)
+{
+    char *save;
+    int count = 0;
+
+    for(char *tok = strtok_r(line, " \t\r\n", &save); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &save))
+    {
+        // stdin/stdout can't be shared between jobs
+        if(count == 3 || strcmp(tok, "-") == 0)
+            return e_failure;
+        job->args[count++] = strdup(tok);
+    }
+
+    if(count == 3)
+        job->op = e_encode;
+    else if(count == 2)
+        job->op = e_decode;
+    else
+        return e_failure;
+    return e_success;
+}
+
+
+/* --- Description for run_batch_job Function --->
+ * Input: arg (BatchJob)
+ * Output: None
+ * Description: Pool task. Waits for an I/O slot, then runs the job through
+ * the same argument validation and do_encoding / do_decoding as the CLI,
+ * with its INFO messages discarded.
+ */
+static void run_batch_job(void *arg)
+{
+    BatchJob *job = arg;
+    struct timespec start, end;
+
+    sem_wait(job->inflight);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    FILE *saved_stdout = silence_stdout();
+
+    job->status = e_failure;
+    if(job->op == e_encode)
+    {
+        EncodeInfo encInfo;
+        char *argv[] = { "stego", "-e", job->args[0], job->args[1], job->args[2] };
+
+        if(read_and_validate_encode_args(5, argv, &encInfo) == e_success)
+        {
+            job->status = do_encoding(&encInfo);
+            job->metrics = encInfo.metrics;
+            close_files(&encInfo);
+        }
+    }
+    else
+    {
+        DecodeInfo decInfo = { 0 };
+        char *argv[] = { "stego", "-d", job->args[0], job->args[1] };
+
+        if(read_and_validate_decode_args(4, argv, &decInfo) == e_success)
+        {
+            job->status = do_decoding(&decInfo);
+            job->metrics = decInfo.metrics;
+            close_decode_files(&decInfo);
+        }
+    }
+
+    restore_stdout(saved_stdout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    sem_post(job->inflight);
+}
+
+
+/* --- Description for do_batch Function --->
+ * Input: batchInfo
+ * Output: Status (e_failure if the manifest is unreadable or any job failed)
+ * Description:
+ * 1. Reads the manifest line by line and submits every job to a
+ *    work-stealing pool of batchInfo->jobs threads as soon as it is parsed.
+ * 2. A semaphore keeps at most batchInfo->inflight jobs doing I/O.
+ * 3. The INFO messages of the jobs are discarded while they run.
+ * 4. Prints one status line per job, in manifest order, and a summary.
+ *    With --json each job is one JSON record instead, malformed and refused
+ *    ones included, with -q only the failed jobs are listed.
+ */
+Status do_batch(BatchInfo *batchInfo)
+{
+    FILE *manifest = fopen(batchInfo->manifest_fname, "r");
+    if(manifest == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", batchInfo->manifest_fname);
+        return e_failure;
+    }
+
+    ThreadPool *pool = threadpool_create(batchInfo->jobs, e_pool_lifo);
+    if(pool == NULL)
+    {
+        fprintf(job_stderr(), "ERROR : Unable to start %u worker threads\n", batchInfo->jobs);
+        fclose(manifest);
+        return e_failure;
+    }
+
+    sem_t inflight;
+    sem_init(&inflight, 0, batchInfo->inflight);
+
+    BatchJob **jobs = NULL;
+    size_t njobs = 0, capacity = 0;
+    uint malformed = 0, line_no = 0;
+    char line[MAX_MANIFEST_LINE];
+
+    while(fgets(line, sizeof(line), manifest) != NULL)
+    {
+        line_no++;
+        char *text = line + strspn(line, " \t");
+        if(*text == '\0' || *text == '\n' || *text == '\r' || *text == '#')
+            continue;
+
+        if(njobs == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            BatchJob **grown = realloc(jobs, capacity * sizeof(BatchJob *));
+            if(grown == NULL)
+                break;
+            jobs = grown;
+        }
+        BatchJob *job = calloc(1, sizeof(BatchJob));
+        if(job == NULL)
+            break;
+        job->line = line_no;
+        job->inflight = &inflight;
+        jobs[njobs++] = job;
+
+        if(parse_manifest_line(text, job) == e_failure)
+        {
+            job->op = e_unsupported;
+            job->status = e_failure;
+            malformed++;
+        }
+        else if(threadpool_submit(pool, run_batch_job, job) == e_failure)
+        {
+            job->status = e_failure;
+        }
+    }
+    fclose(manifest);
+
+    threadpool_destroy(pool);
+    sem_destroy(&inflight);
+
+    uint failed = 0;
+    for(size_t i = 0; i < njobs; i++)
+    {
+        BatchJob *job = jobs[i];
+        if(job->status == e_failure)
+            failed++;
+
+        if(metrics_format() == e_report_json)
+        {
+            // Jobs that never started (malformed, refused by validation) get an error record too
+            if(job->metrics.op != NULL)
+                metrics_report(&job->metrics);
+            else if(job->op == e_unsupported)
+            {
+                char where[32];
+                snprintf(where, sizeof(where), "line %u", job->line);
+                metrics_report_refused("batch", where, NULL);
+            }
+            else
+                metrics_report_refused(job->op == e_encode ? "encode" : "decode", job->args[0],
+                                       job->op == e_encode ? job->args[2] : job->args[1]);
+        }
+        else if(job->op == e_unsupported)
+            fprintf(job_stdout(), "FAIL %8s  line %u: malformed manifest entry\n", "-", job->line);
+        else if(metrics_format() != e_report_quiet || job->status == e_failure)
+            fprintf(job_stdout(), "%s %8.1f ms  %s %s -> %s\n", job->status == e_success ? "OK  " : "FAIL",
+                    job->seconds * 1000, job->op == e_encode ? "encode" : "decode",
+                    job->args[0], job->op == e_encode ? job->args[2] : job->args[1]);
+
+        for(int k = 0; k < 3; k++)
+            free(job->args[k]);
+        free(job);
+    }
+    free(jobs);
+
+    info_printf("INFO : %zu jobs, %zu succeeded, %u failed (%u malformed)\n", njobs, njobs - failed, failed, malformed);
+    return failed ? e_failure : e_success;
+}
@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Batch mode: runs many encode / decode jobs listed in a manifest inside
+ * one process. Each manifest line holds whitespace separated paths:
+ *      <.bmp_file> <secret_file> <output .bmp>    -> encode
+ *      <.bmp_file> <output file>                  -> decode
+ * Empty lines and lines starting with '#' are skipped.
+ */
+
+/* Longest manifest line */
+#define MAX_MANIFEST_LINE 4096
+
+// Structure to hold batch related information
+typedef struct _BatchInfo
+{
+    char *manifest_fname;
+    uint jobs;          // worker threads (-j)
+    uint inflight;      // jobs allowed to do I/O at the same time (--inflight)
+} BatchInfo;
+
+
+/* -- function prototypes for batch mode */
+
+/* Read and validate batch args from argv */
+Status read_and_validate_batch_args(int argc, char *argv[], BatchInfo *batchInfo);
+
+/* Run every job of the manifest and print one status line per job */
+Status do_batch(BatchInfo *batchInfo);
+
+#endif
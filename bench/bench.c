@@ -0,0 +1,1096 @@
+#define _GNU_SOURCE     // mkdtemp
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "encode.h"
+#include "decode.h"
+#include "probe.h"
+#include "analyze.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "chacha20.h"
+#include "lz.h"
+#include "rs.h"
+#include "scatter.h"
+#include "stego.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "types.h"
+
+/*
+ * Throughput benchmark: stego-bench [options]
+ *      --width W --height H    synthetic cover size (default 2048 x 2048)
+ *      --bpp 24|32             bits per pixel of the cover (default 24)
+ *      --payload BYTES         payload size (default: what the cover holds at depth 1, less 64 KiB)
+ *      --entropy BITS          random bits per payload byte, 0 to 8 (default 8)
+ *      --depth N               LSBs per image byte (default 1)
+ *      -j N                    threads of the parallel paths (default 4)
+ *      --repeat R              runs per measurement, the fastest is kept (default 3)
+ * Build from the top of the tree:
+ *      gcc -O2 -I. -o stego-bench bench/bench.c $(ls *.c | grep -v '^main.c$') -lpthread -lm
+ * A cover and a payload are generated in a temporary directory. Every
+ * kernel (LSB, CRC-32C, ChaCha20, LZ, Reed-Solomon, scatter) is timed on
+ * its own, then encode, decode and probe are timed end to end through the
+ * same functions as the CLI and through libstego (see bench_library),
+ * then once more on a small cover (see bench_small_cover). -n must find a smooth cover clean and the payload
+ * encoded into it suspect (see bench_analysis), and the same for a photo of the tree (see bench_real_cover). Each optimized path is checked byte for byte
+ * against the scalar reference (or the payload, for decoders): a line
+ * ending in MISMATCH is a bug, not a slow machine. Peak RSS is the
+ * resident high-water mark of the run, reset before every measurement
+ * where the kernel allows it (/proc/self/clear_refs).
+ */
+
+// Benchmark settings
+typedef struct _BenchInfo
+{
+    uint width;
+    uint height;
+    uint bpp;
+    uint64_t payload_size;  // 0: fill the cover
+    uint entropy;           // random bits per payload byte
+    uint depth;
+    uint jobs;
+    uint repeat;
+    char dir[64];           // temporary directory
+    char cover[96];         // cover.bmp in dir
+    char secret[96];        // payload.bin in dir
+} BenchInfo;
+
+// One measurement, fastest of the runs
+typedef struct _BenchResult
+{
+    double seconds;
+    long peak_kb;
+} BenchResult;
+
+// Buffers shared by the kernel measurements
+typedef struct _BenchData
+{
+    unsigned char *payload;
+    unsigned char *image;   // lsb_image_bytes(size) bytes
+    unsigned char *out;
+    unsigned char *ref;     // output of the reference path
+    size_t size;
+    uint depth;
+    ChaCha cipher;
+    uint crc;
+} BenchData;
+
+typedef void (*BenchFn)(BenchData *data);
+
+/* Side of the second, small cover: 768 KiB of pixels, less than one PIPELINE_BLOCK_SIZE */
+#define BENCH_SMALL_SIDE 512
+
+/* Photo at the top of the tree for bench_real_cover, its 81 byte payload is too small to detect */
+#define BENCH_REAL_COVER "secretout.bmp"
+
+
+/* --- Description for bench_random Function --->
+ * Input: state (not 0)
+ * Output: next value of a xorshift64* generator
+ */
+static uint64_t bench_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* --- Description for bench_now Function --->
+ * Output: monotonic time in seconds
+ */
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* --- Description for bench_reset_peak Function --->
+ * Description: Resets the resident high-water mark (Linux 4.0 and later),
+ * so the next bench_peak_kb covers one measurement only.
+ */
+static void bench_reset_peak(void)
+{
+    FILE *fptr = fopen("/proc/self/clear_refs", "w");
+    if(fptr != NULL)
+    {
+        fputs("5", fptr);
+        fclose(fptr);
+    }
+}
+
+
+/* --- Description for bench_peak_kb Function --->
+ * Output: resident high-water mark in KiB, VmHWM or getrusage's maximum
+ */
+static long bench_peak_kb(void)
+{
+    char line[128];
+    long kb = -1;
+    FILE *fptr = fopen("/proc/self/status", "r");
+
+    while(fptr != NULL && fgets(line, sizeof(line), fptr) != NULL)
+        if(sscanf(line, "VmHWM: %ld", &kb) == 1)
+            break;
+    if(fptr != NULL)
+        fclose(fptr);
+    if(kb < 0)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        kb = usage.ru_maxrss;
+    }
+    return kb;
+}
+
+
+/* --- Description for bench_report Function --->
+ * Input: stage, path, bytes, result, check (NULL when there's nothing to compare)
+ * Output: None
+ */
+static void bench_report(const char *stage, const char *path, uint64_t bytes, BenchResult result, const char *check)
+{
+    printf("%-16s %-14s %10.1f MB/s %9.3f ns/byte %9ld KiB  %s\n", stage, path,
+           bytes / result.seconds / 1e6, result.seconds * 1e9 / bytes, result.peak_kb, check ? check : "");
+}
+
+
+/* --- Description for bench_kernel Function --->
+ * Input: fn, data, repeat
+ * Output: fastest of repeat runs of fn, and the peak RSS over them
+ */
+static BenchResult bench_kernel(BenchFn fn, BenchData *data, uint repeat)
+{
+    BenchResult result = { 1e30, 0 };
+
+    bench_reset_peak();
+    for(uint i = 0; i < repeat; i++)
+    {
+        double start = bench_now();
+        fn(data);
+        double seconds = bench_now() - start;
+        if(seconds < result.seconds)
+            result.seconds = seconds;
+    }
+    result.peak_kb = bench_peak_kb();
+    return result;
+}
+
+
+/* Kernel stages, each over the whole payload */
+
+static void bench_lsb_embed(BenchData *data)
+{
+    lsb_embed_depth(data->image, data->payload, data->size, data->depth);
+}
+
+static void bench_lsb_extract(BenchData *data)
+{
+    lsb_extract_depth(data->out, data->image, data->size, data->depth);
+}
+
+static void bench_crc32c(BenchData *data)
+{
+    data->crc = crc32c(0, data->payload, data->size);
+}
+
+static void bench_crc32c_scalar(BenchData *data)
+{
+    data->crc = crc32c_scalar(0, data->payload, data->size);
+}
+
+static void bench_chacha20(BenchData *data)
+{
+    memcpy(data->out, data->payload, data->size);
+    chacha20_xor(&data->cipher, data->out, data->size, CIPHER_DATA_OFFSET);
+}
+
+static void bench_chacha20_scalar(BenchData *data)
+{
+    memcpy(data->out, data->payload, data->size);
+    chacha20_xor_scalar(&data->cipher, data->out, data->size, CIPHER_DATA_OFFSET);
+}
+
+static void bench_rs(BenchData *data)
+{
+    memset(data->out, 0, data->size);
+    rs_mul_add(data->out, data->payload, data->size, 0x53);
+}
+
+static void bench_rs_scalar(BenchData *data)
+{
+    memset(data->out, 0, data->size);
+    rs_mul_add_scalar(data->out, data->payload, data->size, 0x53);
+}
+
+// compressed chunks go to image, one after the other, with their sizes in out
+static void bench_lz_compress(BenchData *data)
+{
+    size_t *sizes = (size_t *)data->out, pos = 0;
+
+    for(size_t start = 0, i = 0; start < data->size; start += PARALLEL_CHUNK_SIZE, i++)
+    {
+        size_t len = data->size - start < PARALLEL_CHUNK_SIZE ? data->size - start : PARALLEL_CHUNK_SIZE;
+        sizes[i] = lz_compress(data->payload + start, len, data->image + pos, len);
+        pos += sizes[i] ? sizes[i] : len;
+        if(sizes[i] == 0)
+            memcpy(data->image + pos - len, data->payload + start, len);
+    }
+    data->crc = pos;    // compressed size
+}
+
+static void bench_lz_decompress(BenchData *data)
+{
+    const size_t *sizes = (const size_t *)data->out;
+    size_t pos = 0, got;
+
+    for(size_t start = 0, i = 0; start < data->size; start += PARALLEL_CHUNK_SIZE, i++)
+    {
+        size_t len = data->size - start < PARALLEL_CHUNK_SIZE ? data->size - start : PARALLEL_CHUNK_SIZE;
+        if(sizes[i] == 0)
+            memcpy(data->ref + start, data->image + pos, len);
+        else
+            lz_decompress(data->image + pos, sizes[i], data->ref + start, len, &got);
+        pos += sizes[i] ? sizes[i] : len;
+    }
+}
+
+static void bench_scatter(BenchData *data)
+{
+    Scatter scatter;
+    uint64_t sum = 0, blocks = lsb_image_bytes(data->size, data->depth) / SCATTER_BLOCK_SIZE;
+
+    scatter_init(&scatter, blocks, data->payload);
+    for(uint64_t i = 0; i < blocks; i++)
+        sum += scatter_index(&scatter, i);
+    data->crc = sum;    // keeps the loop
+}
+
+
+/* --- Description for bench_kernels Function --->
+ * Input: benchInfo, payload, size
+ * Output: Status (e_failure if any optimized path disagrees with its reference)
+ * Description: Times every kernel on the whole payload, the scalar
+ * reference first, and compares the optimized outputs with it.
+ */
+static Status bench_kernels(BenchInfo *benchInfo, unsigned char *payload, size_t size)
+{
+    BenchData data = { 0 };
+    size_t image_size = lsb_image_bytes(size, benchInfo->depth);
+    unsigned char key[CHACHA_KEY_SIZE], nonce[CHACHA_NONCE_SIZE];
+    Status ret = e_success;
+    BenchResult result;
+
+    data.payload = payload;
+    data.size = size;
+    data.depth = benchInfo->depth;
+    data.image = malloc(image_size + size);
+    data.out = malloc(size + sizeof(size_t) * (size / PARALLEL_CHUNK_SIZE + 1));
+    data.ref = malloc(image_size);
+    if(data.image == NULL || data.out == NULL || data.ref == NULL)
+    {
+        perror("malloc");
+        free(data.image);
+        free(data.out);
+        free(data.ref);
+        return e_failure;
+    }
+    memset(key, 0x42, sizeof(key));
+    memset(nonce, 0x24, sizeof(nonce));
+    chacha20_init(&data.cipher, key, nonce);
+
+    // LSB kernels: the scalar image is the reference for the others
+    for(LsbKernel kernel = e_lsb_scalar; kernel <= e_lsb_avx2; kernel++)
+    {
+        if(lsb_select_kernel(kernel) == e_failure)
+            continue;
+        memset(data.image, 0xA5, image_size);
+        result = bench_kernel(bench_lsb_embed, &data, benchInfo->repeat);
+        int same = kernel == e_lsb_scalar || memcmp(data.image, data.ref, image_size) == 0;
+        if(kernel == e_lsb_scalar)
+            memcpy(data.ref, data.image, image_size);
+        bench_report("lsb embed", lsb_kernel_name(kernel), size, result, same ? "ok" : "MISMATCH");
+        ret = same ? ret : e_failure;
+
+        result = bench_kernel(bench_lsb_extract, &data, benchInfo->repeat);
+        same = memcmp(data.out, payload, size) == 0;
+        bench_report("lsb extract", lsb_kernel_name(kernel), size, result, same ? "ok" : "MISMATCH");
+        ret = same ? ret : e_failure;
+    }
+    lsb_select_kernel(e_lsb_auto);
+
+    result = bench_kernel(bench_crc32c_scalar, &data, benchInfo->repeat);
+    uint crc = data.crc;
+    bench_report("crc32c", "scalar", size, result, "ref");
+    result = bench_kernel(bench_crc32c, &data, benchInfo->repeat);
+    bench_report("crc32c", "auto", size, result, data.crc == crc ? "ok" : "MISMATCH");
+    ret = data.crc == crc ? ret : e_failure;
+
+    result = bench_kernel(bench_chacha20_scalar, &data, benchInfo->repeat);
+    memcpy(data.ref, data.out, size);
+    bench_report("chacha20", "scalar", size, result, "ref");
+    result = bench_kernel(bench_chacha20, &data, benchInfo->repeat);
+    int same = memcmp(data.out, data.ref, size) == 0;
+    bench_report("chacha20", "auto", size, result, same ? "ok" : "MISMATCH");
+    ret = same ? ret : e_failure;
+
+    result = bench_kernel(bench_rs_scalar, &data, benchInfo->repeat);
+    memcpy(data.ref, data.out, size);
+    bench_report("rs mul-add", "scalar", size, result, "ref");
+    result = bench_kernel(bench_rs, &data, benchInfo->repeat);
+    same = memcmp(data.out, data.ref, size) == 0;
+    bench_report("rs mul-add", "auto", size, result, same ? "ok" : "MISMATCH");
+    ret = same ? ret : e_failure;
+
+    char ratio[32];
+    result = bench_kernel(bench_lz_compress, &data, benchInfo->repeat);
+    snprintf(ratio, sizeof(ratio), "ratio %.3f", (double)data.crc / size);
+    bench_report("lz compress", "-", size, result, ratio);
+    result = bench_kernel(bench_lz_decompress, &data, benchInfo->repeat);
+    same = memcmp(data.ref, payload, size) == 0;
+    bench_report("lz decompress", "-", size, result, same ? "ok" : "MISMATCH");
+    ret = same ? ret : e_failure;
+
+    result = bench_kernel(bench_scatter, &data, benchInfo->repeat);
+    bench_report("scatter order", "-", size, result, NULL);
+
+    free(data.image);
+    free(data.out);
+    free(data.ref);
+    return ret;
+}
+
+
+/* --- Description for bench_same_file Function --->
+ * Input: a, b (file names)
+ * Output: 1 if both files hold the same bytes
+ */
+static int bench_same_file(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    char ba[64 * 1024], bb[64 * 1024];
+    int same = fa != NULL && fb != NULL;
+    size_t na, nb;
+
+    while(same && (na = fread(ba, 1, sizeof(ba), fa)) > 0)
+    {
+        nb = fread(bb, 1, na, fb);
+        same = na == nb && memcmp(ba, bb, na) == 0;
+    }
+    if(same && fb != NULL)
+        same = fread(bb, 1, 1, fb) == 0;
+    if(fa != NULL)
+        fclose(fa);
+    if(fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+
+/* --- Description for bench_encode Function --->
+ * Input: benchInfo, stego (output name), options (extra encode options, NULL terminated), result
+ * Output: Status of the last run
+ * Description: Runs the encoder like the CLI does, with the INFO messages
+ * discarded, and keeps the fastest of benchInfo->repeat runs.
+ */
+static Status bench_encode(BenchInfo *benchInfo, const char *stego, char **options, BenchResult *result)
+{
+    char depth[4], jobs[12];
+    char *argv[24] = { "stego", "-e", benchInfo->cover, benchInfo->secret, (char *)stego, "--depth", depth, "-j", jobs };
+    int argc = 9;
+    Status ret = e_success;
+
+    snprintf(depth, sizeof(depth), "%u", benchInfo->depth);
+    snprintf(jobs, sizeof(jobs), "%u", benchInfo->jobs);
+    while(*options != NULL && argc < 23)
+        argv[argc++] = *options++;
+
+    result->seconds = 1e30;
+    bench_reset_peak();
+    for(uint i = 0; i < benchInfo->repeat && ret == e_success; i++)
+    {
+        EncodeInfo encInfo;
+        FILE *saved_stdout = silence_stdout();
+        double start = bench_now();
+
+        ret = read_and_validate_encode_args(argc, argv, &encInfo);
+        if(ret == e_success)
+        {
+            ret = do_encoding(&encInfo);
+            close_files(&encInfo);
+        }
+        double seconds = bench_now() - start;
+        restore_stdout(saved_stdout);
+        if(seconds < result->seconds)
+            result->seconds = seconds;
+    }
+    result->peak_kb = bench_peak_kb();
+    return ret;
+}
+
+
+/* --- Description for bench_decode Function --->
+ * Input: benchInfo, stego, jobs, options (NULL terminated), result
+ * Output: Status (e_failure if decoding fails or the output differs from the payload)
+ */
+static Status bench_decode(BenchInfo *benchInfo, const char *stego, uint jobs, char **options, BenchResult *result)
+{
+    char out[96], decoded[104], jobs_arg[12];
+    char *argv[16] = { "stego", "-d", (char *)stego, out, "-j", jobs_arg };
+    int argc = 6;
+    Status ret = e_success;
+
+    snprintf(out, sizeof(out), "%s/decoded", benchInfo->dir);
+    snprintf(decoded, sizeof(decoded), "%s.bin", out);
+    snprintf(jobs_arg, sizeof(jobs_arg), "%u", jobs);
+    while(*options != NULL && argc < 15)
+        argv[argc++] = *options++;
+
+    result->seconds = 1e30;
+    bench_reset_peak();
+    for(uint i = 0; i < benchInfo->repeat && ret == e_success; i++)
+    {
+        DecodeInfo decInfo = { 0 };
+        FILE *saved_stdout = silence_stdout();
+        double start = bench_now();
+
+        ret = read_and_validate_decode_args(argc, argv, &decInfo);
+        if(ret == e_success)
+        {
+            ret = do_decoding(&decInfo);
+            close_decode_files(&decInfo);
+        }
+        double seconds = bench_now() - start;
+        restore_stdout(saved_stdout);
+        if(seconds < result->seconds)
+            result->seconds = seconds;
+    }
+    result->peak_kb = bench_peak_kb();
+
+    if(ret == e_success && !bench_same_file(decoded, benchInfo->secret))
+        ret = e_failure;
+    unlink(decoded);
+    return ret;
+}
+
+
+/* --- Description for bench_library Function --->
+ * Input: benchInfo, ref (image of the stdio encoder), size (payload bytes)
+ * Output: Status (e_failure if libstego fails or disagrees)
+ * Description: The CLI paths stream the image through the pipeline and do
+ * not call stego_encode / stego_decode, which need the whole image in
+ * memory. Both promise the same bytes for the same options, so libstego
+ * encodes the cover in a buffer and must give back the reference image,
+ * then decodes the reference image and must give back the payload.
+ */
+static Status bench_library(BenchInfo *benchInfo, const char *ref, uint64_t size)
+{
+    FILE *fcover = fopen(benchInfo->cover, "rb"), *fref = fopen(ref, "rb"), *fsecret = fopen(benchInfo->secret, "rb");
+    MappedFile cover = { 0 }, image = { 0 }, secret = { 0 };
+    unsigned char *data = NULL, *out = NULL;
+    StegoOptions options = { .depth = benchInfo->depth, .extn = ".bin" };
+    StegoImage stego;
+    BenchResult result;
+    size_t decoded = 0;
+    Status ret = e_failure;
+
+    if(fcover != NULL && fref != NULL && fsecret != NULL && map_file_read(fcover, &cover) == e_success &&
+       map_file_read(fref, &image) == e_success && map_file_read(fsecret, &secret) == e_success &&
+       secret.size == size && (data = malloc(cover.size)) != NULL && (out = malloc(size ? size : 1)) != NULL)
+        ret = e_success;
+
+    // encode: a fresh copy of the cover every run, the copy is not timed
+    result.seconds = 1e30;
+    bench_reset_peak();
+    for(uint i = 0; i < benchInfo->repeat && ret == e_success; i++)
+    {
+        memcpy(data, cover.data, cover.size);
+        double start = bench_now();
+        if(stego_image_init(&stego, data, cover.size) == e_failure ||
+           stego_encode(&stego, secret.data, secret.size, &options) == e_failure)
+            ret = e_failure;
+        double seconds = bench_now() - start;
+        if(seconds < result.seconds)
+            result.seconds = seconds;
+    }
+    result.peak_kb = bench_peak_kb();
+    int same = ret == e_success && cover.size == image.size && memcmp(data, image.data, image.size) == 0;
+    bench_report("encode", "libstego", size, result, same ? "ok" : "MISMATCH");
+
+    // decode the image of the CLI
+    result.seconds = 1e30;
+    bench_reset_peak();
+    for(uint i = 0; i < benchInfo->repeat && same; i++)
+    {
+        memcpy(data, image.data, image.size);
+        double start = bench_now();
+        if(stego_image_init(&stego, data, image.size) == e_failure ||
+           stego_decode(&stego, &options, out, size, &decoded) == e_failure)
+            ret = e_failure;
+        double seconds = bench_now() - start;
+        if(seconds < result.seconds)
+            result.seconds = seconds;
+    }
+    result.peak_kb = bench_peak_kb();
+    int agree = same && ret == e_success && decoded == size && memcmp(out, secret.data, size) == 0;
+    bench_report("decode", "libstego", size, result, agree ? "ok" : "MISMATCH");
+
+    free(data);
+    free(out);
+    unmap_file(&cover);
+    unmap_file(&image);
+    unmap_file(&secret);
+    if(fcover != NULL)
+        fclose(fcover);
+    if(fref != NULL)
+        fclose(fref);
+    if(fsecret != NULL)
+        fclose(fsecret);
+    return agree ? e_success : e_failure;
+}
+
+
+/* --- Description for bench_pipeline Function --->
+ * Input: benchInfo, size (payload bytes)
+ * Output: Status (e_failure if any path fails or disagrees)
+ * Description: The stdio encoder with the scalar LSB kernel writes the
+ * reference image. Every other I/O path and libstego must write the same
+ * bytes, and every decoder must give back the payload.
+ */
+static Status bench_pipeline(BenchInfo *benchInfo, uint64_t size)
+{
+    static const struct { const char *path; LsbKernel kernel; const char *option; int threads; } paths[] = {
+        { "stdio scalar", e_lsb_scalar, NULL, 0 },
+        { "stdio", e_lsb_auto, NULL, 0 },
+        { "mmap", e_lsb_auto, "--mmap", 0 },
+        { "reflink", e_lsb_auto, "--reflink", 0 },
+        { "stream", e_lsb_auto, "--stream", 0 },
+        { "uring", e_lsb_auto, "--uring", 0 },
+        { "mmap -j", e_lsb_auto, "--mmap", 1 },
+        { "reflink -j", e_lsb_auto, "--reflink", 1 },
+    };
+    char ref[96], stego[96], key[96];
+    uint jobs = benchInfo->jobs;
+    BenchResult result;
+    Status ret = e_success;
+
+    snprintf(ref, sizeof(ref), "%s/ref.bmp", benchInfo->dir);
+    snprintf(stego, sizeof(stego), "%s/stego.bmp", benchInfo->dir);
+    snprintf(key, sizeof(key), "%s/bench.key", benchInfo->dir);
+
+    for(size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        char *options[] = { (char *)paths[i].option, NULL };
+        const char *out = i == 0 ? ref : stego;
+
+        benchInfo->jobs = paths[i].threads ? jobs : 1;
+        lsb_select_kernel(paths[i].kernel);
+        Status status = bench_encode(benchInfo, out, options, &result);
+        int same = status == e_success && (i == 0 || bench_same_file(ref, stego));
+        bench_report("encode", paths[i].path, size, result, i == 0 ? "ref" : same ? "ok" : "MISMATCH");
+        ret = same ? ret : e_failure;
+    }
+    benchInfo->jobs = jobs;
+    lsb_select_kernel(e_lsb_auto);
+
+    char *none[] = { NULL };
+    for(int scalar = 1; scalar >= 0; scalar--)
+    {
+        lsb_select_kernel(scalar ? e_lsb_scalar : e_lsb_auto);
+        Status status = bench_decode(benchInfo, ref, 1, none, &result);
+        bench_report("decode", scalar ? "scalar" : "auto", size, result, status == e_success ? "ok" : "MISMATCH");
+        ret = status == e_success ? ret : e_failure;
+    }
+    lsb_select_kernel(e_lsb_auto);
+    Status status = bench_decode(benchInfo, ref, jobs, none, &result);
+    bench_report("decode", "-j", size, result, status == e_success ? "ok" : "MISMATCH");
+    ret = status == e_success ? ret : e_failure;
+    if(bench_library(benchInfo, ref, size) == e_failure)
+        ret = e_failure;
+
+    // compression and encryption: nonces are random, so only the round trip is checked
+    FILE *fptr = fopen(key, "wb");
+    unsigned char key_bytes[CHACHA_KEY_SIZE];
+    memset(key_bytes, 0x5A, sizeof(key_bytes));
+    if(fptr == NULL || fwrite(key_bytes, 1, sizeof(key_bytes), fptr) != sizeof(key_bytes) || fclose(fptr) != 0)
+        return e_failure;
+    char *compress[] = { "--compress", NULL };
+    char *encrypt[] = { "--key", key, NULL };
+    char *scatter[] = { "--key", key, "--scatter", NULL };
+    char *keyed[] = { "--key", key, NULL };
+    struct { const char *path; char **encode; char **decode; } variants[] = {
+        { "compress", compress, none }, { "key", encrypt, keyed }, { "key scatter", scatter, keyed },
+    };
+    for(size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+    {
+        status = bench_encode(benchInfo, stego, variants[i].encode, &result);
+        bench_report("encode", variants[i].path, size, result, status == e_success ? NULL : "FAILED");
+        if(status == e_success)
+            status = bench_decode(benchInfo, stego, jobs, variants[i].decode, &result);
+        bench_report("decode", variants[i].path, size, result, status == e_success ? "ok" : "MISMATCH");
+        ret = status == e_success ? ret : e_failure;
+    }
+
+    // probe reads the headers only, its rate is over the whole image
+    ProbeInfo probeInfo;
+    char *argv[] = { "stego", "-p", ref };
+    result.seconds = 1e30;
+    bench_reset_peak();
+    for(uint i = 0; i < benchInfo->repeat; i++)
+    {
+        FILE *saved_stdout = silence_stdout();
+        double start = bench_now();
+        status = read_and_validate_probe_args(3, argv, &probeInfo) == e_success ? do_probe(&probeInfo) : e_failure;
+        double seconds = bench_now() - start;
+        restore_stdout(saved_stdout);
+        if(seconds < result.seconds)
+            result.seconds = seconds;
+    }
+    result.peak_kb = bench_peak_kb();
+    bench_report("probe", "-", (uint64_t)benchInfo->width * benchInfo->height * benchInfo->bpp / 8, result,
+                 status == e_success ? "ok" : "FAILED");
+    ret = status == e_success ? ret : e_failure;
+
+    unlink(ref);
+    unlink(stego);
+    unlink(key);
+    return ret;
+}
+
+
+/* --- Description for bench_smooth_row Function --->
+ * Input: benchInfo, y, row, rng
+ * Output: None
+ * Description: One row of waves of colour with a little noise, the kind of
+ * smooth image whose histogram alone looks like an embedded one.
+ */
+static void bench_smooth_row(BenchInfo *benchInfo, uint y, unsigned char *row, uint64_t *rng)
+{
+    uint pixel = benchInfo->bpp / 8;
+
+    for(uint x = 0; x < benchInfo->width; x++)
+    {
+        for(uint c = 0; c < pixel; c++)
+        {
+            double wave = 128 + 100 * sin(0.013 * (c + 1) * x) * cos(0.011 * (y + 40 * c));
+            int value = (int)wave + (int)(bench_random(rng) % 5) - 2;
+            row[x * pixel + c] = value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+    }
+}
+
+
+/* --- Description for bench_write_cover Function --->
+ * Input: benchInfo, path, smooth (random pixels if 0), rng
+ * Output: Status
+ * Description: Writes a bottom-up BMP with a BITMAPINFOHEADER, rows padded
+ * to 4 bytes.
+ */
+static Status bench_write_cover(BenchInfo *benchInfo, const char *path, int smooth, uint64_t *rng)
+{
+    size_t stride = ((size_t)benchInfo->width * benchInfo->bpp / 8 + 3) & ~(size_t)3;
+    uint64_t image_size = stride * benchInfo->height;
+    unsigned char header[54] = { 'B', 'M' };
+    unsigned char *row = calloc(1, stride + 8);
+    FILE *fptr = fopen(path, "wb");
+    Status ret = e_success;
+
+    if(row == NULL || fptr == NULL)
+    {
+        perror("fopen");
+        free(row);
+        if(fptr != NULL)
+            fclose(fptr);
+        return e_failure;
+    }
+
+    put_le(header + 2, 54 + image_size, 4);     // bfSize
+    put_le(header + 10, 54, 4);                 // bfOffBits
+    put_le(header + 14, 40, 4);                 // biSize
+    put_le(header + 18, benchInfo->width, 4);
+    put_le(header + 22, benchInfo->height, 4);
+    put_le(header + 26, 1, 2);                  // biPlanes
+    put_le(header + 28, benchInfo->bpp, 2);
+    put_le(header + 34, image_size, 4);         // biSizeImage
+    if(fwrite(header, 1, sizeof(header), fptr) != sizeof(header))
+        ret = e_failure;
+
+    for(uint y = 0; y < benchInfo->height && ret == e_success; y++)
+    {
+        if(smooth)
+            bench_smooth_row(benchInfo, y, row, rng);
+        for(size_t x = 0; x < stride && !smooth; x += 8)
+        {
+            uint64_t bits = bench_random(rng);
+            memcpy(row + x, &bits, 8);
+        }
+        if(fwrite(row, 1, stride, fptr) != stride)
+            ret = e_failure;
+    }
+    if(fclose(fptr) != 0)
+        ret = e_failure;
+    free(row);
+    return ret;
+}
+
+
+/* --- Description for bench_make_payload Function --->
+ * Input: benchInfo, size, rng
+ * Output: malloc'ed payload, also written to benchInfo->secret (NULL on failure)
+ * Description: Every byte holds entropy random low bits, so 8 gives
+ * incompressible data and 0 a run of zeros.
+ */
+static unsigned char *bench_make_payload(BenchInfo *benchInfo, size_t size, uint64_t *rng)
+{
+    unsigned char *payload = malloc(size + 8);
+    unsigned char mask = (1u << benchInfo->entropy) - 1;
+    FILE *fptr = fopen(benchInfo->secret, "wb");
+
+    if(payload == NULL || fptr == NULL)
+    {
+        perror("fopen");
+        free(payload);
+        if(fptr != NULL)
+            fclose(fptr);
+        return NULL;
+    }
+    for(size_t i = 0; i < size; i += 8)
+    {
+        uint64_t bits = bench_random(rng);
+        memcpy(payload + i, &bits, 8);
+    }
+    for(size_t i = 0; i < size; i++)
+        payload[i] &= mask;
+
+    if(fwrite(payload, 1, size, fptr) != size || fclose(fptr) != 0)
+    {
+        free(payload);
+        return NULL;
+    }
+    return payload;
+}
+
+
+/* --- Description for bench_analyze Function --->
+ * Input: benchInfo, image, result
+ * Output: 1 if the image is reported SUSPECT, 0 if CLEAN, -1 on failure
+ * Description: Runs -n on one image like the CLI does, with its line
+ * written to a file of benchInfo->dir and read back, and keeps the fastest
+ * of benchInfo->repeat runs.
+ */
+static int bench_analyze(BenchInfo *benchInfo, const char *image, BenchResult *result)
+{
+    char out[96], line[16] = "";
+    char *argv[] = { "stego", "-n", (char *)image };
+    int verdict = -1;
+
+    snprintf(out, sizeof(out), "%s/analyze.txt", benchInfo->dir);
+    result->seconds = 1e30;
+    bench_reset_peak();
+    for(uint i = 0; i < benchInfo->repeat; i++)
+    {
+        AnalyzeInfo analyzeInfo;
+        FILE *fout = fopen(out, "w");
+
+        if(fout == NULL)
+        {
+            perror("fopen");
+            break;
+        }
+        FILE *saved_stdout = redirect_stdout(fout);
+        double start = bench_now();
+        Status status = read_and_validate_analyze_args(3, argv, &analyzeInfo) == e_success ?
+                        do_analyze(&analyzeInfo) : e_failure;
+        double seconds = bench_now() - start;
+        restore_stdout(saved_stdout);
+        fclose(fout);
+        if(status == e_failure)
+            break;
+        if(seconds < result->seconds)
+            result->seconds = seconds;
+
+        FILE *fptr = fopen(out, "r");
+        if(fptr != NULL && fgets(line, sizeof(line), fptr) != NULL)
+            verdict = strncmp(line, "SUSPECT", 7) == 0 ? 1 : strncmp(line, "CLEAN", 5) == 0 ? 0 : -1;
+        if(fptr != NULL)
+            fclose(fptr);
+    }
+    result->peak_kb = bench_peak_kb();
+    unlink(out);
+    return verdict;
+}
+
+
+/* --- Description for bench_analysis Function --->
+ * Input: benchInfo, rng
+ * Output: Status (e_failure if a verdict is wrong)
+ * Description: Writes a smooth cover, which must be reported CLEAN, and
+ * a random payload filling it at depth 1, which must be reported SUSPECT
+ * once encoded. The payload is its own so that --depth, --entropy and
+ * --payload leave the verdicts alone. Random pixels are no use here:
+ * their LSBs already look embedded.
+ */
+static Status bench_analysis(BenchInfo *benchInfo, uint64_t *rng)
+{
+    BenchInfo smooth = *benchInfo;
+    uint64_t image_size = (uint64_t)benchInfo->width * benchInfo->height * benchInfo->bpp / 8;
+    char *none[] = { NULL };
+    char stego[96];
+    BenchResult result;
+    Status ret = e_success;
+
+    snprintf(smooth.cover, sizeof(smooth.cover), "%s/smooth.bmp", benchInfo->dir);
+    snprintf(smooth.secret, sizeof(smooth.secret), "%s/smooth-payload.bin", benchInfo->dir);
+    snprintf(stego, sizeof(stego), "%s/smooth-stego.bmp", benchInfo->dir);
+    smooth.depth = 1;
+    smooth.jobs = 1;
+    smooth.entropy = 8;
+
+    // everything the container adds fits in 64 KiB, as for the main payload
+    uint64_t room = (uint64_t)smooth.width * smooth.height * 3 / 8;
+    unsigned char *payload = NULL;
+    if(bench_write_cover(&smooth, smooth.cover, 1, rng) == e_failure ||
+       (payload = bench_make_payload(&smooth, room > 2 * 65536 ? room - 65536 : room / 2, rng)) == NULL)
+    {
+        printf("ERROR : Unable to write %s\n", smooth.cover);
+        unlink(smooth.cover);
+        return e_failure;
+    }
+    free(payload);
+
+    int verdict = bench_analyze(&smooth, smooth.cover, &result);
+    bench_report("analyze", "clean", image_size, result, verdict == 0 ? "ok" : "MISMATCH");
+    ret = verdict == 0 ? ret : e_failure;
+
+    if(bench_encode(&smooth, stego, none, &result) == e_success)
+        verdict = bench_analyze(&smooth, stego, &result);
+    else
+        verdict = -1;
+    bench_report("analyze", "stego", image_size, result, verdict == 1 ? "ok" : "MISMATCH");
+    ret = verdict == 1 ? ret : e_failure;
+
+    unlink(smooth.cover);
+    unlink(smooth.secret);
+    unlink(stego);
+    return ret;
+}
+
+
+/* --- Description for bench_real_cover Function --->
+ * Input: benchInfo, rng
+ * Output: Status (e_failure if a verdict is wrong)
+ * Description: Synthetic covers miss what fools the detectors on photos:
+ * sensor noise and clipped shadows. BENCH_REAL_COVER must be reported
+ * CLEAN, and SUSPECT once a random payload filling a few percent, then
+ * most, of it is encoded. Skipped when the bench is not run from the top
+ * of the tree.
+ */
+static Status bench_real_cover(BenchInfo *benchInfo, uint64_t *rng)
+{
+    static const size_t sizes[] = { 20000, 250000 };
+    BenchInfo real = *benchInfo;
+    char *none[] = { NULL };
+    char stego[96], name[32];
+    BenchResult result;
+    struct stat st;
+    Status ret = e_success;
+
+    if(stat(BENCH_REAL_COVER, &st) == -1)
+    {
+        printf("INFO : %s not found, run from the top of the tree to analyze a real cover\n", BENCH_REAL_COVER);
+        return e_success;
+    }
+    snprintf(real.cover, sizeof(real.cover), "%s", BENCH_REAL_COVER);
+    snprintf(real.secret, sizeof(real.secret), "%s/real-payload.bin", benchInfo->dir);
+    snprintf(stego, sizeof(stego), "%s/real-stego.bmp", benchInfo->dir);
+    real.depth = 1;
+    real.jobs = 1;
+    real.entropy = 8;
+
+    int verdict = bench_analyze(&real, real.cover, &result);
+    bench_report("analyze", "real", st.st_size, result, verdict == 0 ? "ok" : "MISMATCH");
+    ret = verdict == 0 ? ret : e_failure;
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        unsigned char *payload = bench_make_payload(&real, sizes[i], rng);
+
+        verdict = -1;
+        if(payload != NULL && bench_encode(&real, stego, none, &result) == e_success)
+            verdict = bench_analyze(&real, stego, &result);
+        free(payload);
+        snprintf(name, sizeof(name), "real %zu KB", sizes[i] / 1000);
+        bench_report("analyze", name, st.st_size, result, verdict == 1 ? "ok" : "MISMATCH");
+        ret = verdict == 1 ? ret : e_failure;
+    }
+
+    unlink(real.secret);
+    unlink(stego);
+    return ret;
+}
+
+
+/* --- Description for bench_small_cover Function --->
+ * Input: benchInfo, rng
+ * Output: Status (e_failure if any path fails or disagrees)
+ * Description: Runs the encode / decode round trips once more on a
+ * BENCH_SMALL_SIDE square cover, fewer blocks than PIPELINE_DEPTH, so that
+ * --uring also runs with slots that never get a block. One run each, the
+ * rates are only indicative.
+ */
+static Status bench_small_cover(BenchInfo *benchInfo, uint64_t *rng)
+{
+    BenchInfo small = *benchInfo;
+    uint64_t size;
+
+    small.width = small.height = BENCH_SMALL_SIDE;
+    small.repeat = 1;
+    size = (uint64_t)small.width * small.height * 3 * small.depth / 8 / 2;
+    printf("INFO : %ux%u %u bpp cover, %llu byte payload\n",
+           small.width, small.height, small.bpp, (unsigned long long)size);
+
+    unsigned char *payload = NULL;
+    if(bench_write_cover(&small, small.cover, 0, rng) == e_failure || (payload = bench_make_payload(&small, size, rng)) == NULL)
+    {
+        printf("ERROR : Unable to write the cover and payload to %s\n", small.dir);
+        return e_failure;
+    }
+    free(payload);
+    return bench_pipeline(&small, size);
+}
+
+
+/* --- Description for bench_parse_uint Function --->
+ * Input: arg, min, max, value
+ * Output: Status (e_failure unless arg is a number in [min, max])
+ */
+static Status bench_parse_uint(const char *arg, uint64_t min, uint64_t max, uint64_t *value)
+{
+    char *end;
+    unsigned long long parsed = strtoull(arg, &end, 10);
+
+    if(*arg == '\0' || *end != '\0' || parsed < min || parsed > max)
+        return e_failure;
+    *value = parsed;
+    return e_success;
+}
+
+
+/* --- Description for read_and_validate_bench_args Function --->
+ * Input: argc, argv, benchInfo
+ * Output: Status (e_success / e_failure)
+ */
+static Status read_and_validate_bench_args(int argc, char *argv[], BenchInfo *benchInfo)
+{
+    uint64_t value;
+
+    benchInfo->width = benchInfo->height = 2048;
+    benchInfo->bpp = 24;
+    benchInfo->payload_size = 0;
+    benchInfo->entropy = 8;
+    benchInfo->depth = 1;
+    benchInfo->jobs = 4;
+    benchInfo->repeat = 3;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(i + 1 >= argc)
+            return e_failure;
+        else if(strcmp(argv[i], "--width") == 0 && bench_parse_uint(argv[++i], 8, 65535, &value) == e_success)
+            benchInfo->width = value;
+        else if(strcmp(argv[i], "--height") == 0 && bench_parse_uint(argv[++i], 8, 65535, &value) == e_success)
+            benchInfo->height = value;
+        else if(strcmp(argv[i], "--bpp") == 0 && bench_parse_uint(argv[++i], 24, 32, &value) == e_success &&
+                (value == 24 || value == 32))
+            benchInfo->bpp = value;
+        else if(strcmp(argv[i], "--payload") == 0 && bench_parse_uint(argv[++i], 1, UINT32_MAX, &value) == e_success)
+            benchInfo->payload_size = value;
+        else if(strcmp(argv[i], "--entropy") == 0 && bench_parse_uint(argv[++i], 0, 8, &value) == e_success)
+            benchInfo->entropy = value;
+        else if(strcmp(argv[i], "--depth") == 0 &&
+                bench_parse_uint(argv[++i], MIN_LSB_DEPTH, MAX_LSB_DEPTH, &value) == e_success)
+            benchInfo->depth = value;
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            if(parse_jobs(argv[++i], &benchInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strcmp(argv[i], "--repeat") == 0 && bench_parse_uint(argv[++i], 1, 1000, &value) == e_success)
+            benchInfo->repeat = value;
+        else
+            return e_failure;
+    }
+    return e_success;
+}
+
+
+/* --- Description for main Function --->
+ * Input: argc, argv
+ * Output: 0 if every path agrees with its reference, 1 otherwise
+ */
+int main(int argc, char *argv[])
+{
+    BenchInfo benchInfo;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    if(read_and_validate_bench_args(argc, argv, &benchInfo) == e_failure)
+    {
+        printf("Usage : stego-bench [--width W] [--height H] [--bpp 24|32] [--payload bytes] [--entropy 0-8] "
+               "[--depth N] [-j N] [--repeat R]\n");
+        return 1;
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(benchInfo.dir, sizeof(benchInfo.dir), "%s/stego-bench-XXXXXX", tmp != NULL && strlen(tmp) < 40 ? tmp : "/tmp");
+    if(mkdtemp(benchInfo.dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(benchInfo.cover, sizeof(benchInfo.cover), "%s/cover.bmp", benchInfo.dir);
+    snprintf(benchInfo.secret, sizeof(benchInfo.secret), "%s/payload.bin", benchInfo.dir);
+
+    // everything the container adds fits in 64 KiB of payload at depth 1
+    uint64_t colour_bytes = (uint64_t)benchInfo.width * benchInfo.height * 3;
+    uint64_t room = colour_bytes * benchInfo.depth / 8;
+    uint64_t size = benchInfo.payload_size ? benchInfo.payload_size : room > 2 * 65536 ? room - 65536 : room / 2;
+
+    printf("INFO : %ux%u %u bpp cover, %llu byte payload with %u bits of entropy per byte, depth %u, -j %u, best of %u\n",
+           benchInfo.width, benchInfo.height, benchInfo.bpp, (unsigned long long)size, benchInfo.entropy,
+           benchInfo.depth, benchInfo.jobs, benchInfo.repeat);
+
+    unsigned char *payload = NULL;
+    Status ret = bench_write_cover(&benchInfo, benchInfo.cover, 0, &rng);
+    if(ret == e_success && (payload = bench_make_payload(&benchInfo, size, &rng)) == NULL)
+        ret = e_failure;
+    if(ret == e_failure)
+        printf("ERROR : Unable to write the cover and payload to %s\n", benchInfo.dir);
+
+    if(ret == e_success && bench_kernels(&benchInfo, payload, size) == e_failure)
+        ret = e_failure;
+    if(payload != NULL && bench_pipeline(&benchInfo, size) == e_failure)
+        ret = e_failure;
+    if(payload != NULL && bench_analysis(&benchInfo, &rng) == e_failure)
+        ret = e_failure;
+    if(payload != NULL && bench_real_cover(&benchInfo, &rng) == e_failure)
+        ret = e_failure;
+    if(payload != NULL && bench_small_cover(&benchInfo, &rng) == e_failure)
+        ret = e_failure;
+
+    free(payload);
+    unlink(benchInfo.cover);
+    unlink(benchInfo.secret);
+    rmdir(benchInfo.dir);
+    printf("INFO : ## Benchmark %s ##\n", ret == e_success ? "Done, every path agrees" : "Found MISMATCHES");
+    return ret == e_success ? 0 : 1;
+}
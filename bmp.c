@@ -0,0 +1,602 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bmp.h"
+#include "types.h"
+#include "common.h"
+
+/* biCompression values */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+
+/* --- Description for read_le Function --->
+ * Input: bytes, count (2 or 4)
+ * Output: little endian value
+ */
+static uint read_le(const unsigned char *bytes, int count)
+{
+    uint value = 0;
+    for(int i = 0; i < count; i++)
+        value |= (uint)bytes[i] << (8 * i);
+    return value;
+}
+
+
+/* --- Description for bmp_parse_header Function --->
+ * Input: header (first len bytes of the file), len (at least BMP_HEADER_SIZE), info
+ * Output: Status (e_failure for anything but a supported BMP)
+ * Description: Fills info from the file and info headers. 32 bpp images may
+ * use BI_BITFIELDS only with the usual 8 bit masks, so the colour bytes are
+ * always the first 3 bytes of a pixel. All sizes are computed in 64 bits.
+ */
+Status bmp_parse_header(const unsigned char *header, size_t len, BmpInfo *info)
+{
+    if(len < BMP_HEADER_SIZE || header[0] != 'B' || header[1] != 'M')
+        return e_failure;
+
+    int width = (int)read_le(header + 18, 4);
+    int height = (int)read_le(header + 22, 4);
+    uint compression = read_le(header + 30, 4);
+
+    info->data_offset = read_le(header + 10, 4);
+    info->dib_size = read_le(header + 14, 4);
+    info->bpp = read_le(header + 28, 2);
+
+    if(info->dib_size != 40 && info->dib_size != 52 && info->dib_size != 56 &&
+       info->dib_size != 108 && info->dib_size != 124)
+        return e_failure;
+    if(info->data_offset < 14 + info->dib_size || read_le(header + 26, 2) != 1)
+        return e_failure;
+    if(info->bpp != 24 && info->bpp != 32)
+        return e_failure;
+    if(width <= 0 || height == 0 || height == INT32_MIN)
+        return e_failure;
+
+    if(compression == BI_BITFIELDS && info->bpp == 32)
+    {
+        // masks follow a 40 byte header, or are part of the larger ones
+        if(len < 66 || read_le(header + 54, 4) != 0x00FF0000 ||
+           read_le(header + 58, 4) != 0x0000FF00 || read_le(header + 62, 4) != 0x000000FF)
+            return e_failure;
+    }
+    else if(compression != BI_RGB)
+    {
+        return e_failure;
+    }
+
+    info->width = width;
+    info->top_down = height < 0;
+    info->height = height < 0 ? -height : height;
+    info->stride = ((uint64_t)info->width * info->bpp + 31) / 32 * 4;
+    info->row_bytes = (uint64_t)info->width * 3;
+    info->colour_bytes = (uint64_t)info->row_bytes * info->height;
+    info->image_size = info->data_offset + (uint64_t)info->stride * info->height;
+    return e_success;
+}
+
+
+/* --- Description for bmp_copy_header Function --->
+ * Input: src (at the start of the file, may be a pipe), dest (or NULL), info
+ * Output: Status
+ * Description: Reads the headers, parses them, and copies all bytes before
+ * the pixel array (headers, masks, colour table, gaps) to dest. Leaves src
+ * and dest at data_offset.
+ */
+Status bmp_copy_header(FILE *src, FILE *dest, BmpInfo *info)
+{
+    unsigned char header[BMP_MAX_HEADER_SIZE];
+    size_t len = BMP_HEADER_SIZE;
+
+    if(fread(header, 1, len, src) != len)
+        return e_failure;
+
+    uint data_offset = read_le(header + 10, 4);
+    if(data_offset > len)
+    {
+        size_t extra = (data_offset < BMP_MAX_HEADER_SIZE ? data_offset : BMP_MAX_HEADER_SIZE) - len;
+        if(fread(header + len, 1, extra, src) != extra)
+            return e_failure;
+        len += extra;
+    }
+    if(bmp_parse_header(header, len, info) == e_failure)
+        return e_failure;
+    if(dest != NULL && fwrite(header, 1, len, dest) != len)
+        return e_failure;
+
+    // whatever sits between the headers and the pixels
+    unsigned char buffer[4096];
+    for(size_t left = info->data_offset - len; left > 0; )
+    {
+        size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+        if(fread(buffer, 1, chunk, src) != chunk)
+            return e_failure;
+        if(dest != NULL && fwrite(buffer, 1, chunk, dest) != chunk)
+            return e_failure;
+        left -= chunk;
+    }
+    return e_success;
+}
+
+
+/* --- Description for bmp_read_info Function --->
+ * Input: fptr (seekable), info
+ * Output: Status
+ * Description: Parses the headers of an opened file, leaves it at data_offset.
+ */
+Status bmp_read_info(FILE *fptr, BmpInfo *info)
+{
+    if(fseek(fptr, 0, SEEK_SET) != 0)
+        return e_failure;
+    return bmp_copy_header(fptr, NULL, info);
+}
+
+
+/* --- Description for bmp_is_linear Function --->
+ * Input: info
+ * Output: 1 if colour byte i is at data_offset + i
+ * Description: Such images can be embedded with plain offsets (mmap,
+ * positional I/O, threads) instead of walking the rows.
+ */
+int bmp_is_linear(const BmpInfo *info)
+{
+    return info->bpp == 24 && info->stride == info->row_bytes;
+}
+
+
+/* --- Description for bmp_rows_init Function --->
+ * Input: rows, info, src, dest (NULL when only reading)
+ * Output: None
+ */
+void bmp_rows_init(BmpRows *rows, const BmpInfo *info, FILE *src, FILE *dest)
+{
+    memset(rows, 0, sizeof(BmpRows));
+    rows->info = *info;
+    rows->src = src;
+    rows->dest = dest;
+}
+
+
+/* --- Description for bmp_rows_release Function --->
+ * Input: rows, count
+ * Output: Status
+ * Description: Writes the first count rows of the window to dest (if any)
+ * and drops them from the window. A mapped window is already in dest and
+ * is only released as a whole (bmp_rows_flush).
+ */
+static Status bmp_rows_release(BmpRows *rows, uint count)
+{
+    size_t stride = rows->info.stride;
+
+    if(count > rows->rows)
+        count = rows->rows;
+    if(rows->map != NULL)
+    {
+        munmap(rows->map, rows->map_len);
+        rows->map = NULL;
+        rows->window = NULL;
+        rows->first_row += rows->rows;
+        rows->rows = 0;
+        return e_success;
+    }
+    if(rows->dest != NULL && count > 0 &&
+       fwrite(rows->window, stride, count, rows->dest) != count)
+        return e_failure;
+
+    if(rows->rows > count)                  // the window may not be allocated yet
+        memmove(rows->window, rows->window + count * stride, (rows->rows - count) * stride);
+    rows->first_row += count;
+    rows->rows -= count;
+    return e_success;
+}
+
+
+/* --- Description for bmp_rows_copy_span Function --->
+ * Input: rows, buf, pos (colour byte in file order), n, to_window (0: gather into buf, 1: scatter buf)
+ * Output: None
+ * Description: Moves n colour bytes starting at pos between buf and
+ * the window, one scanline at a time. 24 bpp rows are copied in one go,
+ * 32 bpp rows pixel by pixel, skipping the 4th byte.
+ */
+static void bmp_rows_copy_span(BmpRows *rows, unsigned char *buf, uint64_t pos, size_t n, int to_window)
+{
+    const BmpInfo *info = &rows->info;
+
+    while(n > 0)
+    {
+        uint64_t row = pos / info->row_bytes;
+        size_t col = pos % info->row_bytes;
+        size_t len = info->row_bytes - col < n ? info->row_bytes - col : n;
+        unsigned char *raw = rows->window + (row - rows->first_row) * info->stride;
+
+        if(info->bpp == 24)
+        {
+            if(to_window)
+                memcpy(raw + col, buf, len);
+            else
+                memcpy(buf, raw + col, len);
+        }
+        else
+        {
+            for(size_t i = 0; i < len; i++)
+            {
+                size_t c = col + i;
+                unsigned char *byte = raw + c / 3 * 4 + c % 3;
+                if(to_window)
+                    *byte = buf[i];
+                else
+                    buf[i] = *byte;
+            }
+        }
+        buf += len;
+        pos += len;
+        n -= len;
+    }
+}
+
+
+/* --- Description for bmp_rows_copy Function --->
+ * Input: rows, buf, n, to_window
+ * Output: None
+ * Description: Moves the n colour bytes starting at rows->mark. Bytes after
+ * scatter_start are split at block boundaries and each piece is moved to
+ * or from the physical block given by the keyed order.
+ */
+static void bmp_rows_copy(BmpRows *rows, unsigned char *buf, size_t n, int to_window)
+{
+    uint64_t pos = rows->mark;
+
+    if(rows->scatter.blocks == 0)
+    {
+        bmp_rows_copy_span(rows, buf, pos, n, to_window);
+        return;
+    }
+
+    while(n > 0)
+    {
+        size_t len;
+        if(pos < rows->scatter_start)          // header, in file order
+        {
+            len = rows->scatter_start - pos < n ? rows->scatter_start - pos : n;
+            bmp_rows_copy_span(rows, buf, pos, len, to_window);
+        }
+        else
+        {
+            uint64_t block = (pos - rows->scatter_start) / SCATTER_BLOCK_SIZE;
+            size_t offset = (pos - rows->scatter_start) % SCATTER_BLOCK_SIZE;
+            uint64_t physical = rows->scatter_start + scatter_index(&rows->scatter, block) * SCATTER_BLOCK_SIZE;
+
+            len = SCATTER_BLOCK_SIZE - offset < n ? SCATTER_BLOCK_SIZE - offset : n;
+            bmp_rows_copy_span(rows, buf, physical + offset, len, to_window);
+        }
+        buf += len;
+        pos += len;
+        n -= len;
+    }
+}
+
+
+/* --- Description for bmp_rows_read Function --->
+ * Input: rows, buf, n
+ * Output: Status (e_failure past the last colour byte or on I/O errors)
+ * Description: Rows wholly before the current position are released, then
+ * rows are read from src until the window holds the next n colour bytes,
+ * which are copied to buf. Memory stays bounded by n plus two rows.
+ */
+Status bmp_rows_read(BmpRows *rows, unsigned char *buf, size_t n)
+{
+    const BmpInfo *info = &rows->info;
+
+    if(n == 0)
+        return e_success;
+    if(rows->scatter.blocks > 0)            // every row is in the window
+    {
+        if(n > rows->scatter_start + rows->scatter.blocks * SCATTER_BLOCK_SIZE - rows->pos)
+            return e_failure;
+        rows->mark = rows->pos;
+        bmp_rows_copy(rows, buf, n, 0);
+        rows->pos += n;
+        return e_success;
+    }
+    if(n > info->colour_bytes - rows->pos)
+        return e_failure;
+
+    if(bmp_rows_release(rows, rows->pos / info->row_bytes - rows->first_row) == e_failure)
+        return e_failure;
+
+    uint last = (rows->pos + n - 1) / info->row_bytes;
+    size_t need = (size_t)(last - rows->first_row + 1) * info->stride;
+    if(need > rows->capacity)
+    {
+        unsigned char *window = realloc(rows->window, need);
+        if(window == NULL)
+            return e_failure;
+        rows->window = window;
+        rows->capacity = need;
+    }
+    while(rows->first_row + rows->rows <= last)
+    {
+        if(fread(rows->window + rows->rows * info->stride, 1, info->stride, rows->src) != info->stride)
+            return e_failure;
+        rows->rows++;
+    }
+
+    rows->mark = rows->pos;
+    bmp_rows_copy(rows, buf, n, 0);
+    rows->pos += n;
+    return e_success;
+}
+
+
+/* --- Description for bmp_rows_seek Function --->
+ * Input: rows (read only walk), pos
+ * Output: Status
+ * Description: Moves the walk to colour byte pos. Seekable files jump to
+ * the row holding pos and drop the window, pipes can only go forward and
+ * read the rows in between.
+ */
+Status bmp_rows_seek(BmpRows *rows, uint64_t pos)
+{
+    const BmpInfo *info = &rows->info;
+    unsigned char skip[4096];
+
+    if(rows->dest != NULL || pos > info->colour_bytes)
+        return e_failure;
+    if(rows->scatter.blocks > 0)            // every row is in the window
+    {
+        if(pos > rows->scatter_start + rows->scatter.blocks * SCATTER_BLOCK_SIZE)
+            return e_failure;
+        rows->pos = pos;
+        return e_success;
+    }
+
+    uint64_t row = pos / info->row_bytes;
+    if(fseeko(rows->src, info->data_offset + row * info->stride, SEEK_SET) == 0)
+    {
+        rows->first_row = row;
+        rows->rows = 0;
+        rows->pos = pos;
+        return e_success;
+    }
+
+    if(pos < rows->pos)
+        return e_failure;
+    while(rows->pos < pos)
+    {
+        size_t n = pos - rows->pos < sizeof(skip) ? pos - rows->pos : sizeof(skip);
+        if(bmp_rows_read(rows, skip, n) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+
+/* --- Description for bmp_rows_write Function --->
+ * Input: rows, buf, n (size of the last bmp_rows_read)
+ * Output: None
+ */
+void bmp_rows_write(BmpRows *rows, const unsigned char *buf, size_t n)
+{
+    bmp_rows_copy(rows, (unsigned char *)buf, n, 1);
+}
+
+
+/* --- Description for bmp_rows_patch Function --->
+ * Input: rows (dest opened for reading too), pos (colour byte in walk order), buf, n
+ * Output: Status
+ * Description: Lets a field be filled in once the bytes after it are known
+ * (the chunk table). Bytes in rows still in the window are stored there;
+ * rows already released are read back from dest, patched and rewritten in
+ * place, one row at a time. In keyed order every row from scatter_start on
+ * is in the window.
+ */
+Status bmp_rows_patch(BmpRows *rows, uint64_t pos, const unsigned char *buf, size_t n)
+{
+    const BmpInfo *info = &rows->info;
+    uint64_t released = (uint64_t)rows->first_row * info->row_bytes;
+
+    if(rows->dest == NULL)
+        return e_failure;
+
+    if(rows->scatter.blocks == 0 && pos < released)
+    {
+        BmpRows row = *rows;                    // one row window over the released row
+        row.window = malloc(info->stride);
+        row.rows = 1;
+        if(row.window == NULL || fflush(rows->dest) != 0)
+        {
+            free(row.window);
+            return e_failure;
+        }
+
+        int fd = fileno(rows->dest);
+        Status ret = e_success;
+        while(n > 0 && pos < released && ret == e_success)
+        {
+            off_t offset = info->data_offset + (off_t)(pos / info->row_bytes) * info->stride;
+            size_t len = info->row_bytes - pos % info->row_bytes < n ? info->row_bytes - pos % info->row_bytes : n;
+
+            row.first_row = pos / info->row_bytes;
+            if(pread(fd, row.window, info->stride, offset) != (ssize_t)info->stride)
+                ret = e_failure;
+            else
+            {
+                bmp_rows_copy_span(&row, (unsigned char *)buf, pos, len, 1);
+                if(pwrite(fd, row.window, info->stride, offset) != (ssize_t)info->stride)
+                    ret = e_failure;
+            }
+            buf += len;
+            pos += len;
+            n -= len;
+        }
+        free(row.window);
+        if(ret == e_failure)
+            return e_failure;
+    }
+
+    uint64_t mark = rows->mark;
+    rows->mark = pos;
+    bmp_rows_copy(rows, (unsigned char *)buf, n, 1);
+    rows->mark = mark;
+    return e_success;
+}
+
+
+/* --- Description for bmp_rows_mappable Function --->
+ * Input: rows
+ * Output: 1 if bmp_rows_map can be used: src is a regular file holding the
+ * whole pixel array and dest, if any, a regular file opened read / write
+ */
+static int bmp_rows_mappable(const BmpRows *rows)
+{
+    struct stat st;
+
+    if(rows->first_row >= rows->info.height || fstat(fileno(rows->src), &st) == -1 || !S_ISREG(st.st_mode) ||
+       st.st_size < (off_t)rows->info.image_size)
+        return 0;
+    return rows->dest == NULL || (fstat(fileno(rows->dest), &st) == 0 && S_ISREG(st.st_mode) &&
+                                  (fcntl(fileno(rows->dest), F_GETFL) & O_ACCMODE) == O_RDWR);
+}
+
+
+/* --- Description for bmp_rows_map Function --->
+ * Input: rows (bmp_rows_mappable, window released up to the current row)
+ * Output: Status
+ * Description: Makes the window a mapping of the rows from first_row to the
+ * last one. A read only walk maps src. Otherwise the window rows are written
+ * out, the rest of the pixel array is copied from src to dest (nothing to
+ * copy when they are the same file) and dest is mapped shared, so the
+ * keyed blocks are stored straight into it. Both files are left at the end
+ * of the pixel array.
+ */
+static Status bmp_rows_map(BmpRows *rows)
+{
+    const BmpInfo *info = &rows->info;
+    off_t start = info->data_offset + (off_t)rows->first_row * info->stride;
+    off_t base = start - start % sysconf(_SC_PAGESIZE);
+    uint first_row = rows->first_row;
+
+    if(rows->dest != NULL)
+    {
+        struct stat src_st, dest_st;
+        unsigned char buffer[64 * 1024];
+
+        if(bmp_rows_release(rows, rows->rows) == e_failure ||
+           fstat(fileno(rows->src), &src_st) == -1 || fstat(fileno(rows->dest), &dest_st) == -1)
+            return e_failure;
+        if(src_st.st_dev == dest_st.st_dev && src_st.st_ino == dest_st.st_ino)
+        {
+            if(fseeko(rows->dest, info->image_size, SEEK_SET) != 0)
+                return e_failure;
+        }
+        else
+        {
+            for(uint64_t left = (uint64_t)(info->height - rows->first_row) * info->stride; left > 0; )
+            {
+                size_t n = left < sizeof(buffer) ? left : sizeof(buffer);
+                if(fread(buffer, 1, n, rows->src) != n || fwrite(buffer, 1, n, rows->dest) != n)
+                    return e_failure;
+                left -= n;
+            }
+        }
+        if(fflush(rows->dest) != 0)
+            return e_failure;
+    }
+
+    int fd = fileno(rows->dest != NULL ? rows->dest : rows->src);
+    size_t len = info->image_size - base;
+    void *addr = mmap(NULL, len, rows->dest != NULL ? PROT_READ | PROT_WRITE : PROT_READ,
+                      rows->dest != NULL ? MAP_SHARED : MAP_PRIVATE, fd, base);
+    if(addr == MAP_FAILED || fseeko(rows->src, info->image_size, SEEK_SET) != 0)
+        return e_failure;
+    madvise(addr, len, MADV_RANDOM);
+
+    free(rows->window);
+    rows->map = addr;
+    rows->map_len = len;
+    rows->window = rows->map + (start - base);
+    rows->capacity = 0;
+    rows->first_row = first_row;
+    rows->rows = info->height - first_row;
+    return e_success;
+}
+
+
+/* --- Description for bmp_rows_scatter Function --->
+ * Input: rows, key (SCATTER_KEY_SIZE bytes)
+ * Output: Status (e_failure on I/O errors or when out of memory)
+ * Description: Blocks may land anywhere after the current position, so the
+ * rows not walked yet must all be at hand. Regular files get them mapped
+ * (bmp_rows_map), only the pages of the blocks visited are read. Pipes
+ * (or a stego image on stdout) can't be mapped, the rows are then all
+ * loaded into the window, reading src front to back. The whole blocks
+ * between the current position and the last colour byte are then
+ * permuted, a partial last block is left unused.
+ */
+Status bmp_rows_scatter(BmpRows *rows, const unsigned char *key)
+{
+    const BmpInfo *info = &rows->info;
+
+    if(bmp_rows_release(rows, rows->pos / info->row_bytes - rows->first_row) == e_failure)
+        return e_failure;
+
+    if(bmp_rows_mappable(rows))
+    {
+        if(bmp_rows_map(rows) == e_failure)
+            return e_failure;
+        rows->scatter_start = rows->pos;
+        scatter_init(&rows->scatter, (info->colour_bytes - rows->pos) / SCATTER_BLOCK_SIZE, key);
+        return e_success;
+    }
+
+    size_t need = (size_t)(info->height - rows->first_row) * info->stride;
+    if(need > rows->capacity)
+    {
+        unsigned char *window = realloc(rows->window, need);
+        if(window == NULL)
+            return e_failure;
+        rows->window = window;
+        rows->capacity = need;
+    }
+    size_t missing = (size_t)(info->height - rows->first_row - rows->rows) * info->stride;
+    if(fread(rows->window + rows->rows * info->stride, 1, missing, rows->src) != missing)
+        return e_failure;
+    rows->rows = info->height - rows->first_row;
+
+    rows->scatter_start = rows->pos;
+    scatter_init(&rows->scatter, (info->colour_bytes - rows->pos) / SCATTER_BLOCK_SIZE, key);
+    return e_success;
+}
+
+
+/* --- Description for bmp_rows_flush Function --->
+ * Input: rows
+ * Output: Status
+ * Description: Releases every row of the window. src and dest are then both
+ * at the end of the last row read, ready for a plain copy of the rest.
+ */
+Status bmp_rows_flush(BmpRows *rows)
+{
+    return bmp_rows_release(rows, rows->rows);
+}
+
+
+/* --- Description for bmp_rows_free Function --->
+ * Input: rows
+ * Output: None
+ */
+void bmp_rows_free(BmpRows *rows)
+{
+    if(rows->map != NULL)
+        munmap(rows->map, rows->map_len);
+    else
+        free(rows->window);
+    rows->map = NULL;
+    rows->window = NULL;
+    rows->capacity = 0;
+    rows->rows = 0;
+}
@@ -0,0 +1,99 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdio.h>  //for FILE *
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "scatter.h"
+
+/*
+ * BMP reader for the encoder and decoder.
+ * Uncompressed 24 and 32 bits per pixel images are supported, with a
+ * BITMAPINFOHEADER, V4 or V5 header, stored bottom-up or top-down.
+ * The pixel array starts at bfOffBits and every row is padded to 4 bytes.
+ * Only colour bytes (B, G, R) hold hidden data, row padding and the 4th byte
+ * of 32 bpp pixels are left alone. Rows are walked in file order, so the
+ * order of the colour bytes does not depend on the row order.
+ * A walk can switch to a keyed order (bmp_rows_scatter): the rest of the
+ * pixel array is then the window, mapped from the file (or loaded, for
+ * pipes) and the colour bytes after the switch are visited in scattered
+ * blocks (see scatter.h).
+ */
+
+/* File header + largest supported info header (BITMAPV5HEADER) */
+#define BMP_MAX_HEADER_SIZE (14 + 124)
+
+// Structure to hold the layout of a BMP image
+typedef struct _BmpInfo
+{
+    uint data_offset;           // bfOffBits: first byte of the pixel array
+    uint dib_size;              // biSize: 40, 52, 56, 108 (V4) or 124 (V5)
+    uint width;
+    uint height;                // number of rows
+    int top_down;               // biHeight was negative
+    uint bpp;                   // 24 or 32
+    size_t stride;              // stored bytes per row, padding included
+    size_t row_bytes;           // colour bytes per row (3 per pixel)
+    uint64_t colour_bytes;      // colour bytes of the whole image
+    uint64_t image_size;        // data_offset + height * stride
+} BmpInfo;
+
+// Window of scanlines walked front to back through the colour bytes
+typedef struct _BmpRows
+{
+    BmpInfo info;
+    FILE *src;                  // rows are read from here
+    FILE *dest;                 // and written here once done (NULL: read only)
+    unsigned char *window;      // rows loaded and not yet released
+    size_t capacity;            // allocated bytes of window
+    uint first_row;             // row stored at the start of window
+    uint rows;                  // rows in window
+    uint64_t pos;               // next colour byte
+    uint64_t mark;              // first colour byte of the last bmp_rows_read
+    uint64_t scatter_start;     // first colour byte in keyed order
+    Scatter scatter;            // 0 blocks: file order only
+    unsigned char *map;         // mapping the window points into, NULL when the window is allocated
+    size_t map_len;
+} BmpRows;
+
+
+/* -- function prototypes for the BMP reader */
+
+/* Parse and validate the first len bytes of a BMP file */
+Status bmp_parse_header(const unsigned char *header, size_t len, BmpInfo *info);
+
+/* Parse the header at the current position and copy everything up to the pixels to dest (NULL: skip) */
+Status bmp_copy_header(FILE *src, FILE *dest, BmpInfo *info);
+
+/* Read the layout of an opened BMP file */
+Status bmp_read_info(FILE *fptr, BmpInfo *info);
+
+/* Colour bytes stored back to back from data_offset (24 bpp, no padding) */
+int bmp_is_linear(const BmpInfo *info);
+
+/* Start walking the pixel array, src (and dest) positioned at data_offset */
+void bmp_rows_init(BmpRows *rows, const BmpInfo *info, FILE *src, FILE *dest);
+
+/* Copy the next n colour bytes into buf */
+Status bmp_rows_read(BmpRows *rows, unsigned char *buf, size_t n);
+
+/* Continue a read only walk at colour byte pos */
+Status bmp_rows_seek(BmpRows *rows, uint64_t pos);
+
+/* Store n bytes over the colour bytes returned by the last bmp_rows_read */
+void bmp_rows_write(BmpRows *rows, const unsigned char *buf, size_t n);
+
+/* Store n bytes over the colour bytes from pos on, in rows still in the window or already written to dest */
+Status bmp_rows_patch(BmpRows *rows, uint64_t pos, const unsigned char *buf, size_t n);
+
+/* Map (pipes: load) every remaining row and visit the colour bytes from here on in keyed order */
+Status bmp_rows_scatter(BmpRows *rows, const unsigned char *key);
+
+/* Write the rows still in the window to dest, ends the walk */
+Status bmp_rows_flush(BmpRows *rows);
+
+/* Free the window */
+void bmp_rows_free(BmpRows *rows);
+
+#endif
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "chacha20.h"
+#include "container.h"
+#include "types.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define ROTL32(v, n) ((v) << (n) | (v) >> (32 - (n)))
+
+#define QUARTER_ROUND(a, b, c, d)                    \
+    a += b; d ^= a; d = ROTL32(d, 16);               \
+    c += d; b ^= c; b = ROTL32(b, 12);               \
+    a += b; d ^= a; d = ROTL32(d, 8);                \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+/* Signature of the kernels XORing whole keystream blocks into data */
+typedef void (*ChaChaBlocksFn)(const ChaCha *ctx, uint32_t counter, unsigned char *data, size_t blocks);
+
+static void chacha20_blocks_scalar(const ChaCha *ctx, uint32_t counter, unsigned char *data, size_t blocks);
+
+/* Kernel in use, resolved once */
+static ChaChaBlocksFn chacha20_blocks_fn = chacha20_blocks_scalar;
+static pthread_once_t chacha20_kernel_once = PTHREAD_ONCE_INIT;
+
+
+/* --- Description for chacha20_init Function --->
+ * Input: ctx, key (CHACHA_KEY_SIZE bytes), nonce (CHACHA_NONCE_SIZE bytes)
+ * Output: None
+ */
+void chacha20_init(ChaCha *ctx, const unsigned char *key, const unsigned char *nonce)
+{
+    for(int i = 0; i < 8; i++)
+        ctx->key[i] = get_le(key + 4 * i, 4);
+    for(int i = 0; i < 3; i++)
+        ctx->nonce[i] = get_le(nonce + 4 * i, 4);
+}
+
+
+/* --- Description for chacha20_state Function --->
+ * Input: ctx, counter, state (16 words)
+ * Output: None
+ * Description: Initial state of a block: constants, key, counter, nonce.
+ */
+static void chacha20_state(const ChaCha *ctx, uint32_t counter, uint32_t *state)
+{
+    state[0] = 0x61707865;      // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    memcpy(state + 4, ctx->key, sizeof(ctx->key));
+    state[12] = counter;
+    memcpy(state + 13, ctx->nonce, sizeof(ctx->nonce));
+}
+
+
+/* --- Description for chacha20_block Function --->
+ * Input: ctx, counter, out (CHACHA_BLOCK_SIZE bytes)
+ * Output: None
+ * Description: Portable reference: one keystream block, 20 rounds.
+ */
+static void chacha20_block(const ChaCha *ctx, uint32_t counter, unsigned char *out)
+{
+    uint32_t in[16], x[16];
+
+    chacha20_state(ctx, counter, in);
+    memcpy(x, in, sizeof(x));
+    for(int round = 0; round < 10; round++)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);     // columns
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);    // diagonals
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for(int i = 0; i < 16; i++)
+        put_le(out + 4 * i, x[i] + in[i], 4);
+}
+
+
+/* --- Description for chacha20_blocks_scalar Function --->
+ * Input: ctx, counter (first block), data (blocks * CHACHA_BLOCK_SIZE bytes), blocks
+ * Output: None
+ */
+static void chacha20_blocks_scalar(const ChaCha *ctx, uint32_t counter, unsigned char *data, size_t blocks)
+{
+    unsigned char stream[CHACHA_BLOCK_SIZE];
+
+    for(size_t b = 0; b < blocks; b++)
+    {
+        chacha20_block(ctx, counter + b, stream);
+        for(int i = 0; i < CHACHA_BLOCK_SIZE; i++)
+            data[i] ^= stream[i];
+        data += CHACHA_BLOCK_SIZE;
+    }
+}
+
+#ifdef CHACHA_HAVE_X86
+
+#define ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define QUARTER_ROUND_SSE2(a, b, c, d)                                          \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL_SSE2(d, 16);     \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL_SSE2(b, 12);     \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL_SSE2(d, 8);      \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL_SSE2(b, 7);
+
+/* --- Description for chacha20_blocks_sse2 Function --->
+ * Input: ctx, counter, data, blocks
+ * Output: None
+ * Description: 4 blocks per iteration, one block per 32-bit lane: vector i
+ * holds state word i of the 4 blocks. The result is transposed back 4 words
+ * at a time and XORed into the data.
+ */
+__attribute__((target("sse2")))
+static void chacha20_blocks_sse2(const ChaCha *ctx, uint32_t counter, unsigned char *data, size_t blocks)
+{
+    uint32_t in[16];
+    size_t b = 0;
+
+    chacha20_state(ctx, counter, in);
+    for(; b + 4 <= blocks; b += 4)
+    {
+        __m128i s[16], x[16];
+
+        for(int i = 0; i < 16; i++)
+            s[i] = _mm_set1_epi32(in[i]);
+        s[12] = _mm_add_epi32(_mm_set1_epi32(counter + b), _mm_setr_epi32(0, 1, 2, 3));
+        memcpy(x, s, sizeof(x));
+
+        for(int round = 0; round < 10; round++)
+        {
+            QUARTER_ROUND_SSE2(x[0], x[4], x[8], x[12]);
+            QUARTER_ROUND_SSE2(x[1], x[5], x[9], x[13]);
+            QUARTER_ROUND_SSE2(x[2], x[6], x[10], x[14]);
+            QUARTER_ROUND_SSE2(x[3], x[7], x[11], x[15]);
+            QUARTER_ROUND_SSE2(x[0], x[5], x[10], x[15]);
+            QUARTER_ROUND_SSE2(x[1], x[6], x[11], x[12]);
+            QUARTER_ROUND_SSE2(x[2], x[7], x[8], x[13]);
+            QUARTER_ROUND_SSE2(x[3], x[4], x[9], x[14]);
+        }
+
+        for(int i = 0; i < 16; i += 4)
+        {
+            __m128i a = _mm_add_epi32(x[i], s[i]), c = _mm_add_epi32(x[i + 1], s[i + 1]);
+            __m128i e = _mm_add_epi32(x[i + 2], s[i + 2]), g = _mm_add_epi32(x[i + 3], s[i + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a, c), t1 = _mm_unpacklo_epi32(e, g);
+            __m128i t2 = _mm_unpackhi_epi32(a, c), t3 = _mm_unpackhi_epi32(e, g);
+            __m128i words[4];
+            words[0] = _mm_unpacklo_epi64(t0, t1);  // block 0, words i..i+3
+            words[1] = _mm_unpackhi_epi64(t0, t1);
+            words[2] = _mm_unpacklo_epi64(t2, t3);
+            words[3] = _mm_unpackhi_epi64(t2, t3);
+
+            for(int k = 0; k < 4; k++)
+            {
+                __m128i *dst = (__m128i *)(data + CHACHA_BLOCK_SIZE * (b + k) + 4 * i);
+                _mm_storeu_si128(dst, _mm_xor_si128(_mm_loadu_si128(dst), words[k]));
+            }
+        }
+    }
+    chacha20_blocks_scalar(ctx, counter + b, data + CHACHA_BLOCK_SIZE * b, blocks - b);
+}
+
+#define ROTL_AVX2(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/* Rotations by whole bytes are a single byte shuffle (rot16 / rot8 in scope) */
+#define QUARTER_ROUND_AVX2(a, b, c, d)                                                          \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16);  \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL_AVX2(b, 12);               \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8);   \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL_AVX2(b, 7);
+
+/* --- Description for chacha20_blocks_avx2 Function --->
+ * Input: ctx, counter, data, blocks
+ * Output: None
+ * Description: 8 blocks per iteration, laid out like chacha20_blocks_sse2.
+ * The unpack instructions transpose within 128-bit lanes, so the low lane
+ * ends up with blocks 0 to 3 and the high lane with blocks 4 to 7.
+ */
+__attribute__((target("avx2")))
+static void chacha20_blocks_avx2(const ChaCha *ctx, uint32_t counter, unsigned char *data, size_t blocks)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    uint32_t in[16];
+    size_t b = 0;
+
+    chacha20_state(ctx, counter, in);
+    for(; b + 8 <= blocks; b += 8)
+    {
+        __m256i s[16], x[16];
+
+        for(int i = 0; i < 16; i++)
+            s[i] = _mm256_set1_epi32(in[i]);
+        s[12] = _mm256_add_epi32(_mm256_set1_epi32(counter + b), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        memcpy(x, s, sizeof(x));
+
+        for(int round = 0; round < 10; round++)
+        {
+            QUARTER_ROUND_AVX2(x[0], x[4], x[8], x[12]);
+            QUARTER_ROUND_AVX2(x[1], x[5], x[9], x[13]);
+            QUARTER_ROUND_AVX2(x[2], x[6], x[10], x[14]);
+            QUARTER_ROUND_AVX2(x[3], x[7], x[11], x[15]);
+            QUARTER_ROUND_AVX2(x[0], x[5], x[10], x[15]);
+            QUARTER_ROUND_AVX2(x[1], x[6], x[11], x[12]);
+            QUARTER_ROUND_AVX2(x[2], x[7], x[8], x[13]);
+            QUARTER_ROUND_AVX2(x[3], x[4], x[9], x[14]);
+        }
+
+        for(int i = 0; i < 16; i += 4)
+        {
+            __m256i a = _mm256_add_epi32(x[i], s[i]), c = _mm256_add_epi32(x[i + 1], s[i + 1]);
+            __m256i e = _mm256_add_epi32(x[i + 2], s[i + 2]), g = _mm256_add_epi32(x[i + 3], s[i + 3]);
+            __m256i t0 = _mm256_unpacklo_epi32(a, c), t1 = _mm256_unpacklo_epi32(e, g);
+            __m256i t2 = _mm256_unpackhi_epi32(a, c), t3 = _mm256_unpackhi_epi32(e, g);
+            __m256i words[4];
+            words[0] = _mm256_unpacklo_epi64(t0, t1);   // blocks 0 and 4, words i..i+3
+            words[1] = _mm256_unpackhi_epi64(t0, t1);
+            words[2] = _mm256_unpacklo_epi64(t2, t3);
+            words[3] = _mm256_unpackhi_epi64(t2, t3);
+
+            for(int k = 0; k < 4; k++)
+            {
+                __m128i *lo = (__m128i *)(data + CHACHA_BLOCK_SIZE * (b + k) + 4 * i);
+                __m128i *hi = (__m128i *)(data + CHACHA_BLOCK_SIZE * (b + k + 4) + 4 * i);
+                _mm_storeu_si128(lo, _mm_xor_si128(_mm_loadu_si128(lo), _mm256_castsi256_si128(words[k])));
+                _mm_storeu_si128(hi, _mm_xor_si128(_mm_loadu_si128(hi), _mm256_extracti128_si256(words[k], 1)));
+            }
+        }
+    }
+    chacha20_blocks_sse2(ctx, counter + b, data + CHACHA_BLOCK_SIZE * b, blocks - b);
+}
+
+#endif
+
+
+/* --- Description for chacha20_select_kernel Function --->
+ * Input: None
+ * Output: None
+ * Description: Picks AVX2, then SSE2, then the scalar kernel. Run once through pthread_once.
+ */
+static void chacha20_select_kernel(void)
+{
+#ifdef CHACHA_HAVE_X86
+    if(__builtin_cpu_supports("avx2"))
+        chacha20_blocks_fn = chacha20_blocks_avx2;
+    else if(__builtin_cpu_supports("sse2"))
+        chacha20_blocks_fn = chacha20_blocks_sse2;
+#endif
+}
+
+
+/* --- Description for chacha20_xor_with Function --->
+ * Input: ctx, data, len, pos (keystream byte of data[0]), blocks_fn
+ * Output: None
+ * Description: A partial block at either end goes through the reference
+ * block function, whole blocks through blocks_fn.
+ */
+static void chacha20_xor_with(const ChaCha *ctx, unsigned char *data, size_t len, uint64_t pos, ChaChaBlocksFn blocks_fn)
+{
+    unsigned char stream[CHACHA_BLOCK_SIZE];
+    uint32_t counter = pos / CHACHA_BLOCK_SIZE;
+    size_t skip = pos % CHACHA_BLOCK_SIZE;
+
+    if(skip > 0 && len > 0)
+    {
+        size_t n = len < CHACHA_BLOCK_SIZE - skip ? len : CHACHA_BLOCK_SIZE - skip;
+        chacha20_block(ctx, counter++, stream);
+        for(size_t i = 0; i < n; i++)
+            data[i] ^= stream[skip + i];
+        data += n;
+        len -= n;
+    }
+
+    size_t blocks = len / CHACHA_BLOCK_SIZE;
+    blocks_fn(ctx, counter, data, blocks);
+    counter += blocks;
+    data += blocks * CHACHA_BLOCK_SIZE;
+    len -= blocks * CHACHA_BLOCK_SIZE;
+
+    if(len > 0)
+    {
+        chacha20_block(ctx, counter, stream);
+        for(size_t i = 0; i < len; i++)
+            data[i] ^= stream[i];
+    }
+}
+
+
+/* --- Description for chacha20_xor Function --->
+ * Input: ctx, data, len, pos (keystream byte of data[0])
+ * Output: None
+ * Description: Encrypts or decrypts in place, whole blocks through the
+ * selected kernel.
+ */
+void chacha20_xor(const ChaCha *ctx, unsigned char *data, size_t len, uint64_t pos)
+{
+    pthread_once(&chacha20_kernel_once, chacha20_select_kernel);
+    chacha20_xor_with(ctx, data, len, pos, chacha20_blocks_fn);
+}
+
+
+/* --- Description for chacha20_xor_scalar Function --->
+ * Input: ctx, data, len, pos (keystream byte of data[0])
+ * Output: None
+ * Description: chacha20_xor through the scalar kernel whatever the CPU,
+ * the reference the SSE2 and AVX2 kernels are checked against.
+ */
+void chacha20_xor_scalar(const ChaCha *ctx, unsigned char *data, size_t len, uint64_t pos)
+{
+    chacha20_xor_with(ctx, data, len, pos, chacha20_blocks_scalar);
+}
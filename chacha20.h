@@ -0,0 +1,39 @@
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * ChaCha20 stream cipher (RFC 8439: 256-bit key, 96-bit nonce, 32-bit
+ * block counter). The keystream is addressed by byte position, so any part
+ * of a payload can be encrypted or decrypted on its own: keystream byte p
+ * comes from block p / 64. Several blocks are generated at once with SSE2
+ * or AVX2 when the CPU has them, picked at runtime like the LSB kernels.
+ */
+
+#define CHACHA_KEY_SIZE 32
+#define CHACHA_NONCE_SIZE 12
+#define CHACHA_BLOCK_SIZE 64
+
+// Key and nonce, expanded once
+typedef struct _ChaCha
+{
+    uint32_t key[8];
+    uint32_t nonce[3];
+} ChaCha;
+
+
+/* -- function prototypes for ChaCha20 */
+
+/* Load key and nonce (little endian words) */
+void chacha20_init(ChaCha *ctx, const unsigned char *key, const unsigned char *nonce);
+
+/* XOR len bytes of data with the keystream starting at keystream byte pos */
+void chacha20_xor(const ChaCha *ctx, unsigned char *data, size_t len, uint64_t pos);
+
+/* Same through the scalar kernel */
+void chacha20_xor_scalar(const ChaCha *ctx, unsigned char *data, size_t len, uint64_t pos);
+
+#endif
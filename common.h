@@ -5,4 +5,21 @@
 #define MAGIC_STRING "#*"
 #define MAGIC_STRING_SIZE 3
 
+/* Secret size stored when the secret is streamed and its length is unknown.
+ * The data is then stored as frames: 32 bit length + bytes, and a frame
+ * of length 0 ends the secret. */
+#define STREAM_SIZE_MARKER 0xFFFFFFFFu
+#define STREAM_FRAME_SIZE (64 * 1024)
+
+/* The 32 bit extension size field also carries the embedding depth of the
+ * secret data: bits 0-15 hold the extension size, bits 16-18 hold depth - 1.
+ * Images written before the depth existed have 0 there (1 bit per byte).
+ * Everything up to the secret size is always stored at depth 1. */
+#define EXTN_SIZE_MASK 0xFFFF
+#define DEPTH_SHIFT 16
+#define DEPTH_MASK 0x7
+
+/* Size of the BMP file header + info header */
+#define BMP_HEADER_SIZE 54
+
 #endif
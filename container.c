@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <string.h>
+#include "container.h"
+#include "crc32c.h"
+#include "lsb.h"
+#include "types.h"
+
+
+/* --- Description for put_le Function --->
+ * Input: out, value, count
+ * Output: None
+ */
+void put_le(unsigned char *out, uint64_t value, int count)
+{
+    for(int i = 0; i < count; i++)
+        out[i] = (value >> (8 * i)) & 0xFF;
+}
+
+
+/* --- Description for get_le Function --->
+ * Input: in, count
+ * Output: value
+ */
+uint64_t get_le(const unsigned char *in, int count)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < count; i++)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+
+/* --- Description for chunk_entry_pack Function --->
+ * Input: entry, out (CHUNK_ENTRY_SIZE bytes)
+ * Output: None
+ */
+void chunk_entry_pack(const ChunkEntry *entry, unsigned char *out)
+{
+    put_le(out, entry->length | (entry->compressed ? CHUNK_COMPRESSED : 0), 4);
+    put_le(out + 4, entry->crc, 4);
+}
+
+
+/* --- Description for chunk_entry_unpack Function --->
+ * Input: entry, in (CHUNK_ENTRY_SIZE bytes)
+ * Output: None
+ */
+void chunk_entry_unpack(ChunkEntry *entry, const unsigned char *in)
+{
+    uint length = get_le(in, 4);
+
+    entry->length = length & ~CHUNK_COMPRESSED;
+    entry->compressed = (length & CHUNK_COMPRESSED) != 0;
+    entry->crc = get_le(in + 4, 4);
+}
+
+
+/* --- Description for shard_fields_pack Function --->
+ * Input: shard, out (SHARD_FIELDS_SIZE bytes)
+ * Output: None
+ */
+void shard_fields_pack(const ShardFields *shard, unsigned char *out)
+{
+    memcpy(out, shard->set_id, SHARD_SET_ID_SIZE);
+    put_le(out + 8, shard->payload_size, 8);
+    put_le(out + 16, shard->index | shard->data << 8 | shard->parity << 16, 4);
+    put_le(out + 20, shard->payload_crc, 4);
+    put_le(out + 24, crc32c(0, out, 24), 4);
+}
+
+
+/* --- Description for shard_fields_unpack Function --->
+ * Input: shard, in (SHARD_FIELDS_SIZE bytes)
+ * Output: Status
+ * Description: Rejects fields whose CRC does not match, and shard numbers
+ * that cannot belong to a set of at most MAX_SHARDS shards.
+ */
+Status shard_fields_unpack(ShardFields *shard, const unsigned char *in)
+{
+    uint word = get_le(in + 16, 4);
+
+    if(crc32c(0, in, 24) != get_le(in + 24, 4) || word >> 24 != 0)
+        return e_failure;
+
+    memcpy(shard->set_id, in, SHARD_SET_ID_SIZE);
+    shard->payload_size = get_le(in + 8, 8);
+    shard->index = word & 0xFF;
+    shard->data = word >> 8 & 0xFF;
+    shard->parity = word >> 16 & 0xFF;
+    shard->payload_crc = get_le(in + 20, 4);
+
+    if(shard->data == 0 || shard->data + shard->parity > MAX_SHARDS || shard->index >= shard->data + shard->parity)
+        return e_failure;
+    return e_success;
+}
+
+
+/* --- Description for chunk_stored_size Function --->
+ * Input: length, depth
+ * Output: length rounded up to a multiple of lsb_group_size(depth)
+ * Description: Chunks start on whole groups of image bytes, so each can be
+ * located and embedded or extracted on its own.
+ */
+size_t chunk_stored_size(size_t length, uint depth)
+{
+    uint group = lsb_group_size(depth);
+    return (length + group - 1) / group * group;
+}
+
+
+/* --- Description for container_header_pack Function --->
+ * Input: header (key_check set for CONTAINER_ENCRYPTED), out (MAX_HEADER_SIZE bytes)
+ * Output: number of header bytes
+ * Description: Lays out the version 1 header that precedes the chunk table
+ * (see above): magic string, extension size field, extension, payload size
+ * (64 bit), flags, chunk size, header checksum, for encrypted payloads nonce
+ * and key check, and for shards the shard fields. Numbers are stored least
+ * significant byte first, which embeds like the original 32 bit size field, so
+ * the header can go through the bulk LSB kernel.
+ */
+uint container_header_pack(const ContainerHeader *header, unsigned char *out)
+{
+    uint extn_len = strlen(header->extn);
+    uint len = 0;
+
+    memcpy(out, MAGIC_STRING, strlen(MAGIC_STRING));
+    len += strlen(MAGIC_STRING);
+    put_le(out + len, extn_len | (header->depth - 1) << DEPTH_SHIFT | CONTAINER_VERSION << VERSION_SHIFT, 4);
+    len += 4;
+    memcpy(out + len, header->extn, extn_len);
+    len += extn_len;
+    put_le(out + len, header->size, 8);
+    put_le(out + len + 8, header->flags, 4);
+    put_le(out + len + 12, header->chunk_size, 4);
+    len += 16;
+    put_le(out + len, crc32c(0, out, len), 4);
+    len += 4;
+
+    if(header->flags & CONTAINER_ENCRYPTED)
+    {
+        memcpy(out + len, header->nonce, CHACHA_NONCE_SIZE);
+        put_le(out + len + CHACHA_NONCE_SIZE, header->key_check, 4);
+        len += CIPHER_FIELDS_SIZE;
+    }
+    if(header->flags & CONTAINER_SHARDED)
+    {
+        shard_fields_pack(&header->shard, out + len);
+        len += SHARD_FIELDS_SIZE;
+    }
+    return len;
+}
+
+
+/* --- Description for container_header_unpack Function --->
+ * Input: header, in, len (bytes available), header_len (set to the bytes used)
+ * Output: Status (e_failure for anything but a valid version 1 header)
+ * Description: The checks of the decoder on a header held in memory:
+ * magic string, known depth and version, extension length, header CRC,
+ * known flags, keyed order only with a key, chunk size and shard fields.
+ * Whether the payload fits the image is left to the caller.
+ */
+Status container_header_unpack(ContainerHeader *header, const unsigned char *in, size_t len, size_t *header_len)
+{
+    size_t pos = strlen(MAGIC_STRING);
+
+    memset(header, 0, sizeof(*header));
+    if(len < pos + 4 || memcmp(in, MAGIC_STRING, pos) != 0)
+        return e_failure;
+
+    uint field = get_le(in + pos, 4);
+    uint extn_len = field & EXTN_SIZE_MASK;
+    header->depth = (field >> DEPTH_SHIFT & DEPTH_MASK) + 1;
+    if((field >> DEPTH_SHIFT & 0xFF) > DEPTH_MASK || header->depth > MAX_LSB_DEPTH ||
+       field >> VERSION_SHIFT != CONTAINER_VERSION || extn_len >= MAX_FILE_SUFFIX)
+        return e_failure;
+    pos += 4;
+    if(len < pos + extn_len + CONTAINER_FIELDS_SIZE)
+        return e_failure;
+    memcpy(header->extn, in + pos, extn_len);
+    pos += extn_len;
+
+    header->size = get_le(in + pos, 8);
+    header->flags = get_le(in + pos + 8, 4);
+    header->chunk_size = get_le(in + pos + 12, 4);
+    if(crc32c(0, in, pos + 16) != get_le(in + pos + 16, 4))
+        return e_failure;
+    pos += CONTAINER_FIELDS_SIZE;
+
+    if(header->flags & ~CONTAINER_KNOWN_FLAGS)
+        return e_failure;
+    if((header->flags & CONTAINER_SCATTERED) && !(header->flags & CONTAINER_ENCRYPTED))
+        return e_failure;
+    if(header->chunk_size == 0 || header->chunk_size > MAX_CHUNK_SIZE ||
+       header->chunk_size % lsb_group_size(header->depth))
+        return e_failure;
+    if((header->flags & CONTAINER_STREAMED) && header->size != 0)
+        return e_failure;
+
+    if(header->flags & CONTAINER_ENCRYPTED)
+    {
+        if(len < pos + CIPHER_FIELDS_SIZE)
+            return e_failure;
+        memcpy(header->nonce, in + pos, CHACHA_NONCE_SIZE);
+        header->key_check = get_le(in + pos + CHACHA_NONCE_SIZE, 4);
+        pos += CIPHER_FIELDS_SIZE;
+    }
+    if(header->flags & CONTAINER_SHARDED)
+    {
+        if(len < pos + SHARD_FIELDS_SIZE || shard_fields_unpack(&header->shard, in + pos) == e_failure)
+            return e_failure;
+        pos += SHARD_FIELDS_SIZE;
+    }
+    *header_len = pos;
+    return e_success;
+}
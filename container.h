@@ -0,0 +1,162 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "common.h"
+#include "chacha20.h"
+
+/*
+ * Payload container stored in the colour bytes of the image.
+ *
+ * Version 0 (original layout, still decoded):
+ *      magic, le32 extension size, extension, le32 size, data
+ *
+ * Version 1:
+ *      magic               "#*"
+ *      le32 field          extension size | (depth - 1) << DEPTH_SHIFT | version << VERSION_SHIFT
+ *      extension
+ *      le64 payload size   0 for streamed payloads
+ *      le32 flags
+ *      le32 chunk size     payload bytes per chunk, the last chunk may be shorter
+ *      le32 header CRC     CRC-32C of all header bytes above
+ *      cipher fields       with CONTAINER_ENCRYPTED only: 12 byte nonce, le32 key check
+ *      shard fields        with CONTAINER_SHARDED only (see ShardFields)
+ *      chunk table         one entry per chunk (none for streamed payloads)
+ *      chunks              each zero padded to whole groups (see lsb_group_size)
+ * Up to the chunk table everything is stored at depth 1, the chunks at the
+ * depth given in the header. A streamed payload has no table, each chunk is
+ * preceded by its own entry instead (padded the same way) and an entry of
+ * length 0 ends the payload.
+ * With CONTAINER_COMPRESSED, chunks that shrink are stored LZ compressed
+ * (see lz.h) and flagged CHUNK_COMPRESSED in their entry. Entries always
+ * hold the stored length and the CRC of the stored bytes.
+ * With CONTAINER_ENCRYPTED, the stored chunks (compressed or not) are XORed
+ * with a ChaCha20 keystream (see chacha20.h): stored byte j of chunk i uses
+ * keystream byte CIPHER_DATA_OFFSET + i * chunk size + j. The key check is
+ * the first 4 keystream bytes, so a wrong key (or a damaged nonce) is caught
+ * before any data is decoded. CRCs cover the encrypted bytes and can be
+ * checked without the key.
+ * With CONTAINER_SCATTERED (only together with CONTAINER_ENCRYPTED), the
+ * colour bytes after the header, from the chunk table on, are visited in a
+ * keyed block order (see scatter.h) keyed by keystream bytes
+ * SCATTER_KEY_OFFSET onwards.
+ * With CONTAINER_SHARDED, the payload is one shard of a larger payload split
+ * over several images (see shard.h). The shard fields tell which set and
+ * which shard it is, and carry the size and CRC of the whole payload.
+ * With CONTAINER_ARCHIVE, the payload is a table of contents followed by
+ * several files (see archive.h).
+ */
+
+#define CONTAINER_VERSION 1
+#define VERSION_SHIFT 24
+
+/* Header flags */
+#define CONTAINER_STREAMED 0x1          // size unknown, entries inline
+#define CONTAINER_COMPRESSED 0x2        // chunks may be compressed
+#define CONTAINER_ENCRYPTED 0x4         // chunks encrypted, cipher fields follow the header
+#define CONTAINER_SCATTERED 0x8         // data after the header in keyed block order
+#define CONTAINER_SHARDED 0x10          // payload is one shard of a set, shard fields follow
+#define CONTAINER_ARCHIVE 0x20          // payload starts with a table of contents
+#define CONTAINER_KNOWN_FLAGS (CONTAINER_STREAMED | CONTAINER_COMPRESSED | CONTAINER_ENCRYPTED | \
+                               CONTAINER_SCATTERED | CONTAINER_SHARDED | CONTAINER_ARCHIVE)
+
+/* Bytes following the extension: size, flags, chunk size, header CRC */
+#define CONTAINER_FIELDS_SIZE 20
+
+/* Bytes following the header CRC of encrypted payloads: nonce, key check */
+#define CIPHER_FIELDS_SIZE 16
+
+/* Shard fields: set id, payload size, le32 index | data << 8 | parity << 16, payload CRC, CRC of the fields */
+#define SHARD_FIELDS_SIZE 28
+#define SHARD_SET_ID_SIZE 8
+
+/* Longest extension stored, terminating NUL included */
+#define MAX_FILE_SUFFIX 8
+
+/* Largest header (magic, extn size, extn, container, cipher and shard fields) stored before the chunk table */
+#define MAX_HEADER_SIZE (MAGIC_STRING_SIZE + 4 + MAX_FILE_SUFFIX + CONTAINER_FIELDS_SIZE + CIPHER_FIELDS_SIZE + \
+                         SHARD_FIELDS_SIZE)
+
+/* Most shards (data + parity) in a set, shard numbers fit a byte */
+#define MAX_SHARDS 255
+
+/* Keystream byte of the first payload byte, the block before it gives the key check */
+#define CIPHER_DATA_OFFSET 64
+
+/* Keystream byte of the scatter key, after the key check */
+#define SCATTER_KEY_OFFSET 16
+
+/* Stored chunk entry: le32 length + le32 CRC-32C */
+#define CHUNK_ENTRY_SIZE 8
+
+/* Top bit of the stored length: chunk is compressed */
+#define CHUNK_COMPRESSED 0x80000000u
+
+/* Largest chunk size a decoder accepts */
+#define MAX_CHUNK_SIZE (16 * 1024 * 1024)
+
+// One chunk table entry
+typedef struct _ChunkEntry
+{
+    uint length;    // stored bytes of the chunk
+    uint crc;       // CRC-32C of those bytes
+    int compressed; // stored LZ compressed
+} ChunkEntry;
+
+// Shard fields of a sharded payload
+typedef struct _ShardFields
+{
+    unsigned char set_id[SHARD_SET_ID_SIZE];   // random, the same in every shard of a set
+    uint64_t payload_size;  // bytes of the whole payload
+    uint index;             // shard number: data shards first, then parity shards
+    uint data;              // data shards, 0 when not sharded
+    uint parity;            // parity shards
+    uint payload_crc;       // CRC-32C of the whole payload
+} ShardFields;
+
+// Fields of a version 1 header, everything stored before the chunk table
+typedef struct _ContainerHeader
+{
+    char extn[MAX_FILE_SUFFIX];     // NUL terminated
+    uint depth;                     // LSBs per image byte of the chunks
+    uint64_t size;                  // payload bytes, 0 when streamed
+    uint flags;                     // CONTAINER_* flags
+    uint chunk_size;                // payload bytes per chunk
+    unsigned char nonce[CHACHA_NONCE_SIZE]; // with CONTAINER_ENCRYPTED
+    uint key_check;                 // with CONTAINER_ENCRYPTED: first 4 keystream bytes
+    ShardFields shard;              // with CONTAINER_SHARDED
+} ContainerHeader;
+
+
+/* -- function prototypes for the container */
+
+/* Store value as count little endian bytes */
+void put_le(unsigned char *out, uint64_t value, int count);
+
+/* Read count little endian bytes */
+uint64_t get_le(const unsigned char *in, int count);
+
+/* Serialize a chunk entry (CHUNK_ENTRY_SIZE bytes) */
+void chunk_entry_pack(const ChunkEntry *entry, unsigned char *out);
+
+/* Parse a serialized chunk entry */
+void chunk_entry_unpack(ChunkEntry *entry, const unsigned char *in);
+
+/* Serialize shard fields (SHARD_FIELDS_SIZE bytes, CRC included) */
+void shard_fields_pack(const ShardFields *shard, unsigned char *out);
+
+/* Parse serialized shard fields, e_failure if damaged or impossible */
+Status shard_fields_unpack(ShardFields *shard, const unsigned char *in);
+
+/* Bytes stored for length payload bytes: rounded up to whole groups */
+size_t chunk_stored_size(size_t length, uint depth);
+
+/* Serialize a version 1 header (at most MAX_HEADER_SIZE bytes), returns its length */
+uint container_header_pack(const ContainerHeader *header, unsigned char *out);
+
+/* Parse and validate a version 1 header from the first len bytes of in */
+Status container_header_unpack(ContainerHeader *header, const unsigned char *in, size_t len, size_t *header_len);
+
+#endif
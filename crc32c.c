@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "crc32c.h"
+#include "types.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u
+
+/* Signature of the checksum kernels, on the inverted crc */
+typedef uint (*Crc32cFn)(uint crc, const unsigned char *bytes, size_t len);
+
+/* Slicing-by-8 tables: crc32c_table[k][b] is byte b followed by k zero bytes */
+static uint crc32c_table[8][256];
+
+/* Kernel in use, resolved on first call together with the tables */
+static Crc32cFn crc32c_fn;
+static pthread_once_t crc32c_init_once = PTHREAD_ONCE_INIT;
+
+
+/* --- Description for crc32c_sw Function --->
+ * Input: crc (inverted), bytes, len
+ * Output: updated inverted crc
+ * Description: Portable slicing-by-8: 8 bytes per iteration through 8
+ * table lookups, byte at a time for the ends.
+ */
+static uint crc32c_sw(uint crc, const unsigned char *bytes, size_t len)
+{
+    for(; len > 0 && ((uintptr_t)bytes & 7) != 0; len--)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+
+    for(; len >= 8; len -= 8, bytes += 8)
+    {
+        uint lo = crc ^ (bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint)bytes[3] << 24);
+        uint hi = bytes[4] | bytes[5] << 8 | bytes[6] << 16 | (uint)bytes[7] << 24;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][lo >> 8 & 0xFF] ^
+              crc32c_table[5][lo >> 16 & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][hi >> 8 & 0xFF] ^
+              crc32c_table[1][hi >> 16 & 0xFF] ^ crc32c_table[0][hi >> 24];
+    }
+
+    for(; len > 0; len--)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_X86
+
+/* --- Description for crc32c_hw Function --->
+ * Input: crc (inverted), bytes, len
+ * Output: updated inverted crc
+ * Description: SSE4.2 crc32 instruction, which computes CRC-32C directly,
+ * 8 bytes at a time (4 on 32-bit builds).
+ */
+__attribute__((target("sse4.2")))
+static uint crc32c_hw(uint crc, const unsigned char *bytes, size_t len)
+{
+    for(; len > 0 && ((uintptr_t)bytes & 7) != 0; len--)
+        crc = _mm_crc32_u8(crc, *bytes++);
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for(; len >= 8; len -= 8, bytes += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+#endif
+    for(; len >= 4; len -= 4, bytes += 4)
+    {
+        uint32_t word;
+        memcpy(&word, bytes, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+
+    for(; len > 0; len--)
+        crc = _mm_crc32_u8(crc, *bytes++);
+    return crc;
+}
+
+#endif
+
+
+/* --- Description for crc32c_init Function --->
+ * Input: None
+ * Output: None
+ * Description: Fills the slicing tables and picks the kernel: the crc32
+ * instruction when the CPU has SSE4.2, slicing-by-8 otherwise.
+ * Run once through pthread_once.
+ */
+static void crc32c_init(void)
+{
+    for(uint i = 0; i < 256; i++)
+    {
+        uint crc = i;
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        crc32c_table[0][i] = crc;
+    }
+    for(uint i = 0; i < 256; i++)
+        for(int k = 1; k < 8; k++)
+            crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[k - 1][i] & 0xFF];
+
+    crc32c_fn = crc32c_sw;
+#ifdef CRC32C_HAVE_X86
+    if(__builtin_cpu_supports("sse4.2"))
+        crc32c_fn = crc32c_hw;
+#endif
+}
+
+
+/* --- Description for crc32c Function --->
+ * Input: crc (0 or previous result), data, len
+ * Output: updated checksum
+ */
+uint crc32c(uint crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_init_once, crc32c_init);
+    return ~crc32c_fn(~crc, data, len);
+}
+
+
+/* --- Description for crc32c_scalar Function --->
+ * Input: crc (0 or previous result), data, len
+ * Output: updated checksum
+ * Description: Slicing-by-8 whatever the CPU, the reference the SSE4.2
+ * kernel is checked against.
+ */
+uint crc32c_scalar(uint crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_init_once, crc32c_init);
+    return ~crc32c_sw(~crc, data, len);
+}
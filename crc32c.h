@@ -0,0 +1,23 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), used for the
+ * header and chunk checksums of the payload container.
+ * crc32c(0, data, len) gives the standard check value, passing a previous
+ * result continues the checksum over more bytes.
+ * The SSE4.2 crc32 instruction is used when the CPU has it, table driven
+ * slicing-by-8 otherwise. The decoder checksums every block right after
+ * extracting it, while it is still in cache.
+ */
+
+/* Checksum len bytes of data, continuing from crc */
+uint crc32c(uint crc, const void *data, size_t len);
+
+/* Same checksum through the portable code */
+uint crc32c_scalar(uint crc, const void *data, size_t len);
+
+#endif
@@ -1,9 +1,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "decode.h"
+#include "lsb.h"
+#include "fileio.h"
+#include "parallel.h"
 #include "types.h"
 #include "common.h"
+#include "bmp.h"
+#include "container.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "chacha20.h"
+#include "metrics.h"
 
 /*-----------------------------------------------------------------------------------------------*/
 /* --- Description for read_and_validate_decode_args Function --->
@@ -13,23 +23,59 @@
  * Output: Status (e_success / e_failure)
  * Description: Validates command line arguments for decoding and
  * stores stego image file name and optional output file name.
+ * "-j N" decodes the secret data with N threads, "--key file" gives the
+ * key of an encrypted secret.
  */
 Status read_and_validate_decode_args(int argc,char *argv[], DecodeInfo *decInfo)
 {
-     if(argc < 3 || argc > 4)  // Check argument count
+     char *args[2];      // positional arguments
+     int count = 0;
+
+     decInfo->jobs = 1;
+     decInfo->key_fname = NULL;
+
+     for(int i = 2; i < argc; i++)
+     {
+        if(strcmp(argv[i], "--key") == 0 && i + 1 < argc) // --key file
+        {
+            decInfo->key_fname = argv[++i];
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)   // -j N
+        {
+            if(parse_jobs(argv[++i], &decInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)          // -jN
+        {
+            if(parse_jobs(argv[i] + 2, &decInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "--", 2) == 0)          // Unknown option
+        {
+            return e_failure;
+        }
+        else
+        {
+            if(count == 2)
+                return e_failure;
+            args[count++] = argv[i];
+        }
+     }
+
+     if(count < 1)  // Check argument count
      {
         return e_failure;
      }
-     if(strstr(argv[2],".bmp") == NULL) // Validate stego BMP image
+     if(strstr(args[0],".bmp") == NULL && strcmp(args[0], "-") != 0) // Validate stego BMP image (- is stdin)
      {
         return e_failure;
      }
      
-     decInfo->stego_image_fname = argv[2]; // Store stego image file name
+     decInfo->stego_image_fname = args[0]; // Store stego image file name
 
-     if(argc == 4)   // If user provided output secret file name
+     if(count == 2)   // If user provided output secret file name
      {
-            decInfo->secret_fname = argv[3];
+            decInfo->secret_fname = args[1];
      }
      else
      {
@@ -39,22 +85,76 @@ Status read_and_validate_decode_args(int argc,char *argv[], DecodeInfo *decInfo)
      return e_success;
 }
 
+/*-----------------------------------------------------------------------------------------------*/
+/* --- Description for read_and_validate_extract_args Function --->
+---------------------------------------------------------------------------------------------------
+
+ * Input : argc, argv, decInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -x <.bmp_file> <offset> <length> [output file] [--key file]
+ * Offset and length count secret bytes (decimal, or hex with 0x).
+ * The bytes are written to stdout when no output file is given.
+ */
+Status read_and_validate_extract_args(int argc, char *argv[], DecodeInfo *decInfo)
+{
+     char *args[4];      // positional arguments
+     int count = 0;
+     char *end;
+
+     decInfo->key_fname = NULL;
+     for(int i = 2; i < argc; i++)
+     {
+        if(strcmp(argv[i], "--key") == 0 && i + 1 < argc) // --key file
+           decInfo->key_fname = argv[++i];
+        else if(strncmp(argv[i], "--", 2) == 0 || count == 4) // Unknown option, too many arguments
+           return e_failure;
+        else
+           args[count++] = argv[i];
+     }
+
+     if(count < 3)   // Check argument count
+        return e_failure;
+     if(strstr(args[0], ".bmp") == NULL && strcmp(args[0], "-") != 0) // Validate stego BMP image (- is stdin)
+        return e_failure;
+
+     for(int i = 1; i < 3; i++)
+     {
+        if(args[i][0] < '0' || args[i][0] > '9')   // No sign, no empty string
+           return e_failure;
+        uint64_t value = strtoull(args[i], &end, 0);
+        if(*end != '\0')
+           return e_failure;
+        if(i == 1)
+           decInfo->range_offset = value;
+        else
+           decInfo->range_length = value;
+     }
+
+     decInfo->stego_image_fname = args[0];
+     decInfo->secret_fname = count == 4 ? args[3] : "-";
+     decInfo->jobs = 1;
+     return e_success;
+}
+
 /*--------------------------------------------------------------------------------------------------------------------*/
 /* --- Description for open_decode_files Function --->
 -----------------------------------------------------------------------------------------------------------------------
 
  * Input : decInfo
  * Output: Status
- * Description: Opens stego image file for reading.
+ * Description: Opens stego image file for reading ("-" reads stdin).
  */
 Status open_decode_files(DecodeInfo *decInfo)
 {
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname,"rb"); // Open stego image
+    if(strcmp(decInfo->stego_image_fname, "-") == 0)
+        decInfo->fptr_stego_image = job_stdin();                          // Stego image from a pipe
+    else
+        decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname,"rb"); // Open stego image
     
     if(decInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
-        fprintf(stderr,"ERROR : Unable to open file %s\n", decInfo->stego_image_fname);
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", decInfo->stego_image_fname);
         return e_failure;
     }
     
@@ -62,62 +162,74 @@ Status open_decode_files(DecodeInfo *decInfo)
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------*/
-/* --- Description for decode_byte_from_lsb Function --->
+/* --- Description for close_decode_files Function --->
 ------------------------------------------------------------------------------------------------------------------------------------
 
- * Input : image_buffer, data pointer
- * Output: Status
- * Description: Decodes 1 byte from 8 LSBs of image buffer bytes.
+ * Input : decInfo
+ * Output: None
+ * Description: Closes the stego image and output file, removes the output of
+ * a decode that did not complete (see decode_finish_output) and frees the
+ * decoded magic string, extension and names. Safe to call again after a failed decode.
  */
-Status decode_byte_from_lsb(char *data, char *image_buffer)
+void close_decode_files(DecodeInfo *decInfo)
 {
-    unsigned char ch = 0; // Variable to hold decoded byte
+    if(decInfo->fptr_stego_image != NULL)
+        fclose(decInfo->fptr_stego_image);
+    if(decInfo->fptr_secret != NULL)
+        fclose(decInfo->fptr_secret);
+    if(decInfo->temp_fname != NULL)     // Decoding failed, the secret is incomplete
+        unlink(decInfo->temp_fname);
+    free(decInfo->temp_fname);
+    free(decInfo->magic_data);
+    free(decInfo->extn_secret_file);
+    free(decInfo->output_fname);
+    bmp_rows_free(&decInfo->rows);
+    free(decInfo->table);
 
-    for(int i = 0; i < 8; i++)
-    {
-        ch = ch | (image_buffer[i] & 1) << i; // Extract LSB and place at correct bit
-    }
-
-    *data = ch; // Store decoded byte
-    return e_success;
+    decInfo->table = NULL;
+    decInfo->output_fname = NULL;
+    decInfo->temp_fname = NULL;
+    decInfo->fptr_stego_image = NULL;
+    decInfo->fptr_secret = NULL;
+    decInfo->magic_data = NULL;
+    decInfo->extn_secret_file = NULL;
 }
 
-/*-----------------------------------------------------------------------------------------------------------------------------------*/
-/* --- Description for decode_size_from_lsb Function --->
---------------------------------------------------------------------------------------------------------------------------------------
+/*-----------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_data_from_image Function --->
+-------------------------------------------------------------------------------------------------------------------------------------------
 
- * Input : buffer (32 bytes), size pointer
+ * Input : buffer, size, rows (stego image scanlines)
  * Output: Status
- * Description: Decodes 32-bit integer from LSBs of buffer.
+ * Description: Decodes multiple bytes from stego image into buffer.
  */
-Status decode_size_from_lsb(unsigned char *buffer, int *size)
+Status decode_data_from_image(char *buffer, int size, BmpRows *rows)
 {
-    int num = 0; // Variable to store decoded number
-    for (int i = 0; i < 32; i++)
-    {
-        num = num | (buffer[i] & 1) << i; // Extract each LSB and reconstruct integer
-    }
-    *size = num; // Store in output pointer
-    return e_success;
+    return decode_data_at_depth((unsigned char *)buffer, size, 1, rows); // Header data uses 1 LSB
 }
 
 /*-----------------------------------------------------------------------------------------------------------------------------------------*/
-/* --- Description for decode_data_from_image Function --->
+/* --- Description for decode_data_at_depth Function --->
 -------------------------------------------------------------------------------------------------------------------------------------------
 
- * Input : buffer, size, fptr_stego_image
+ * Input : buffer, size, depth, rows
  * Output: Status
- * Description: Decodes multiple bytes from stego image into buffer.
+ * Description: Decodes bytes hidden in the depth low bits of each colour byte.
+ * Blocks hold whole groups of image bytes (see lsb_group_size), like on encode.
  */
-Status decode_data_from_image(char *buffer, int size, FILE *fptr_stego_image)
+Status decode_data_at_depth(unsigned char *buffer, size_t size, uint depth, BmpRows *rows)
 {
-    unsigned char arr[8];
+    unsigned char arr[LSB_BLOCK_SIZE * 8];
+    size_t block = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(depth);
+    size_t chunk;
 
-    for(int i = 0 ; i < size ; i++)
+    for(size_t done = 0 ; done < size ; done += chunk)
     {
-        if(fread(arr,8,1,fptr_stego_image) != 1) // Read 8 bytes
+        chunk = (size - done < block) ? size - done : block;
+        size_t image_bytes = lsb_image_bytes(chunk, depth);
+        if(bmp_rows_read(rows, arr, image_bytes) == e_failure) // 8 / depth image bytes per secret byte
             return e_failure;
-        decode_byte_from_lsb(&buffer[i],arr); // Decode single byte
+        lsb_extract_depth(buffer + done, arr, chunk, depth); // Decode whole block
     }
 
     return e_success;
@@ -133,11 +245,15 @@ Status decode_data_from_image(char *buffer, int size, FILE *fptr_stego_image)
  */
 Status decode_magic_string(DecodeInfo *decInfo)
 {
-    fseek(decInfo->fptr_stego_image, 54, SEEK_SET); // Skip BMP header
+    fseek(decInfo->fptr_stego_image, 0, SEEK_SET);                                   // Pipes are already at the start
+    if(bmp_copy_header(decInfo->fptr_stego_image, NULL, &decInfo->bmp) == e_failure)   // Skip BMP headers up to the pixels
+        return e_failure;
+    bmp_rows_init(&decInfo->rows, &decInfo->bmp, decInfo->fptr_stego_image, NULL);
 
     decInfo->magic_data = malloc(strlen(MAGIC_STRING) + 1); // Allocate memory for magic string
 
-    decode_data_from_image(decInfo->magic_data, strlen(MAGIC_STRING), decInfo->fptr_stego_image); // Decode magic string
+    if(decode_data_from_image(decInfo->magic_data, strlen(MAGIC_STRING), &decInfo->rows) == e_failure) // Decode magic string
+        return e_failure;
 
     decInfo->magic_data[strlen(MAGIC_STRING)] = '\0'; // Null terminate
 
@@ -159,7 +275,8 @@ Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo)
 {
    decInfo->extn_secret_file = malloc(file_extn + 1); // Allocate memory
 
-   decode_data_from_image(decInfo->extn_secret_file, file_extn, decInfo->fptr_stego_image); // Decode extension
+   if(decode_data_from_image(decInfo->extn_secret_file, file_extn, &decInfo->rows) == e_failure) // Decode extension
+      return e_failure;
 
    decInfo->extn_secret_file[file_extn] = '\0'; // Null terminate
    return e_success;
@@ -172,15 +289,27 @@ Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo)
  * Input : decInfo
  * Output: Status
  * Description: Decodes the length of secret file extension from 32 LSBs.
+ * The same field holds the embedding depth of the secret data (see DEPTH_SHIFT)
+ * and the container version (see VERSION_SHIFT). Extensions the encoder
+ * cannot write (MAX_FILE_SUFFIX and longer) are rejected before anything
+ * is allocated or named after them.
  */
 Status decode_file_extn_size(DecodeInfo *decInfo)
 {
-   unsigned char buffer[32];
+   unsigned char bytes[4];
 
-   if(fread(buffer,1,32,decInfo->fptr_stego_image) != 32) // Read 32 bytes
+   if(decode_data_from_image((char *)bytes, 4, &decInfo->rows) == e_failure) // 32 LSBs, least significant byte first
       return e_failure;
+   uint field = get_le(bytes, 4);
 
-   if (decode_size_from_lsb(buffer, &decInfo->extn_size) == e_failure) // Decode size
+   decInfo->extn_size = field & EXTN_SIZE_MASK;
+   decInfo->depth = (field >> DEPTH_SHIFT & DEPTH_MASK) + 1;
+   decInfo->version = field >> VERSION_SHIFT;
+   if(decInfo->extn_size >= MAX_FILE_SUFFIX)                                         // Longer than any encoder writes
+      return e_failure;
+   if((field >> DEPTH_SHIFT & 0xFF) > DEPTH_MASK || decInfo->depth > MAX_LSB_DEPTH) // Unknown bits set
+      return e_failure;
+   if(decInfo->version > CONTAINER_VERSION)                                          // Written by a newer version
       return e_failure;
 
    return e_success;
@@ -192,145 +321,970 @@ Status decode_file_extn_size(DecodeInfo *decInfo)
 
  * Input : decInfo
  * Output: Status
- * Description: Decodes size of secret file from 32 LSBs.
+ * Description: Version 0 stores the size of secret file in 32 LSBs. Version 1
+ * stores a 64 bit size, flags and chunk size, and a CRC of the whole header
+ * which is checked against the header rebuilt from the decoded fields.
+ * The cipher fields of an encrypted secret and the shard fields of a shard are
+ * read as well (see decode_cipher_key and shard.h).
+ * Every field is validated, and the size checked against the colour bytes
+ * left in the image, before anything is allocated for the secret data.
  */
 Status decode_secret_file_size(DecodeInfo *decInfo)
 {
-   char arr[32];
-   int size = 0;
+   unsigned char bytes[CONTAINER_FIELDS_SIZE];
+   uint64_t left = decInfo->bmp.colour_bytes - decInfo->rows.pos;  // Colour bytes after the header
+   uint group = lsb_group_size(decInfo->depth);
+
+   decInfo->flags = 0;
+   decInfo->nchunks = 0;
+   decInfo->shard.data = 0;
+   if(decInfo->version == 0)
+   {
+      if(decode_data_from_image((char *)bytes, 4, &decInfo->rows) == e_failure) // 32 LSBs, least significant byte first
+         return e_failure;
+      decInfo->size_secret_file = get_le(bytes, 4);                              // Store in structure
+      decInfo->chunk_size = PARALLEL_CHUNK_SIZE - PARALLEL_CHUNK_SIZE % group;   // Work split only, nothing stored
+
+      if(decInfo->size_secret_file == STREAM_SIZE_MARKER)                       // Frames are checked one by one
+         return e_success;
+      return lsb_image_bytes(decInfo->size_secret_file, decInfo->depth) <= left - 32 ? e_success : e_failure;
+   }
+
+   if(decode_data_from_image((char *)bytes, CONTAINER_FIELDS_SIZE, &decInfo->rows) == e_failure)
+      return e_failure;
+   decInfo->size_secret_file = get_le(bytes, 8);
+   decInfo->flags = get_le(bytes + 8, 4);
+   decInfo->chunk_size = get_le(bytes + 12, 4);
+
+   // Rebuild the header bytes covered by the CRC
+   size_t len = strlen(MAGIC_STRING) + 4 + decInfo->extn_size + 16;
+   unsigned char *header = malloc(len);
+   if(header == NULL)
+      return e_failure;
+   memcpy(header, MAGIC_STRING, strlen(MAGIC_STRING));
+   put_le(header + strlen(MAGIC_STRING), decInfo->extn_size | (decInfo->depth - 1) << DEPTH_SHIFT |
+          decInfo->version << VERSION_SHIFT, 4);
+   memcpy(header + strlen(MAGIC_STRING) + 4, decInfo->extn_secret_file, decInfo->extn_size);
+   memcpy(header + len - 16, bytes, 16);
+   uint crc = crc32c(0, header, len);
+   free(header);
+
+   if(crc != get_le(bytes + 16, 4))                                   // Damaged header
+      return e_failure;
+   if(decInfo->flags & ~CONTAINER_KNOWN_FLAGS)                         // Unknown flags
+      return e_failure;
+   if((decInfo->flags & CONTAINER_SCATTERED) && !(decInfo->flags & CONTAINER_ENCRYPTED)) // Order keyed by the cipher
+      return e_failure;
+   if(decInfo->chunk_size == 0 || decInfo->chunk_size > MAX_CHUNK_SIZE || decInfo->chunk_size % group)
+      return e_failure;
+
+   left -= 8 * CONTAINER_FIELDS_SIZE;
+   if(decInfo->flags & CONTAINER_ENCRYPTED)                            // Nonce and key check follow
+   {
+      if(decode_data_from_image((char *)bytes, CIPHER_FIELDS_SIZE, &decInfo->rows) == e_failure)
+         return e_failure;
+      memcpy(decInfo->nonce, bytes, CHACHA_NONCE_SIZE);
+      decInfo->key_check = get_le(bytes + CHACHA_NONCE_SIZE, 4);
+      left -= 8 * CIPHER_FIELDS_SIZE;
+   }
+   if(decInfo->flags & CONTAINER_SHARDED)                              // Set, shard number and payload follow
+   {
+      unsigned char shard[SHARD_FIELDS_SIZE];
+      if(decode_data_from_image((char *)shard, SHARD_FIELDS_SIZE, &decInfo->rows) == e_failure ||
+         shard_fields_unpack(&decInfo->shard, shard) == e_failure)
+         return e_failure;
+      left -= 8 * SHARD_FIELDS_SIZE;
+   }
+   if(decInfo->flags & CONTAINER_STREAMED)                             // Chunks are checked one by one
+      return decInfo->size_secret_file == 0 ? e_success : e_failure;
 
-   fread(arr,32,1,decInfo->fptr_stego_image); // Read 32 bytes
-   decode_size_from_lsb(arr, &size);           // Decode integer
-   decInfo->size_secret_file = size;           // Store in structure
+   // Every chunk takes a table entry, compressed ones are checked against the table
+   decInfo->nchunks = decInfo->size_secret_file / decInfo->chunk_size + (decInfo->size_secret_file % decInfo->chunk_size != 0);
+   if(decInfo->nchunks > left / (8 * CHUNK_ENTRY_SIZE))
+      return e_failure;
+   if(decInfo->flags & CONTAINER_COMPRESSED)
+      return e_success;
+
+   // Each secret byte takes at least 2 image bytes, so this cannot overflow
+   if(decInfo->size_secret_file > left ||
+      8 * CHUNK_ENTRY_SIZE * decInfo->nchunks +
+      lsb_image_bytes(chunk_stored_size(decInfo->size_secret_file, decInfo->depth), decInfo->depth) > left)
+      return e_failure;
 
    return e_success;
 }
 
+/*------------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_cipher_key Function --->
+---------------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (size decoded)
+ * Output: Status
+ * Description: Nothing to do for secrets stored in clear. Otherwise loads the
+ * key given with --key and checks it against the key check of the header, so
+ * a wrong key is reported instead of decoding garbage. For scattered secrets
+ * the image walk then switches to the keyed order (see scatter.h).
+ */
+Status decode_cipher_key(DecodeInfo *decInfo)
+{
+   unsigned char key[CHACHA_KEY_SIZE];
+   unsigned char check[4] = { 0 };
+   unsigned char scatter_key[SCATTER_KEY_SIZE] = { 0 };
+
+   if(!(decInfo->flags & CONTAINER_ENCRYPTED))
+      return e_success;
+   if(decInfo->key_fname == NULL)
+   {
+      fprintf(job_stderr(), "ERROR : The secret is encrypted, give its key with --key\n");
+      return e_failure;
+   }
+   if(read_key_file(decInfo->key_fname, key, sizeof(key)) == e_failure)
+      return e_failure;
+
+   chacha20_init(&decInfo->cipher, key, decInfo->nonce);
+   memset(key, 0, sizeof(key));
+   chacha20_xor(&decInfo->cipher, check, sizeof(check), 0);                // First keystream bytes
+   if(get_le(check, 4) != decInfo->key_check)
+   {
+      fprintf(job_stderr(), "ERROR : Wrong key for this image\n");
+      return e_failure;
+   }
+
+   if(!(decInfo->flags & CONTAINER_SCATTERED))
+      return e_success;
+   chacha20_xor(&decInfo->cipher, scatter_key, sizeof(scatter_key), SCATTER_KEY_OFFSET);
+   return bmp_rows_scatter(&decInfo->rows, scatter_key);                   // Maps the rest of the image
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_chunk_table Function --->
+---------------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (size decoded)
+ * Output: Status
+ * Description: Decodes the chunk table that follows a version 1 header.
+ * Every chunk but the last must be chunk_size long, so the table can only
+ * describe the payload size the header announced: stored lengths must match,
+ * or be shorter for compressed chunks. The stored chunks must fit in the
+ * image. Nothing to do for version 0 and streamed secrets. Either way
+ * data_pos is left at the first chunk for decode_secret_bytes.
+ */
+Status decode_chunk_table(DecodeInfo *decInfo)
+{
+   decInfo->data_pos = decInfo->rows.pos;
+   if(decInfo->nchunks == 0)
+      return e_success;
+
+   size_t table_size = decInfo->nchunks * CHUNK_ENTRY_SIZE;
+   unsigned char *bytes = malloc(table_size);
+   decInfo->table = malloc(decInfo->nchunks * sizeof(ChunkEntry));
+   uint64_t stored = 0;    // Image bytes of the stored chunks
+   Status ret = e_success;
+
+   if(bytes == NULL || decInfo->table == NULL)
+   {
+      perror("malloc");
+      free(bytes);
+      return e_failure;
+   }
+
+   if(decode_data_from_image((char *)bytes, table_size, &decInfo->rows) == e_failure)
+      ret = e_failure;
+   for(uint64_t i = 0; i < decInfo->nchunks && ret == e_success; i++)
+   {
+      uint64_t left = decInfo->size_secret_file - i * decInfo->chunk_size;
+
+      uint64_t expected = left < decInfo->chunk_size ? left : decInfo->chunk_size;
+      ChunkEntry *entry = &decInfo->table[i];
+
+      chunk_entry_unpack(entry, bytes + i * CHUNK_ENTRY_SIZE);
+      if(entry->compressed ? !(decInfo->flags & CONTAINER_COMPRESSED) || entry->length == 0 || entry->length >= expected
+                           : entry->length != expected)   // Inconsistent table
+         ret = e_failure;
+      stored += lsb_image_bytes(chunk_stored_size(entry->length, decInfo->depth), decInfo->depth);
+   }
+   if(stored > decInfo->bmp.colour_bytes - decInfo->rows.pos)   // Chunks past the last colour byte
+      ret = e_failure;
+   decInfo->data_pos = decInfo->rows.pos;
+
+   free(bytes);
+   return ret;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for is_framed Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (size decoded)
+ * Output: 1 if the secret is stored in frames, 0 otherwise
+ */
+static int is_framed(const DecodeInfo *decInfo)
+{
+    return (decInfo->version == 0 && decInfo->size_secret_file == STREAM_SIZE_MARKER) ||
+           (decInfo->flags & CONTAINER_STREAMED);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_decrypt Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (key loaded), data, len, pos (stored position, see container.h)
+ * Output: None
+ * Description: Decrypts stored bytes in place once their CRC is taken.
+ */
+static void decode_decrypt(const DecodeInfo *decInfo, unsigned char *data, size_t len, uint64_t pos)
+{
+    if(decInfo->flags & CONTAINER_ENCRYPTED)
+        chacha20_xor(&decInfo->cipher, data, len, CIPHER_DATA_OFFSET + pos);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_stored_chunk Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo, entry, stored (entry->length bytes, CRC checked), raw (cap bytes), cap, raw_len
+ * Output: Status
+ * Description: Gives the payload bytes of a stored chunk: compressed chunks are
+ * decompressed into raw, others are used as they are. *raw_len receives the size.
+ */
+static Status decode_stored_chunk(DecodeInfo *decInfo, const ChunkEntry *entry, unsigned char **stored,
+                                  unsigned char *raw, size_t cap, size_t *raw_len)
+{
+    if(!entry->compressed)
+    {
+        *raw_len = entry->length;
+        return e_success;
+    }
+    if(!(decInfo->flags & CONTAINER_COMPRESSED) ||                          // Flag set by the encoder only
+       lz_decompress(*stored, entry->length, raw, cap, raw_len) == e_failure)
+        return e_failure;
+    *stored = raw;
+    return e_success;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_frames_range Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (rows at the first frame), offset, end
+ * Output: Status
+ * Description: Decodes secret bytes [offset, end) of a secret stored in frames
+ * (version 0 size field is STREAM_SIZE_MARKER, version 1 is flagged CONTAINER_STREAMED).
+ * Each frame is a 32 bit length followed by the data, a 0 length ends the secret.
+ * Version 1 frames start with a whole chunk entry, whose CRC is checked.
+ * Length and data are padded to whole groups of image bytes (see lsb_group_size).
+ * Every frame but the last holds max_len secret bytes, so without compression
+ * the frame holding offset is found without reading the ones before it.
+ * Compressed frames vary in size: the frames before offset are skipped one
+ * entry at a time instead.
+ */
+static Status decode_frames_range(DecodeInfo *decInfo, uint64_t offset, uint64_t end)
+{
+    uint group = lsb_group_size(decInfo->depth);
+    size_t max_len = decInfo->version ? decInfo->chunk_size : STREAM_FRAME_SIZE;
+    size_t entry_size = chunk_stored_size(decInfo->version ? CHUNK_ENTRY_SIZE : 4, decInfo->depth);
+    unsigned char *frame = malloc(max_len + group);          // One frame as stored
+    unsigned char *raw = malloc(max_len);                    // One frame of secret data
+    unsigned char len_bytes[CHUNK_ENTRY_SIZE + MAX_LSB_DEPTH] = { 0 };
+    uint64_t start = 0;                                      // Secret offset of the current frame
+    uint64_t index = 0;                                      // Number of the current frame
+    Status ret = e_success;
+
+    if(frame == NULL || raw == NULL)
+    {
+        perror("malloc");
+        free(frame);
+        free(raw);
+        return e_failure;
+    }
+
+    uint64_t frame_image_bytes = lsb_image_bytes(entry_size + chunk_stored_size(max_len, decInfo->depth), decInfo->depth);
+    if(!(decInfo->flags & CONTAINER_COMPRESSED) && offset >= max_len)
+    {
+        index = offset / max_len;
+        start = index * max_len;
+        if(bmp_rows_seek(&decInfo->rows, decInfo->rows.pos + start / max_len * frame_image_bytes) == e_failure)
+            start = end = 0, ret = e_failure;               // Past the last colour byte
+    }
+
+    while(start < end)
+    {
+        if(decode_data_at_depth(len_bytes, entry_size, decInfo->depth, &decInfo->rows) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+        ChunkEntry entry;
+        chunk_entry_unpack(&entry, len_bytes);
+        uint len = entry.length;
+        if(len == 0)                  // End of secret
+            break;
+        if(len > max_len)             // Corrupted frame length
+        {
+            ret = e_failure;
+            break;
+        }
+
+        size_t stored_size = chunk_stored_size(len, decInfo->depth);
+        if(start + max_len <= offset) // Frame before the range, full by construction
+        {
+            if(bmp_rows_seek(&decInfo->rows, decInfo->rows.pos + lsb_image_bytes(stored_size, decInfo->depth)) == e_failure)
+            {
+                ret = e_failure;
+                break;
+            }
+            start += entry.compressed ? max_len : len;
+            index++;
+            continue;
+        }
+
+        unsigned char *data = frame;
+        size_t raw_len;
+        if(decode_data_at_depth(frame, stored_size, decInfo->depth, &decInfo->rows) == e_failure ||
+           (decInfo->version && crc32c(0, frame, len) != entry.crc))
+        {
+            ret = e_failure;
+            break;
+        }
+        decode_decrypt(decInfo, frame, len, index++ * max_len);
+        if(decode_stored_chunk(decInfo, &entry, &data, raw, max_len, &raw_len) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+
+        size_t from = offset > start ? offset - start : 0;               // Part of the frame inside the range
+        size_t to = end - start < raw_len ? end - start : raw_len;
+        if(from < to && fwrite(data + from, 1, to - from, decInfo->fptr_secret) != to - from)
+        {
+            ret = e_failure;
+            break;
+        }
+        decInfo->metrics.payload_bytes += to > from ? to - from : 0;
+        start += raw_len;
+    }
+
+    if(offset > start)                // Secret ends before the range
+        ret = e_failure;
+    free(frame);
+    free(raw);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_secret_file_frames Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo
+ * Output: Status
+ * Description: Decodes a whole secret stored in frames (see decode_frames_range).
+ */
+Status decode_secret_file_frames(DecodeInfo *decInfo)
+{
+    return decode_frames_range(decInfo, 0, UINT64_MAX);
+}
+
+// Shared state of the threads decoding the secret data
+typedef struct _DecodeChunks
+{
+    size_t size;      // Secret bytes
+    size_t chunk_size; // Secret bytes per chunk, whole groups of image bytes
+    uint depth;
+    const ChunkEntry *table; // Checksums to verify, NULL for version 0
+    const ChaCha *cipher;    // NULL unless encrypted
+    int stego_fd;
+    int secret_fd;
+    off_t offset;     // Stego image offset of the secret data
+} DecodeChunks;
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_chunk_at_offset Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : ctx (DecodeChunks), chunk, worker
+ * Output: Status
+ * Description: Decodes secret bytes [chunk * chunk_size, +chunk_size) and
+ * checks them against the chunk table.
+ * Image bytes are read with pread and the secret bytes written with pwrite at
+ * their final offset, so threads never contend on a file position.
+ */
+static Status decode_chunk_at_offset(void *ctx, size_t chunk, uint worker)
+{
+    DecodeChunks *chunks = ctx;
+    unsigned char image_block[LSB_BLOCK_SIZE * 8];
+    unsigned char data_block[LSB_BLOCK_SIZE];
+    size_t block = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(chunks->depth);
+    size_t start = chunk * chunks->chunk_size;
+    size_t end = chunks->size - start < chunks->chunk_size ? chunks->size : start + chunks->chunk_size;
+    uint crc = 0;
+    (void)worker;
+
+    for(size_t pos = start; pos < end; pos += block)
+    {
+        size_t len = end - pos < block ? end - pos : block;
+        ssize_t image_bytes = lsb_image_bytes(len, chunks->depth);
+
+        if(pread(chunks->stego_fd, image_block, image_bytes, chunks->offset + lsb_image_bytes(pos, chunks->depth)) != image_bytes)
+            return e_failure;
+        lsb_extract_depth(data_block, image_block, len, chunks->depth);
+        if(chunks->table != NULL)
+            crc = crc32c(crc, data_block, len);
+        if(chunks->cipher != NULL)
+            chacha20_xor(chunks->cipher, data_block, len, CIPHER_DATA_OFFSET + pos);
+        if(pwrite(chunks->secret_fd, data_block, len, pos) != (ssize_t)len)
+            return e_failure;
+    }
+
+    if(chunks->table != NULL && crc != chunks->table[chunk].crc) // Corrupted chunk
+    {
+        fprintf(job_stderr(), "ERROR : Chunk %zu of the secret data is corrupted\n", chunk);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_secret_file_data_parallel Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (header decoded, image rows walked up to the secret data)
+ * Output: Status
+ * Description: Decodes the secret data with decInfo->jobs threads, for
+ * images whose colour bytes are contiguous (bmp_is_linear).
+ */
+Status decode_secret_file_data_parallel(DecodeInfo *decInfo)
+{
+    DecodeChunks chunks;
+
+    fflush(decInfo->fptr_secret);
+    chunks.size = decInfo->size_secret_file;
+    chunks.depth = decInfo->depth;
+    chunks.chunk_size = decInfo->chunk_size;
+    chunks.table = decInfo->table;
+    chunks.cipher = decInfo->flags & CONTAINER_ENCRYPTED ? &decInfo->cipher : NULL;
+    chunks.stego_fd = fileno(decInfo->fptr_stego_image);
+    chunks.secret_fd = fileno(decInfo->fptr_secret);
+    chunks.offset = decInfo->bmp.data_offset + decInfo->rows.pos; // Colour bytes are contiguous
+
+    if(ftruncate(chunks.secret_fd, chunks.size) == -1)
+        return e_failure;
+
+    return parallel_for(decInfo->jobs, (chunks.size + chunks.chunk_size - 1) / chunks.chunk_size,
+                        decode_chunk_at_offset, &chunks);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_secret_range Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (rows at secret byte offset rounded down to a group), offset, end
+ * Output: Status
+ * Description: Decodes secret bytes [offset, end) block-by-block and writes them to the output file.
+ * Each DECODE_BLOCK_SIZE bytes of secret are recovered from one large read of the
+ * stego image scanlines with the bulk LSB kernel and written out with a single fwrite.
+ * With a chunk table, every chunk decoded from start to end is checked against its CRC.
+ */
+static Status decode_secret_range(DecodeInfo *decInfo, uint64_t offset, uint64_t end)
+{
+    unsigned char *image_block = malloc((size_t)DECODE_BLOCK_SIZE * 8); // Stego image bytes
+    unsigned char *data_block = malloc(DECODE_BLOCK_SIZE);             // Recovered secret bytes
+    size_t block = DECODE_BLOCK_SIZE - DECODE_BLOCK_SIZE % lsb_group_size(decInfo->depth);
+    uint64_t first = offset - offset % lsb_group_size(decInfo->depth); // Group holding offset
+    int whole = first % decInfo->chunk_size == 0;                      // Current chunk decoded from its start
+    Status ret = e_success;
+    uint crc = 0;
+    size_t chunk;
+
+    if(image_block == NULL || data_block == NULL)
+    {
+        perror("malloc");
+        free(image_block);
+        free(data_block);
+        return e_failure;
+    }
+
+    for (uint64_t done = first; done < end && ret == e_success; done += chunk)
+    {
+        uint64_t in_chunk = done % decInfo->chunk_size;                        // Blocks never cross a chunk
+        chunk = decInfo->chunk_size - in_chunk;
+        if(chunk > block)
+            chunk = block;
+        if(chunk > end - done)
+            chunk = end - done;
+        if(in_chunk == 0)
+            whole = 1;
+
+        size_t image_bytes = lsb_image_bytes(chunk, decInfo->depth);
+        if(bmp_rows_read(&decInfo->rows, image_block, image_bytes) == e_failure) // 8 / depth bytes per secret byte
+        {
+            ret = e_failure;
+            break;
+        }
+        lsb_extract_depth(data_block, image_block, chunk, decInfo->depth);           // Decode block
+        if(decInfo->table != NULL)
+            crc = crc32c(crc, data_block, chunk);                                    // CRC of the stored bytes
+        decode_decrypt(decInfo, data_block, chunk, done);
+        size_t skip = offset > done ? offset - done : 0;                             // Bytes before the range
+        if(fwrite(data_block + skip, 1, chunk - skip, decInfo->fptr_secret) != chunk - skip) // Write to secret file
+        {
+            ret = e_failure;
+            break;
+        }
+
+        if(decInfo->table == NULL)
+            continue;
+        if(in_chunk + chunk == decInfo->table[done / decInfo->chunk_size].length)  // Chunk complete
+        {
+            if(whole && crc != decInfo->table[done / decInfo->chunk_size].crc)
+            {
+                fprintf(job_stderr(), "ERROR : Chunk %llu of the secret data is corrupted\n",
+                        (unsigned long long)(done / decInfo->chunk_size));
+                ret = e_failure;
+            }
+            crc = 0;
+        }
+    }
+
+    free(image_block);
+    free(data_block);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_compressed_range Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (rows at the first chunk), offset, end
+ * Output: Status
+ * Description: Decodes secret bytes [offset, end) of a secret whose chunks may be
+ * compressed. Stored chunks vary in size, so the image bytes of the first chunk
+ * needed are found by adding up the stored sizes in the chunk table. Every
+ * chunk touched is decoded whole, checked against its CRC and decompressed.
+ */
+static Status decode_compressed_range(DecodeInfo *decInfo, uint64_t offset, uint64_t end)
+{
+    unsigned char *stored = malloc(decInfo->chunk_size + MAX_LSB_DEPTH); // One chunk as stored
+    unsigned char *raw = malloc(decInfo->chunk_size);                    // One chunk of secret data
+    uint64_t chunk = offset / decInfo->chunk_size;
+    uint64_t skip = 0;                                                   // Image bytes before chunk
+    Status ret = e_success;
+
+    if(stored == NULL || raw == NULL)
+    {
+        perror("malloc");
+        free(stored);
+        free(raw);
+        return e_failure;
+    }
+
+    for(uint64_t i = 0; i < chunk && i < decInfo->nchunks; i++)
+        skip += lsb_image_bytes(chunk_stored_size(decInfo->table[i].length, decInfo->depth), decInfo->depth);
+    if(skip > 0 && bmp_rows_seek(&decInfo->rows, decInfo->rows.pos + skip) == e_failure)
+        ret = e_failure;
+
+    for(uint64_t start = chunk * decInfo->chunk_size; start < end && ret == e_success; start += decInfo->chunk_size, chunk++)
+    {
+        const ChunkEntry *entry = &decInfo->table[chunk];
+        uint64_t expected = decInfo->size_secret_file - start < decInfo->chunk_size ? decInfo->size_secret_file - start
+                                                                                    : decInfo->chunk_size;
+        unsigned char *data = stored;
+        size_t raw_len;
+
+        if(decode_data_at_depth(stored, chunk_stored_size(entry->length, decInfo->depth), decInfo->depth, &decInfo->rows) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+        if(crc32c(0, stored, entry->length) != entry->crc)                  // Corrupted chunk
+        {
+            fprintf(job_stderr(), "ERROR : Chunk %llu of the secret data is corrupted\n", (unsigned long long)chunk);
+            ret = e_failure;
+            break;
+        }
+        decode_decrypt(decInfo, stored, entry->length, start);
+        if(decode_stored_chunk(decInfo, entry, &data, raw, expected, &raw_len) == e_failure || raw_len != expected)
+        {
+            fprintf(job_stderr(), "ERROR : Chunk %llu of the secret data does not decompress\n", (unsigned long long)chunk);
+            ret = e_failure;
+            break;
+        }
+
+        size_t from = offset > start ? offset - start : 0;                   // Part of the chunk inside the range
+        size_t to = end - start < raw_len ? end - start : raw_len;
+        if(fwrite(data + from, 1, to - from, decInfo->fptr_secret) != to - from)
+            ret = e_failure;
+    }
+
+    free(stored);
+    free(raw);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_secret_bytes Function --->
+---------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (chunk table decoded), offset, end (at most the secret size)
+ * Output: Status
+ * Description: Decodes secret bytes [offset, end) to the output file, from wherever
+ * the walk is: it goes back to data_pos and seeks to the image bytes of the group
+ * holding offset (through the table when chunks are compressed, through the frame
+ * entries when the secret is stored in frames, whose end may be past the secret).
+ * Pipes can only seek forward.
+ */
+Status decode_secret_bytes(DecodeInfo *decInfo, uint64_t offset, uint64_t end)
+{
+    uint64_t first = offset - offset % lsb_group_size(decInfo->depth);   // Groups start at fixed image bytes
+
+    if(offset > end)
+        return e_failure;
+    if(is_framed(decInfo))                                              // Size unknown, frames say where it ends
+        return bmp_rows_seek(&decInfo->rows, decInfo->data_pos) == e_success ?
+               decode_frames_range(decInfo, offset, end) : e_failure;
+    if(end > decInfo->size_secret_file)
+        return e_failure;
+    if(decInfo->flags & CONTAINER_COMPRESSED)                           // Chunks located through the table
+        return bmp_rows_seek(&decInfo->rows, decInfo->data_pos) == e_success ?
+               decode_compressed_range(decInfo, offset, end) : e_failure;
+    if(bmp_rows_seek(&decInfo->rows, decInfo->data_pos + lsb_image_bytes(first, decInfo->depth)) == e_failure)
+        return e_failure;
+    return decode_secret_range(decInfo, offset, end);
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------*/
 /* --- Description for decode_secret_file_data Function --->
 ---------------------------------------------------------------------------------------------------------------------------------------
 
  * Input : decInfo
  * Output: Status
- * Description: Decodes secret file data byte-by-byte and writes to output file.
+ * Description: Decodes the whole secret file data and writes it to the output file,
+ * from frames, from compressed chunks, with several threads, or front to back
+ * (see decode_secret_range).
  */
 Status decode_secret_file_data(DecodeInfo *decInfo)
 {
-    unsigned char arr[8];
-    unsigned char ch;
+    if(is_framed(decInfo))                                                 // Secret was streamed in frames
+    {
+        decInfo->metrics.path = "frames";
+        return decode_secret_file_frames(decInfo);
+    }
+    if(decInfo->flags & CONTAINER_COMPRESSED)                              // Chunks located through the table
+    {
+        decInfo->metrics.path = "compressed";
+        return decode_compressed_range(decInfo, 0, decInfo->size_secret_file);
+    }
 
-    for (int i = 0; i < decInfo->size_secret_file; i++)
+    if(decInfo->jobs > 1 && decInfo->output_fname != NULL &&             // Threads need positional I/O in a file of ours
+       !(decInfo->flags & CONTAINER_SCATTERED) &&
+       is_regular_file(decInfo->fptr_stego_image) && is_regular_file(decInfo->fptr_secret) &&
+       bmp_is_linear(&decInfo->bmp))
     {
-        fread(arr, 8, 1, decInfo->fptr_stego_image); // Read 8 bytes
-        decode_byte_from_lsb((char *)&ch, arr);       // Decode byte
-        fputc(ch, decInfo->fptr_secret);             // Write to secret file
+        decInfo->metrics.path = "parallel";
+        return decode_secret_file_data_parallel(decInfo);
     }
+
+    decInfo->metrics.path = "stdio";
+    return decode_secret_range(decInfo, 0, decInfo->size_secret_file);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_open_output Function --->
+----------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (header decoded and checked)
+ * Output: Status
+ * Description: Names the output file after the output name given ("decoded"
+ * if none) up to its first '.', followed by the decoded extension, and
+ * creates a file of its own next to it to decode into (see
+ * create_sibling_file), so that jobs decoding to the same name at once never
+ * share a file. "-" writes the secret to stdout. Called once the header
+ * passed its checks, so a damaged or hostile image never creates or names a
+ * file. Extensions holding a '/' would place the file elsewhere and are rejected.
+ */
+static Status decode_open_output(DecodeInfo *decInfo)
+{
+    const char *name = decInfo->secret_fname != NULL ? decInfo->secret_fname : "decoded"; // Default output name
+    size_t base_len = strcspn(name, ".");                                                   // Remove extension if any
+
+    if(base_len == 1 && name[0] == '-')   // "-" writes the secret to stdout
+    {
+        decInfo->fptr_secret = claim_stdout();   // INFO messages move to stderr
+        metrics_set_output(&decInfo->metrics, "-");
+        return decInfo->fptr_secret != NULL ? e_success : e_failure;
+    }
+    if(strchr(decInfo->extn_secret_file, '/') != NULL)
+    {
+        fprintf(job_stderr(), "ERROR : Decoded extension %s is not a file extension\n", decInfo->extn_secret_file);
+        return e_failure;
+    }
+
+    size_t size = base_len + strlen(decInfo->extn_secret_file) + 1;
+    decInfo->output_fname = malloc(size);
+    if(decInfo->output_fname == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+    snprintf(decInfo->output_fname, size, "%.*s%s", (int)base_len, name, decInfo->extn_secret_file); // Append extension
+
+    decInfo->fptr_secret = create_sibling_file(decInfo->output_fname, &decInfo->temp_fname); // Renamed once complete
+    if(decInfo->fptr_secret == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", decInfo->output_fname);
+        return e_failure;
+    }
+    metrics_set_output(&decInfo->metrics, decInfo->output_fname);
     return e_success;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------*/
-/* --- Description for do_decoding Function --->
+/* --- Description for decode_finish_output Function --->
+----------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo (secret data decoded)
+ * Output: Status
+ * Description: Closes the file the secret was decoded into and renames it to
+ * its final name, replacing any file of that name. Nothing to do for stdout.
+ */
+static Status decode_finish_output(DecodeInfo *decInfo)
+{
+    if(decInfo->temp_fname == NULL)
+        return e_success;
+
+    int closed = fclose(decInfo->fptr_secret);
+    decInfo->fptr_secret = NULL;
+    if(closed != 0 || rename(decInfo->temp_fname, decInfo->output_fname) != 0)
+    {
+        perror("rename");
+        fprintf(job_stderr(), "ERROR : Unable to write file %s\n", decInfo->output_fname);
+        return e_failure;               // close_decode_files removes the temporary file
+    }
+    free(decInfo->temp_fname);
+    decInfo->temp_fname = NULL;
+    return e_success;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for decode_steps Function --->
 ----------------------------------------------------------------------------------------------------------------------------------------
 
  * Input : decInfo
  * Output: Status
  * Description: Master function to perform entire decoding procedure:
- * open files, decode magic string, file extension size, extension,
- * secret size, secret data, and finalize secret file with correct extension.
+ * open the stego image, decode magic string, file extension size, extension,
+ * secret size and chunk table, then create the secret file with its extension
+ * (see decode_open_output) and decode the secret data into it.
+ * Every step is a stage of decInfo->metrics.
  */
-Status do_decoding(DecodeInfo *decInfo)
+static Status decode_steps(DecodeInfo *decInfo)
 {
+    decInfo->fptr_secret = NULL;
+    decInfo->magic_data = NULL;
+    decInfo->extn_secret_file = NULL;
+    decInfo->output_fname = NULL;
+    decInfo->temp_fname = NULL;
+    decInfo->rows.window = NULL;
+    decInfo->rows.map = NULL;
+    decInfo->table = NULL;
+
+    metrics_stage(&decInfo->metrics, e_stage_open);
     if( open_decode_files(decInfo) != e_success) // Open stego image
     {
-        printf("ERROR : Failed to open files.\n");
+        fprintf(job_stderr(), "ERROR : Failed to open files.\n");
         return e_failure;
     }
 
-    char base_name[50];
-
-    if(decInfo->secret_fname == NULL)  // Default output name if not provided
-        strcpy(base_name, "decoded"); 
-    else
-        strcpy(base_name, decInfo->secret_fname); // Use user-provided name
+    metrics_stage(&decInfo->metrics, e_stage_magic);
+    if(decode_magic_string(decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Magic String not matched\n");
+        return e_failure;
+    }
 
-    strtok(base_name, ".");              // Remove extension if any
+    metrics_stage(&decInfo->metrics, e_stage_extn);
+    if (decode_file_extn_size(decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed Decoding of Secret.txt File Extension Size\n");
+        return e_failure;
+    }
 
-    decInfo->secret_fname = malloc(strlen(base_name) + 1); // Allocate memory for clean filename
-    strcpy(decInfo->secret_fname, base_name);              // Copy base name
+    if (decode_secret_file_extn(decInfo->extn_size, decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed Decoding of Secret.txt File Extension\n");
+        return e_failure;
+    }
 
-    decInfo->fptr_secret = fopen(decInfo->secret_fname, "wb"); // Create output file
-    if(decInfo->fptr_secret == NULL)
+    metrics_stage(&decInfo->metrics, e_stage_size);
+    if (decode_secret_file_size(decInfo) == e_failure)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", decInfo->secret_fname);
+        fprintf(job_stderr(), "ERROR : Failed Decoding of secret.txt file size\n");
         return e_failure;
     }
-    printf("INFO : Decoding file created as %s\n",decInfo->secret_fname);
 
-    printf("INFO : Decoding Magic String Signature\n");
-    if(decode_magic_string(decInfo) == e_success)
-        printf("INFO : Done. Magic string Matched\n");
-    else
+    if(decInfo->flags & CONTAINER_SHARDED)   // Only part of the payload, see shard.h
     {
-        printf("ERROR : Magic String not matched\n");
+        fprintf(job_stderr(), "ERROR : The image holds shard %u of a set of %u, join the set with -m\n",
+                decInfo->shard.index, decInfo->shard.data + decInfo->shard.parity);
+        return e_failure;
+    }
+    if(decInfo->flags & CONTAINER_ARCHIVE)   // Several files, see archive.h
+    {
+        fprintf(job_stderr(), "ERROR : The image holds an archive, list it with -t and unpack it with -u\n");
         return e_failure;
     }
 
-    printf("INFO : Decoding secret.txt File Extension Size\n");
-    if (decode_file_extn_size(decInfo) == e_success)
-        printf("INFO : Done\n");
-    else
+    if(decInfo->flags & CONTAINER_ENCRYPTED)
+    {
+        metrics_stage(&decInfo->metrics, e_stage_capacity);
+        if(decode_cipher_key(decInfo) == e_failure)
+        {
+            fprintf(job_stderr(), "ERROR : Failed to load the key\n");
+            return e_failure;
+        }
+    }
+
+    metrics_stage(&decInfo->metrics, e_stage_table);
+    if (decode_chunk_table(decInfo) == e_failure)
     {
-        printf("ERROR : Failed Decoding of Secret.txt File Extension Size\n");
+        fprintf(job_stderr(), "ERROR : Failed Decoding of chunk table\n");
         return e_failure;
     }
 
-    printf("INFO : Decoding Secret File Extension\n");
-    if (decode_secret_file_extn(decInfo->extn_size, decInfo) == e_success)
-        printf("INFO : Done\n");
-    else
+    if(decode_open_output(decInfo) == e_failure)  // Header checked, the extension can name the file
+        return e_failure;
+
+    metrics_stage(&decInfo->metrics, e_stage_data);
+    if (decode_secret_file_data(decInfo) == e_failure)
     {
-        printf("ERROR : Failed Decoding of Secret.txt File Extension\n");
+        fprintf(job_stderr(), "ERROR : Failed Decoding of secret.txt file data\n");
         return e_failure;
     }
+    if(!is_framed(decInfo))
+        decInfo->metrics.payload_bytes = decInfo->size_secret_file;
 
-    char newname[64]; 
-    sprintf(newname, "%s%s",decInfo->secret_fname, decInfo->extn_secret_file); // Append extension
+    if(decode_finish_output(decInfo) == e_failure)
+        return e_failure;
+
+    close_decode_files(decInfo);         // Close files, free decoded strings
+
+    return e_success;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for do_decoding Function --->
+----------------------------------------------------------------------------------------------------------------------------------------
+
+ * Input : decInfo
+ * Output: Status
+ * Description: Runs the decoding steps (see decode_steps) as one job of
+ * decInfo->metrics, reported by the caller with metrics_report. A failed
+ * step leaves its files and buffers to close_decode_files, called here so
+ * that long running callers (-b, -l) never keep them.
+ */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    metrics_begin(&decInfo->metrics, "decode", decInfo->stego_image_fname, decInfo->secret_fname);
+    decInfo->metrics.jobs = decInfo->jobs;
+
+    Status ret = decode_steps(decInfo);
+    if(ret == e_failure)
+        close_decode_files(decInfo);
+
+    metrics_end(&decInfo->metrics, ret);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------*/
+/* --- Description for do_extract_range Function --->
+----------------------------------------------------------------------------------------------------------------------------------------
 
-    fclose(decInfo->fptr_secret);            // Close temporary file
-    rename(decInfo->secret_fname, newname);  // Rename to final name
-    decInfo->fptr_secret = fopen(newname,"a"); // Reopen final file in append mode
+ * Input : decInfo (range set by read_and_validate_extract_args)
+ * Output: Status
+ * Description: Decodes the header (magic string, extension, size, key and chunk table),
+ * then seeks straight to the image bytes of secret byte range_offset and decodes
+ * only the range_length bytes from there. The range is cut at the end of the secret.
+ * Chunks wholly inside the range are checked against their CRC.
+ */
+Status do_extract_range(DecodeInfo *decInfo)
+{
+    decInfo->fptr_secret = NULL;
+    decInfo->magic_data = NULL;
+    decInfo->extn_secret_file = NULL;
+    decInfo->output_fname = NULL;
+    decInfo->temp_fname = NULL;
+    decInfo->rows.window = NULL;
+    decInfo->rows.map = NULL;
+    decInfo->table = NULL;
+
+    if(open_decode_files(decInfo) != e_success) // Open stego image
+    {
+        fprintf(job_stderr(), "ERROR : Failed to open files.\n");
+        close_decode_files(decInfo);
+        return e_failure;
+    }
+
+    if(strcmp(decInfo->secret_fname, "-") == 0)
+        decInfo->fptr_secret = claim_stdout();                     // INFO messages move to stderr
+    else
+        decInfo->fptr_secret = fopen(decInfo->secret_fname, "wb"); // Raw bytes, no extension added
     if(decInfo->fptr_secret == NULL)
     {
         perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", decInfo->secret_fname);
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", decInfo->secret_fname);
+        close_decode_files(decInfo);
         return e_failure;
     }
-    printf("INFO : The final Decoded file with Extension : %s\n",newname);
 
-    printf("INFO : Decoding secret.txt File Size\n");
-    if (decode_secret_file_size(decInfo) == e_success)
-        printf("INFO : Done\n");
+    info_printf("INFO : Decoding Header\n");
+    if(decode_magic_string(decInfo) == e_success && decode_file_extn_size(decInfo) == e_success &&
+       decode_secret_file_extn(decInfo->extn_size, decInfo) == e_success &&
+       decode_secret_file_size(decInfo) == e_success && decode_cipher_key(decInfo) == e_success &&
+       decode_chunk_table(decInfo) == e_success)
+        info_printf("INFO : Done\n");
     else
     {
-        printf("ERROR : Failed Decoding of secret.txt file size\n");
+        fprintf(job_stderr(), "ERROR : Failed Decoding of the header\n");
+        close_decode_files(decInfo);
+        return e_failure;
+    }
+    if(decInfo->flags & CONTAINER_SHARDED)   // Offsets of the whole payload span several images
+    {
+        fprintf(job_stderr(), "ERROR : The image holds shard %u of a set of %u, join the set with -m\n",
+                decInfo->shard.index, decInfo->shard.data + decInfo->shard.parity);
+        close_decode_files(decInfo);
         return e_failure;
     }
 
-    printf("INFO : Decoding secret.txt File Data\n");
-    if (decode_secret_file_data(decInfo) == e_success)
-        printf("INFO : Done\n");
-    else
+    uint64_t offset = decInfo->range_offset;
+    uint64_t end = decInfo->range_length > UINT64_MAX - offset ? UINT64_MAX : offset + decInfo->range_length;
+    Status ret;
+
+    if(is_framed(decInfo))                               // Size unknown, frames say where the secret ends
+    {
+        info_printf("INFO : Extracting secret bytes from %llu\n", (unsigned long long)offset);
+        ret = decode_frames_range(decInfo, offset, end);
+    }
+    else if(offset > decInfo->size_secret_file)
     {
-        printf("ERROR : Failed Decoding of secret.txt file data\n");
+        fprintf(job_stderr(), "ERROR : Range starts past the end of the %llu byte secret\n", (unsigned long long)decInfo->size_secret_file);
+        close_decode_files(decInfo);
         return e_failure;
     }
+    else
+    {
+        if(end > decInfo->size_secret_file)
+            end = decInfo->size_secret_file;
+        info_printf("INFO : Extracting secret bytes %llu to %llu\n", (unsigned long long)offset, (unsigned long long)end);
 
-    fclose(decInfo->fptr_stego_image);   // Close stego image
-    fclose(decInfo->fptr_secret);        // Close secret file
+        ret = decode_secret_bytes(decInfo, offset, end);
+    }
 
-    free(decInfo->extn_secret_file);     // Free allocated memory
-    free(decInfo->secret_fname);
+    if(ret == e_success)
+        info_printf("INFO : Done\n");
+    else
+        fprintf(job_stderr(), "ERROR : Failed Extracting the secret bytes\n");
 
-    return e_success;
+    close_decode_files(decInfo);
+    return ret;
 }
@@ -3,6 +3,10 @@
 
 #include <stdio.h>  //for FILE *
 #include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "container.h"
+#include "chacha20.h"
+#include "metrics.h"
 
 /* 
  * Structure to store information required for
@@ -11,8 +15,8 @@
  * also stored
  */
 
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
+/* Secret bytes recovered per read/extract/write cycle of the data decoder */
+#define DECODE_BLOCK_SIZE (64 * 1024)
 
 // Structure to hold decoding related imformation
 typedef struct _DecodeInfo
@@ -20,16 +24,42 @@ typedef struct _DecodeInfo
    /* Stego Image Info */     
     char *stego_image_fname;   
     FILE *fptr_stego_image;
+    BmpInfo bmp;            // layout of the stego image
+    BmpRows rows;           // scanlines walked while decoding
 
     /* magic string */
     char *magic_data;
 
     /* Secret File Info */
     char *secret_fname;     
+    char *output_fname;     // file written: secret_fname up to its first '.' and the decoded extension
+    char *temp_fname;       // unique file the secret is decoded into, renamed to output_fname once complete
     FILE *fptr_secret;
-    int size_secret_file;
+    uint64_t size_secret_file;
     char *extn_secret_file;
     int extn_size;
+    uint depth;             // LSBs per image byte of the secret data, from the header
+
+    /* Container */
+    uint version;           // 0: original layout, 1: container.h
+    uint flags;             // CONTAINER_* flags
+    uint chunk_size;        // payload bytes per chunk
+    uint64_t nchunks;       // entries of table (0 for version 0 and streamed secrets)
+    ChunkEntry *table;
+    unsigned char nonce[CHACHA_NONCE_SIZE]; // cipher fields, with CONTAINER_ENCRYPTED
+    uint key_check;
+    ChaCha cipher;
+    ShardFields shard;      // with CONTAINER_SHARDED (shard.data is 0 otherwise)
+    uint64_t data_pos;      // colour byte of the first chunk
+
+    /* Options */
+    uint jobs;              // worker threads (-j)
+    char *key_fname;        // key file given with --key, NULL if none
+    uint64_t range_offset;  // -x: first secret byte to extract
+    uint64_t range_length;  // -x: secret bytes to extract
+
+    /* Instrumentation */
+    Metrics metrics;        // stage timings and I/O counters of do_decoding
    
 } DecodeInfo;
 
@@ -39,17 +69,20 @@ typedef struct _DecodeInfo
 /* Read and validate Decode args from argv */
 Status read_and_validate_decode_args(int argc,char *argv[], DecodeInfo *decInfo);
 
+/* Read and validate Extract args from argv */
+Status read_and_validate_extract_args(int argc, char *argv[], DecodeInfo *decInfo);
+
 /* Get File pointers for i/p stego and o/p decoded files */
 Status open_decode_files(DecodeInfo *decInfo);
 
-/* Decode a byte from LSB of image data array */
-Status decode_byte_from_lsb(char *data, char *image_buffer);
-
-/* Decode integer size values from LSB of image bytes */
-Status decode_size_from_lsb(unsigned char *buffer, int *size);
+/* Close files and free memory of a decode job */
+void close_decode_files(DecodeInfo *decInfo);
 
 /* Decode actual data bits from image into a buffer */
-Status decode_data_from_image(char *buffer, int size, FILE *fptr_stego_image);
+Status decode_data_from_image(char *buffer, int size, BmpRows *rows);
+
+/* Decode data stored in the given number of LSBs per image byte */
+Status decode_data_at_depth(unsigned char *buffer, size_t size, uint depth, BmpRows *rows);
 
 /* Decode Magic String */
 Status decode_magic_string(DecodeInfo *decInfo);
@@ -60,13 +93,31 @@ Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo);
 /* Decode file extn size */
 Status decode_file_extn_size(DecodeInfo *decInfo);
 
-/* Decode secret file size */
+/* Decode secret file size (and the container fields of version 1) */
 Status decode_secret_file_size(DecodeInfo *decInfo);
 
+/* Load the key of an encrypted secret and check it against the header */
+Status decode_cipher_key(DecodeInfo *decInfo);
+
+/* Decode and validate the chunk table */
+Status decode_chunk_table(DecodeInfo *decInfo);
+
+/* Decode secret bytes [offset, end) to the output file */
+Status decode_secret_bytes(DecodeInfo *decInfo, uint64_t offset, uint64_t end);
+
+/* Decode secret file data stored in frames (streamed secret) */
+Status decode_secret_file_frames(DecodeInfo *decInfo);
+
+/* Decode secret file data with several threads */
+Status decode_secret_file_data_parallel(DecodeInfo *decInfo);
+
 /* Decode secret file data*/
 Status decode_secret_file_data(DecodeInfo *decInfo);
 
 /* Perform the decoding */
 Status do_decoding(DecodeInfo *decInfo);
 
+/* Decode only a byte range of the secret */
+Status do_extract_range(DecodeInfo *decInfo);
+
 #endif
@@ -2,9 +2,22 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "encode.h"
+#include "lsb.h"
+#include "fileio.h"
+#include "parallel.h"
 #include "types.h"
 #include "common.h"
+#include "bmp.h"
+#include "container.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "chacha20.h"
+#include "metrics.h"
+#include "stego.h"
+#include "ioqueue.h"
 
 /* Function Definitions */
 
@@ -13,7 +26,10 @@
     * Output : OperationType (e_encode / e_decode / e_unsupported)
     * Description: 
     * Checks command-line arguments to decide whether user wants to perform encoding or decoding. 
-    * Returns e_encode if "-e/-E", e_decode if "-d/-D", otherwise e_unsupported.
+    * Returns e_encode if "-e/-E", e_decode if "-d/-D", e_batch if "-b/-B", e_extract if "-x/-X",
+    * e_probe if "-p/-P", e_shard if "-s/-S", e_join if "-m/-M", e_archive if "-a/-A",
+    * e_list if "-t/-T", e_unpack if "-u/-U", e_update if "-r/-R", e_serve if "-l/-L",
+    * e_client if "-c/-C", e_analyze if "-n/-N", otherwise e_unsupported.
 */
 
 /* Check operation type */
@@ -29,11 +45,48 @@ OperationType check_operation_type(int argc,char *argv[])
         return e_encode;                // return encode operation
     if(op == 'd')                       // if argument is -d/-D
         return e_decode;                // return decode operation
+    if(op == 'b')                       // if argument is -b/-B
+        return e_batch;                 // return batch operation
+    if(op == 'x')                       // if argument is -x/-X
+        return e_extract;               // return extract operation
+    if(op == 'p')                       // if argument is -p/-P
+        return e_probe;                 // return probe operation
+    if(op == 's')                       // if argument is -s/-S
+        return e_shard;                 // return shard operation
+    if(op == 'm')                       // if argument is -m/-M
+        return e_join;                  // return join operation
+    if(op == 'a')                       // if argument is -a/-A
+        return e_archive;               // return archive operation
+    if(op == 't')                       // if argument is -t/-T
+        return e_list;                  // return list operation
+    if(op == 'u')                       // if argument is -u/-U
+        return e_unpack;                // return unpack operation
+    if(op == 'r')                       // if argument is -r/-R
+        return e_update;                // return update operation
+    if(op == 'l')                       // if argument is -l/-L
+        return e_serve;                 // return serve operation
+    if(op == 'c')                       // if argument is -c/-C
+        return e_client;                // return client operation
+    if(op == 'n')                       // if argument is -n/-N
+        return e_analyze;               // return analyze operation
     else
         return e_unsupported;
 }
 
 
+/* --- Description for get_file_extn Function --->
+ * Input: fname (path of secret file)
+ * Output: pointer to the extension (".txt") inside fname, NULL if none
+ * Description: Extension starts at the first dot of the file name,
+ * directories in the path are skipped.
+ */
+static const char *get_file_extn(const char *fname)
+{
+    const char *base = strrchr(fname, '/');
+    return strchr(base ? base + 1 : fname, '.');
+}
+
+
 /* --- Description for read_and_validate_encode_args Function --->
  * Input: argc, argv, encInfo (EncodeInfo structure)
  * Output: Status (e_success / e_failure)
@@ -41,74 +94,202 @@ OperationType check_operation_type(int argc,char *argv[])
  * Validates arguments for encoding mode.          
  * Extracts source image file, secret file, and output file.            
  * Ensures image ends with .bmp and secret file exists.
+ * Options (starting with "--") may appear anywhere after -e:
+ *      --mmap    : build the stego image through memory mapped files
+ *      --reflink : clone the source image and rewrite only the modified prefix
+ *      --stream  : single pass over the files (implied for pipes)
+ *      --uring   : overlap reading, embedding and writing with asynchronous I/O
+ *      --extn .x : extension to store, for secrets read from pipes
+ *      -j N      : embed the secret data with N threads
+ *      --depth N : hide the secret data in the N (1 to 4) low bits of each image byte
+ *      --compress: compress the secret data chunk by chunk before embedding
+ *      --key file: encrypt the secret data with the 32 byte key in file
+ *      --scatter : spread the secret data over the image in a keyed order (needs --key)
+ * "-" reads the source image or the secret from stdin, or writes the stego
+ * image to stdout.
  */
 
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(int argc, char *argv[], EncodeInfo *encInfo)
 {
-    // check for correct number of arguments
-    if(argc < 4 || argc > 5)  
+    char *args[3];      // positional arguments
+    int count = 0;
+
+    encInfo->io_mode = e_io_stdio;
+    encInfo->extn_option = NULL;
+    encInfo->jobs = 1;
+    encInfo->depth = 1;
+    encInfo->compress = 0;
+    encInfo->key_fname = NULL;
+    encInfo->scatter = 0;
+    encInfo->shard.data = 0;
+    encInfo->archive = 0;
+    encInfo->in_place = 0;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--mmap") == 0)
+        {
+            encInfo->io_mode = e_io_mmap;
+        }
+        else if(strcmp(argv[i], "--reflink") == 0)
+        {
+            encInfo->io_mode = e_io_reflink;
+        }
+        else if(strcmp(argv[i], "--stream") == 0)
+        {
+            encInfo->io_mode = e_io_stream;
+        }
+        else if(strcmp(argv[i], "--uring") == 0)
+        {
+            encInfo->io_mode = e_io_uring;
+        }
+        else if(strcmp(argv[i], "--compress") == 0)
+        {
+            encInfo->compress = 1;
+        }
+        else if(strcmp(argv[i], "--scatter") == 0)
+        {
+            encInfo->scatter = 1;
+        }
+        else if(strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+        {
+            encInfo->key_fname = argv[++i];
+        }
+        else if(strcmp(argv[i], "--extn") == 0 && i + 1 < argc && argv[i + 1][0] == '.')
+        {
+            encInfo->extn_option = argv[++i];
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &encInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)    // -jN
+        {
+            if(parse_jobs(argv[i] + 2, &encInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+        {
+            char *end;
+            long depth = strtol(argv[++i], &end, 10);
+            if(*end != '\0' || depth < MIN_LSB_DEPTH || depth > MAX_LSB_DEPTH)
+                return e_failure;
+            encInfo->depth = depth;
+        }
+        else if(strncmp(argv[i], "--", 2) == 0)   // unknown option
+        {
+            return e_failure;
+        }
+        else
+        {
+            if(count == 3)
+                return e_failure;
+            args[count++] = argv[i];
+        }
+    }
+
+    // check for correct number of arguments, the keyed order needs a key
+    if(count < 2 || (encInfo->scatter && encInfo->key_fname == NULL))
     {
         return e_failure;
     }
 
-    //validate source image (must end with .bmp)
-    if(strstr(argv[2],".bmp") == NULL)
+    //validate source image (must end with .bmp, or - for stdin)
+    if(strstr(args[0],".bmp") == NULL && strcmp(args[0], "-") != 0)
     {
         return e_failure;
     }
-    encInfo->src_image_fname = argv[2];    
+    encInfo->src_image_fname = args[0];    
 
-    //validate secret file (must contain a dot, like .txt)
-    if(strstr(argv[3],".") == NULL)
+    //validate secret file (must contain a dot, like .txt, unless --extn given)
+    if(get_file_extn(args[1]) == NULL && encInfo->extn_option == NULL && strcmp(args[1], "-") != 0)
     {
         return e_failure;
     }
-    encInfo->secret_fname = argv[3];  
+
+    //source image and secret file can't both come from stdin
+    if(strcmp(args[0], "-") == 0 && strcmp(args[1], "-") == 0)
+    {
+        return e_failure;
+    }
+    encInfo->secret_fname = args[1];  
 
     //validate output stego image (if given by CLA) else use default
-    if(argc == 5)
+    if(count == 3)
     {
-        encInfo->stego_image_fname = argv[4];
+        encInfo->stego_image_fname = args[2];
     }
     else
     {
-        printf("INFO : Output File not mentioned. Creating stego.bmp as default\n");
+        info_printf("INFO : Output File not mentioned. Creating stego.bmp as default\n");
         encInfo->stego_image_fname = "stego.bmp";   
     }
     return e_success;
 }
 
 
+/* --- Description for encode_option_size Function --->
+ * Input: argc, argv, i (index of the argument)
+ * Output: 2 for an encoding option taking a value, 1 for one without,
+ * 0 if argv[i] is not one of them (or its value is missing)
+ * Description: Lets modes that run the encoder for several images (-s, -a)
+ * pass --depth, --key, --compress, --scatter and the I/O mode on as given.
+ */
+int encode_option_size(int argc, char *argv[], int i)
+{
+    if(strcmp(argv[i], "--depth") == 0 || strcmp(argv[i], "--key") == 0)
+        return i + 1 < argc ? 2 : 0;
+    if(strcmp(argv[i], "--compress") == 0 || strcmp(argv[i], "--scatter") == 0 || strcmp(argv[i], "--mmap") == 0 ||
+       strcmp(argv[i], "--reflink") == 0 || strcmp(argv[i], "--stream") == 0 || strcmp(argv[i], "--uring") == 0)
+        return 1;
+    return 0;
+}
+
+
 /* --- Description for open_files Function --->
  * Input: encInfo (structure containing file names)
  * Output: Status (e_success/e_failure)
  * Description: Opens source image, secret file and stego image file.
+ * "-" stands for stdin (source image, secret) or stdout (stego image).
  * Returns e_failure if any file cannot be opened.
  */
 Status open_files(EncodeInfo *encInfo)
 {
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
+    if(strcmp(encInfo->src_image_fname, "-") == 0)
+        encInfo->fptr_src_image = job_stdin();
+    else
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
     if (encInfo->fptr_src_image == NULL)
     {
         perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->src_image_fname);
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", encInfo->src_image_fname);
         return e_failure;
     }
 
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "rb");
+    if(strcmp(encInfo->secret_fname, "-") == 0)
+        encInfo->fptr_secret = job_stdin();
+    else
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "rb");
     if (encInfo->fptr_secret == NULL)
     {
         perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->secret_fname);
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", encInfo->secret_fname);
         return e_failure;
     }
 
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb");
+    // stdout was already claimed by do_encoding for "-"
+    // the stego image is opened for reading too: a shared writable mapping needs it, and the
+    // chunk table is patched in after the data; an image updated in place must keep the bytes it doesn't rewrite
+    if(encInfo->in_place)
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "r+b");
+    else if(strcmp(encInfo->stego_image_fname, "-") != 0)
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w+b");
     if (encInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->stego_image_fname);
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", encInfo->stego_image_fname);
         return e_failure;
     }
 
@@ -116,24 +297,47 @@ Status open_files(EncodeInfo *encInfo)
 }
 
 
+/* --- Description for close_files Function --->
+ * Input: encInfo
+ * Output: None
+ * Description: Closes whichever of the three files are still open. Safe to
+ * call again, so callers running many jobs can clean up after a failed one.
+ */
+void close_files(EncodeInfo *encInfo)
+{
+    if(encInfo->fptr_src_image != NULL)
+        fclose(encInfo->fptr_src_image);
+    if(encInfo->fptr_secret != NULL)
+        fclose(encInfo->fptr_secret);
+    if(encInfo->fptr_stego_image != NULL)
+        fclose(encInfo->fptr_stego_image);
+    if(encInfo->fptr_stored != NULL)
+        fclose(encInfo->fptr_stored);
+    bmp_rows_free(&encInfo->rows);
+    free(encInfo->table);
+    free(encInfo->table_image);
+
+    encInfo->table = NULL;
+    encInfo->table_image = NULL;
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->fptr_stored = NULL;
+}
+
+
 /* --- Description for check_capacity Function --->
  * Input: encInfo (source and secret files)
  * Output: Status (e_success/e_failure)
  * Description: Ensures that source image has enough space to hide
  * secret file data along with magic string and metadata.
+ * The metadata takes 8 image bytes per byte, the secret data 8 / depth.
  */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    uint image_data_bytes = get_image_size_for_bmp(encInfo->fptr_src_image);
-    uint secret_file_size = get_file_size(encInfo->fptr_secret);
-
-    // each secret byte requires 8 image bytes (1 LSB per image byte)
-    uint image_capacity_for_secret_bytes = image_data_bytes / 8;
+    uint64_t image_data_bytes = get_image_size_for_bmp(encInfo->fptr_src_image);
 
-    // required bytes: magic string + 32 bits for size + extension + 32 bits + secret
-    uint required_bytes = strlen(MAGIC_STRING) + 32/8 + strlen(encInfo->extn_secret_file) + 32/8 + secret_file_size;
-
-    if(image_capacity_for_secret_bytes >= required_bytes)
+    if(image_data_bytes >= encode_required_image_bytes(encInfo))
         return e_success;
     else
         return e_failure;
@@ -142,16 +346,16 @@ Status check_capacity(EncodeInfo *encInfo)
 
 /* --- Description for get_image_size_for_bmp Function --->
  * Input: fptr_image
- * Output: total byte capacity (width * height * 3)
- * Description: Reads width and height from BMP header and returns total image data size.
+ * Output: total byte capacity (width * height * 3), 0 if not a supported BMP
+ * Description: Reads the BMP headers and returns the number of colour bytes,
+ * padding and alpha bytes excluded (see bmp.h).
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+uint64_t get_image_size_for_bmp(FILE *fptr_image)
 {
-    uint width, height;
-    fseek(fptr_image, 18, SEEK_SET);
-    fread(&width, sizeof(int), 1, fptr_image);
-    fread(&height, sizeof(int), 1, fptr_image);
-    return width * height * 3;
+    BmpInfo info;
+    if(bmp_read_info(fptr_image, &info) == e_failure)
+        return 0;
+    return info.colour_bytes;
 }
 
 
@@ -160,74 +364,65 @@ uint get_image_size_for_bmp(FILE *fptr_image)
  * Output: file size in bytes
  * Description: Seeks to end of file to get size, then rewinds pointer to start.
  */
-uint get_file_size(FILE *fptr)
+uint64_t get_file_size(FILE *fptr)
 {
-    uint size;
-    fseek(fptr, 0, SEEK_END);
-    size = ftell(fptr);
-    fseek(fptr, 0, SEEK_SET);
+    uint64_t size;
+    fseeko(fptr, 0, SEEK_END);
+    size = ftello(fptr);
+    fseeko(fptr, 0, SEEK_SET);
     return size;
 }
 
 
 /* --- Description for copy_bmp_header Function --->
- * Input: fptr_src_image, fptr_dest_image
+ * Input: fptr_src_image, fptr_dest_image, info (filled)
  * Output: Status
- * Description: Copies 54-byte BMP header from source to destination.
+ * Description: Copies everything before the pixel array (headers, colour
+ * masks, gaps up to bfOffBits) from source to destination.
  */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, BmpInfo *info)
 {
-    unsigned char buffer[54];
     fseek(fptr_src_image, 0, SEEK_SET);
-    fread(buffer, 1, 54, fptr_src_image);
-    fwrite(buffer, 1, 54, fptr_dest_image);
-    return e_success;
+    return bmp_copy_header(fptr_src_image, fptr_dest_image, info);
 }
 
 
-/* --- Description for encode_byte_to_lsb Function --->
- * Input: data (1 byte), image_buffer (8 bytes)
+/* --- Description for encode_data_to_image Function --->
+ * Input: data (char array), size (int), encInfo
  * Output: Status
- * Description: Encodes one byte into the LSB of 8 bytes of image data.
+ * Description: Encodes multiple bytes into the image block by block, one
+ * LSB per image byte (see encode_data_at_depth).
  */
-Status encode_byte_to_lsb(char data, char *image_buffer)
+Status encode_data_to_image(const char *data, int size, EncodeInfo *encInfo)
 {
-    for(int i = 0; i < 8; i++)
-    {
-        image_buffer[i] = (image_buffer[i] & (~1)) | ((data >> i) & 1);
-    }
-    return e_success;
+    return encode_data_at_depth((const unsigned char *)data, size, 1, &encInfo->rows);
 }
 
 
-/* --- Description for encode_size_to_lsb Function --->
- * Input: size (int), image_buffer (32 bytes)
+/* --- Description for encode_data_at_depth Function --->
+ * Input: data, size, depth, rows (source to stego scanlines)
  * Output: Status
- * Description: Encodes a 32-bit integer into the LSBs of 32 bytes of image data.
+ * Description: Each block of up to LSB_BLOCK_SIZE secret bytes is taken as one
+ * chunk of colour bytes, embedded with the LSB kernel at the given depth and
+ * stored back in a single call. Blocks hold whole groups of image bytes
+ * (see lsb_group_size), so callers splitting data over several calls must
+ * do the same with all but the last piece.
  */
-Status encode_size_to_lsb(int size, char *image_buffer)
+Status encode_data_at_depth(const unsigned char *data, size_t size, uint depth, BmpRows *rows)
 {
-    for(int i = 0; i < 32; i++)
-    {
-        image_buffer[i] = (image_buffer[i] & (~1)) | ((size >> i) & 1);
-    }
-    return e_success;
-}
-
+    unsigned char image_block[LSB_BLOCK_SIZE * 8];
+    size_t block = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(depth);
+    size_t chunk;
 
-/* --- Description for encode_data_to_image Function --->
- * Input: data (char array), size (int), fptr_src_image, fptr_stego_image, encInfo
- * Output: Status
- * Description: Encodes multiple bytes into the image by repeatedly calling encode_byte_to_lsb.
- */
-Status encode_data_to_image(const char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
-{
-    unsigned char arr[8];
-    for(int i = 0; i < size; i++)
+    for(size_t done = 0; done < size; done += chunk)
     {
-        fread(arr, 8, 1, fptr_src_image);
-        encode_byte_to_lsb(data[i], arr);
-        fwrite(arr, 8, 1, fptr_stego_image);
+        chunk = (size - done < block) ? size - done : block;
+        size_t image_bytes = lsb_image_bytes(chunk, depth);
+
+        if(bmp_rows_read(rows, image_block, image_bytes) == e_failure)
+            return e_failure;
+        lsb_embed_depth(image_block, data + done, chunk, depth);
+        bmp_rows_write(rows, image_block, image_bytes);
     }
     return e_success;
 }
@@ -236,12 +431,11 @@ Status encode_data_to_image(const char *data, int size, FILE *fptr_src_image, FI
 /* --- Description for encode_magic_string Function --->
  * Input: magic_string, encInfo
  * Output: Status
- * Description: Stores predefined MAGIC_STRING in the image to verify decoding later.
+ * Description: Stores magic_string (MAGIC_STRING) in the image to verify decoding later.
  */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
-    encode_data_to_image(MAGIC_STRING, strlen(MAGIC_STRING), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
-    return e_success;
+    return encode_data_to_image(magic_string, strlen(magic_string), encInfo);
 }
 
 
@@ -252,59 +446,315 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
  */
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
-    encode_data_to_image(file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
-    return e_success;
+    return encode_data_to_image(file_extn, strlen(file_extn), encInfo);
 }
 
 
 /* --- Description for encode_secret_file_extn_size Function --->
- * Input: size, fptr_src_image, fptr_stego_image
+ * Input: size, encInfo
  * Output: Status
  * Description: Encodes size of secret file extension using 32 LSBs.
+ * Stored least significant byte first, one bit per LSB.
  */
-Status encode_secret_file_extn_size(int size, FILE* fptr_src_image, FILE* fptr_stego_image)
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
-    char arr[32];
-    fread(arr, 32, 1, fptr_src_image);
-    encode_size_to_lsb(size, arr);
-    fwrite(arr, 32, 1, fptr_stego_image);
-    return e_success;
+    char arr[4];
+    for(int i = 0; i < 4; i++)
+        arr[i] = ((uint)size >> (8 * i)) & 0xFF;
+    return encode_data_to_image(arr, 4, encInfo);
 }
 
 
 /* --- Description for encode_secret_file_size Function --->
- * Input: file_size, encInfo
+ * Input: encInfo
  * Output: Status
- * Description: Encodes size of secret file using 32 LSBs.
+ * Description: Encodes the container fields following the extension:
+ * 64 bit size of secret file, flags, chunk size, and the checksum of the
+ * whole header (see container.h), then the cipher and shard fields if any,
+ * i.e. the tail of encode_header_to_buffer.
  */
-Status encode_secret_file_size(int file_size, EncodeInfo *encInfo)
+Status encode_secret_file_size(EncodeInfo *encInfo)
 {
-    char arr[32];
-    fread(arr, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(file_size, arr);
-    fwrite(arr, 32, 1, encInfo->fptr_stego_image);
-    return e_success;
+    unsigned char header[MAX_HEADER_SIZE];
+    uint header_size = encode_header_to_buffer(encInfo, header);
+
+    uint fields = CONTAINER_FIELDS_SIZE + (encInfo->flags & CONTAINER_ENCRYPTED ? CIPHER_FIELDS_SIZE : 0) +
+                  (encInfo->flags & CONTAINER_SHARDED ? SHARD_FIELDS_SIZE : 0);
+
+    return encode_data_to_image((char *)header + header_size - fields, fields, encInfo);
+}
+
+
+/* --- Description for pack_chunk_table Function --->
+ * Input: encInfo (table filled)
+ * Output: malloc'ed nchunks * CHUNK_ENTRY_SIZE bytes, NULL on failure
+ */
+static unsigned char *pack_chunk_table(EncodeInfo *encInfo)
+{
+    unsigned char *bytes = malloc(encInfo->nchunks * CHUNK_ENTRY_SIZE + 1);
+
+    if(bytes == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    for(uint64_t i = 0; i < encInfo->nchunks; i++)
+        chunk_entry_pack(&encInfo->table[i], bytes + i * CHUNK_ENTRY_SIZE);
+    return bytes;
+}
+
+
+/* --- Description for encode_encrypt Function --->
+ * Input: encInfo, data, len, pos (stored position, see container.h)
+ * Output: None
+ * Description: Encrypts stored bytes in place, nothing to do without --key.
+ */
+static void encode_encrypt(EncodeInfo *encInfo, unsigned char *data, size_t len, uint64_t pos)
+{
+    if(encInfo->flags & CONTAINER_ENCRYPTED)
+        chacha20_xor(&encInfo->cipher, data, len, CIPHER_DATA_OFFSET + pos);
+}
+
+
+/* --- Description for encode_stored_chunk Function --->
+ * Input: encInfo, entry, index (chunk number), raw, len, packed (len bytes), data (set to the bytes to store)
+ * Output: None
+ * Description: Fills the chunk entry for len secret bytes. With --compress
+ * the chunk is stored compressed when that makes it smaller, with --key it
+ * is then encrypted in place (raw or packed), before the CRC is taken.
+ */
+static void encode_stored_chunk(EncodeInfo *encInfo, ChunkEntry *entry, uint64_t index, unsigned char *raw, size_t len,
+                                unsigned char *packed, unsigned char **data)
+{
+    size_t packed_len = encInfo->compress && len > 1 ? lz_compress(raw, len, packed, len - 1) : 0;
+
+    entry->compressed = packed_len > 0;
+    entry->length = entry->compressed ? packed_len : len;
+    *data = entry->compressed ? packed : raw;
+    encode_encrypt(encInfo, *data, entry->length, index * encInfo->chunk_size);
+    entry->crc = crc32c(0, *data, entry->length);
+}
+
+
+/* --- Description for encode_prepare_chunks Function --->
+ * Input: encInfo (size and chunk size set)
+ * Output: Status
+ * Description: The table comes before the chunks and can't be patched in
+ * afterwards when the stego image goes to a pipe, so the secret file is
+ * then read once up front to checksum every chunk. With --compress the
+ * chunks are compressed in the same pass and the stored chunks are kept in
+ * a temporary file (fptr_stored) for encode_secret_file_data.
+ */
+Status encode_prepare_chunks(EncodeInfo *encInfo)
+{
+    unsigned char *buffer = malloc(encInfo->chunk_size);
+    unsigned char *packed = malloc(encInfo->chunk_size);
+    Status ret = e_success;
+
+    if(buffer == NULL || packed == NULL)
+    {
+        perror("malloc");
+        free(buffer);
+        free(packed);
+        return e_failure;
+    }
+    if(encInfo->compress && (encInfo->fptr_stored = tmpfile()) == NULL)
+    {
+        perror("tmpfile");
+        ret = e_failure;
+    }
+
+    fseeko(encInfo->fptr_secret, 0, SEEK_SET);
+    for(uint64_t i = 0; i < encInfo->nchunks && ret == e_success; i++)
+    {
+        uint64_t left = encInfo->size_secret_file - i * encInfo->chunk_size;
+        size_t len = left < encInfo->chunk_size ? left : encInfo->chunk_size;
+        unsigned char *data;
+
+        if(fread(buffer, 1, len, encInfo->fptr_secret) != len)
+        {
+            ret = e_failure;
+            break;
+        }
+        encode_stored_chunk(encInfo, &encInfo->table[i], i, buffer, len, packed, &data);
+        if(encInfo->fptr_stored != NULL &&
+           fwrite(data, 1, encInfo->table[i].length, encInfo->fptr_stored) != encInfo->table[i].length)
+            ret = e_failure;
+    }
+
+    free(buffer);
+    free(packed);
+    return ret;
+}
+
+
+/* --- Description for encode_chunk_table Function --->
+ * Input: encInfo (table filled by encode_prepare_chunks, or table_image set)
+ * Output: Status
+ * Description: Encodes the chunk table with 1 LSB per image byte, like the
+ * header. With table_image, the colour bytes the table will take are only
+ * kept there, left as they are in the stego image, and the table is
+ * patched in by encode_secret_file_data.
+ */
+Status encode_chunk_table(EncodeInfo *encInfo)
+{
+    if(encInfo->table_image != NULL)
+    {
+        encInfo->table_pos = encInfo->rows.pos;
+        return bmp_rows_read(&encInfo->rows, encInfo->table_image, 8 * encInfo->nchunks * CHUNK_ENTRY_SIZE);
+    }
+
+    unsigned char *bytes = pack_chunk_table(encInfo);
+    if(bytes == NULL)
+        return e_failure;
+
+    Status ret = encode_data_to_image((char *)bytes, encInfo->nchunks * CHUNK_ENTRY_SIZE, encInfo);
+    free(bytes);
+    return ret;
 }
 
 
 /* --- Description for encode_secret_file_data Function --->
- * Input: encInfo
+ * Input: encInfo (table_image set by encode_chunk_table, or table filled by encode_prepare_chunks)
  * Output: Status
- * Description: Reads secret file into buffer and encodes byte by byte into image.
+ * Description: Reads the chunks one by one and encodes each chunk into
+ * image, zero padded to whole groups, so memory use does not grow with the
+ * secret size. With table_image, each chunk read from the secret file is
+ * compressed, encrypted and checksummed right before embedding, and the
+ * filled table is then patched in over the colour bytes kept for it, in a
+ * single read of the secret. Otherwise the chunks come from the compressed
+ * copy, or from the secret file and are encrypted again.
  */
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-    fseek(encInfo->fptr_secret, 0, SEEK_SET);
-    char *buffer = malloc(encInfo->size_secret_file);
-    if(buffer == NULL)
+    unsigned char *buffer = malloc(encInfo->chunk_size + MAX_LSB_DEPTH);
+    unsigned char *packed = encInfo->compress ? malloc(encInfo->chunk_size + MAX_LSB_DEPTH) : NULL;
+    FILE *fptr = encInfo->fptr_stored != NULL ? encInfo->fptr_stored : encInfo->fptr_secret;
+    Status ret = e_success;
+
+    if(buffer == NULL || (encInfo->compress && packed == NULL))
     {
-        perror("malloc failed\n");
+        perror("malloc");
+        free(buffer);
+        free(packed);
         return e_failure;
     }
-    fread(buffer, 1, encInfo->size_secret_file, encInfo->fptr_secret);
-    encode_data_to_image(buffer, encInfo->size_secret_file, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+
+    fseeko(fptr, 0, SEEK_SET);
+    for(uint64_t i = 0; i < encInfo->nchunks && ret == e_success; i++)
+    {
+        unsigned char *data = buffer;
+
+        if(encInfo->table_image != NULL)
+        {
+            uint64_t left = encInfo->size_secret_file - i * encInfo->chunk_size;
+            size_t len = left < encInfo->chunk_size ? left : encInfo->chunk_size;
+
+            if(fread(buffer, 1, len, fptr) != len)
+                ret = e_failure;
+            encode_stored_chunk(encInfo, &encInfo->table[i], i, buffer, len, packed, &data);
+        }
+        else
+        {
+            if(fread(buffer, 1, encInfo->table[i].length, fptr) != encInfo->table[i].length)
+                ret = e_failure;
+            if(encInfo->fptr_stored == NULL)
+                encode_encrypt(encInfo, buffer, encInfo->table[i].length, i * encInfo->chunk_size);
+        }
+
+        size_t chunk = encInfo->table[i].length;
+        size_t stored = chunk_stored_size(chunk, encInfo->depth);
+        memset(data + chunk, 0, stored - chunk);
+        if(ret == e_success && encode_data_at_depth(data, stored, encInfo->depth, &encInfo->rows) == e_failure)
+        {
+            fprintf(job_stderr(), "ERROR : Image cannot hold secret data\n");
+            ret = e_failure;
+        }
+    }
     free(buffer);
-    return e_success;
+    free(packed);
+
+    // the table precedes the chunks but is only known once they are done
+    if(ret == e_success && encInfo->table_image != NULL)
+    {
+        unsigned char *bytes = pack_chunk_table(encInfo);
+        size_t table_size = encInfo->nchunks * CHUNK_ENTRY_SIZE;
+
+        if(bytes == NULL)
+            return e_failure;
+        lsb_embed_depth(encInfo->table_image, bytes, table_size, 1);
+        free(bytes);
+        ret = bmp_rows_patch(&encInfo->rows, encInfo->table_pos, encInfo->table_image, 8 * table_size);
+    }
+
+    if(ret == e_success && encInfo->compress)
+    {
+        uint64_t stored = 0;
+        for(uint64_t i = 0; i < encInfo->nchunks; i++)
+            stored += encInfo->table[i].length;
+        info_printf("INFO : Secret compressed from %llu to %llu bytes\n",
+                    (unsigned long long)encInfo->size_secret_file, (unsigned long long)stored);
+    }
+    return ret;
+}
+
+
+/* --- Description for encode_secret_file_frames Function --->
+ * Input: encInfo
+ * Output: Status
+ * Description: Used when the secret size is not known up front (pipe).
+ * The secret is read in chunks of up to encInfo->chunk_size bytes, each
+ * chunk is encoded as its entry (length and checksum) followed by the bytes,
+ * both zero padded to whole groups of image bytes. An entry of length 0
+ * marks the end of the secret.
+ */
+Status encode_secret_file_frames(EncodeInfo *encInfo)
+{
+    size_t start = chunk_stored_size(CHUNK_ENTRY_SIZE, encInfo->depth);    // padded entry
+    unsigned char *frame = calloc(1, start + encInfo->chunk_size + MAX_LSB_DEPTH);
+    unsigned char *raw = malloc(encInfo->chunk_size);
+    Status ret = e_success;
+    uint64_t index = 0;
+    size_t got, len;
+
+    if(frame == NULL || raw == NULL)
+    {
+        perror("malloc");
+        free(frame);
+        free(raw);
+        return e_failure;
+    }
+
+    do
+    {
+        ChunkEntry entry;
+        unsigned char *data;
+
+        got = fread(raw, 1, encInfo->chunk_size, encInfo->fptr_secret);
+        encInfo->metrics.payload_bytes += got;
+        encode_stored_chunk(encInfo, &entry, index++, raw, got, frame + start, &data);
+        if(data == raw)
+            memcpy(frame + start, raw, got);
+        chunk_entry_pack(&entry, frame);
+        len = start + chunk_stored_size(entry.length, encInfo->depth);
+        memset(frame + start + entry.length, 0, len - start - entry.length);
+
+        if(encode_data_at_depth(frame, len, encInfo->depth, &encInfo->rows) == e_failure)
+        {
+            fprintf(job_stderr(), "ERROR : Image cannot hold secret data\n");
+            ret = e_failure;
+            break;
+        }
+    } while(got > 0);
+
+    if(ferror(encInfo->fptr_secret))
+    {
+        perror("fread");
+        ret = e_failure;
+    }
+    free(frame);
+    free(raw);
+    return ret;
 }
 
 
@@ -315,14 +765,729 @@ Status encode_secret_file_data(EncodeInfo *encInfo)
  */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-    char ch;
-    while(fread(&ch, 1, 1, fptr_src) == 1)
-        fwrite(&ch, 1, 1, fptr_dest);
+    char buffer[64 * 1024];
+    size_t got;
+
+    while((got = fread(buffer, 1, sizeof(buffer), fptr_src)) > 0)
+    {
+        if(fwrite(buffer, 1, got, fptr_dest) != got)
+            return e_failure;
+    }
+    return ferror(fptr_src) ? e_failure : e_success;
+}
+
+
+/* --- Description for encode_header_to_buffer Function --->
+ * Input: encInfo, header (at least MAX_HEADER_SIZE bytes)
+ * Output: number of header bytes
+ * Description: Lays out the version 1 header that precedes the chunk table
+ * from the fields of encInfo, see container_header_pack.
+ */
+uint encode_header_to_buffer(EncodeInfo *encInfo, unsigned char *header)
+{
+    ContainerHeader fields = { 0 };
+
+    strcpy(fields.extn, encInfo->extn_secret_file);
+    fields.depth = encInfo->depth;
+    fields.size = encInfo->size_secret_file;
+    fields.flags = encInfo->flags;
+    fields.chunk_size = encInfo->chunk_size;
+    if(encInfo->flags & CONTAINER_ENCRYPTED)
+    {
+        unsigned char check[4] = { 0 };
+        chacha20_xor(&encInfo->cipher, check, sizeof(check), 0);
+        memcpy(fields.nonce, encInfo->nonce, CHACHA_NONCE_SIZE);
+        fields.key_check = get_le(check, 4);
+    }
+    if(encInfo->flags & CONTAINER_SHARDED)
+        fields.shard = encInfo->shard;
+    return container_header_pack(&fields, header);
+}
+
+
+/* --- Description for encode_required_image_bytes Function --->
+ * Input: encInfo (extension, size and container fields set)
+ * Output: colour bytes needed to hold header, chunk table and chunks
+ * Description: Header and table take 8 image bytes per byte, the chunks
+ * 8 / depth. Streamed secrets only need room for the header here, the
+ * frames are checked while they are written. Compressed chunks are
+ * counted at their stored length once the table is filled; while it is
+ * still to be patched in (table_image) they are only known as they are
+ * embedded, and are checked then.
+ * The keyed order may leave up to a block unused.
+ */
+uint64_t encode_required_image_bytes(EncodeInfo *encInfo)
+{
+    unsigned char header[MAX_HEADER_SIZE];
+    uint64_t header_size = encode_header_to_buffer(encInfo, header);
+    uint64_t required = 8 * (header_size + encInfo->nchunks * CHUNK_ENTRY_SIZE);
+
+    if(encInfo->flags & CONTAINER_SCATTERED)     // partial last block unused
+        required += SCATTER_BLOCK_SIZE - 1;
+    if(!(encInfo->flags & CONTAINER_COMPRESSED))
+        return required + lsb_image_bytes(chunk_stored_size(encInfo->size_secret_file, encInfo->depth), encInfo->depth);
+
+    for(uint64_t i = 0; i < encInfo->nchunks; i++)
+        required += lsb_image_bytes(chunk_stored_size(encInfo->table[i].length, encInfo->depth), encInfo->depth);
+    return required;
+}
+
+
+/* --- Description for encode_data_at_offset Function --->
+ * Input: data, size, depth, src_fd, stego_fd, offset (image offset, advanced)
+ * Output: Status
+ * Description: Positional counterpart of encode_data_at_depth. Image bytes
+ * are read with pread from the source and written with pwrite to the same
+ * offset of the stego image.
+ */
+Status encode_data_at_offset(const unsigned char *data, size_t size, uint depth, int src_fd, int stego_fd, off_t *offset)
+{
+    unsigned char image_block[LSB_BLOCK_SIZE * 8];
+    size_t block = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(depth);
+    size_t chunk;
+
+    for(size_t done = 0; done < size; done += chunk)
+    {
+        chunk = (size - done < block) ? size - done : block;
+        ssize_t image_bytes = lsb_image_bytes(chunk, depth);
+
+        if(pread(src_fd, image_block, image_bytes, *offset) != image_bytes)
+            return e_failure;
+        lsb_embed_depth(image_block, data + done, chunk, depth);
+        if(pwrite(stego_fd, image_block, image_bytes, *offset) != image_bytes)
+            return e_failure;
+        *offset += image_bytes;
+    }
     return e_success;
 }
 
 
-/* --- Description for do_encoding Function --->
+/* --- Description for encode_frames_at_offset Function --->
+ * Input: encInfo (secret and stego image opened, stego image read-write and linear), index, image_offset
+ * Output: Status
+ * Description: Positional counterpart of encode_secret_file_frames, used to
+ * append to a payload stored in frames without rewriting the image. The
+ * frames, numbered from index, and the ending entry are embedded into the
+ * stego image's own bytes from image_offset on. The caller checks
+ * the capacity first, so a full image can't leave the payload unterminated.
+ */
+Status encode_frames_at_offset(EncodeInfo *encInfo, uint64_t index, uint64_t image_offset)
+{
+    off_t offset = image_offset;
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    size_t start = chunk_stored_size(CHUNK_ENTRY_SIZE, encInfo->depth);    // padded entry
+    unsigned char *frame = calloc(1, start + encInfo->chunk_size + MAX_LSB_DEPTH);
+    unsigned char *raw = malloc(encInfo->chunk_size);
+    Status ret = e_success;
+    size_t got, len;
+
+    if(frame == NULL || raw == NULL)
+    {
+        perror("malloc");
+        free(frame);
+        free(raw);
+        return e_failure;
+    }
+
+    do
+    {
+        ChunkEntry entry;
+        unsigned char *data;
+
+        got = fread(raw, 1, encInfo->chunk_size, encInfo->fptr_secret);
+        encode_stored_chunk(encInfo, &entry, index++, raw, got, frame + start, &data);
+        if(data == raw)
+            memcpy(frame + start, raw, got);
+        chunk_entry_pack(&entry, frame);
+        len = start + chunk_stored_size(entry.length, encInfo->depth);
+        memset(frame + start + entry.length, 0, len - start - entry.length);
+
+        if(encode_data_at_offset(frame, len, encInfo->depth, stego_fd, stego_fd, &offset) == e_failure)
+        {
+            perror("pwrite");
+            ret = e_failure;
+            break;
+        }
+    } while(got > 0);
+
+    if(ferror(encInfo->fptr_secret))
+    {
+        perror("fread");
+        ret = e_failure;
+    }
+    free(frame);
+    free(raw);
+    return ret;
+}
+
+
+// Shared state of the threads embedding the secret data
+typedef struct _EncodeChunks
+{
+    size_t size;                    // secret bytes
+    size_t chunk_size;              // secret bytes per chunk, whole groups of image bytes
+    uint depth;
+    ChunkEntry *table;              // filled in by the threads
+    const ChaCha *cipher;           // NULL unless encrypting
+    const unsigned char *secret;    // mmap: mapped secret
+    StegoImage *image;              // mmap: stego mapping
+    uint64_t pos;                   // mmap: colour byte of the secret data
+    int secret_fd;                  // reflink: descriptors for pread/pwrite
+    int src_fd;
+    int stego_fd;
+    off_t offset;                   // reflink: image offset of the secret data
+} EncodeChunks;
+
+
+/* --- Description for encode_chunk_mmap Function --->
+ * Input: ctx (EncodeChunks), chunk, worker
+ * Output: Status
+ * Description: Embeds secret bytes [chunk * chunk_size, +chunk_size) into their
+ * colour bytes inside the stego mapping and records the chunk in the table
+ * (see stego_embed_chunk).
+ */
+static Status encode_chunk_mmap(void *ctx, size_t chunk, uint worker)
+{
+    EncodeChunks *chunks = ctx;
+    size_t start = chunk * chunks->chunk_size;
+    size_t len = chunks->size - start < chunks->chunk_size ? chunks->size - start : chunks->chunk_size;
+    (void)worker;
+
+    stego_embed_chunk(chunks->image, chunks->pos + lsb_image_bytes(start, chunks->depth), chunks->secret + start, len,
+                      chunks->depth, chunks->cipher, start, &chunks->table[chunk]);
+    return e_success;
+}
+
+
+/* --- Description for encode_chunk_at_offset Function --->
+ * Input: ctx (EncodeChunks), chunk, worker
+ * Output: Status
+ * Description: Positional I/O version of encode_chunk_mmap. Secret bytes are
+ * read with pread, so threads never share a file position.
+ */
+static Status encode_chunk_at_offset(void *ctx, size_t chunk, uint worker)
+{
+    EncodeChunks *chunks = ctx;
+    unsigned char secret_block[LSB_BLOCK_SIZE];
+    size_t block = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(chunks->depth);
+    size_t start = chunk * chunks->chunk_size;
+    size_t end = chunks->size - start < chunks->chunk_size ? chunks->size : start + chunks->chunk_size;
+    off_t offset = chunks->offset + lsb_image_bytes(start, chunks->depth);
+    uint crc = 0;
+    (void)worker;
+
+    for(size_t pos = start; pos < end; )
+    {
+        size_t want = end - pos < block ? end - pos : block;
+        size_t stored = chunk_stored_size(want, chunks->depth);
+        // a short read would shift the following bytes off their group
+        if(pread(chunks->secret_fd, secret_block, want, pos) != (ssize_t)want)
+            return e_failure;
+        if(chunks->cipher != NULL)
+            chacha20_xor(chunks->cipher, secret_block, want, CIPHER_DATA_OFFSET + pos);
+        crc = crc32c(crc, secret_block, want);
+        memset(secret_block + want, 0, stored - want);
+        if(encode_data_at_offset(secret_block, stored, chunks->depth, chunks->src_fd, chunks->stego_fd, &offset) == e_failure)
+            return e_failure;
+        pos += want;
+    }
+
+    chunks->table[chunk].length = end - start;
+    chunks->table[chunk].crc = crc;
+    return e_success;
+}
+
+
+/* --- Description for encode_image_mmap Function --->
+ * Input: encInfo (files opened, capacity checked)
+ * Output: Status
+ * Description: Memory mapped variant of steps 3 to 7 of do_encoding.
+ * The source image and secret file are mapped read-only, the stego image is
+ * created at its final size and mapped writable. The whole source image is
+ * copied with a single memcpy and the header and secret data are then
+ * embedded into the mapping through the library (see stego.h), by
+ * encInfo->jobs threads. Padded rows and 32 bpp pixels are walked by the
+ * library, so any supported image can take this path.
+ */
+Status encode_image_mmap(EncodeInfo *encInfo)
+{
+    MappedFile src, secret, stego;
+    unsigned char header[MAX_HEADER_SIZE];
+    uint header_size = encode_header_to_buffer(encInfo, header);
+    size_t table_size = encInfo->nchunks * CHUNK_ENTRY_SIZE;
+    size_t required = encInfo->bmp.data_offset + encode_required_image_bytes(encInfo);
+
+    if(map_file_read(encInfo->fptr_src_image, &src) == e_failure)
+        return e_failure;
+    if(src.size < required)
+    {
+        fprintf(job_stderr(), "ERROR : %s is shorter than its header claims\n", encInfo->src_image_fname);
+        unmap_file(&src);
+        return e_failure;
+    }
+    if(map_file_read(encInfo->fptr_secret, &secret) == e_failure)
+    {
+        unmap_file(&src);
+        return e_failure;
+    }
+    if(map_file_write(encInfo->fptr_stego_image, src.size, &stego) == e_failure)
+    {
+        unmap_file(&src);
+        unmap_file(&secret);
+        return e_failure;
+    }
+
+    // header, untouched tail and the pixels about to be modified in one go
+    metrics_stage(&encInfo->metrics, e_stage_header);
+    memcpy(stego.data, src.data, src.size);
+
+    metrics_stage(&encInfo->metrics, e_stage_magic);
+    StegoImage image;
+    if(stego_image_init(&image, stego.data, stego.size) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : %s: %s\n", encInfo->src_image_fname, stego_error_string(image.error));
+        unmap_file(&src);
+        unmap_file(&secret);
+        unmap_file(&stego);
+        return e_failure;
+    }
+    stego_embed(&image, 0, header, header_size, 1);
+
+    EncodeChunks chunks = { 0 };
+    chunks.size = encInfo->size_secret_file;
+    chunks.depth = encInfo->depth;
+    chunks.chunk_size = encInfo->chunk_size;
+    chunks.table = encInfo->table;
+    chunks.cipher = encInfo->flags & CONTAINER_ENCRYPTED ? &encInfo->cipher : NULL;
+    chunks.secret = secret.data;
+    chunks.image = &image;
+    chunks.pos = 8 * (header_size + table_size);
+    metrics_stage(&encInfo->metrics, e_stage_data);
+    Status ret = parallel_for(encInfo->jobs, encInfo->nchunks, encode_chunk_mmap, &chunks);
+
+    // the table precedes the chunks but is only known once they are done
+    metrics_stage(&encInfo->metrics, e_stage_table);
+    unsigned char *bytes = ret == e_success ? pack_chunk_table(encInfo) : NULL;
+    if(bytes != NULL)
+        stego_embed(&image, 8 * header_size, bytes, table_size, 1);
+    else
+        ret = e_failure;
+    free(bytes);
+
+    unmap_file(&src);
+    unmap_file(&secret);
+    unmap_file(&stego);
+    return ret;
+}
+
+
+/* --- Description for encode_image_reflink Function --->
+ * Input: encInfo (files opened, capacity checked)
+ * Output: Status
+ * Description: Only the first bfOffBits + 8 * (header + table) + 8 * secret / depth bytes of the stego
+ * image differ from the source. The source image is cloned into the stego
+ * image inside the kernel (see clone_file), then only that prefix is read,
+ * embedded and written back with pwrite. The secret data is cut in chunks
+ * handled by encInfo->jobs threads. Needs contiguous colour bytes (bmp_is_linear).
+ * An image updated in place (encInfo->in_place) is its own source and is
+ * not cloned.
+ */
+Status encode_image_reflink(EncodeInfo *encInfo)
+{
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    unsigned char header[MAX_HEADER_SIZE];
+    uint header_size = encode_header_to_buffer(encInfo, header);
+    off_t offset = encInfo->bmp.data_offset;
+    const char *method;
+    struct stat st;
+
+    if(fstat(src_fd, &st) == -1)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    metrics_stage(&encInfo->metrics, e_stage_header);
+    if(encInfo->in_place)
+        info_printf("INFO : Updating the image in place\n");
+    else if(clone_file(encInfo->fptr_src_image, encInfo->fptr_stego_image, st.st_size, &method) == e_failure)
+        return e_failure;
+    else
+        info_printf("INFO : Source image cloned using %s\n", method);
+
+    metrics_stage(&encInfo->metrics, e_stage_magic);
+    if(encode_data_at_offset(header, header_size, 1, src_fd, stego_fd, &offset) == e_failure)
+        return e_failure;
+
+    EncodeChunks chunks = { 0 };
+    chunks.size = encInfo->size_secret_file;
+    chunks.depth = encInfo->depth;
+    chunks.chunk_size = encInfo->chunk_size;
+    chunks.table = encInfo->table;
+    chunks.cipher = encInfo->flags & CONTAINER_ENCRYPTED ? &encInfo->cipher : NULL;
+    chunks.secret_fd = fileno(encInfo->fptr_secret);
+    chunks.src_fd = src_fd;
+    chunks.stego_fd = stego_fd;
+    chunks.offset = offset + 8 * encInfo->nchunks * CHUNK_ENTRY_SIZE;
+    metrics_stage(&encInfo->metrics, e_stage_data);
+    if(parallel_for(encInfo->jobs, encInfo->nchunks, encode_chunk_at_offset, &chunks) == e_failure)
+        return e_failure;
+
+    // the table precedes the chunks but is only known once they are done
+    metrics_stage(&encInfo->metrics, e_stage_table);
+    unsigned char *bytes = pack_chunk_table(encInfo);
+    if(bytes == NULL)
+        return e_failure;
+    Status ret = encode_data_at_offset(bytes, encInfo->nchunks * CHUNK_ENTRY_SIZE, 1, src_fd, stego_fd, &offset);
+    free(bytes);
+    return ret;
+}
+
+
+// One block of the pipelined path: image bytes [offset, offset + len) and the secret bytes they carry
+typedef struct _PipelineSlot
+{
+    unsigned char *image;
+    unsigned char *secret;
+    uint64_t block;             // index of the block, blocks are embedded in order
+    off_t offset;
+    size_t len;
+    uint64_t secret_pos;        // secret byte embedded first
+    size_t stored;              // secret bytes embedded, padding included (0 past the secret)
+    size_t secret_len;          // secret bytes read from the secret file
+    uint reads;                 // reads in flight
+    int writing;                // write in flight
+    int active;                 // holds a block, from its reads to the end of its write
+} PipelineSlot;
+
+// State of encode_image_uring
+typedef struct _EncodePipeline
+{
+    EncodeInfo *encInfo;
+    IoQueue *queue;
+    int src_fd;
+    int secret_fd;
+    int stego_fd;
+    off_t data_start;           // image offset of the secret data
+    off_t file_size;
+    uint64_t stored_size;       // secret bytes embedded, padding included
+    const ChaCha *cipher;       // NULL unless encrypting
+    off_t next;                 // image offset of the next block to read
+    uint64_t started;           // blocks read so far
+    uint64_t embedded;          // blocks embedded so far
+    PipelineSlot slots[PIPELINE_DEPTH];
+} EncodePipeline;
+
+
+/* --- Description for pipeline_read Function --->
+ * Input: pipeline, slot (free)
+ * Output: Status
+ * Description: Gives the next block of the image to the slot and queues the
+ * reads of its image bytes and of the secret bytes they will carry.
+ */
+static Status pipeline_read(EncodePipeline *pipeline, PipelineSlot *slot)
+{
+    uint depth = pipeline->encInfo->depth;
+    uint64_t size = pipeline->encInfo->size_secret_file;
+
+    slot->block = pipeline->started++;
+    slot->offset = pipeline->next;
+    slot->len = pipeline->file_size - pipeline->next < PIPELINE_BLOCK_SIZE ?
+                pipeline->file_size - pipeline->next : PIPELINE_BLOCK_SIZE;
+    slot->secret_pos = (pipeline->next - pipeline->data_start) / 8 * depth;
+    slot->stored = 0;
+    slot->secret_len = 0;
+    if(slot->secret_pos < pipeline->stored_size)
+        slot->stored = pipeline->stored_size - slot->secret_pos < PIPELINE_BLOCK_SIZE / 8 * depth ?
+                       pipeline->stored_size - slot->secret_pos : PIPELINE_BLOCK_SIZE / 8 * depth;
+    if(slot->secret_pos < size)
+        slot->secret_len = size - slot->secret_pos < slot->stored ? size - slot->secret_pos : slot->stored;
+    slot->reads = slot->secret_len > 0 ? 2 : 1;
+    slot->writing = 0;
+    slot->active = 1;
+    pipeline->next += slot->len;
+
+    if(ioq_read(pipeline->queue, pipeline->src_fd, slot->image, slot->len, slot->offset, slot) == e_failure)
+        return e_failure;
+    if(slot->secret_len > 0 &&
+       ioq_read(pipeline->queue, pipeline->secret_fd, slot->secret, slot->secret_len, slot->secret_pos, slot) == e_failure)
+        return e_failure;
+    return e_success;
+}
+
+
+/* --- Description for pipeline_embed Function --->
+ * Input: pipeline, slot (reads done)
+ * Output: None
+ * Description: Encrypts the secret bytes of the block, adds them to the
+ * checksums of their chunks and embeds them, zero padded to whole groups,
+ * at the start of the image bytes of the block. Blocks past the secret data
+ * are left as read.
+ */
+static void pipeline_embed(EncodePipeline *pipeline, PipelineSlot *slot)
+{
+    EncodeInfo *encInfo = pipeline->encInfo;
+
+    if(slot->stored == 0)
+        return;
+    if(pipeline->cipher != NULL)
+        chacha20_xor(pipeline->cipher, slot->secret, slot->secret_len, CIPHER_DATA_OFFSET + slot->secret_pos);
+    for(size_t done = 0; done < slot->secret_len; )
+    {
+        uint64_t pos = slot->secret_pos + done;
+        uint64_t chunk = pos / encInfo->chunk_size;
+        size_t piece = (chunk + 1) * encInfo->chunk_size - pos;
+
+        if(piece > slot->secret_len - done)
+            piece = slot->secret_len - done;
+        encInfo->table[chunk].crc = crc32c(encInfo->table[chunk].crc, slot->secret + done, piece);
+        encInfo->table[chunk].length += piece;
+        done += piece;
+    }
+    memset(slot->secret + slot->secret_len, 0, slot->stored - slot->secret_len);
+    lsb_embed_depth(slot->image, slot->secret, slot->stored, encInfo->depth);
+}
+
+
+/* --- Description for encode_image_uring Function --->
+ * Input: encInfo (files opened, capacity checked)
+ * Output: Status
+ * Description: Pipelined variant of steps 3 to 7 of do_encoding for large
+ * covers. The image from the secret data on is cut in blocks of
+ * PIPELINE_BLOCK_SIZE bytes, PIPELINE_DEPTH of them in flight: while one block
+ * is embedded, the reads of the next ones (image and secret bytes) and the
+ * writes of the previous ones are queued on an I/O queue (io_uring, or
+ * pread / pwrite threads, see ioqueue.h). Blocks past the secret data are
+ * copied through the same queue. The BMP headers and the container header
+ * are read first and written last, once the chunk table is known.
+ * Needs contiguous colour bytes (bmp_is_linear).
+ */
+Status encode_image_uring(EncodeInfo *encInfo)
+{
+    unsigned char header[MAX_HEADER_SIZE];
+    uint header_size = encode_header_to_buffer(encInfo, header);
+    size_t table_size = encInfo->nchunks * CHUNK_ENTRY_SIZE;
+    size_t secret_block = PIPELINE_BLOCK_SIZE / 8 * MAX_LSB_DEPTH;
+    EncodePipeline pipeline = { 0 };
+    struct stat st;
+
+    pipeline.encInfo = encInfo;
+    pipeline.src_fd = fileno(encInfo->fptr_src_image);
+    pipeline.secret_fd = fileno(encInfo->fptr_secret);
+    pipeline.stego_fd = fileno(encInfo->fptr_stego_image);
+    pipeline.data_start = encInfo->bmp.data_offset + 8 * (header_size + table_size);
+    pipeline.stored_size = chunk_stored_size(encInfo->size_secret_file, encInfo->depth);
+    pipeline.cipher = encInfo->flags & CONTAINER_ENCRYPTED ? &encInfo->cipher : NULL;
+    pipeline.next = pipeline.data_start;
+
+    if(fstat(pipeline.src_fd, &st) == -1)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    pipeline.file_size = st.st_size;
+    if(pipeline.file_size < pipeline.data_start + (off_t)lsb_image_bytes(pipeline.stored_size, encInfo->depth))
+    {
+        fprintf(job_stderr(), "ERROR : %s is shorter than its header claims\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    // headers, up to the secret data
+    metrics_stage(&encInfo->metrics, e_stage_header);
+    unsigned char *prefix = malloc(pipeline.data_start);
+    unsigned char *buffers = malloc(PIPELINE_DEPTH * (PIPELINE_BLOCK_SIZE + secret_block));
+    if(prefix == NULL || buffers == NULL)
+    {
+        perror("malloc");
+        free(prefix);
+        free(buffers);
+        return e_failure;
+    }
+    if(pread(pipeline.src_fd, prefix, pipeline.data_start, 0) != pipeline.data_start)
+    {
+        perror("pread");
+        free(prefix);
+        free(buffers);
+        return e_failure;
+    }
+
+    metrics_stage(&encInfo->metrics, e_stage_magic);
+    lsb_embed_depth(prefix + encInfo->bmp.data_offset, header, header_size, 1);
+
+    pipeline.queue = ioq_create(2 * PIPELINE_DEPTH);
+    if(pipeline.queue == NULL)
+    {
+        free(prefix);
+        free(buffers);
+        return e_failure;
+    }
+    info_printf("INFO : Pipelined I/O through %s\n", ioq_backend(pipeline.queue));
+
+    metrics_stage(&encInfo->metrics, e_stage_data);
+    Status ret = e_success;
+    for(uint i = 0; i < PIPELINE_DEPTH; i++)
+    {
+        pipeline.slots[i].image = buffers + i * (PIPELINE_BLOCK_SIZE + secret_block);
+        pipeline.slots[i].secret = pipeline.slots[i].image + PIPELINE_BLOCK_SIZE;
+        if(pipeline.next < pipeline.file_size && ret == e_success)
+            ret = pipeline_read(&pipeline, &pipeline.slots[i]);
+    }
+
+    while(ret == e_success && ioq_pending(pipeline.queue) > 0)
+    {
+        PipelineSlot *slot;
+        if(ioq_wait(pipeline.queue, (void **)&slot) == e_failure)
+        {
+            perror(ioq_backend(pipeline.queue));
+            ret = e_failure;
+            break;
+        }
+
+        // a written block frees its slot for the next one
+        if(slot->writing)
+        {
+            slot->writing = 0;
+            slot->active = 0;
+            if(pipeline.next < pipeline.file_size)
+                ret = pipeline_read(&pipeline, slot);
+            continue;
+        }
+        slot->reads--;
+
+        // blocks are embedded in order, the chunk checksums run front to back
+        for(uint i = 0; i < PIPELINE_DEPTH && ret == e_success; )
+        {
+            PipelineSlot *ready = &pipeline.slots[i];
+            // slots never given a block (covers of fewer blocks than PIPELINE_DEPTH) are skipped
+            if(!ready->active || ready->block != pipeline.embedded || ready->reads > 0 || ready->writing)
+            {
+                i++;
+                continue;
+            }
+            pipeline_embed(&pipeline, ready);
+            ready->writing = 1;
+            pipeline.embedded++;
+            ret = ioq_write(pipeline.queue, pipeline.stego_fd, ready->image, ready->len, ready->offset, ready);
+            i = 0;
+        }
+    }
+    ioq_destroy(pipeline.queue);
+
+    // the table precedes the chunks but is only known once they are done
+    metrics_stage(&encInfo->metrics, e_stage_table);
+    unsigned char *bytes = ret == e_success ? pack_chunk_table(encInfo) : NULL;
+    if(bytes != NULL)
+    {
+        lsb_embed_depth(prefix + encInfo->bmp.data_offset + 8 * header_size, bytes, table_size, 1);
+        if(pwrite(pipeline.stego_fd, prefix, pipeline.data_start, 0) != pipeline.data_start)
+        {
+            perror("pwrite");
+            ret = e_failure;
+        }
+    }
+    else
+        ret = e_failure;
+
+    free(bytes);
+    free(prefix);
+    free(buffers);
+    return ret;
+}
+
+
+/* --- Description for encode_image_stream Function --->
+ * Input: encInfo (files opened, may be pipes)
+ * Output: Status
+ * Description: Single front to back pass, no seeking, bounded buffers.
+ * Capacity is checked against the BMP headers read from the stream, then
+ * the image is walked scanline by scanline. When the secret size is unknown
+ * the header is flagged CONTAINER_STREAMED and the data is encoded in frames.
+ */
+Status encode_image_stream(EncodeInfo *encInfo)
+{
+    unsigned char header[MAX_HEADER_SIZE];
+    uint header_size = encode_header_to_buffer(encInfo, header);
+
+    metrics_stage(&encInfo->metrics, e_stage_header);
+    if(bmp_copy_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, &encInfo->bmp) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : %s is not a supported BMP image\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    if(encInfo->bmp.colour_bytes < encode_required_image_bytes(encInfo))
+    {
+        fprintf(job_stderr(), "ERROR : Image cannot hold secret data\n");
+        return e_failure;
+    }
+
+    bmp_rows_init(&encInfo->rows, &encInfo->bmp, encInfo->fptr_src_image, encInfo->fptr_stego_image);
+    metrics_stage(&encInfo->metrics, e_stage_magic);
+    if(encode_data_to_image((char *)header, header_size, encInfo) == e_failure ||
+       encode_scatter_init(encInfo) == e_failure)
+        return e_failure;
+
+    Status ret;
+    if(encInfo->flags & CONTAINER_STREAMED)
+    {
+        metrics_stage(&encInfo->metrics, e_stage_data);
+        ret = encode_secret_file_frames(encInfo);
+    }
+    else
+    {
+        metrics_stage(&encInfo->metrics, e_stage_table);
+        ret = encode_chunk_table(encInfo);
+        metrics_stage(&encInfo->metrics, e_stage_data);
+        if(ret == e_success)
+            ret = encode_secret_file_data(encInfo);
+    }
+    if(ret == e_failure || bmp_rows_flush(&encInfo->rows) == e_failure)
+        return e_failure;
+
+    metrics_stage(&encInfo->metrics, e_stage_tail);
+    return encInfo->in_place ? e_success : copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image);
+}
+
+
+/* --- Description for encode_cipher_init Function --->
+ * Input: encInfo (key_fname set)
+ * Output: Status
+ * Description: Loads the key, draws a fresh random nonce for this image and
+ * flags the container CONTAINER_ENCRYPTED.
+ */
+Status encode_cipher_init(EncodeInfo *encInfo)
+{
+    unsigned char key[CHACHA_KEY_SIZE];
+
+    if(read_key_file(encInfo->key_fname, key, sizeof(key)) == e_failure ||
+       read_random_bytes(encInfo->nonce, sizeof(encInfo->nonce)) == e_failure)
+        return e_failure;
+
+    chacha20_init(&encInfo->cipher, key, encInfo->nonce);
+    memset(key, 0, sizeof(key));
+    encInfo->flags |= CONTAINER_ENCRYPTED;
+    return e_success;
+}
+
+
+/* --- Description for encode_scatter_init Function --->
+ * Input: encInfo (header encoded)
+ * Output: Status
+ * Description: With --scatter, everything after the header goes through the
+ * keyed order, keyed by the keystream (see container.h).
+ */
+Status encode_scatter_init(EncodeInfo *encInfo)
+{
+    unsigned char key[SCATTER_KEY_SIZE] = { 0 };
+
+    if(!(encInfo->flags & CONTAINER_SCATTERED))
+        return e_success;
+    chacha20_xor(&encInfo->cipher, key, sizeof(key), SCATTER_KEY_OFFSET);
+    return bmp_rows_scatter(&encInfo->rows, key);
+}
+
+
+/* --- Description for encode_steps Function --->
  * Input: encInfo
  * Output: Status
  * Description: Master function to drive encoding process:
@@ -332,123 +1497,268 @@ Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
  * 3. Copy BMP header.
  * 4. Encode magic string.
  * 5. Encode secret file extension size and extension.
- * 6. Encode secret file size and data.
+ * 6. Encode secret file size, chunk table and data.
  * 7. Copy remaining image bytes to stego.
+ * With --mmap / --reflink / --uring, steps 3 to 7 are done by encode_image_mmap /
+ * encode_image_reflink / encode_image_uring. Pipes and --stream use encode_image_stream instead.
+ * Every step is a stage of encInfo->metrics.
  */
-Status do_encoding(EncodeInfo *encInfo)
+static Status encode_steps(EncodeInfo *encInfo)
 {
-    printf(": Opening required files\n");
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->fptr_stored = NULL;
+    encInfo->rows.window = NULL;
+    encInfo->rows.map = NULL;
+    encInfo->table = NULL;
+    encInfo->table_image = NULL;
+
+    // stego image goes to stdout, keep the INFO messages off it
+    if(strcmp(encInfo->stego_image_fname, "-") == 0)
+    {
+        encInfo->fptr_stego_image = claim_stdout();
+        if(encInfo->fptr_stego_image == NULL)
+            return e_failure;
+    }
+
+    metrics_stage(&encInfo->metrics, e_stage_open);
     if (open_files(encInfo) == e_success)
     {
-        // get the actual size of secret.txt
-        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
-        printf("INFO : Opened SkeletonCode/beautiful.bmp\n");
-        printf("INFO : Opened secret\n");
-        printf("INFO : Opened stego.bmp\n");
-        printf("INFO : Done\n");
+        // pipes can only be read once, front to back
+        if(!is_regular_file(encInfo->fptr_src_image) || !is_regular_file(encInfo->fptr_secret) ||
+           (encInfo->io_mode != e_io_stdio && !is_regular_file(encInfo->fptr_stego_image)))
+            encInfo->io_mode = e_io_stream;
+
+        // in place, only the positional path and the image walk stop where the payload ends
+        if(encInfo->in_place && encInfo->io_mode != e_io_stdio)
+            encInfo->io_mode = e_io_reflink;
+
+        // pipes get their BMP headers parsed while streaming
+        if(encInfo->io_mode != e_io_stream && bmp_read_info(encInfo->fptr_src_image, &encInfo->bmp) == e_failure)
+        {
+            fprintf(job_stderr(), "ERROR : %s is not a supported BMP image\n", encInfo->src_image_fname);
+            return e_failure;
+        }
+
+        // positional I/O needs the colour bytes back to back
+        if(encInfo->io_mode != e_io_stream && encInfo->io_mode != e_io_mmap && !bmp_is_linear(&encInfo->bmp))
+            encInfo->io_mode = e_io_stdio;
+
+        // threads need positional I/O, which the reflink path provides
+        if(encInfo->jobs > 1 && encInfo->io_mode == e_io_stdio && bmp_is_linear(&encInfo->bmp))
+            encInfo->io_mode = e_io_reflink;
+
+        // compressed chunks have no fixed image offset, they are laid out one after the other,
+        // and scattered blocks are placed through the image walk
+        if((encInfo->compress || encInfo->scatter) && encInfo->io_mode != e_io_stream)
+            encInfo->io_mode = e_io_stdio;
+
+        // get the actual size of secret.txt (unknown for pipes)
+        uint group = lsb_group_size(encInfo->depth);
+        if(is_regular_file(encInfo->fptr_secret))
+        {
+            encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+            encInfo->flags = 0;
+            encInfo->chunk_size = PARALLEL_CHUNK_SIZE - PARALLEL_CHUNK_SIZE % group;
+            encInfo->nchunks = (encInfo->size_secret_file + encInfo->chunk_size - 1) / encInfo->chunk_size;
+        }
+        else
+        {
+            encInfo->size_secret_file = 0;
+            encInfo->flags = CONTAINER_STREAMED;
+            encInfo->chunk_size = STREAM_FRAME_SIZE - STREAM_FRAME_SIZE % group;
+            encInfo->nchunks = 0;
+        }
+        if(encInfo->compress)
+            encInfo->flags |= CONTAINER_COMPRESSED;
+        if(encInfo->shard.data != 0)
+            encInfo->flags |= CONTAINER_SHARDED;
+        if(encInfo->archive)
+            encInfo->flags |= CONTAINER_ARCHIVE;
+        if(encInfo->key_fname != NULL && encode_cipher_init(encInfo) == e_failure)
+            return e_failure;
+        if(encInfo->scatter)
+            encInfo->flags |= CONTAINER_SCATTERED;
+        encInfo->table = calloc(encInfo->nchunks + 1, sizeof(ChunkEntry));
+        if(encInfo->table == NULL)
+        {
+            perror("calloc");
+            return e_failure;
+        }
+        encInfo->metrics.payload_bytes = encInfo->size_secret_file;
     }
     else
     {
-        printf("ERROR: Failed to Open files \n");
+        fprintf(job_stderr(), "ERROR: Failed to Open files \n");
         return e_failure;
     }
 
-    printf("INFO : ## Encoding Procedure Started ##\n");
-    printf("INFO : Checking for SkeletonCode/beautiful.bmp capacity to handle secret\n");
-    if (check_capacity(encInfo) == e_success)
+    // Extract extension (--extn wins, stdin defaults to .bin)
+    const char *extn = encInfo->extn_option;
+    if(extn == NULL)
+        extn = get_file_extn(encInfo->secret_fname);
+    if(extn == NULL)
+        extn = ".bin";
+    if(strlen(extn) >= MAX_FILE_SUFFIX)
     {
-        printf("INFO : Done. Found OK\n");
-    }
-    else
-    {
-        printf("ERROR : Image cannot hold secret data\n");
+        fprintf(job_stderr(), "ERROR : Secret file extension is too long\n");
         return e_failure;
     }
+    strcpy(encInfo->extn_secret_file, extn);
 
-    printf("INFO : Copying Image Header\n"); 
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+    // the table is written before the chunks: its place is kept and it is patched in once the
+    // chunks are done, a stego image on a pipe can't be patched and gets them checksummed (and
+    // compressed) in a pass of their own
+    if((encInfo->io_mode == e_io_stdio || encInfo->io_mode == e_io_stream) && !(encInfo->flags & CONTAINER_STREAMED))
     {
-        printf("INFO : Done\n");
+        if(strcmp(encInfo->stego_image_fname, "-") != 0)
+        {
+            encInfo->table_image = malloc(8 * encInfo->nchunks * CHUNK_ENTRY_SIZE + 1);
+            if(encInfo->table_image == NULL)
+            {
+                perror("malloc");
+                return e_failure;
+            }
+        }
+        else
+        {
+            metrics_stage(&encInfo->metrics, e_stage_data);
+            if(encode_prepare_chunks(encInfo) == e_failure)
+            {
+                fprintf(job_stderr(), "ERROR : Failed to read secret data\n");
+                return e_failure;
+            }
+        }
     }
-    else
+
+    if(encInfo->io_mode == e_io_stream)
     {
-        printf("ERROR : Failed to copy bmp header\n");
-        return e_failure;
-    }
+        Status ret = encode_image_stream(encInfo);
+        if(ret == e_failure)
+            fprintf(job_stderr(), "ERROR : Failed to encode secret data\n");
 
+        close_files(encInfo);
+        return ret;
+    }
 
-    printf("INFO : Encoding Magic String Signature\n"); 
-    if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+    metrics_stage(&encInfo->metrics, e_stage_capacity);
+    if (check_capacity(encInfo) == e_failure)
     {
-        printf("INFO : Done\n");
+        fprintf(job_stderr(), "ERROR : Image cannot hold secret data\n");
+        return e_failure;
     }
-    else
+
+    if(encInfo->io_mode != e_io_stdio)
     {
-        printf("ERROR : Failed to encode magic string\n");
-        return e_failure;
+        Status ret;
+        if(encInfo->io_mode == e_io_mmap)
+            ret = encode_image_mmap(encInfo);
+        else if(encInfo->io_mode == e_io_uring)
+            ret = encode_image_uring(encInfo);
+        else
+            ret = encode_image_reflink(encInfo);
+        if(ret == e_failure)
+            fprintf(job_stderr(), "ERROR : Failed to encode secret data\n");
+
+        close_files(encInfo);
+        return ret;
     }
 
-    printf("INFO : Encoding secret.txt File Extenstion Size\n"); 
-    // Extract extension
-    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname, "."));
-    if (encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+    metrics_stage(&encInfo->metrics, e_stage_header);
+    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, &encInfo->bmp) == e_success)
     {
-        printf("INFO : Done\n");
+        bmp_rows_init(&encInfo->rows, &encInfo->bmp, encInfo->fptr_src_image, encInfo->fptr_stego_image);
     }
     else
     {
-        printf("ERROR : Failed to encode secret file extn size\n");
+        fprintf(job_stderr(), "ERROR : Failed to copy bmp header\n");
         return e_failure;
     }
 
-    printf("INFO : Encoding secret.txt File Extenstion\n"); 
-    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
+    metrics_stage(&encInfo->metrics, e_stage_magic);
+    if (encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
     {
-        printf("INFO : Done\n");
+        fprintf(job_stderr(), "ERROR : Failed to encode magic string\n");
+        return e_failure;
     }
-    else
+
+    metrics_stage(&encInfo->metrics, e_stage_extn);
+    uint extn_field = strlen(encInfo->extn_secret_file) | (encInfo->depth - 1) << DEPTH_SHIFT |
+                      CONTAINER_VERSION << VERSION_SHIFT;
+    if (encode_secret_file_extn_size(extn_field, encInfo) == e_failure)
     {
-        printf("ERROR : Failed to encode secret file extn\n");
+        fprintf(job_stderr(), "ERROR : Failed to encode secret file extn size\n");
         return e_failure;
     }
 
-    printf("INFO : Encoding secret.txt File Size\n");
-    if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
+    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_failure)
     {
-        printf("INFO : Done\n");
+        fprintf(job_stderr(), "ERROR : Failed to encode secret file extn\n");
+        return e_failure;
     }
-    else
+
+    metrics_stage(&encInfo->metrics, e_stage_size);
+    if (encode_secret_file_size(encInfo) == e_failure)
     {
-        printf("ERROR : Failed to encode secret file size\n");
+        fprintf(job_stderr(), "ERROR : Failed to encode secret file size\n");
         return e_failure;
     }
 
-    printf("INFO : Encoding secret.txt File Data\n"); 
-    if (encode_secret_file_data(encInfo) == e_success)
+    if (encode_scatter_init(encInfo) == e_failure)
     {
-        printf("INFO : Done\n");
+        fprintf(job_stderr(), "ERROR : Failed to map the image for the keyed order\n");
+        return e_failure;
     }
-    else
+
+    metrics_stage(&encInfo->metrics, e_stage_table);
+    if (encode_chunk_table(encInfo) == e_failure)
     {
-        printf("ERROR : Failed to encode secret file data\n");
+        fprintf(job_stderr(), "ERROR : Failed to encode chunk table\n");
         return e_failure;
     }
-    
-    printf("INFO : Copying Left Over Data\n"); 
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+
+    metrics_stage(&encInfo->metrics, e_stage_data);
+    if (encode_secret_file_data(encInfo) == e_failure)
     {
-        printf("INFO : Done\n");
+        fprintf(job_stderr(), "ERROR : Failed to encode secret file data\n");
+        return e_failure;
     }
-    else
+
+    metrics_stage(&encInfo->metrics, e_stage_tail);
+    if (bmp_rows_flush(&encInfo->rows) == e_failure || (!encInfo->in_place &&
+        copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure))
     {
-        printf("ERROR : Failed to copy remaining data successfully\n");
+        fprintf(job_stderr(), "ERROR : Failed to copy remaining data successfully\n");
         return e_failure;
     }
 
     // close all the opened files
-    fclose(encInfo->fptr_src_image);
-    fclose(encInfo->fptr_secret);
-    fclose(encInfo->fptr_stego_image);
+    close_files(encInfo);
 
     return e_success;
 }
+
+
+/* --- Description for do_encoding Function --->
+ * Input: encInfo
+ * Output: Status
+ * Description: Runs the encoding steps (see encode_steps) as one job of
+ * encInfo->metrics, reported by the caller with metrics_report. A failed
+ * step leaves its files and buffers to close_files, called here so that
+ * long running callers (-b, -l) never keep them.
+ */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    metrics_begin(&encInfo->metrics, "encode", encInfo->src_image_fname, encInfo->stego_image_fname);
+    encInfo->metrics.jobs = encInfo->jobs;
+
+    Status ret = encode_steps(encInfo);
+    if(ret == e_failure)
+        close_files(encInfo);
+
+    static const char *const io_names[] = { "stdio", "mmap", "reflink", "stream", "uring" };
+    encInfo->metrics.path = io_names[encInfo->io_mode];
+    metrics_end(&encInfo->metrics, ret);
+    return ret;
+}
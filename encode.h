@@ -2,7 +2,13 @@
 #define ENCODE_H
 
 #include <stdio.h>  //for FILE *
+#include <sys/types.h> //for off_t
 #include "types.h" // Contains user defined types
+#include "common.h"
+#include "bmp.h"
+#include "container.h"
+#include "chacha20.h"
+#include "metrics.h"
 
 /* 
  * Structure to store information required for
@@ -11,9 +17,19 @@
  * also stored
  */
 
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
+/* How the stego image is produced */
+typedef enum
+{
+    e_io_stdio,     // fread/fwrite through the source image
+    e_io_mmap,      // embed directly into memory mapped files
+    e_io_reflink,   // clone the source image, rewrite only the modified prefix
+    e_io_stream,    // single front to back pass, works on pipes
+    e_io_uring      // asynchronous reads and writes overlapping the embedding
+} IoMode;
+
+/* Image bytes per request, and blocks in flight, of the pipelined path (--uring) */
+#define PIPELINE_BLOCK_SIZE (1024 * 1024)
+#define PIPELINE_DEPTH 4
 
 // Structure to hold Encoding related imformation
 typedef struct _EncodeInfo
@@ -21,20 +37,44 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname;  
     FILE *fptr_src_image;
-    uint image_capacity;
-    uint bits_per_pixel;
-    char image_data[MAX_IMAGE_BUF_SIZE];
+    BmpInfo bmp;            // layout of the source image
 
     /* Secret File Info */
     char *secret_fname;    
     FILE *fptr_secret;
     char extn_secret_file[MAX_FILE_SUFFIX];
-    char secret_data[MAX_SECRET_BUF_SIZE];
-    int size_secret_file;
+    uint64_t size_secret_file;   // 0 when streamed from a pipe
 
     /* Stego Image Info */      
     char *stego_image_fname;    
     FILE *fptr_stego_image;
+    BmpRows rows;           // scanlines walked from source to stego image
+    FILE *fptr_stored;      // compressed chunks waiting to be embedded (stego image on a pipe only)
+    unsigned char *table_image; // colour bytes under the chunk table until it is patched in, NULL if written in order
+    uint64_t table_pos;     // colour byte of the walk where the chunk table starts
+
+    /* Container */
+    uint flags;             // CONTAINER_* flags
+    uint chunk_size;        // payload bytes per chunk
+    uint64_t nchunks;       // entries of table (0 when streamed)
+    ChunkEntry *table;
+    ChaCha cipher;          // key and nonce, with CONTAINER_ENCRYPTED
+    unsigned char nonce[CHACHA_NONCE_SIZE];
+    ShardFields shard;      // with CONTAINER_SHARDED (shard.data != 0, set by shard mode)
+    int archive;            // payload is an archive (CONTAINER_ARCHIVE, set by archive mode)
+    int in_place;           // stego image is the source image, rewritten in place (set by update mode)
+
+    /* Options */
+    IoMode io_mode;
+    char *extn_option;      // extension given with --extn, NULL if none
+    uint jobs;              // worker threads (-j)
+    uint depth;             // LSBs per image byte for the secret data (--depth)
+    int compress;           // compress the chunks before embedding (--compress)
+    char *key_fname;        // key file given with --key, NULL to store the secret in clear
+    int scatter;            // keyed pixel order (--scatter, needs --key)
+
+    /* Instrumentation */
+    Metrics metrics;        // stage timings and I/O counters of do_encoding
 
 } EncodeInfo;
 
@@ -47,29 +87,32 @@ OperationType check_operation_type(int argc, char *argv[]);
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(int argc, char *argv[], EncodeInfo *encInfo);
 
+/* Number of arguments taken by an encoding option passed on by -s / -a */
+int encode_option_size(int argc, char *argv[], int i);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close the files opened by open_files */
+void close_files(EncodeInfo *encInfo);
+
 /* check if image has enough capacity to store secret file */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size for BMP file */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Get number of colour bytes of a BMP file */
+uint64_t get_image_size_for_bmp(FILE *fptr_image);
 
 /* Get file size of any file */
-uint get_file_size(FILE *fptr);
-
-/* Copy bmp image header(54 bytes) to output stego image */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+uint64_t get_file_size(FILE *fptr);
 
-/* Encode a byte into LSB of image data array */
-Status encode_byte_to_lsb(char data, char *image_buffer);
-
-/*  Encode integer size ino image LSBs */
-Status encode_size_to_lsb(int size, char *image_buffer);
+/* Copy bmp image headers (up to the pixel array) to output stego image */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, BmpInfo *info);
 
 /* Encode function, which does the real encoding */
-Status encode_data_to_image(const char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image,EncodeInfo *encInfo);
+Status encode_data_to_image(const char *data, int size, EncodeInfo *encInfo);
+
+/* Encode data using the given number of LSBs per image byte */
+Status encode_data_at_depth(const unsigned char *data, size_t size, uint depth, BmpRows *rows);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
@@ -78,10 +121,16 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file extension size into stego image */
-Status encode_secret_file_extn_size(int size, FILE *fptr_src_image, FILE *fptr_stego_image);
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
+
+/* Encode secret file size, flags, chunk size and header checksum into stego image */
+Status encode_secret_file_size(EncodeInfo *encInfo);
 
-/* Encode secret file size into stego image */
-Status encode_secret_file_size(int file_size, EncodeInfo *encInfo);
+/* Compute the chunk checksums up front, compressing the chunks if asked (stego image on a pipe) */
+Status encode_prepare_chunks(EncodeInfo *encInfo);
+
+/* Encode the chunk table, or keep its place to patch it in after the data */
+Status encode_chunk_table(EncodeInfo *encInfo);
 
 /* Encode secret file data into stego image */
 Status encode_secret_file_data(EncodeInfo *encInfo);
@@ -89,6 +138,39 @@ Status encode_secret_file_data(EncodeInfo *encInfo);
 /* Copy remaining image bytes from src to stego image after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
 
+/* Build the header bytes stored in the image before the chunk table */
+uint encode_header_to_buffer(EncodeInfo *encInfo, unsigned char *header);
+
+/* Image bytes needed for header, chunk table and chunks */
+uint64_t encode_required_image_bytes(EncodeInfo *encInfo);
+
+/* Encode header and secret data through memory mapped files */
+Status encode_image_mmap(EncodeInfo *encInfo);
+
+/* Clone the source image and rewrite only the modified prefix */
+Status encode_image_reflink(EncodeInfo *encInfo);
+
+/* Pipeline reads, embedding and writes of the whole image with asynchronous I/O */
+Status encode_image_uring(EncodeInfo *encInfo);
+
+/* Encode secret data streamed in frames (secret size not known) */
+Status encode_secret_file_frames(EncodeInfo *encInfo);
+
+/* Embed size bytes into the image bytes from offset on, with pread / pwrite */
+Status encode_data_at_offset(const unsigned char *data, size_t size, uint depth, int src_fd, int stego_fd, off_t *offset);
+
+/* Append frames to a payload stored in frames, in place from image_offset on */
+Status encode_frames_at_offset(EncodeInfo *encInfo, uint64_t index, uint64_t image_offset);
+
+/* Encode in a single pass over pipes with bounded buffers */
+Status encode_image_stream(EncodeInfo *encInfo);
+
+/* Load the key and pick the nonce for an encrypted secret */
+Status encode_cipher_init(EncodeInfo *encInfo);
+
+/* Switch the image walk to the keyed order after the header */
+Status encode_scatter_init(EncodeInfo *encInfo);
+
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
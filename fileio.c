@@ -0,0 +1,560 @@
+#define _GNU_SOURCE     // copy_file_range
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/random.h>
+#ifdef __linux__
+#include <linux/fs.h>   // FICLONE
+#endif
+#include <pthread.h>
+#include "fileio.h"
+#include "types.h"
+
+// Client descriptors standing in for stdin / stdout / stderr on this thread (see set_job_fds)
+static __thread int job_in_fd = -1, job_out_fd = -1;
+static __thread FILE *job_out, *job_err;
+static __thread int job_out_claimed;
+
+// Text output of this thread set by redirect_stdout, NULL for the one above
+static __thread FILE *job_text;
+
+// /dev/null, shared by every silenced thread (stdio locks the stream)
+static FILE *null_out;
+static pthread_once_t null_out_once = PTHREAD_ONCE_INIT;
+
+/* --- Description for map_file_read Function --->
+ * Input: fptr (opened for reading), map
+ * Output: Status (e_success/e_failure)
+ * Description: Maps the whole file read-only. An empty file gives
+ * a NULL mapping of size 0 which is still a success.
+ */
+Status map_file_read(FILE *fptr, MappedFile *map)
+{
+    struct stat st;
+
+    map->data = NULL;
+    map->size = 0;
+
+    if(fstat(fileno(fptr), &st) == -1)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+    if(st.st_size == 0)
+        return e_success;
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+    if(addr == MAP_FAILED)
+    {
+        perror("mmap");
+        return e_failure;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    map->data = addr;
+    map->size = st.st_size;
+    return e_success;
+}
+
+
+/* --- Description for map_file_write Function --->
+ * Input: fptr (opened for writing), size, map
+ * Output: Status (e_success/e_failure)
+ * Description: Sets the file to its final size and maps it shared and
+ * writable, so stores into the mapping land directly in the file.
+ */
+Status map_file_write(FILE *fptr, size_t size, MappedFile *map)
+{
+    map->data = NULL;
+    map->size = 0;
+
+    fflush(fptr);
+    if(ftruncate(fileno(fptr), size) == -1)
+    {
+        perror("ftruncate");
+        return e_failure;
+    }
+    if(size == 0)
+        return e_success;
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fptr), 0);
+    if(addr == MAP_FAILED)
+    {
+        perror("mmap");
+        return e_failure;
+    }
+
+    map->data = addr;
+    map->size = size;
+    return e_success;
+}
+
+
+/* --- Description for unmap_file Function --->
+ * Input: map
+ * Output: None
+ * Description: Unmaps the file (no-op for empty mappings).
+ */
+void unmap_file(MappedFile *map)
+{
+    if(map->data != NULL)
+        munmap(map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+
+/* --- Description for copy_fd_range Function --->
+ * Input: src_fd, dest_fd, size
+ * Output: Status
+ * Description: Last resort for clone_file, plain read/write loop with a
+ * large buffer for filesystems that support neither reflink nor
+ * copy_file_range.
+ */
+static Status copy_fd_range(int src_fd, int dest_fd, size_t size)
+{
+    static const size_t buf_size = 1 << 20;
+    char *buffer = malloc(buf_size);
+    off_t offset = 0;
+
+    if(buffer == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+    while((size_t)offset < size)
+    {
+        size_t want = size - offset < buf_size ? size - offset : buf_size;
+        ssize_t got = pread(src_fd, buffer, want, offset);
+        if(got <= 0 || pwrite(dest_fd, buffer, got, offset) != got)
+        {
+            perror("copy");
+            free(buffer);
+            return e_failure;
+        }
+        offset += got;
+    }
+    free(buffer);
+    return e_success;
+}
+
+
+/* --- Description for clone_file Function --->
+ * Input: fptr_src, fptr_dest (empty, opened for writing), size, method
+ * Output: Status
+ * Description: Makes dest a copy of the first size bytes of src without
+ * moving the data through user space:
+ *      1. FICLONE shares the extents (reflink) on XFS/Btrfs, O(1) time and space.
+ *      2. copy_file_range lets the kernel (or the server for NFS) copy.
+ *      3. pread/pwrite loop otherwise.
+ * method is set to the name of the technique that worked.
+ */
+Status clone_file(FILE *fptr_src, FILE *fptr_dest, size_t size, const char **method)
+{
+    int src_fd = fileno(fptr_src);
+    int dest_fd = fileno(fptr_dest);
+
+    fflush(fptr_dest);
+
+#ifdef FICLONE
+    if(ioctl(dest_fd, FICLONE, src_fd) == 0)
+    {
+        *method = "reflink";
+        return e_success;
+    }
+#endif
+
+#ifdef __linux__
+    loff_t in_off = 0, out_off = 0;
+    while((size_t)in_off < size)
+    {
+        ssize_t done = copy_file_range(src_fd, &in_off, dest_fd, &out_off, size - in_off, 0);
+        if(done <= 0)
+            break;
+    }
+    if((size_t)in_off == size)
+    {
+        *method = "copy_file_range";
+        return e_success;
+    }
+    // copy_file_range failed part way (EXDEV, ENOSYS ...), start over
+    if(ftruncate(dest_fd, 0) == -1)
+    {
+        perror("ftruncate");
+        return e_failure;
+    }
+#endif
+
+    *method = "read/write";
+    return copy_fd_range(src_fd, dest_fd, size);
+}
+
+
+/* --- Description for walk_bmp_files Function --->
+ * Input: dir_path, fn, ctx
+ * Output: Status (e_failure when fn fails or memory runs out)
+ * Description: Calls fn(ctx, path) for every *.bmp file below dir_path, in
+ * directory order. Symbolic links are not followed, so a link to a parent
+ * directory cannot loop. Unreadable directories are reported and skipped.
+ */
+Status walk_bmp_files(const char *dir_path, PathFn fn, void *ctx)
+{
+    DIR *dir = opendir(dir_path);
+    struct dirent *entry;
+    Status ret = e_success;
+
+    if(dir == NULL)
+    {
+        perror("opendir");
+        fprintf(job_stderr(), "ERROR : Unable to open directory %s\n", dir_path);
+        return e_success;
+    }
+
+    while(ret == e_success && (entry = readdir(dir)) != NULL)
+    {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        size_t len = strlen(dir_path) + 1 + strlen(entry->d_name) + 1;
+        char *path = malloc(len);
+        if(path == NULL)
+        {
+            ret = e_failure;
+            break;
+        }
+        snprintf(path, len, "%s/%s", dir_path, entry->d_name);
+
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if(type == DT_UNKNOWN && lstat(path, &st) == 0)     // file systems without d_type
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+        size_t name_len = strlen(entry->d_name);
+        if(type == DT_DIR)
+            ret = walk_bmp_files(path, fn, ctx);
+        else if(type == DT_REG && name_len > 4 && strcasecmp(entry->d_name + name_len - 4, ".bmp") == 0)
+            ret = fn(ctx, path);
+        free(path);
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+
+/* --- Description for is_regular_file Function --->
+ * Input: fptr
+ * Output: 1 for a regular file, 0 for pipes, sockets, terminals ...
+ */
+int is_regular_file(FILE *fptr)
+{
+    struct stat st;
+    return fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+
+/* --- Description for set_job_fds Function --->
+ * Input: in_fd, out_fd, err_fd (descriptors of a client, -1 for the process' own)
+ * Output: Status
+ * Description: Jobs served for a client run on a worker thread next to
+ * other jobs, so they can't take over the process' stdin and stdout. From
+ * here on "-" on this thread reads in_fd and writes out_fd, and the text
+ * output goes to out_fd (err_fd once the job writes data to out_fd).
+ * The descriptors are duplicated, the caller keeps its own.
+ */
+Status set_job_fds(int in_fd, int out_fd, int err_fd)
+{
+    if(job_out != NULL)
+        fclose(job_out);
+    if(job_err != NULL)
+        fclose(job_err);
+    job_out = job_err = NULL;
+    job_in_fd = job_out_fd = -1;
+    job_out_claimed = 0;
+    if(in_fd == -1)
+        return e_success;
+
+    int out_dup = dup(out_fd), err_dup = dup(err_fd);
+    job_out = out_dup == -1 ? NULL : fdopen(out_dup, "w");
+    job_err = err_dup == -1 ? NULL : fdopen(err_dup, "w");
+    if(job_out == NULL || job_err == NULL)
+    {
+        perror("dup");
+        if(job_out == NULL && out_dup != -1)
+            close(out_dup);
+        if(job_err == NULL && err_dup != -1)
+            close(err_dup);
+        set_job_fds(-1, -1, -1);
+        return e_failure;
+    }
+    job_in_fd = in_fd;
+    job_out_fd = out_fd;
+    return e_success;
+}
+
+
+/* --- Description for job_stdin Function --->
+ * Output: stream to read "-" from, NULL on failure
+ */
+FILE *job_stdin(void)
+{
+    if(job_in_fd == -1)
+        return stdin;
+
+    int fd = dup(job_in_fd);
+    FILE *fptr = fd == -1 ? NULL : fdopen(fd, "rb");
+    if(fptr == NULL && fd != -1)
+        close(fd);
+    return fptr;
+}
+
+
+/* --- Description for job_stdout Function --->
+ * Output: stream for the text output (INFO messages, reports, listings)
+ * Description: stdout, or the client's stdout / stderr for a served job,
+ * stderr once stdout carries the data (see claim_stdout), unless the
+ * thread's text output was redirected (see redirect_stdout).
+ */
+FILE *job_stdout(void)
+{
+    if(job_text != NULL)
+        return job_text;
+    if(job_out == NULL)
+        return job_out_claimed ? stderr : stdout;
+    return job_out_claimed ? job_err : job_out;
+}
+
+
+/* --- Description for job_stderr Function --->
+ * Output: stream for error messages of a served job, stderr otherwise
+ */
+FILE *job_stderr(void)
+{
+    return job_err != NULL ? job_err : stderr;
+}
+
+
+/* --- Description for claim_stdout Function --->
+ * Input: None
+ * Output: stream writing to the original stdout, NULL on failure
+ * Description: Used when "-" is given as output file. The original stdout is
+ * duplicated for the binary data and the text output of this thread moves
+ * to stderr (see job_stdout), so the INFO messages keep working without
+ * corrupting the output. A served job gets the client's stdout and its text
+ * output moves to the client's stderr. The process' descriptors are left
+ * alone, jobs on other threads are not affected.
+ */
+FILE *claim_stdout(void)
+{
+    if(job_out != NULL)
+    {
+        int fd = dup(job_out_fd);
+        FILE *fptr = fd == -1 ? NULL : fdopen(fd, "wb");
+
+        if(fptr == NULL)
+        {
+            perror("dup");
+            if(fd != -1)
+                close(fd);
+            return NULL;
+        }
+        fflush(job_out);
+        job_out_claimed = 1;
+        return fptr;
+    }
+
+    fflush(stdout);
+
+    int data_fd = dup(STDOUT_FILENO);
+    FILE *fptr = data_fd == -1 ? NULL : fdopen(data_fd, "wb");
+    if(fptr == NULL)
+    {
+        perror("dup");
+        if(data_fd != -1)
+            close(data_fd);
+        return NULL;
+    }
+    job_out_claimed = 1;
+    return fptr;
+}
+
+
+/* --- Description for redirect_stdout Function --->
+ * Input: fptr (NULL to go back to the stream job_stdout picks)
+ * Output: previous stream of this thread, for restore_stdout
+ * Description: Sends the text output of the jobs run on this thread to
+ * fptr. Unlike a dup2 over the process' stdout, jobs running on other
+ * threads keep their own.
+ */
+FILE *redirect_stdout(FILE *fptr)
+{
+    FILE *previous = job_text;
+
+    fflush(job_stdout());
+    job_text = fptr;
+    return previous;
+}
+
+
+/* --- Description for open_null_out Function --->
+ * Description: Opens /dev/null for silence_stdout. Run once through pthread_once.
+ */
+static void open_null_out(void)
+{
+    null_out = fopen("/dev/null", "w");
+}
+
+
+/* --- Description for silence_stdout Function --->
+ * Input: None
+ * Output: previous stream of this thread, for restore_stdout
+ * Description: Discards the text output of jobs run in bulk, on this
+ * thread only: batch and shard jobs call it on the worker running them.
+ * Errors still reach job_stderr.
+ */
+FILE *silence_stdout(void)
+{
+    pthread_once(&null_out_once, open_null_out);
+    return redirect_stdout(null_out);   // NULL if /dev/null can't be opened, nothing is discarded then
+}
+
+
+/* --- Description for restore_stdout Function --->
+ * Input: saved (from silence_stdout)
+ * Output: None
+ */
+void restore_stdout(FILE *saved)
+{
+    redirect_stdout(saved);
+}
+
+
+/* --- Description for read_key_file Function --->
+ * Input: fname, key (size bytes), size
+ * Output: Status (e_failure unless the file holds exactly size bytes)
+ * Description: Reads a raw binary key, e.g. made with
+ * "head -c 32 /dev/urandom > secret.key".
+ */
+Status read_key_file(const char *fname, unsigned char *key, size_t size)
+{
+    FILE *fptr = fopen(fname, "rb");
+    unsigned char extra;
+
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open key file %s\n", fname);
+        return e_failure;
+    }
+
+    Status ret = fread(key, 1, size, fptr) == size && fread(&extra, 1, 1, fptr) == 0 ? e_success : e_failure;
+    fclose(fptr);
+    if(ret == e_failure)
+        fprintf(job_stderr(), "ERROR : Key file %s must hold exactly %zu bytes\n", fname, size);
+    return ret;
+}
+
+
+/* --- Description for read_random_bytes Function --->
+ * Input: buffer, size
+ * Output: Status
+ * Description: Fills buffer from the kernel random number generator.
+ */
+Status read_random_bytes(unsigned char *buffer, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t got = getrandom(buffer, size, 0);
+        if(got == -1)
+        {
+            perror("getrandom");
+            return e_failure;
+        }
+        buffer += got;
+        size -= got;
+    }
+    return e_success;
+}
+
+
+/* --- Description for create_temp_file Function --->
+ * Input: fname (set to the malloc'ed name)
+ * Output: file opened for reading and writing, NULL on failure
+ * Description: Creates a file in $TMPDIR (or /tmp), for data handed to the
+ * encoder by name, where tmpfile() can't be used. The caller removes it.
+ */
+FILE *create_temp_file(char **fname)
+{
+    const char *dir = getenv("TMPDIR");
+    if(dir == NULL || *dir == '\0')
+        dir = "/tmp";
+
+    *fname = malloc(strlen(dir) + sizeof("/stego-XXXXXX"));
+    if(*fname == NULL)
+        return NULL;
+    sprintf(*fname, "%s/stego-XXXXXX", dir);
+
+    int fd = mkstemp(*fname);
+    if(fd == -1)
+    {
+        perror("mkstemp");
+        free(*fname);
+        *fname = NULL;
+        return NULL;
+    }
+    FILE *fptr = fdopen(fd, "w+b");
+    if(fptr == NULL)
+        close(fd);
+    return fptr;
+}
+
+
+/* --- Description for create_sibling_file Function --->
+ * Input: fname (final name), temp_fname (set to the malloc'ed name)
+ * Output: file opened for writing, NULL on failure
+ * Description: Creates fname.stego-PID-N with O_EXCL, a name no other job
+ * of this process or another one is using, in the directory of fname so
+ * that rename can move it in place once complete. Unlike mkstemp the file
+ * gets the usual mode (0666 less the umask), which rename keeps. The
+ * caller renames or removes it.
+ */
+FILE *create_sibling_file(const char *fname, char **temp_fname)
+{
+    static uint counter;
+    size_t size = strlen(fname) + sizeof(".stego-4294967295-4294967295");
+
+    *temp_fname = malloc(size);
+    if(*temp_fname == NULL)
+        return NULL;
+
+    for(int tries = 0; tries < 64; tries++)
+    {
+        snprintf(*temp_fname, size, "%s.stego-%u-%u", fname, (uint)getpid(),
+                 __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+        int fd = open(*temp_fname, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if(fd == -1 && errno == EEXIST)     // left over by a process of the same pid, try the next number
+            continue;
+
+        FILE *fptr = fd == -1 ? NULL : fdopen(fd, "wb");
+        if(fptr != NULL)
+            return fptr;
+        perror("open");
+        if(fd != -1)
+        {
+            close(fd);
+            unlink(*temp_fname);
+        }
+        break;
+    }
+    free(*temp_fname);
+    *temp_fname = NULL;
+    return NULL;
+}
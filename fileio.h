@@ -0,0 +1,79 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stdio.h>  //for FILE *
+#include <stddef.h> //for size_t
+#include "types.h" // Contains user defined types
+
+/*
+ * Helpers for the fast and streaming file I/O paths.
+ * Files already opened with fopen() are mapped through their
+ * descriptors so the pixel data can be modified in place.
+ */
+
+// Structure to hold a memory mapped file
+typedef struct _MappedFile
+{
+    unsigned char *data;
+    size_t size;
+} MappedFile;
+
+
+/* -- function prototypes for file I/O helpers */
+
+/* Map an opened file read-only */
+Status map_file_read(FILE *fptr, MappedFile *map);
+
+/* Resize an opened file to size bytes and map it writable */
+Status map_file_write(FILE *fptr, size_t size, MappedFile *map);
+
+/* Release a mapping created by map_file_read / map_file_write */
+void unmap_file(MappedFile *map);
+
+/* Copy size bytes of src into dest inside the kernel (reflink if possible) */
+Status clone_file(FILE *fptr_src, FILE *fptr_dest, size_t size, const char **method);
+
+/* Called for every file found by walk_bmp_files */
+typedef Status (*PathFn)(void *ctx, const char *path);
+
+/* Call fn for every *.bmp file below a directory */
+Status walk_bmp_files(const char *dir_path, PathFn fn, void *ctx);
+
+/* Check whether an opened file is a regular (seekable, mappable) file */
+int is_regular_file(FILE *fptr);
+
+/* Take stdout over for binary output, the text output of this thread goes to stderr */
+FILE *claim_stdout(void);
+
+/* Run the jobs of this thread on a client's descriptors (-1: the process' own) */
+Status set_job_fds(int in_fd, int out_fd, int err_fd);
+
+/* Stream for "-" as input: stdin, or the client's for a served job */
+FILE *job_stdin(void);
+
+/* Streams for the text output and the errors of the job on this thread */
+FILE *job_stdout(void);
+FILE *job_stderr(void);
+
+/* Send the text output of this thread to fptr (NULL: back to job_stdout's own), returns the previous one */
+FILE *redirect_stdout(FILE *fptr);
+
+/* Discard the text output of this thread, returns what restore_stdout needs */
+FILE *silence_stdout(void);
+
+/* Undo silence_stdout */
+void restore_stdout(FILE *saved);
+
+/* Read a key file holding exactly size bytes */
+Status read_key_file(const char *fname, unsigned char *key, size_t size);
+
+/* Fill buffer with random bytes from the kernel */
+Status read_random_bytes(unsigned char *buffer, size_t size);
+
+/* Create a named temporary file, removed by the caller */
+FILE *create_temp_file(char **fname);
+
+/* Create a new file next to fname, to be renamed to it once complete */
+FILE *create_sibling_file(const char *fname, char **temp_fname);
+
+#endif
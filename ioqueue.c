@@ -0,0 +1,482 @@
+#define _GNU_SOURCE     // syscall
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__NR_io_uring_setup) && !defined(NO_IO_URING)
+#include <linux/io_uring.h>
+#define IOQ_URING
+#endif
+#include "ioqueue.h"
+#include "types.h"
+
+// One read or write, owned by the caller between ioq_read / ioq_write and ioq_wait
+typedef struct _IoRequest
+{
+    int fd;
+    int write;
+    unsigned char *buf;
+    size_t len;
+    off_t offset;
+    size_t done;                // bytes transferred so far
+    int error;                  // errno of a failed request, 0 if none
+    void *tag;
+    struct iovec iov;           // io_uring: the part still to transfer
+    struct _IoRequest *next;    // free list, or the queues of the threads
+} IoRequest;
+
+struct _IoQueue
+{
+    uint depth;
+    uint pending;               // queued and not yet returned by ioq_wait
+    IoRequest *requests;
+    IoRequest *free;            // requests not in use
+
+    /* io_uring (ring_fd -1 when served by threads) */
+    int ring_fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    uint to_submit;             // entries added since the last io_uring_enter
+
+    /* threads */
+    pthread_t threads[IOQ_THREADS];
+    uint nthreads;
+    pthread_mutex_t lock;       // protects the lists below and stop
+    pthread_cond_t work_cv;     // signalled when a request is queued or on stop
+    pthread_cond_t done_cv;     // signalled when a request completes
+    IoRequest *todo, *todo_tail;
+    IoRequest *done, *done_tail;
+    int stop;
+};
+
+
+#ifdef IOQ_URING
+/* --- Description for ring_setup Function --->
+ * Input: queue (depth set)
+ * Output: Status (e_failure if the kernel has no io_uring or refuses one)
+ * Description: Creates a ring of queue->depth entries and maps its
+ * submission and completion queues.
+ */
+static Status ring_setup(IoQueue *queue)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, queue->depth, &params);
+    if(fd < 0)
+        return e_failure;
+
+    queue->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    queue->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(queue->cq_ring_size > queue->sq_ring_size)
+            queue->sq_ring_size = queue->cq_ring_size;
+        queue->cq_ring_size = 0;
+    }
+    queue->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    queue->sq_ring = mmap(NULL, queue->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    queue->cq_ring = queue->sq_ring;
+    if(queue->sq_ring != MAP_FAILED && queue->cq_ring_size != 0)
+        queue->cq_ring = mmap(NULL, queue->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    queue->sqes = mmap(NULL, queue->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(queue->sq_ring == MAP_FAILED || queue->cq_ring == MAP_FAILED || queue->sqes == MAP_FAILED)
+    {
+        if(queue->sq_ring != MAP_FAILED)
+            munmap(queue->sq_ring, queue->sq_ring_size);
+        if(queue->cq_ring != MAP_FAILED && queue->cq_ring_size != 0)
+            munmap(queue->cq_ring, queue->cq_ring_size);
+        if(queue->sqes != MAP_FAILED)
+            munmap(queue->sqes, queue->sqes_size);
+        close(fd);
+        return e_failure;
+    }
+
+    unsigned char *sq = queue->sq_ring, *cq = queue->cq_ring;
+    queue->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    queue->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    queue->sq_array = (unsigned *)(sq + params.sq_off.array);
+    queue->cq_head = (unsigned *)(cq + params.cq_off.head);
+    queue->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    queue->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    queue->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    queue->ring_fd = fd;
+    return e_success;
+}
+
+
+/* --- Description for ring_push Function --->
+ * Input: queue, request
+ * Output: None
+ * Description: Adds a submission entry for the part of the request still to
+ * transfer. Entries are handed to the kernel by the next ring_next, so
+ * requests queued together cost one system call. The ring has an entry for
+ * every request, so it can't be full.
+ */
+static void ring_push(IoQueue *queue, IoRequest *request)
+{
+    unsigned tail = *queue->sq_tail;
+    unsigned index = tail & *queue->sq_mask;
+    struct io_uring_sqe *sqe = &queue->sqes[index];
+
+    request->iov.iov_base = request->buf + request->done;
+    request->iov.iov_len = request->len - request->done;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request->fd;
+    sqe->addr = (uintptr_t)&request->iov;
+    sqe->len = 1;
+    sqe->off = request->offset + request->done;
+    sqe->user_data = (uintptr_t)request;
+
+    queue->sq_array[index] = index;
+    __atomic_store_n(queue->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queue->to_submit++;
+}
+
+
+/* --- Description for ring_next Function --->
+ * Input: queue (requests in flight)
+ * Output: the next request done in full or failed, NULL if the ring fails (errno set)
+ * Description: Submits the new entries and reaps completions, waiting for
+ * one if there is none. Short transfers are submitted again for the rest.
+ */
+static IoRequest *ring_next(IoQueue *queue)
+{
+    for(;;)
+    {
+        unsigned head = *queue->cq_head;
+        if(head != __atomic_load_n(queue->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &queue->cqes[head & *queue->cq_mask];
+            IoRequest *request = (IoRequest *)(uintptr_t)cqe->user_data;
+            int res = cqe->res;
+
+            __atomic_store_n(queue->cq_head, head + 1, __ATOMIC_RELEASE);
+            if(res == -EINTR || res == -EAGAIN)
+                res = 0, request->error = 0;
+            else if(res < 0)
+                request->error = -res;
+            else if(res == 0 && request->len > 0)
+                request->error = ENODATA;   // end of file
+            request->done += res > 0 ? res : 0;
+            if(request->error == 0 && request->done < request->len)
+            {
+                ring_push(queue, request);
+                continue;
+            }
+            return request;
+        }
+
+        int ret = syscall(__NR_io_uring_enter, queue->ring_fd, queue->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR)
+            return NULL;
+        if(ret > 0)
+            queue->to_submit -= ret;
+    }
+}
+#endif
+
+
+/* --- Description for ioq_thread Function --->
+ * Input: arg (IoQueue)
+ * Output: NULL
+ * Description: Serves queued requests with pread / pwrite, continuing short
+ * transfers, until the queue is stopped and empty.
+ */
+static void *ioq_thread(void *arg)
+{
+    IoQueue *queue = arg;
+
+    pthread_mutex_lock(&queue->lock);
+    for(;;)
+    {
+        while(queue->todo == NULL && !queue->stop)
+            pthread_cond_wait(&queue->work_cv, &queue->lock);
+        if(queue->todo == NULL)
+            break;
+        IoRequest *request = queue->todo;
+        queue->todo = request->next;
+        pthread_mutex_unlock(&queue->lock);
+
+        while(request->done < request->len)
+        {
+            unsigned char *buf = request->buf + request->done;
+            size_t len = request->len - request->done;
+            off_t offset = request->offset + request->done;
+            ssize_t got = request->write ? pwrite(request->fd, buf, len, offset) : pread(request->fd, buf, len, offset);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got <= 0)
+            {
+                request->error = got < 0 ? errno : ENODATA;
+                break;
+            }
+            request->done += got;
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        request->next = NULL;
+        if(queue->done == NULL)
+            queue->done = request;
+        else
+            queue->done_tail->next = request;
+        queue->done_tail = request;
+        pthread_cond_signal(&queue->done_cv);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+
+/* --- Description for ioq_next Function --->
+ * Input: queue (requests in flight)
+ * Output: the next completed request, NULL if the queue fails (errno set)
+ * Description: Takes the next completion from the ring or the threads.
+ */
+static IoRequest *ioq_next(IoQueue *queue)
+{
+    IoRequest *request;
+
+#ifdef IOQ_URING
+    if(queue->ring_fd >= 0)
+        return ring_next(queue);
+#endif
+    pthread_mutex_lock(&queue->lock);
+    while(queue->done == NULL)
+        pthread_cond_wait(&queue->done_cv, &queue->lock);
+    request = queue->done;
+    queue->done = request->next;
+    pthread_mutex_unlock(&queue->lock);
+    return request;
+}
+
+
+/* --- Description for ioq_create Function --->
+ * Input: depth (requests in flight, capped at IOQ_MAX_DEPTH)
+ * Output: queue, NULL on failure
+ * Description: Sets up an io_uring, or starts IOQ_THREADS threads when the
+ * kernel has none (too old, or disabled by a seccomp filter or sysctl).
+ */
+IoQueue *ioq_create(uint depth)
+{
+    IoQueue *queue = calloc(1, sizeof(IoQueue));
+
+    if(depth == 0)
+        depth = 1;
+    if(depth > IOQ_MAX_DEPTH)
+        depth = IOQ_MAX_DEPTH;
+    if(queue == NULL || (queue->requests = calloc(depth, sizeof(IoRequest))) == NULL)
+    {
+        perror("calloc");
+        free(queue);
+        return NULL;
+    }
+    queue->depth = depth;
+    for(uint i = 0; i < depth; i++)
+    {
+        queue->requests[i].next = queue->free;
+        queue->free = &queue->requests[i];
+    }
+    queue->ring_fd = -1;
+
+#ifdef IOQ_URING
+    if(ring_setup(queue) == e_success)
+        return queue;
+#endif
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work_cv, NULL);
+    pthread_cond_init(&queue->done_cv, NULL);
+    for(uint i = 0; i < IOQ_THREADS; i++)
+    {
+        if(pthread_create(&queue->threads[i], NULL, ioq_thread, queue) != 0)
+            break;
+        queue->nthreads++;
+    }
+    if(queue->nthreads == 0)
+    {
+        fprintf(stderr, "ERROR : Unable to start the I/O threads\n");
+        ioq_destroy(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+
+/* --- Description for ioq_backend Function --->
+ * Input: queue
+ * Output: "io_uring" or "pread / pwrite threads"
+ * Description: For the INFO message of the caller.
+ */
+const char *ioq_backend(const IoQueue *queue)
+{
+    return queue->ring_fd >= 0 ? "io_uring" : "pread / pwrite threads";
+}
+
+
+/* --- Description for ioq_submit Function --->
+ * Input: queue, request fields
+ * Output: Status (e_failure, errno EBUSY, if depth requests are in flight)
+ * Description: Common part of ioq_read and ioq_write.
+ */
+static Status ioq_submit(IoQueue *queue, int fd, int write, void *buf, size_t len, off_t offset, void *tag)
+{
+    IoRequest *request = queue->free;
+
+    if(request == NULL)
+    {
+        errno = EBUSY;
+        return e_failure;
+    }
+    queue->free = request->next;
+    request->fd = fd;
+    request->write = write;
+    request->buf = buf;
+    request->len = len;
+    request->offset = offset;
+    request->done = 0;
+    request->error = 0;
+    request->tag = tag;
+    request->next = NULL;
+    queue->pending++;
+
+#ifdef IOQ_URING
+    if(queue->ring_fd >= 0)
+    {
+        ring_push(queue, request);
+        return e_success;
+    }
+#endif
+    pthread_mutex_lock(&queue->lock);
+    if(queue->todo == NULL)
+        queue->todo = request;
+    else
+        queue->todo_tail->next = request;
+    queue->todo_tail = request;
+    pthread_cond_signal(&queue->work_cv);
+    pthread_mutex_unlock(&queue->lock);
+    return e_success;
+}
+
+
+/* --- Description for ioq_read Function --->
+ * Input: queue, fd, buf, len, offset, tag
+ * Output: Status
+ * Description: Queues a read of len bytes at offset into buf. The buffer
+ * must not be touched until ioq_wait returns the tag.
+ */
+Status ioq_read(IoQueue *queue, int fd, void *buf, size_t len, off_t offset, void *tag)
+{
+    return ioq_submit(queue, fd, 0, buf, len, offset, tag);
+}
+
+
+/* --- Description for ioq_write Function --->
+ * Input: queue, fd, buf, len, offset, tag
+ * Output: Status
+ * Description: Queues a write of len bytes of buf at offset. The buffer
+ * must stay as it is until ioq_wait returns the tag.
+ */
+Status ioq_write(IoQueue *queue, int fd, const void *buf, size_t len, off_t offset, void *tag)
+{
+    return ioq_submit(queue, fd, 1, (void *)buf, len, offset, tag);
+}
+
+
+/* --- Description for ioq_wait Function --->
+ * Input: queue, tag (set to the tag of the completed request)
+ * Output: Status (e_failure with errno set if the request failed,
+ * or with *tag NULL if nothing is pending or the queue itself failed)
+ * Description: Waits for the next request to complete.
+ */
+Status ioq_wait(IoQueue *queue, void **tag)
+{
+    *tag = NULL;
+    if(queue->pending == 0)
+    {
+        errno = EINVAL;
+        return e_failure;
+    }
+
+    IoRequest *request = ioq_next(queue);
+    if(request == NULL)
+        return e_failure;
+
+    queue->pending--;
+    request->next = queue->free;
+    queue->free = request;
+    *tag = request->tag;
+    if(request->error != 0)
+    {
+        errno = request->error;
+        return e_failure;
+    }
+    return e_success;
+}
+
+
+/* --- Description for ioq_pending Function --->
+ * Input: queue
+ * Output: requests queued and not yet returned by ioq_wait
+ * Description: Lets a caller drain the queue after a failure.
+ */
+uint ioq_pending(const IoQueue *queue)
+{
+    return queue->pending;
+}
+
+
+/* --- Description for ioq_destroy Function --->
+ * Input: queue (may be NULL)
+ * Output: None
+ * Description: Waits for the requests still in flight, so their buffers can
+ * be freed afterwards, then releases the ring or stops the threads.
+ */
+void ioq_destroy(IoQueue *queue)
+{
+    if(queue == NULL)
+        return;
+
+    while(queue->pending > 0 && ioq_next(queue) != NULL)
+        queue->pending--;
+
+#ifdef IOQ_URING
+    if(queue->ring_fd >= 0)
+    {
+        munmap(queue->sqes, queue->sqes_size);
+        if(queue->cq_ring_size != 0)
+            munmap(queue->cq_ring, queue->cq_ring_size);
+        munmap(queue->sq_ring, queue->sq_ring_size);
+        close(queue->ring_fd);
+        free(queue->requests);
+        free(queue);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->work_cv);
+    pthread_mutex_unlock(&queue->lock);
+    for(uint i = 0; i < queue->nthreads; i++)
+        pthread_join(queue->threads[i], NULL);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->work_cv);
+    pthread_cond_destroy(&queue->done_cv);
+    free(queue->requests);
+    free(queue);
+}
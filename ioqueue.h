@@ -0,0 +1,50 @@
+#ifndef IOQUEUE_H
+#define IOQUEUE_H
+
+#include <stddef.h>     //for size_t
+#include <sys/types.h>  //for off_t
+#include "types.h" // Contains user defined types
+
+/*
+ * Queue of asynchronous positional reads and writes, used to keep several
+ * large requests in flight while the caller works on other buffers.
+ * Requests go to an io_uring when the kernel offers one (raw system calls,
+ * no liburing), else to a few threads calling pread / pwrite; build with
+ * -DNO_IO_URING to always use the threads. A request is either done in full
+ * (short transfers are continued) or fails, and completes with its tag.
+ * Completions may come in any order.
+ */
+
+/* Most requests in flight at once */
+#define IOQ_MAX_DEPTH 64
+
+/* Threads serving the requests without io_uring */
+#define IOQ_THREADS 2
+
+typedef struct _IoQueue IoQueue;
+
+
+/* -- function prototypes for the I/O queue */
+
+/* Create a queue for up to depth requests in flight */
+IoQueue *ioq_create(uint depth);
+
+/* Name of the backend serving the queue */
+const char *ioq_backend(const IoQueue *queue);
+
+/* Queue a read of len bytes at offset of fd into buf */
+Status ioq_read(IoQueue *queue, int fd, void *buf, size_t len, off_t offset, void *tag);
+
+/* Queue a write of len bytes of buf at offset of fd */
+Status ioq_write(IoQueue *queue, int fd, const void *buf, size_t len, off_t offset, void *tag);
+
+/* Wait for the next completion, e_failure (errno set) if its request failed */
+Status ioq_wait(IoQueue *queue, void **tag);
+
+/* Requests queued and not yet returned by ioq_wait */
+uint ioq_pending(const IoQueue *queue);
+
+/* Wait for the requests in flight and free the queue */
+void ioq_destroy(IoQueue *queue);
+
+#endif
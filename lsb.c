@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "lsb.h"
+#include "types.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSB_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Low bits of 8 image bytes used at depth 1..4, as one 64-bit mask */
+static const uint64_t lsb_depth_mask[MAX_LSB_DEPTH + 1] =
+{
+    0, 0x0101010101010101ULL, 0x0303030303030303ULL, 0x0707070707070707ULL, 0x0F0F0F0F0F0F0F0FULL
+};
+
+/* Signatures shared by every embedding / extraction kernel */
+typedef void (*LsbEmbedFn)(unsigned char *image_buffer, const unsigned char *data, size_t size);
+typedef void (*LsbExtractFn)(unsigned char *data, const unsigned char *image_buffer, size_t size);
+typedef void (*LsbEmbedGroupsFn)(unsigned char *image_buffer, const unsigned char *data, size_t groups, uint depth);
+typedef void (*LsbExtractGroupsFn)(unsigned char *data, const unsigned char *image_buffer, size_t groups, uint depth);
+
+/* Kernels in use, resolved once before the first call */
+static LsbEmbedFn lsb_embed_fn;
+static LsbExtractFn lsb_extract_fn;
+static LsbEmbedGroupsFn lsb_embed_groups_fn;
+static LsbExtractGroupsFn lsb_extract_groups_fn;
+static LsbKernel lsb_kernel = e_lsb_auto;
+static pthread_once_t lsb_kernel_once = PTHREAD_ONCE_INIT;
+
+
+/* --- Description for lsb_embed_scalar Function --->
+ * Input: image_buffer (size * 8 bytes), data (size bytes), size
+ * Output: None
+ * Description: Portable reference kernel. Least significant bit first,
+ * bit i of payload byte j goes to LSB of image byte (8 * j + i).
+ */
+static void lsb_embed_scalar(unsigned char *image_buffer, const unsigned char *data, size_t size)
+{
+    for(size_t j = 0; j < size; j++)
+    {
+        unsigned char byte = data[j];
+        for(int i = 0; i < 8; i++)
+        {
+            image_buffer[i] = (image_buffer[i] & 0xFE) | ((byte >> i) & 1);
+        }
+        image_buffer += 8;
+    }
+}
+
+/* --- Description for lsb_extract_scalar Function --->
+ * Input: data (size bytes), image_buffer (size * 8 bytes), size
+ * Output: None
+ * Description: Portable reference kernel, mirror of lsb_embed_scalar.
+ */
+static void lsb_extract_scalar(unsigned char *data, const unsigned char *image_buffer, size_t size)
+{
+    for(size_t j = 0; j < size; j++)
+    {
+        unsigned char byte = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            byte = byte | (image_buffer[i] & 1) << i;
+        }
+        data[j] = byte;
+        image_buffer += 8;
+    }
+}
+
+/* --- Description for lsb_embed_groups_scalar Function --->
+ * Input: image_buffer (groups * 8 bytes), data (groups * depth bytes), groups, depth
+ * Output: None
+ * Description: Depth 2..4 reference kernel. Each group of depth payload
+ * bytes is read as one little endian number and cut into 8 fields of
+ * depth bits, one per image byte.
+ */
+static void lsb_embed_groups_scalar(unsigned char *image_buffer, const unsigned char *data, size_t groups, uint depth)
+{
+    unsigned char mask = (1 << depth) - 1;
+
+    for(size_t g = 0; g < groups; g++)
+    {
+        uint64_t bits = 0;
+        for(uint b = 0; b < depth; b++)
+            bits |= (uint64_t)data[b] << (8 * b);
+        for(int i = 0; i < 8; i++)
+            image_buffer[i] = (image_buffer[i] & ~mask) | ((bits >> (i * depth)) & mask);
+        image_buffer += 8;
+        data += depth;
+    }
+}
+
+/* --- Description for lsb_extract_groups_scalar Function --->
+ * Input: data, image_buffer, groups, depth
+ * Output: None
+ * Description: Mirror of lsb_embed_groups_scalar.
+ */
+static void lsb_extract_groups_scalar(unsigned char *data, const unsigned char *image_buffer, size_t groups, uint depth)
+{
+    unsigned char mask = (1 << depth) - 1;
+
+    for(size_t g = 0; g < groups; g++)
+    {
+        uint64_t bits = 0;
+        for(int i = 0; i < 8; i++)
+            bits |= (uint64_t)(image_buffer[i] & mask) << (i * depth);
+        for(uint b = 0; b < depth; b++)
+            data[b] = (bits >> (8 * b)) & 0xFF;
+        image_buffer += 8;
+        data += depth;
+    }
+}
+
+#ifdef LSB_HAVE_X86
+
+/* --- Description for lsb_embed_sse2 Function --->
+ * Input: image_buffer, data, size
+ * Output: None
+ * Description: Spreads 8 payload bytes into 64 image bytes per iteration.
+ * Every payload byte is replicated 8 times with unpack instructions, then
+ * compared against the per-byte bit masks {1, 2, 4 ... 128}.
+ */
+__attribute__((target("sse2")))
+static void lsb_embed_sse2(unsigned char *image_buffer, const unsigned char *data, size_t size)
+{
+    const __m128i bit_mask = _mm_set1_epi64x(0x8040201008040201LL);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    size_t j = 0;
+
+    for(; j + 8 <= size; j += 8)
+    {
+        __m128i src = _mm_loadl_epi64((const __m128i *)(data + j));
+        __m128i x2 = _mm_unpacklo_epi8(src, src);   // b0 b0 b1 b1 ... b7 b7
+        __m128i lo = _mm_unpacklo_epi16(x2, x2);    // b0..b3, 4 times each
+        __m128i hi = _mm_unpackhi_epi16(x2, x2);    // b4..b7, 4 times each
+        __m128i rep[4];
+        rep[0] = _mm_unpacklo_epi32(lo, lo);        // b0 x8, b1 x8
+        rep[1] = _mm_unpackhi_epi32(lo, lo);        // b2 x8, b3 x8
+        rep[2] = _mm_unpacklo_epi32(hi, hi);        // b4 x8, b5 x8
+        rep[3] = _mm_unpackhi_epi32(hi, hi);        // b6 x8, b7 x8
+
+        for(int k = 0; k < 4; k++)
+        {
+            __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(rep[k], bit_mask), bit_mask), one);
+            __m128i *dst = (__m128i *)(image_buffer + 8 * j + 16 * k);
+            __m128i img = _mm_loadu_si128(dst);
+            _mm_storeu_si128(dst, _mm_or_si128(_mm_and_si128(img, keep), bits));
+        }
+    }
+    lsb_embed_scalar(image_buffer + 8 * j, data + j, size - j);
+}
+
+/* --- Description for lsb_embed_avx2 Function --->
+ * Input: image_buffer, data, size
+ * Output: None
+ * Description: Spreads 4 payload bytes into 32 image bytes per iteration
+ * using an in-lane byte shuffle to replicate each payload byte 8 times.
+ */
+__attribute__((target("avx2")))
+static void lsb_embed_avx2(unsigned char *image_buffer, const unsigned char *data, size_t size)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit_mask = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+    size_t j = 0;
+
+    for(; j + 4 <= size; j += 4)
+    {
+        int32_t word;
+        memcpy(&word, data + j, 4);
+        __m256i rep = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(rep, bit_mask), bit_mask), one);
+        __m256i *dst = (__m256i *)(image_buffer + 8 * j);
+        __m256i img = _mm256_loadu_si256(dst);
+        _mm256_storeu_si256(dst, _mm256_or_si256(_mm256_and_si256(img, keep), bits));
+    }
+    lsb_embed_scalar(image_buffer + 8 * j, data + j, size - j);
+}
+
+/* --- Description for lsb_embed_bmi2 Function --->
+ * Input: image_buffer, data, size
+ * Output: None
+ * Description: pdep deposits the 8 bits of a payload byte into the low bit
+ * of each byte of a 64-bit word, which is merged into 8 image bytes at once.
+ */
+__attribute__((target("bmi2")))
+static void lsb_embed_bmi2(unsigned char *image_buffer, const unsigned char *data, size_t size)
+{
+    const uint64_t lsb_mask = 0x0101010101010101ULL;
+
+    for(size_t j = 0; j < size; j++)
+    {
+        uint64_t img;
+        memcpy(&img, image_buffer, 8);
+        img = (img & ~lsb_mask) | _pdep_u64(data[j], lsb_mask);
+        memcpy(image_buffer, &img, 8);
+        image_buffer += 8;
+    }
+}
+
+/* --- Description for lsb_extract_sse2 Function --->
+ * Input: data, image_buffer, size
+ * Output: None
+ * Description: Shifts the LSB of every image byte up to bit 7 and collects
+ * the 16 sign bits with movemask, giving 2 payload bytes per 16 image bytes.
+ */
+__attribute__((target("sse2")))
+static void lsb_extract_sse2(unsigned char *data, const unsigned char *image_buffer, size_t size)
+{
+    size_t j = 0;
+
+    for(; j + 2 <= size; j += 2)
+    {
+        __m128i img = _mm_loadu_si128((const __m128i *)(image_buffer + 8 * j));
+        uint16_t bits = (uint16_t)_mm_movemask_epi8(_mm_slli_epi16(img, 7));
+        data[j] = (unsigned char)bits;
+        data[j + 1] = (unsigned char)(bits >> 8);
+    }
+    lsb_extract_scalar(data + j, image_buffer + 8 * j, size - j);
+}
+
+/* --- Description for lsb_extract_avx2 Function --->
+ * Input: data, image_buffer, size
+ * Output: None
+ * Description: 256-bit version of lsb_extract_sse2, 4 payload bytes per
+ * 32 image bytes.
+ */
+__attribute__((target("avx2")))
+static void lsb_extract_avx2(unsigned char *data, const unsigned char *image_buffer, size_t size)
+{
+    size_t j = 0;
+
+    for(; j + 4 <= size; j += 4)
+    {
+        __m256i img = _mm256_loadu_si256((const __m256i *)(image_buffer + 8 * j));
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(img, 7));
+        memcpy(data + j, &bits, 4);
+    }
+    lsb_extract_scalar(data + j, image_buffer + 8 * j, size - j);
+}
+
+/* --- Description for lsb_extract_bmi2 Function --->
+ * Input: data, image_buffer, size
+ * Output: None
+ * Description: pext gathers the low bit of each of 8 image bytes into one
+ * payload byte.
+ */
+__attribute__((target("bmi2")))
+static void lsb_extract_bmi2(unsigned char *data, const unsigned char *image_buffer, size_t size)
+{
+    const uint64_t lsb_mask = 0x0101010101010101ULL;
+
+    for(size_t j = 0; j < size; j++)
+    {
+        uint64_t img;
+        memcpy(&img, image_buffer, 8);
+        data[j] = (unsigned char)_pext_u64(img, lsb_mask);
+        image_buffer += 8;
+    }
+}
+
+/* --- Description for lsb_embed_groups_bmi2 Function --->
+ * Input: image_buffer, data, groups, depth
+ * Output: None
+ * Description: pdep spreads the 8 * depth payload bits of a group over the
+ * low depth bits of 8 image bytes in one instruction.
+ */
+__attribute__((target("bmi2")))
+static void lsb_embed_groups_bmi2(unsigned char *image_buffer, const unsigned char *data, size_t groups, uint depth)
+{
+    const uint64_t mask = lsb_depth_mask[depth];
+
+    for(size_t g = 0; g < groups; g++)
+    {
+        uint64_t bits = 0, img;
+        memcpy(&bits, data, depth);
+        memcpy(&img, image_buffer, 8);
+        img = (img & ~mask) | _pdep_u64(bits, mask);
+        memcpy(image_buffer, &img, 8);
+        image_buffer += 8;
+        data += depth;
+    }
+}
+
+/* --- Description for lsb_extract_groups_bmi2 Function --->
+ * Input: data, image_buffer, groups, depth
+ * Output: None
+ * Description: pext gathers the low depth bits of 8 image bytes into
+ * depth payload bytes.
+ */
+__attribute__((target("bmi2")))
+static void lsb_extract_groups_bmi2(unsigned char *data, const unsigned char *image_buffer, size_t groups, uint depth)
+{
+    const uint64_t mask = lsb_depth_mask[depth];
+
+    for(size_t g = 0; g < groups; g++)
+    {
+        uint64_t img, bits;
+        memcpy(&img, image_buffer, 8);
+        bits = _pext_u64(img, mask);
+        memcpy(data, &bits, depth);
+        image_buffer += 8;
+        data += depth;
+    }
+}
+
+#endif
+
+
+/* --- Description for lsb_kernel_supported Function --->
+ * Input: kernel
+ * Output: 1 if the running CPU can execute the kernel, else 0
+ */
+static int lsb_kernel_supported(LsbKernel kernel)
+{
+    switch(kernel)
+    {
+        case e_lsb_scalar :
+            return 1;
+#ifdef LSB_HAVE_X86
+        case e_lsb_sse2 :
+            return __builtin_cpu_supports("sse2");
+        case e_lsb_bmi2 :
+            return __builtin_cpu_supports("bmi2");
+        case e_lsb_avx2 :
+            return __builtin_cpu_supports("avx2");
+#endif
+        default :
+            return 0;
+    }
+}
+
+
+/* --- Description for lsb_install_kernel Function --->
+ * Input: kernel (e_lsb_auto to let the CPU decide)
+ * Output: Status (e_failure if the CPU lacks the requested kernel)
+ * Description: Installs the kernels used by lsb_embed_block and lsb_extract_block.
+ * Auto selection prefers AVX2, then BMI2, then SSE2, then scalar.
+ */
+static Status lsb_install_kernel(LsbKernel kernel)
+{
+    if(kernel == e_lsb_auto)
+    {
+        if(lsb_kernel_supported(e_lsb_avx2))
+            kernel = e_lsb_avx2;
+        else if(lsb_kernel_supported(e_lsb_bmi2))
+            kernel = e_lsb_bmi2;
+        else if(lsb_kernel_supported(e_lsb_sse2))
+            kernel = e_lsb_sse2;
+        else
+            kernel = e_lsb_scalar;
+    }
+
+    if(!lsb_kernel_supported(kernel))
+        return e_failure;
+
+    switch(kernel)
+    {
+#ifdef LSB_HAVE_X86
+        case e_lsb_sse2 :
+            lsb_embed_fn = lsb_embed_sse2;
+            lsb_extract_fn = lsb_extract_sse2;
+            break;
+        case e_lsb_bmi2 :
+            lsb_embed_fn = lsb_embed_bmi2;
+            lsb_extract_fn = lsb_extract_bmi2;
+            break;
+        case e_lsb_avx2 :
+            lsb_embed_fn = lsb_embed_avx2;
+            lsb_extract_fn = lsb_extract_avx2;
+            break;
+#endif
+        default :
+            lsb_embed_fn = lsb_embed_scalar;
+            lsb_extract_fn = lsb_extract_scalar;
+            break;
+    }
+
+    // deeper embedding has no SIMD version, pdep is used whenever available
+    lsb_embed_groups_fn = lsb_embed_groups_scalar;
+    lsb_extract_groups_fn = lsb_extract_groups_scalar;
+#ifdef LSB_HAVE_X86
+    if(kernel != e_lsb_scalar && lsb_kernel_supported(e_lsb_bmi2))
+    {
+        lsb_embed_groups_fn = lsb_embed_groups_bmi2;
+        lsb_extract_groups_fn = lsb_extract_groups_bmi2;
+    }
+#endif
+
+    lsb_kernel = kernel;
+    return e_success;
+}
+
+
+/* --- Description for lsb_init Function --->
+ * Input: None
+ * Output: None
+ * Description: Installs the best kernel the CPU has. Run once through
+ * pthread_once, before any kernel is used or selected.
+ */
+static void lsb_init(void)
+{
+    lsb_install_kernel(e_lsb_auto);
+}
+
+
+/* --- Description for lsb_select_kernel Function --->
+ * Input: kernel (e_lsb_auto to let the CPU decide)
+ * Output: Status (e_failure if the CPU lacks the requested kernel)
+ * Description: Replaces the kernel picked by lsb_init. Not to be called
+ * while other threads embed or extract (the bench switches kernels
+ * between runs).
+ */
+Status lsb_select_kernel(LsbKernel kernel)
+{
+    pthread_once(&lsb_kernel_once, lsb_init);
+    return lsb_install_kernel(kernel);
+}
+
+
+/* --- Description for lsb_embed_block Function --->
+ * Input: image_buffer (size * 8 bytes), data (size bytes), size
+ * Output: None
+ * Description: Embeds a whole block of payload bytes with the selected kernel.
+ */
+void lsb_embed_block(unsigned char *image_buffer, const unsigned char *data, size_t size)
+{
+    pthread_once(&lsb_kernel_once, lsb_init);
+    lsb_embed_fn(image_buffer, data, size);
+}
+
+
+/* --- Description for lsb_extract_block Function --->
+ * Input: data (size bytes), image_buffer (size * 8 bytes), size
+ * Output: None
+ * Description: Recovers a whole block of payload bytes with the selected kernel.
+ */
+void lsb_extract_block(unsigned char *data, const unsigned char *image_buffer, size_t size)
+{
+    pthread_once(&lsb_kernel_once, lsb_init);
+    lsb_extract_fn(data, image_buffer, size);
+}
+
+
+/* --- Description for lsb_image_bytes Function --->
+ * Input: size (payload bytes), depth
+ * Output: image bytes touched, a partly used last byte counts as one
+ */
+size_t lsb_image_bytes(size_t size, uint depth)
+{
+    return (8 * size + depth - 1) / depth;
+}
+
+
+/* --- Description for lsb_group_size Function --->
+ * Input: depth
+ * Output: smallest number of payload bytes filling whole image bytes
+ */
+uint lsb_group_size(uint depth)
+{
+    return depth == 3 ? 3 : 1;
+}
+
+
+/* --- Description for lsb_embed_depth Function --->
+ * Input: image_buffer (lsb_image_bytes(size, depth) bytes), data, size, depth (1..4)
+ * Output: None
+ * Description: Depth 1 goes to the bulk kernel. Otherwise whole groups of
+ * depth payload bytes (8 image bytes) go to the group kernel and the few
+ * bytes left over are embedded bit by bit, the unused high bits of a
+ * partly used last image byte are kept.
+ */
+void lsb_embed_depth(unsigned char *image_buffer, const unsigned char *data, size_t size, uint depth)
+{
+    if(depth == 1)
+    {
+        lsb_embed_block(image_buffer, data, size);
+        return;
+    }
+    pthread_once(&lsb_kernel_once, lsb_init);
+
+    size_t groups = size / depth;
+    lsb_embed_groups_fn(image_buffer, data, groups, depth);
+    image_buffer += 8 * groups;
+    data += depth * groups;
+    size -= depth * groups;
+
+    uint64_t bits = 0;
+    for(size_t b = 0; b < size; b++)
+        bits |= (uint64_t)data[b] << (8 * b);
+    for(uint left = 8 * size; left > 0; image_buffer++)
+    {
+        uint used = left < depth ? left : depth;
+        unsigned char mask = (1 << used) - 1;
+        *image_buffer = (*image_buffer & ~mask) | (bits & mask);
+        bits >>= depth;
+        left -= used;
+    }
+}
+
+
+/* --- Description for lsb_extract_depth Function --->
+ * Input: data, image_buffer, size, depth (1..4)
+ * Output: None
+ * Description: Mirror of lsb_embed_depth.
+ */
+void lsb_extract_depth(unsigned char *data, const unsigned char *image_buffer, size_t size, uint depth)
+{
+    if(depth == 1)
+    {
+        lsb_extract_block(data, image_buffer, size);
+        return;
+    }
+    pthread_once(&lsb_kernel_once, lsb_init);
+
+    size_t groups = size / depth;
+    lsb_extract_groups_fn(data, image_buffer, groups, depth);
+    image_buffer += 8 * groups;
+    data += depth * groups;
+    size -= depth * groups;
+
+    uint64_t bits = 0;
+    uint shift = 0;
+    for(uint left = 8 * size; left > 0; image_buffer++)
+    {
+        uint used = left < depth ? left : depth;
+        bits |= (uint64_t)(*image_buffer & ((1 << used) - 1)) << shift;
+        shift += depth;
+        left -= used;
+    }
+    for(size_t b = 0; b < size; b++)
+        data[b] = (bits >> (8 * b)) & 0xFF;
+}
+
+
+/* --- Description for lsb_active_kernel Function --->
+ * Output: kernel in use (resolving it first if nothing was selected yet)
+ */
+LsbKernel lsb_active_kernel(void)
+{
+    pthread_once(&lsb_kernel_once, lsb_init);
+    return lsb_kernel;
+}
+
+
+/* --- Description for lsb_kernel_name Function --->
+ * Input: kernel
+ * Output: printable kernel name
+ */
+const char *lsb_kernel_name(LsbKernel kernel)
+{
+    switch(kernel)
+    {
+        case e_lsb_scalar :
+            return "scalar";
+        case e_lsb_sse2 :
+            return "sse2";
+        case e_lsb_bmi2 :
+            return "bmi2";
+        case e_lsb_avx2 :
+            return "avx2";
+        default :
+            return "auto";
+    }
+}
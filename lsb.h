@@ -0,0 +1,64 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h> //for size_t
+#include "types.h" // Contains user defined types
+
+/*
+ * Bulk LSB kernels used by the encoder and decoder.
+ * A whole block of payload bytes is spread into (or gathered from) the
+ * LSBs of a block of image bytes in one call (8 image bytes per payload byte).
+ * The best kernel for the running CPU is picked at runtime.
+ *
+ * With a depth of k bits per image byte, payload bit n goes to bit (n % k)
+ * of image byte n / k, so k payload bytes fill exactly 8 image bytes.
+ */
+
+/* Number of payload bytes handled per bulk read/embed/write */
+#define LSB_BLOCK_SIZE 4096
+
+/* Embedding depth: low bits of every image byte used for payload */
+#define MIN_LSB_DEPTH 1
+#define MAX_LSB_DEPTH 4
+
+/* Kernels available for bulk embedding and extraction */
+typedef enum
+{
+    e_lsb_auto,
+    e_lsb_scalar,
+    e_lsb_sse2,
+    e_lsb_bmi2,
+    e_lsb_avx2
+} LsbKernel;
+
+
+/* --- function prototypes for bulk LSB kernels */
+
+/* Embed size payload bytes into the LSBs of (size * 8) image bytes */
+void lsb_embed_block(unsigned char *image_buffer, const unsigned char *data, size_t size);
+
+/* Gather size payload bytes from the LSBs of (size * 8) image bytes */
+void lsb_extract_block(unsigned char *data, const unsigned char *image_buffer, size_t size);
+
+/* Image bytes holding size payload bytes at the given depth */
+size_t lsb_image_bytes(size_t size, uint depth);
+
+/* Payload bytes per whole group of image bytes (3 for depth 3, else 1) */
+uint lsb_group_size(uint depth);
+
+/* Embed size payload bytes using the low depth bits of each image byte */
+void lsb_embed_depth(unsigned char *image_buffer, const unsigned char *data, size_t size, uint depth);
+
+/* Gather size payload bytes from the low depth bits of each image byte */
+void lsb_extract_depth(unsigned char *data, const unsigned char *image_buffer, size_t size, uint depth);
+
+/* Select the kernel to use (e_lsb_auto picks the best one supported) */
+Status lsb_select_kernel(LsbKernel kernel);
+
+/* Kernel currently in use */
+LsbKernel lsb_active_kernel(void);
+
+/* Printable name of a kernel */
+const char *lsb_kernel_name(LsbKernel kernel);
+
+#endif
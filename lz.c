@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+#include "types.h"
+
+
+/* --- Description for lz_load32 Function --->
+ * Input: p
+ * Output: 4 bytes at p (unaligned)
+ */
+static inline uint32_t lz_load32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+
+/* --- Description for lz_hash Function --->
+ * Input: seq (4 bytes)
+ * Output: index into the hash table
+ */
+static inline uint lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+
+/* --- Description for lz_put_length Function --->
+ * Input: dst, op (advanced), len (part of the length above the nibble)
+ * Output: None
+ */
+static void lz_put_length(unsigned char *dst, size_t *op, size_t len)
+{
+    for(; len >= 255; len -= 255)
+        dst[(*op)++] = 255;
+    dst[(*op)++] = len;
+}
+
+
+/* --- Description for lz_put_sequence Function --->
+ * Input: dst, op (advanced), cap, literals, nlit, offset, match (0: last sequence)
+ * Output: Status (e_failure when dst would overflow cap)
+ */
+static Status lz_put_sequence(unsigned char *dst, size_t *op, size_t cap, const unsigned char *literals,
+                              size_t nlit, size_t offset, size_t match)
+{
+    size_t mcode = match ? match - LZ_MIN_MATCH : 0;
+
+    // token, both length extensions, literals and offset at most
+    if(*op + 1 + nlit / 255 + 1 + nlit + 2 + mcode / 255 + 1 > cap)
+        return e_failure;
+
+    unsigned char *token = &dst[(*op)++];
+    *token = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+    if(nlit >= 15)
+        lz_put_length(dst, op, nlit - 15);
+    memcpy(dst + *op, literals, nlit);
+    *op += nlit;
+
+    if(match)
+    {
+        dst[(*op)++] = offset & 0xFF;
+        dst[(*op)++] = offset >> 8;
+        if(mcode >= 15)
+            lz_put_length(dst, op, mcode - 15);
+    }
+    return e_success;
+}
+
+
+/* --- Description for lz_compress Function --->
+ * Input: src, n, dst, cap
+ * Output: compressed size, 0 if the block does not fit in cap bytes
+ * Description: Greedy single pass: the last position of every 4 byte
+ * sequence is kept in a hash table and a match is taken whenever the
+ * sequence at the current position was seen within LZ_MAX_OFFSET bytes.
+ * The step grows while no match is found, so incompressible data is
+ * skipped over quickly.
+ */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS] = { 0 };
+    size_t ip = 0, anchor = 0, op = 0;
+
+    while(ip + LZ_MIN_MATCH <= n)
+    {
+        uint32_t seq = lz_load32(src + ip);
+        uint h = lz_hash(seq);
+        size_t candidate = table[h];
+        table[h] = ip;
+
+        if(candidate >= ip || ip - candidate > LZ_MAX_OFFSET || lz_load32(src + candidate) != seq)
+        {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        size_t len = LZ_MIN_MATCH;
+        while(ip + len < n && src[candidate + len] == src[ip + len])
+            len++;
+        if(lz_put_sequence(dst, &op, cap, src + anchor, ip - anchor, ip - candidate, len) == e_failure)
+            return 0;
+        ip += len;
+        anchor = ip;
+    }
+
+    if(lz_put_sequence(dst, &op, cap, src + anchor, n - anchor, 0, 0) == e_failure)
+        return 0;
+    return op;
+}
+
+
+/* --- Description for lz_get_length Function --->
+ * Input: src, ip (advanced), n, len (nibble value, 15 if extended)
+ * Output: Status (e_failure if the block ends inside the length)
+ */
+static Status lz_get_length(const unsigned char *src, size_t *ip, size_t n, size_t *len)
+{
+    if(*len < 15)
+        return e_success;
+    unsigned char byte;
+    do
+    {
+        if(*ip >= n)
+            return e_failure;
+        byte = src[(*ip)++];
+        *len += byte;
+    } while(byte == 255);
+    return e_success;
+}
+
+
+/* --- Description for lz_decompress Function --->
+ * Input: src, n, dst, cap, out_len
+ * Output: Status (e_failure for corrupted blocks or output over cap bytes)
+ * Description: Every length and offset is checked against the input and
+ * output bounds, so damaged data cannot read or write out of range.
+ */
+Status lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap, size_t *out_len)
+{
+    size_t ip = 0, op = 0;
+
+    while(ip < n)
+    {
+        unsigned char token = src[ip++];
+        size_t nlit = token >> 4;
+
+        if(lz_get_length(src, &ip, n, &nlit) == e_failure || nlit > n - ip || nlit > cap - op)
+            return e_failure;
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if(ip == n)                             // last sequence
+            break;
+
+        if(n - ip < 2)
+            return e_failure;
+        size_t offset = src[ip] | src[ip + 1] << 8;
+        size_t len = token & 0xF;
+        ip += 2;
+        if(lz_get_length(src, &ip, n, &len) == e_failure)
+            return e_failure;
+        len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > op || len > cap - op)
+            return e_failure;
+
+        // overlapping matches repeat the last offset bytes
+        for(size_t i = 0; i < len; i++)
+            dst[op + i] = dst[op - offset + i];
+        op += len;
+    }
+
+    *out_len = op;
+    return e_success;
+}
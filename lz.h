@@ -0,0 +1,34 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h> //for size_t
+#include "types.h" // Contains user defined types
+
+/*
+ * In-tree LZ77 block codec used to compress payload chunks before embedding.
+ * The block format follows LZ4: a sequence is a token byte (literal length
+ * in the high nibble, match length - 4 in the low nibble, 15 meaning more
+ * length bytes follow, each adding up to 255), the literals, a 16 bit little
+ * endian match offset and the extra match length bytes. The last sequence
+ * holds literals only. Each block is compressed on its own.
+ */
+
+/* Shortest match worth a sequence */
+#define LZ_MIN_MATCH 4
+
+/* Farthest match offset */
+#define LZ_MAX_OFFSET 65535
+
+/* Entries of the compressor's hash table (power of 2) */
+#define LZ_HASH_BITS 14
+
+
+/* -- function prototypes for the LZ codec */
+
+/* Compress n bytes of src into dst, returns the compressed size or 0 if it does not fit in cap bytes */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/* Decompress a block of n bytes into at most cap bytes of dst, *out_len receives the size */
+Status lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap, size_t *out_len);
+
+#endif
@@ -2,6 +2,14 @@
 #include <string.h>
 #include "encode.h"
 #include "decode.h"
+#include "batch.h"
+#include "probe.h"
+#include "analyze.h"
+#include "shard.h"
+#include "archive.h"
+#include "update.h"
+#include "server.h"
+#include "metrics.h"
 #include "types.h"
 #include "common.h"
 
@@ -23,12 +31,40 @@ Description:
  *      1. Determines operation type (encode/decode) based on arguments.
  *      2. Performs encoding if '-e' or '-E' is specified.
  *      3. Performs decoding if '-d' or '-D' is specified.
- *      4. Prints error messages and usage instructions for invalid arguments.
+ *      4. Runs a manifest of encode/decode jobs if '-b' or '-B' is specified.
+ *      5. Decodes only a byte range of the secret if '-x' or '-X' is specified.
+ *      6. Reports which images carry a payload if '-p' or '-P' is specified.
+ *      7. Splits a secret over several covers if '-s' or '-S' is specified,
+ *         and joins the shards back if '-m' or '-M' is specified.
+ *      8. Stores several files in one image if '-a' or '-A' is specified, lists
+ *         them if '-t' or '-T' is specified and unpacks them if '-u' or '-U' is.
+ *      9. Replaces or appends to the payload of a stego image in place if '-r'
+ *         or '-R' is specified.
+ *     10. Serves encode / decode / probe jobs on a Unix socket if '-l' or '-L'
+ *         is specified, and runs one on such a server if '-c' or '-C' is.
+ *     11. Looks for signs of LSB embedding in the pixel statistics (chi-square
+ *         and RS analysis) if '-n' or '-N' is specified.
+ *     12. Prints error messages and usage instructions for invalid arguments.
+ *     -q silences the INFO messages and --json replaces them with one JSON
+ *     record per encode / decode job, in every mode.
  */
 int main(int argc,char *argv[])
 {
     EncodeInfo encInfo;   // Structure to hold encoding info
     DecodeInfo decInfo;   // Structure to hold decoding info
+    BatchInfo batchInfo;  // Structure to hold batch info
+    ProbeInfo probeInfo;  // Structure to hold probe info
+    AnalyzeInfo analyzeInfo;  // Structure to hold analyze info
+    ShardInfo shardInfo;  // Structure to hold shard info
+    ArchiveInfo archiveInfo;  // Structure to hold archive info
+    UpdateInfo updateInfo;  // Structure to hold update info
+    ServerInfo serverInfo;  // Structure to hold server / client info
+
+    // -q / --json apply to every mode, see metrics.h
+    metrics_parse_args(&argc, argv);
+
+    // Usage messages stay off stdout when it carries JSON records
+    FILE *help = metrics_format() == e_report_json ? stderr : stdout;
 
     // Function call to check operation type (-e/-d)
     OperationType res = check_operation_type(argc,argv);
@@ -41,21 +77,24 @@ int main(int argc,char *argv[])
             if(read_and_validate_encode_args(argc, argv, &encInfo) == e_success)
             {
                 // Perform encoding
-                if(do_encoding(&encInfo) == e_success)
+                Status ret = do_encoding(&encInfo);
+                metrics_report(&encInfo.metrics);
+                if(ret == e_success)
                 {
-                    printf("INFO : ## Encoding Done Successfully ##\n");
+                    info_printf("INFO : ## Encoding Done Successfully ##\n");
                 }   
                 else
                 {
-                    printf("INFO : ## Encoding Failed ##\n");
+                    info_printf("INFO : ## Encoding Failed ##\n");
                     return e_failure;
                 }
             }
             else
             {
                 // Invalid arguments for encoding
-                printf("INFO : ## Invalid Arguments for Encoding ##\n");
-                printf("Usage : <./a.out> -e/-E <.bmp_file> <.txt_file> [output file]\n");
+                metrics_report_refused("encode", argc > 2 ? argv[2] : NULL, NULL);
+                fprintf(help, "INFO : ## Invalid Arguments for Encoding ##\n");
+                fprintf(help, "Usage : <./a.out> -e/-E <.bmp_file> <.txt_file> [output file] [--mmap|--reflink|--stream|--uring] [--extn .ext] [--depth N] [--compress] [--key file [--scatter]] [-j N]\n");
                 return e_failure;
             }
         }
@@ -66,29 +105,317 @@ int main(int argc,char *argv[])
             // Read and validate decoding arguments
             if (read_and_validate_decode_args(argc, argv, &decInfo) == e_success)
             {
-                // Open stego image for decoding
-                if (open_decode_files(&decInfo) == e_success)
+                // Perform decoding (it opens the stego image, a failed open is reported like any failure)
+                Status ret = do_decoding(&decInfo);
+                metrics_report(&decInfo.metrics);
+                if (ret == e_success)
                 {
-                    // Perform decoding
-                    if (do_decoding(&decInfo) == e_success)
-                    {
-                        printf("INFO : ## Decoding Done Successfully ##\n");
-                    }
-                    else
-                    {
-                        printf("INFO : ## Decoding Failed ##\n");
-                    }
+                    info_printf("INFO : ## Decoding Done Successfully ##\n");
                 }
                 else
                 {
-                    printf("INFO : ## Failed to Open Files for Decoding ##\n");
+                    info_printf("INFO : ## Decoding Failed ##\n");
                 }
             }
             else
             {
                 // Invalid arguments for decoding
-                printf("INFO : ## Invalid Arguments for Decoding ##\n");
-                printf("Usage : <./a.out> -d/-D <.bmp_file> [output file]\n");
+                metrics_report_refused("decode", argc > 2 ? argv[2] : NULL, NULL);
+                fprintf(help, "INFO : ## Invalid Arguments for Decoding ##\n");
+                fprintf(help, "Usage : <./a.out> -d/-D <.bmp_file> [output file] [--key file] [-j N]\n");
+            }
+        }
+        break;
+
+        case e_batch :
+        {
+            // Read and validate batch arguments
+            if (read_and_validate_batch_args(argc, argv, &batchInfo) == e_success)
+            {
+                // Run every job of the manifest
+                if (do_batch(&batchInfo) == e_success)
+                {
+                    info_printf("INFO : ## Batch Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Batch Finished With Failures ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for batch
+                fprintf(help, "INFO : ## Invalid Arguments for Batch ##\n");
+                fprintf(help, "Usage : <./a.out> -b/-B <manifest> [-j N] [--inflight M]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_extract :
+        {
+            // Read and validate extract arguments
+            if (read_and_validate_extract_args(argc, argv, &decInfo) == e_success)
+            {
+                // Decode the requested bytes only
+                if (do_extract_range(&decInfo) == e_success)
+                {
+                    info_printf("INFO : ## Extraction Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Extraction Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for extract
+                fprintf(help, "INFO : ## Invalid Arguments for Extraction ##\n");
+                fprintf(help, "Usage : <./a.out> -x/-X <.bmp_file> <offset> <length> [output file] [--key file]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_probe :
+        {
+            // Read and validate probe arguments
+            if (read_and_validate_probe_args(argc, argv, &probeInfo) == e_success)
+            {
+                // Decode the header of every image
+                if (do_probe(&probeInfo) == e_failure)
+                {
+                    info_printf("INFO : ## Probe Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for probe
+                fprintf(help, "INFO : ## Invalid Arguments for Probe ##\n");
+                fprintf(help, "Usage : <./a.out> -p/-P <.bmp_file | directory>... [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_analyze :
+        {
+            // Read and validate analyze arguments
+            if (read_and_validate_analyze_args(argc, argv, &analyzeInfo) == e_success)
+            {
+                // Run the detectors over every image
+                if (do_analyze(&analyzeInfo) == e_failure)
+                {
+                    info_printf("INFO : ## Analyze Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for analyze
+                fprintf(help, "INFO : ## Invalid Arguments for Analyze ##\n");
+                fprintf(help, "Usage : <./a.out> -n/-N <.bmp_file | directory>... [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_shard :
+        {
+            // Read and validate shard arguments
+            if (read_and_validate_shard_args(argc, argv, &shardInfo) == e_success)
+            {
+                // Split the secret and encode every shard
+                if (do_shard(&shardInfo) == e_success)
+                {
+                    info_printf("INFO : ## Sharding Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Sharding Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for shard
+                fprintf(help, "INFO : ## Invalid Arguments for Sharding ##\n");
+                fprintf(help, "Usage : <./a.out> -s/-S <.txt_file> <output prefix> <.bmp_file>... [--parity M] [--extn .ext] [--depth N] [--compress] [--key file [--scatter]] [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_join :
+        {
+            // Read and validate join arguments
+            if (read_and_validate_join_args(argc, argv, &shardInfo) == e_success)
+            {
+                // Decode the shards and rebuild the secret
+                if (do_join(&shardInfo) == e_success)
+                {
+                    info_printf("INFO : ## Joining Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Joining Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for join
+                fprintf(help, "INFO : ## Invalid Arguments for Joining ##\n");
+                fprintf(help, "Usage : <./a.out> -m/-M <.bmp_file>... [-o output file] [--key file] [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_archive :
+        {
+            // Read and validate archive arguments
+            if (read_and_validate_archive_args(argc, argv, &archiveInfo) == e_success)
+            {
+                // Pack the files and encode them
+                if (do_archive(&archiveInfo) == e_success)
+                {
+                    info_printf("INFO : ## Archiving Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Archiving Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for archive
+                fprintf(help, "INFO : ## Invalid Arguments for Archiving ##\n");
+                fprintf(help, "Usage : <./a.out> -a/-A <.bmp_file> <output .bmp_file> <file>... [--mmap|--reflink|--stream|--uring] [--depth N] [--compress] [--key file [--scatter]] [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_list :
+        {
+            // Read and validate list arguments
+            if (read_and_validate_unpack_args(argc, argv, &archiveInfo) == e_success)
+            {
+                // Decode the table of contents
+                if (do_list(&archiveInfo) == e_success)
+                {
+                    info_printf("INFO : ## Listing Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Listing Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for list
+                fprintf(help, "INFO : ## Invalid Arguments for Listing ##\n");
+                fprintf(help, "Usage : <./a.out> -t/-T <.bmp_file> [--key file]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_unpack :
+        {
+            // Read and validate unpack arguments
+            if (read_and_validate_unpack_args(argc, argv, &archiveInfo) == e_success)
+            {
+                // Decode the members asked for
+                if (do_unpack(&archiveInfo) == e_success)
+                {
+                    info_printf("INFO : ## Unpacking Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Unpacking Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for unpack
+                fprintf(help, "INFO : ## Invalid Arguments for Unpacking ##\n");
+                fprintf(help, "Usage : <./a.out> -u/-U <.bmp_file> [member]... [-o directory] [--key file]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_update :
+        {
+            // Read and validate update arguments
+            if (read_and_validate_update_args(argc, argv, &updateInfo) == e_success)
+            {
+                // Rewrite the payload in place
+                if (do_update(&updateInfo) == e_success)
+                {
+                    info_printf("INFO : ## Updating Done Successfully ##\n");
+                }
+                else
+                {
+                    info_printf("INFO : ## Updating Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for update
+                fprintf(help, "INFO : ## Invalid Arguments for Updating ##\n");
+                fprintf(help, "Usage : <./a.out> -r/-R <.bmp_file> <.txt_file> [--append] [--extn .ext] [--key file] [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_serve :
+        {
+            // Read and validate server arguments
+            if (read_and_validate_server_args(argc, argv, &serverInfo) == e_success)
+            {
+                // Serve jobs until stopped
+                if (do_serve(&serverInfo) == e_failure)
+                {
+                    info_printf("INFO : ## Server Failed ##\n");
+                    return e_failure;
+                }
+            }
+            else
+            {
+                // Invalid arguments for server
+                fprintf(help, "INFO : ## Invalid Arguments for Server ##\n");
+                fprintf(help, "Usage : <./a.out> -l/-L <socket> [-j N]\n");
+                return e_failure;
+            }
+        }
+        break;
+
+        case e_client :
+        {
+            // Read and validate client arguments
+            if (read_and_validate_client_args(argc, argv, &serverInfo) == e_success)
+            {
+                // Run the job on the server, it reports to our stdout / stderr
+                if (do_client(&serverInfo) == e_failure)
+                    return e_failure;
+            }
+            else
+            {
+                // Invalid arguments for client
+                fprintf(help, "INFO : ## Invalid Arguments for Client ##\n");
+                fprintf(help, "Usage : <./a.out> -c/-C <socket> -e|-d|-p <args>...\n");
+                return e_failure;
             }
         }
         break;
@@ -96,9 +423,22 @@ int main(int argc,char *argv[])
         default :
         {
             // Invalid operation type
-            printf("INFO : ## Invalid Arguments ##\n");
-            printf("For Encoding --> Usage : <./a.out> -e/-E <.bmp_file> <.txt_file> [output file]\n");
-            printf("For Decoding --> Usage : <./a.out> -d/-D <.bmp_file> [output file]\n");
+            fprintf(help, "INFO : ## Invalid Arguments ##\n");
+            fprintf(help, "For Encoding --> Usage : <./a.out> -e/-E <.bmp_file> <.txt_file> [output file] [--mmap|--reflink|--stream|--uring] [--extn .ext] [--depth N] [--compress] [--key file [--scatter]] [-j N]\n");
+            fprintf(help, "For Decoding --> Usage : <./a.out> -d/-D <.bmp_file> [output file] [--key file] [-j N]\n");
+            fprintf(help, "For Batch    --> Usage : <./a.out> -b/-B <manifest> [-j N] [--inflight M]\n");
+            fprintf(help, "For Extract  --> Usage : <./a.out> -x/-X <.bmp_file> <offset> <length> [output file] [--key file]\n");
+            fprintf(help, "For Probe    --> Usage : <./a.out> -p/-P <.bmp_file | directory>... [-j N]\n");
+            fprintf(help, "For Analyze  --> Usage : <./a.out> -n/-N <.bmp_file | directory>... [-j N]\n");
+            fprintf(help, "For Shard    --> Usage : <./a.out> -s/-S <.txt_file> <output prefix> <.bmp_file>... [--parity M] [--extn .ext] [--depth N] [--compress] [--key file [--scatter]] [-j N]\n");
+            fprintf(help, "For Join     --> Usage : <./a.out> -m/-M <.bmp_file>... [-o output file] [--key file] [-j N]\n");
+            fprintf(help, "For Archive  --> Usage : <./a.out> -a/-A <.bmp_file> <output .bmp_file> <file>... [--mmap|--reflink|--stream|--uring] [--depth N] [--compress] [--key file [--scatter]] [-j N]\n");
+            fprintf(help, "For List     --> Usage : <./a.out> -t/-T <.bmp_file> [--key file]\n");
+            fprintf(help, "For Unpack   --> Usage : <./a.out> -u/-U <.bmp_file> [member]... [-o directory] [--key file]\n");
+            fprintf(help, "For Update   --> Usage : <./a.out> -r/-R <.bmp_file> <.txt_file> [--append] [--extn .ext] [--key file] [-j N]\n");
+            fprintf(help, "For Server   --> Usage : <./a.out> -l/-L <socket> [-j N]\n");
+            fprintf(help, "For Client   --> Usage : <./a.out> -c/-C <socket> -e|-d|-p <args>...\n");
+            fprintf(help, "Any mode     --> -q : errors only, --json : one JSON record per encode / decode job\n");
             return e_failure;
         }
 
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "metrics.h"
+#include "fileio.h"
+#include "types.h"
+
+static ReportFormat report_format = e_report_human;
+
+// Format asked for by the client of the job running on this thread, NULL for report_format
+static __thread const ReportFormat *thread_format;
+
+// Job running on this thread (do_encoding / do_decoding nest for -a, -s and -r)
+static __thread Metrics *current_metrics;
+
+static const char *const stage_names[e_stage_count] = {
+    "open", "capacity", "header", "magic", "extn", "size", "table", "data", "tail"
+};
+
+
+/* --- Description for metrics_parse_args Function --->
+ * Input: argc, argv
+ * Output: None
+ * Description: Removes -q and --json wherever they are, so the modes never
+ * see them, and selects the report format. The last one given wins.
+ */
+void metrics_parse_args(int *argc, char *argv[])
+{
+    int kept = 1;
+
+    for(int i = 1; i < *argc; i++)
+    {
+        if(strcmp(argv[i], "-q") == 0)
+            report_format = e_report_quiet;
+        else if(strcmp(argv[i], "--json") == 0)
+            report_format = e_report_json;
+        else
+            argv[kept++] = argv[i];
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+}
+
+
+/* --- Description for metrics_set_format Function --->
+ * Input: format
+ * Output: None
+ */
+void metrics_set_format(ReportFormat format)
+{
+    report_format = format;
+}
+
+
+/* --- Description for metrics_set_thread_format Function --->
+ * Input: format (NULL: back to the format of the command line)
+ * Output: None
+ * Description: Jobs served for a client report in the client's format.
+ */
+void metrics_set_thread_format(const ReportFormat *format)
+{
+    thread_format = format;
+}
+
+
+/* --- Description for metrics_format Function --->
+ * Output: report format of the job on this thread, else the command line's
+ */
+ReportFormat metrics_format(void)
+{
+    return thread_format != NULL ? *thread_format : report_format;
+}
+
+
+/* --- Description for info_printf Function --->
+ * Input: format, ...
+ * Output: None
+ * Description: printf for the INFO messages. -q drops them, and --json
+ * too so that stdout carries nothing but records. Served jobs print to
+ * their client (see job_stdout).
+ */
+void info_printf(const char *format, ...)
+{
+    va_list args;
+
+    if(metrics_format() != e_report_human)
+        return;
+    va_start(args, format);
+    vfprintf(job_stdout(), format, args);
+    va_end(args);
+}
+
+
+/* --- Description for metrics_now Function --->
+ * Output: monotonic time in nanoseconds
+ */
+static uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+/* --- Description for metrics_read_io Function --->
+ * Input: io, self_bytes (length of the file read)
+ * Output: Status (e_failure without /proc/thread-self/io)
+ * Description: Reads the read / write counters of the calling thread. They
+ * don't include the read of the file itself, the next reading does: callers
+ * add self_bytes to the start and metrics_io_since drops one call.
+ */
+static Status metrics_read_io(MetricsIo *io, uint64_t *self_bytes)
+{
+    char text[512];
+    int fd = open("/proc/thread-self/io", O_RDONLY);
+    ssize_t len = fd == -1 ? -1 : read(fd, text, sizeof(text) - 1);
+
+    if(fd != -1)
+        close(fd);
+    if(len <= 0)
+        return e_failure;
+    text[len] = '\0';
+    *self_bytes = len;
+
+    char *rchar = strstr(text, "rchar:"), *wchar = strstr(text, "wchar:");
+    char *syscr = strstr(text, "syscr:"), *syscw = strstr(text, "syscw:");
+    if(rchar == NULL || wchar == NULL || syscr == NULL || syscw == NULL)
+        return e_failure;
+    io->read_bytes = strtoull(rchar + 6, NULL, 10);
+    io->write_bytes = strtoull(wchar + 6, NULL, 10);
+    io->read_calls = strtoull(syscr + 6, NULL, 10);
+    io->write_calls = strtoull(syscw + 6, NULL, 10);
+    return e_success;
+}
+
+
+/* --- Description for metrics_io_since Function --->
+ * Input: start (from metrics_read_io plus self_bytes), delta
+ * Output: Status
+ * Description: Counters of the calling thread since start, less the reads
+ * of the counters themselves.
+ */
+static Status metrics_io_since(const MetricsIo *start, MetricsIo *delta)
+{
+    MetricsIo now;
+    uint64_t self_bytes;
+
+    if(metrics_read_io(&now, &self_bytes) == e_failure)
+        return e_failure;
+    delta->read_bytes = now.read_bytes - start->read_bytes;
+    delta->write_bytes = now.write_bytes - start->write_bytes;
+    delta->read_calls = now.read_calls - start->read_calls - 1;
+    delta->write_calls = now.write_calls - start->write_calls;
+    return e_success;
+}
+
+
+/* --- Description for metrics_begin Function --->
+ * Input: metrics, op, input, output (may be NULL)
+ * Output: None
+ * Description: Starts the clock and, unless -q, the I/O counters of the
+ * job, and makes it the job of the calling thread.
+ */
+void metrics_begin(Metrics *metrics, const char *op, const char *input, const char *output)
+{
+    uint64_t self_bytes;
+
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->op = op;
+    metrics->input = input;
+    metrics_set_output(metrics, output);
+    metrics->stage = e_stage_count;
+    metrics->status = e_failure;
+
+    if(metrics_format() != e_report_quiet && metrics_read_io(&metrics->io_start, &self_bytes) == e_success)
+    {
+        metrics->io_start.read_bytes += self_bytes;
+        metrics->io_valid = 1;
+    }
+    metrics->outer = current_metrics;
+    current_metrics = metrics;
+    metrics->start_ns = metrics->mark_ns = metrics_now();
+}
+
+
+/* --- Description for metrics_set_output Function --->
+ * Input: metrics, output (NULL for none)
+ * Output: None
+ */
+void metrics_set_output(Metrics *metrics, const char *output)
+{
+    snprintf(metrics->output, sizeof(metrics->output), "%s", output != NULL ? output : "");
+}
+
+
+/* --- Description for metrics_stage Function --->
+ * Input: metrics, stage
+ * Output: None
+ * Description: Charges the time since the last mark to the running stage
+ * and starts stage. A stage run twice adds up.
+ */
+void metrics_stage(Metrics *metrics, MetricsStage stage)
+{
+    uint64_t now = metrics_now();
+
+    if(metrics->stage < e_stage_count)
+        metrics->stage_ns[metrics->stage] += now - metrics->mark_ns;
+    metrics->stage = stage;
+    metrics->mark_ns = now;
+}
+
+
+/* --- Description for metrics_end Function --->
+ * Input: metrics, status
+ * Output: None
+ * Description: Closes the running stage, the total and the I/O counters,
+ * and gives the thread back to the enclosing job.
+ */
+void metrics_end(Metrics *metrics, Status status)
+{
+    MetricsIo delta;
+
+    metrics_stage(metrics, e_stage_count);
+    metrics->total_ns = metrics->mark_ns - metrics->start_ns;
+    metrics->status = status;
+    current_metrics = metrics->outer;
+
+    if(metrics->io_valid && metrics_io_since(&metrics->io_start, &delta) == e_success)
+    {
+        metrics->io.read_bytes += delta.read_bytes;
+        metrics->io.write_bytes += delta.write_bytes;
+        metrics->io.read_calls += delta.read_calls;
+        metrics->io.write_calls += delta.write_calls;
+    }
+    else
+        metrics->io_valid = 0;
+}
+
+
+/* --- Description for metrics_current Function --->
+ * Output: job running on the calling thread, NULL if none
+ */
+Metrics *metrics_current(void)
+{
+    return current_metrics;
+}
+
+
+/* --- Description for metrics_worker_begin Function --->
+ * Input: metrics (job the worker thread helps, NULL for none), start
+ * Output: Status (e_failure if there's nothing to count)
+ */
+Status metrics_worker_begin(Metrics *metrics, MetricsIo *start)
+{
+    uint64_t self_bytes;
+
+    if(metrics == NULL || !metrics->io_valid || metrics_read_io(start, &self_bytes) == e_failure)
+        return e_failure;
+    start->read_bytes += self_bytes;
+    return e_success;
+}
+
+
+/* --- Description for metrics_worker_end Function --->
+ * Input: metrics, start (metrics_worker_begin succeeded)
+ * Output: None
+ * Description: Adds the I/O of the worker thread to the job. Workers end
+ * at the same time, hence the atomic adds.
+ */
+void metrics_worker_end(Metrics *metrics, const MetricsIo *start)
+{
+    MetricsIo delta;
+
+    if(metrics_io_since(start, &delta) == e_failure)
+        return;
+    __atomic_fetch_add(&metrics->io.read_bytes, delta.read_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics->io.write_bytes, delta.write_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics->io.read_calls, delta.read_calls, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics->io.write_calls, delta.write_calls, __ATOMIC_RELAXED);
+}
+
+
+/* --- Description for metrics_json_string Function --->
+ * Input: out, text
+ * Output: None
+ * Description: Prints text as a JSON string.
+ */
+void metrics_json_string(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for(const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++)
+    {
+        if(*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if(*c < 0x20)
+            fprintf(out, "\\u%04x", *c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+
+/* --- Description for metrics_report Function --->
+ * Input: metrics (ended)
+ * Output: None
+ * Description: Human format: the rate, the stages that ran and the I/O
+ * counters in three INFO lines. JSON format: one record on one line, every
+ * stage present (0 when skipped), I/O counters null when unavailable.
+ * A failed job has status "error" and no payload size or rate, which would
+ * only count the bytes done before the failure. Nothing with -q.
+ */
+void metrics_report(const Metrics *metrics)
+{
+    double seconds = metrics->total_ns / 1e9;
+    FILE *out = job_stdout();
+    ReportFormat format = metrics_format();
+    double rate = seconds > 0 ? metrics->payload_bytes / seconds / 1e6 : 0;
+
+    if(format == e_report_human)
+    {
+        fprintf(out, "INFO : %s %s -> %s%s%s%s: ", metrics->op, metrics->input, metrics->output,
+                metrics->path ? " (" : "", metrics->path ? metrics->path : "", metrics->path ? ")" : "");
+        if(metrics->status == e_success)
+            fprintf(out, "%llu bytes in %.3f ms, %.1f MB/s\n", (unsigned long long)metrics->payload_bytes, seconds * 1e3, rate);
+        else
+            fprintf(out, "failed after %.3f ms\n", seconds * 1e3);
+        fprintf(out, "INFO : stages (ms):");
+        for(int i = 0; i < e_stage_count; i++)
+            if(metrics->stage_ns[i] != 0)
+                fprintf(out, " %s %.3f", stage_names[i], metrics->stage_ns[i] / 1e6);
+        fprintf(out, "\n");
+        if(metrics->io_valid)
+            fprintf(out, "INFO : read %llu bytes in %llu calls, wrote %llu bytes in %llu calls\n",
+                    (unsigned long long)metrics->io.read_bytes, (unsigned long long)metrics->io.read_calls,
+                    (unsigned long long)metrics->io.write_bytes, (unsigned long long)metrics->io.write_calls);
+    }
+    else if(format == e_report_json)
+    {
+        fprintf(out, "{\"op\":\"%s\",\"status\":\"%s\",\"input\":", metrics->op, metrics->status == e_success ? "ok" : "error");
+        metrics_json_string(out, metrics->input != NULL ? metrics->input : "");
+        fprintf(out, ",\"output\":");
+        metrics_json_string(out, metrics->output);
+        fprintf(out, ",\"path\":");
+        if(metrics->path != NULL)
+            metrics_json_string(out, metrics->path);
+        else
+            fprintf(out, "null");
+        fprintf(out, ",\"jobs\":%u", metrics->jobs);
+        if(metrics->status == e_success)
+            fprintf(out, ",\"payload_bytes\":%llu", (unsigned long long)metrics->payload_bytes);
+        fprintf(out, ",\"total_ns\":%llu", (unsigned long long)metrics->total_ns);
+        if(metrics->status == e_success)
+            fprintf(out, ",\"mb_per_s\":%.3f", rate);
+        fprintf(out, ",\"stages_ns\":{");
+        for(int i = 0; i < e_stage_count; i++)
+            fprintf(out, "%s\"%s\":%llu", i ? "," : "", stage_names[i], (unsigned long long)metrics->stage_ns[i]);
+        fprintf(out, "},\"io\":");
+        if(metrics->io_valid)
+            fprintf(out, "{\"read_bytes\":%llu,\"read_calls\":%llu,\"write_bytes\":%llu,\"write_calls\":%llu}",
+                    (unsigned long long)metrics->io.read_bytes, (unsigned long long)metrics->io.read_calls,
+                    (unsigned long long)metrics->io.write_bytes, (unsigned long long)metrics->io.write_calls);
+        else
+            fprintf(out, "null");
+        fprintf(out, "}\n");
+    }
+    fflush(out);
+}
+
+
+/* --- Description for metrics_report_refused Function --->
+ * Input: op, input, output (NULL if not given)
+ * Output: None
+ * Description: JSON format only: the "error" record of a job refused
+ * before it started (invalid arguments, malformed batch entry), so that
+ * every job asked for gets its record. The other formats print their own
+ * message.
+ */
+void metrics_report_refused(const char *op, const char *input, const char *output)
+{
+    Metrics metrics;
+
+    if(metrics_format() != e_report_json)
+        return;
+    metrics_begin(&metrics, op, input != NULL ? input : "", output);
+    metrics_end(&metrics, e_failure);
+    metrics_report(&metrics);
+}
@@ -0,0 +1,121 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>  //for FILE *
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Per job instrumentation of the encoder and decoder.
+ * do_encoding / do_decoding time every stage of the job and count the bytes
+ * and read / write calls of the job (from /proc/thread-self/io, summed over
+ * the -j worker threads; pages of memory mapped files are not counted).
+ * The report format is global, chosen on the command line:
+ *      (default)   a short human summary per job, and the INFO messages
+ *      -q          nothing but errors
+ *      --json      one JSON record per job on stdout, nothing else
+ *                  (stderr when stdout carries the decoded secret or the image)
+ * Jobs served for a client (see server.h) report to the client, in its format.
+ */
+
+/* Longest output name kept in a record */
+#define MAX_METRICS_NAME 256
+
+typedef enum
+{
+    e_report_human,
+    e_report_quiet,
+    e_report_json
+} ReportFormat;
+
+/* Stages of a job, in the order they run */
+typedef enum
+{
+    e_stage_open,       // open files, read the BMP headers
+    e_stage_capacity,   // capacity check (encode), key check (decode)
+    e_stage_header,     // BMP header copy
+    e_stage_magic,      // magic string (mmap, reflink and stream: whole container header)
+    e_stage_extn,       // extension size and extension
+    e_stage_size,       // secret size
+    e_stage_table,      // chunk table
+    e_stage_data,       // secret data
+    e_stage_tail,       // image bytes after the secret
+    e_stage_count
+} MetricsStage;
+
+/* Read / write counters of /proc/<pid>/task/<tid>/io */
+typedef struct _MetricsIo
+{
+    uint64_t read_bytes;    // rchar
+    uint64_t write_bytes;   // wchar
+    uint64_t read_calls;    // syscr
+    uint64_t write_calls;   // syscw
+} MetricsIo;
+
+// Measurements of one encode or decode job
+typedef struct _Metrics
+{
+    const char *op;                     // "encode" / "decode"
+    const char *input;                  // cover or stego image
+    char output[MAX_METRICS_NAME];      // stego image or decoded file
+    const char *path;                   // I/O path taken, NULL if not relevant
+    uint jobs;
+    uint64_t payload_bytes;             // secret bytes encoded / decoded
+    Status status;
+
+    uint64_t total_ns;
+    uint64_t stage_ns[e_stage_count];
+    MetricsStage stage;                 // running stage, e_stage_count for none
+    uint64_t start_ns, mark_ns;
+
+    int io_valid;                       // 0 without /proc/thread-self/io
+    MetricsIo io;                       // job totals (atomic adds from the workers)
+    MetricsIo io_start;
+    struct _Metrics *outer;             // job running on this thread before this one
+} Metrics;
+
+
+/* -- function prototypes for the metrics */
+
+/* Strip -q / --json from argv and select the report format */
+void metrics_parse_args(int *argc, char *argv[]);
+
+/* Select / get the report format */
+void metrics_set_format(ReportFormat format);
+ReportFormat metrics_format(void);
+
+/* Select the report format of the jobs on this thread (NULL: the command line's) */
+void metrics_set_thread_format(const ReportFormat *format);
+
+/* printf for INFO messages, only in the human format */
+void info_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/* Start timing a job on the calling thread */
+void metrics_begin(Metrics *metrics, const char *op, const char *input, const char *output);
+
+/* Replace the output name of the job */
+void metrics_set_output(Metrics *metrics, const char *output);
+
+/* End the running stage and start the next one */
+void metrics_stage(Metrics *metrics, MetricsStage stage);
+
+/* Stop timing the job */
+void metrics_end(Metrics *metrics, Status status);
+
+/* Job running on the calling thread, NULL if none */
+Metrics *metrics_current(void);
+
+/* Count the I/O of a worker thread into metrics (NULL: no job) */
+Status metrics_worker_begin(Metrics *metrics, MetricsIo *start);
+void metrics_worker_end(Metrics *metrics, const MetricsIo *start);
+
+/* Print the job in the selected format */
+void metrics_report(const Metrics *metrics);
+
+/* Print the error record of a job refused before it started (--json only) */
+void metrics_report_refused(const char *op, const char *input, const char *output);
+
+/* Print text as a JSON string, for other modes writing JSON records */
+void metrics_json_string(FILE *out, const char *text);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "parallel.h"
+#include "metrics.h"
+#include "types.h"
+
+// State shared by the workers of one parallel_for call
+typedef struct _ParallelLoop
+{
+    ChunkFn fn;
+    void *ctx;
+    size_t nchunks;
+    size_t next_chunk;      // next chunk to hand out (atomic)
+    int failed;             // set once any chunk fails (atomic)
+    Metrics *metrics;       // job of the calling thread, gets the I/O of the workers
+} ParallelLoop;
+
+// Per thread argument
+typedef struct _ParallelWorker
+{
+    ParallelLoop *loop;
+    uint index;
+    pthread_t thread;
+} ParallelWorker;
+
+
+/* --- Description for parallel_worker Function --->
+ * Input: arg (ParallelWorker)
+ * Output: NULL
+ * Description: Takes the next chunk index until all chunks are handed out
+ * or a chunk failed. Chunks are claimed one at a time so faster threads
+ * simply take more of them. Started threads count their I/O into the job
+ * of the calling thread.
+ */
+static void *parallel_worker(void *arg)
+{
+    ParallelWorker *worker = arg;
+    ParallelLoop *loop = worker->loop;
+    MetricsIo io_start;
+    int counted = worker->index != 0 && metrics_worker_begin(loop->metrics, &io_start) == e_success;
+
+    while(!__atomic_load_n(&loop->failed, __ATOMIC_RELAXED))
+    {
+        size_t chunk = __atomic_fetch_add(&loop->next_chunk, 1, __ATOMIC_RELAXED);
+        if(chunk >= loop->nchunks)
+            break;
+        if(loop->fn(loop->ctx, chunk, worker->index) == e_failure)
+            __atomic_store_n(&loop->failed, 1, __ATOMIC_RELAXED);
+    }
+    if(counted)
+        metrics_worker_end(loop->metrics, &io_start);
+    return NULL;
+}
+
+
+/* --- Description for parallel_for Function --->
+ * Input: nthreads, nchunks, fn, ctx
+ * Output: Status (e_failure if any chunk failed)
+ * Description: Calls fn(ctx, chunk, worker) for every chunk index on a pool
+ * of nthreads threads (the calling thread is worker 0). With one thread or
+ * one chunk everything runs on the calling thread.
+ */
+Status parallel_for(uint nthreads, size_t nchunks, ChunkFn fn, void *ctx)
+{
+    ParallelLoop loop = { fn, ctx, nchunks, 0, 0, metrics_current() };
+
+    if(nthreads > nchunks)
+        nthreads = nchunks;
+    if(nthreads <= 1)
+    {
+        for(size_t chunk = 0; chunk < nchunks; chunk++)
+        {
+            if(fn(ctx, chunk, 0) == e_failure)
+                return e_failure;
+        }
+        return e_success;
+    }
+
+    ParallelWorker *workers = calloc(nthreads, sizeof(ParallelWorker));
+    if(workers == NULL)
+    {
+        perror("calloc");
+        return e_failure;
+    }
+
+    uint started = 1;
+    for(; started < nthreads; started++)
+    {
+        workers[started].loop = &loop;
+        workers[started].index = started;
+        if(pthread_create(&workers[started].thread, NULL, parallel_worker, &workers[started]) != 0)
+            break;      // run with the threads we got
+    }
+    workers[0].loop = &loop;
+    workers[0].index = 0;
+    parallel_worker(&workers[0]);
+
+    for(uint i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    free(workers);
+    return loop.failed ? e_failure : e_success;
+}
+
+
+/* --- Description for parse_jobs Function --->
+ * Input: arg (text after -j), jobs
+ * Output: Status (e_failure unless 1 <= N <= MAX_JOBS)
+ */
+Status parse_jobs(const char *arg, uint *jobs)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if(*arg == '\0' || *end != '\0' || value < 1 || value > MAX_JOBS)
+        return e_failure;
+    *jobs = value;
+    return e_success;
+}
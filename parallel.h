@@ -0,0 +1,31 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h> //for size_t
+#include "types.h" // Contains user defined types
+
+/*
+ * Chunked parallel loop used by the multithreaded encoder and decoder.
+ * Payload byte i always maps to image bytes [base + 8i, base + 8i + 8),
+ * so the payload is cut in chunks that worker threads process on their own.
+ */
+
+/* Payload bytes handled per chunk */
+#define PARALLEL_CHUNK_SIZE (1024 * 1024)
+
+/* Upper bound for -j */
+#define MAX_JOBS 256
+
+/* Work for one chunk, worker is the index of the calling thread */
+typedef Status (*ChunkFn)(void *ctx, size_t chunk, uint worker);
+
+
+/* -- function prototypes for the parallel loop */
+
+/* Run fn for chunks 0 .. nchunks-1 on nthreads threads */
+Status parallel_for(uint nthreads, size_t nchunks, ChunkFn fn, void *ctx);
+
+/* Parse the value of a -j option */
+Status parse_jobs(const char *arg, uint *jobs);
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "probe.h"
+#include "fileio.h"
+#include "encode.h"
+#include "decode.h"
+#include "parallel.h"
+#include "metrics.h"
+#include "types.h"
+
+// What a probe found
+typedef enum
+{
+    e_probe_payload,    // header decoded and valid
+    e_probe_clean,      // no magic string
+    e_probe_damaged,    // magic string, but the rest of the header is invalid
+    e_probe_not_bmp,    // not a supported BMP image
+    e_probe_unreadable  // could not be opened
+} ProbeStatus;
+
+// One probed image
+typedef struct _ProbeResult
+{
+    char *path;
+    ProbeStatus status;
+    uint version;
+    uint depth;
+    int streamed;                   // size unknown, stored in frames
+    int compressed;                 // chunks stored compressed
+    int encrypted;                  // chunks stored encrypted
+    int scattered;                  // keyed pixel order
+    int archive;                    // several files with a table of contents
+    uint shard;                     // shard number, with shards != 0
+    uint shards;                    // shards in the set, 0 if not a shard
+    uint64_t size;
+    char extn[MAX_FILE_SUFFIX];
+} ProbeResult;
+
+// Images found on the command line and in directories
+typedef struct _ProbeList
+{
+    ProbeResult *results;
+    size_t count;
+    size_t capacity;
+} ProbeList;
+
+
+/* --- Description for read_and_validate_probe_args Function --->
+ * Input: argc, argv, probeInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -p <.bmp_file | directory>... [-j N]
+ * Every argument that is not an option is a path to probe.
+ */
+Status read_and_validate_probe_args(int argc, char *argv[], ProbeInfo *probeInfo)
+{
+    probeInfo->paths = malloc(argc * sizeof(char *));
+    probeInfo->npaths = 0;
+    probeInfo->jobs = 1;
+    if(probeInfo->paths == NULL)
+        return e_failure;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &probeInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)
+        {
+            if(parse_jobs(argv[i] + 2, &probeInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(argv[i][0] == '-')
+        {
+            return e_failure;
+        }
+        else
+        {
+            probeInfo->paths[probeInfo->npaths++] = argv[i];
+        }
+    }
+
+    return probeInfo->npaths > 0 ? e_success : e_failure;
+}
+
+
+/* --- Description for probe_list_add Function --->
+ * Input: ctx (ProbeList), path
+ * Output: Status
+ */
+static Status probe_list_add(void *ctx, const char *path)
+{
+    ProbeList *list = ctx;
+
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? 2 * list->capacity : 1024;
+        ProbeResult *grown = realloc(list->results, capacity * sizeof(ProbeResult));
+        if(grown == NULL)
+            return e_failure;
+        list->results = grown;
+        list->capacity = capacity;
+    }
+
+    ProbeResult *result = &list->results[list->count];
+    memset(result, 0, sizeof(ProbeResult));
+    result->path = strdup(path);
+    if(result->path == NULL)
+        return e_failure;
+    list->count++;
+    return e_success;
+}
+
+
+/* --- Description for probe_image Function --->
+ * Input: result (path set)
+ * Output: None, result filled in
+ * Description: Reads the BMP headers and decodes the magic string, extension
+ * and size with the decoder's own functions, which validate them (and the
+ * header CRC of version 1 images). The file is read through a buffer of
+ * PROBE_READ_SIZE bytes and the kernel is told to expect random access, so
+ * only the first pages of an image are read from disk.
+ */
+static void probe_image(ProbeResult *result)
+{
+    char buffer[PROBE_READ_SIZE];
+    DecodeInfo decInfo = { 0 };
+
+    decInfo.fptr_stego_image = fopen(result->path, "rb");
+    if(decInfo.fptr_stego_image == NULL)
+    {
+        result->status = e_probe_unreadable;
+        return;
+    }
+    setvbuf(decInfo.fptr_stego_image, buffer, _IOFBF, sizeof(buffer));
+    posix_fadvise(fileno(decInfo.fptr_stego_image), 0, 0, POSIX_FADV_RANDOM);
+    posix_fadvise(fileno(decInfo.fptr_stego_image), 0, PROBE_READ_SIZE, POSIX_FADV_WILLNEED);
+
+    if(bmp_read_info(decInfo.fptr_stego_image, &decInfo.bmp) == e_failure)
+        result->status = e_probe_not_bmp;
+    else if(decode_magic_string(&decInfo) == e_failure)
+        result->status = e_probe_clean;
+    else if(decode_file_extn_size(&decInfo) == e_failure ||
+            decode_secret_file_extn(decInfo.extn_size, &decInfo) == e_failure ||
+            decInfo.extn_secret_file[0] != '.' || decode_secret_file_size(&decInfo) == e_failure)
+        result->status = e_probe_damaged;   // the encoder always stores ".ext"
+    else
+    {
+        result->status = e_probe_payload;
+        result->version = decInfo.version;
+        result->depth = decInfo.depth;
+        result->streamed = (decInfo.version == 0 && decInfo.size_secret_file == STREAM_SIZE_MARKER) ||
+                           (decInfo.flags & CONTAINER_STREAMED);
+        result->compressed = (decInfo.flags & CONTAINER_COMPRESSED) != 0;
+        result->encrypted = (decInfo.flags & CONTAINER_ENCRYPTED) != 0;
+        result->scattered = (decInfo.flags & CONTAINER_SCATTERED) != 0;
+        result->archive = (decInfo.flags & CONTAINER_ARCHIVE) != 0;
+        result->shard = decInfo.shard.index;
+        result->shards = decInfo.shard.data + decInfo.shard.parity;
+        result->size = decInfo.size_secret_file;
+        strcpy(result->extn, decInfo.extn_secret_file);
+    }
+
+    close_decode_files(&decInfo);   // closes the image before buffer goes away
+}
+
+
+/* --- Description for probe_chunk Function --->
+ * Input: ctx (ProbeList), chunk (image index), worker
+ * Output: e_success, failures are recorded in the result
+ */
+static Status probe_chunk(void *ctx, size_t chunk, uint worker)
+{
+    ProbeList *list = ctx;
+
+    (void)worker;
+    probe_image(&list->results[chunk]);
+    return e_success;
+}
+
+
+/* --- Description for print_probe_result Function --->
+ * Input: result
+ * Output: None
+ */
+static void print_probe_result(const ProbeResult *result)
+{
+    FILE *out = job_stdout();
+    char details[80];
+    int len = snprintf(details, sizeof(details), "%s%s%s%s", result->compressed ? ", compressed" : "",
+                       result->encrypted ? ", encrypted" : "", result->scattered ? ", scattered" : "",
+                       result->archive ? ", archive" : "");
+
+    if(result->shards != 0)
+        snprintf(details + len, sizeof(details) - len, ", shard %u of %u", result->shard, result->shards);
+
+    if(result->status == e_probe_payload && result->streamed)
+        fprintf(out, "STEGO   %s  (version %u, depth %u, %s, streamed%s)\n", result->path,
+                result->version, result->depth, result->extn, details);
+    else if(result->status == e_probe_payload)
+        fprintf(out, "STEGO   %s  (version %u, depth %u, %s, %llu bytes%s)\n", result->path,
+                result->version, result->depth, result->extn, (unsigned long long)result->size, details);
+    else if(result->status == e_probe_clean)
+        fprintf(out, "CLEAN   %s\n", result->path);
+    else if(result->status == e_probe_damaged)
+        fprintf(out, "DAMAGED %s  (magic string found, header invalid)\n", result->path);
+    else
+        fprintf(out, "SKIPPED %s  (%s)\n", result->path,
+                result->status == e_probe_not_bmp ? "not a supported BMP image" : "unable to open");
+}
+
+
+/* --- Description for do_probe Function --->
+ * Input: probeInfo
+ * Output: Status (e_failure if a path is missing or memory runs out)
+ * Description:
+ * 1. Collects the images: files given directly and *.bmp files below directories.
+ * 2. Probes them with probeInfo->jobs threads.
+ * 3. Prints one line per image and a summary.
+ */
+Status do_probe(ProbeInfo *probeInfo)
+{
+    ProbeList list = { 0 };
+    Status ret = e_success;
+    struct stat st;
+
+    for(int i = 0; i < probeInfo->npaths && ret == e_success; i++)
+    {
+        if(stat(probeInfo->paths[i], &st) == -1)
+        {
+            perror("stat");
+            fprintf(job_stderr(), "ERROR : Unable to open %s\n", probeInfo->paths[i]);
+            ret = e_failure;
+        }
+        else if(S_ISDIR(st.st_mode))
+            ret = walk_bmp_files(probeInfo->paths[i], probe_list_add, &list);
+        else
+            ret = probe_list_add(&list, probeInfo->paths[i]);
+    }
+
+    if(ret == e_success)
+        parallel_for(probeInfo->jobs, list.count, probe_chunk, &list);
+
+    size_t found = 0, damaged = 0, skipped = 0;
+    for(size_t i = 0; i < list.count; i++)
+    {
+        ProbeResult *result = &list.results[i];
+
+        if(ret == e_success)
+            print_probe_result(result);
+        found += result->status == e_probe_payload;
+        damaged += result->status == e_probe_damaged;
+        skipped += result->status == e_probe_not_bmp || result->status == e_probe_unreadable;
+        free(result->path);
+    }
+    free(list.results);
+    free(probeInfo->paths);
+
+    if(ret == e_success)
+        info_printf("INFO : %zu images, %zu carry a payload, %zu damaged, %zu skipped\n",
+                    list.count, found, damaged, skipped);
+    return ret;
+}
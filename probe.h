@@ -0,0 +1,35 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Probe mode: tells whether images carry a payload by decoding only the
+ * header stored in the first colour bytes (magic string, extension and
+ * size), without creating any output file.
+ *      -p <.bmp_file | directory>... [-j N]
+ * Directories are walked recursively and every *.bmp file in them is probed.
+ * One line per image is printed, in the order the paths were found.
+ */
+
+/* Bytes read ahead from the start of each probed image */
+#define PROBE_READ_SIZE 4096
+
+// Structure to hold probe related information
+typedef struct _ProbeInfo
+{
+    char **paths;       // files and directories given on the command line
+    int npaths;
+    uint jobs;          // images probed at the same time (-j)
+} ProbeInfo;
+
+
+/* -- function prototypes for probe mode */
+
+/* Read and validate probe args from argv */
+Status read_and_validate_probe_args(int argc, char *argv[], ProbeInfo *probeInfo);
+
+/* Probe every image and print one line per image */
+Status do_probe(ProbeInfo *probeInfo);
+
+#endif
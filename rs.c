@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rs.h"
+#include "types.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define GF_POLY 0x11D
+
+/* Signature of the multiply-add kernels */
+typedef void (*RsMulFn)(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef);
+
+/* gf_exp[i] = 2^i (doubled so products need no reduction), gf_log its inverse */
+static unsigned char gf_exp[510];
+static unsigned char gf_log[256];
+
+/* Kernel in use, resolved on first call together with the tables */
+static RsMulFn rs_mul_fn;
+static pthread_once_t rs_init_once = PTHREAD_ONCE_INIT;
+
+
+/* --- Description for gf_mul Function --->
+ * Input: a, b
+ * Output: a * b in GF(2^8)
+ */
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if(a == 0 || b == 0)
+        return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+
+/* --- Description for gf_inv Function --->
+ * Input: a (not 0)
+ * Output: 1 / a in GF(2^8)
+ */
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+
+/* --- Description for rs_mul_add_sw Function --->
+ * Input: dest, src, len, coef
+ * Output: None
+ * Description: Portable kernel, one lookup in the product table of coef per byte.
+ */
+static void rs_mul_add_sw(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef)
+{
+    unsigned char table[256];
+
+    for(int i = 0; i < 256; i++)
+        table[i] = gf_mul(coef, i);
+    for(size_t i = 0; i < len; i++)
+        dest[i] ^= table[src[i]];
+}
+
+#ifdef RS_HAVE_X86
+
+/* --- Description for rs_mul_add_ssse3 Function --->
+ * Input: dest, src, len, coef
+ * Output: None
+ * Description: Multiplication is linear over XOR, so coef * x is
+ * coef * (x & 15) ^ coef * (x & 240): two 16 entry tables looked up with
+ * pshufb, 16 bytes per iteration.
+ */
+__attribute__((target("ssse3")))
+static void rs_mul_add_ssse3(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef)
+{
+    unsigned char lo[16], hi[16];
+
+    for(int i = 0; i < 16; i++)
+    {
+        lo[i] = gf_mul(coef, i);
+        hi[i] = gf_mul(coef, i << 4);
+    }
+    __m128i lo_table = _mm_loadu_si128((const __m128i *)lo);
+    __m128i hi_table = _mm_loadu_si128((const __m128i *)hi);
+    __m128i nibble = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(lo_table, _mm_and_si128(x, nibble)),
+                                        _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi64(x, 4), nibble)));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(d, product));
+    }
+    for(; i < len; i++)
+        dest[i] ^= lo[src[i] & 15] ^ hi[src[i] >> 4];
+}
+
+#endif
+
+
+/* --- Description for rs_init Function --->
+ * Input: None
+ * Output: None
+ * Description: Builds the log and exp tables (2 generates the field) and
+ * picks the kernel. Run once through pthread_once.
+ */
+static void rs_init(void)
+{
+    uint x = 1;
+
+    for(int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if(x & 0x100)
+            x ^= GF_POLY;
+    }
+
+    rs_mul_fn = rs_mul_add_sw;
+#ifdef RS_HAVE_X86
+    if(__builtin_cpu_supports("ssse3"))
+        rs_mul_fn = rs_mul_add_ssse3;
+#endif
+}
+
+
+/* --- Description for rs_parity_coef Function --->
+ * Input: data, parity (data + parity <= RS_MAX_SHARDS), coef (parity * data bytes)
+ * Output: None
+ * Description: Cauchy matrix 1 / (x_r ^ y_c) with x_r = data + r and
+ * y_c = c, column c divided by its first entry so row 0 is all ones.
+ */
+void rs_parity_coef(uint data, uint parity, unsigned char *coef)
+{
+    pthread_once(&rs_init_once, rs_init);
+
+    for(uint r = 0; r < parity; r++)
+        for(uint c = 0; c < data; c++)
+            coef[r * data + c] = gf_mul(gf_inv((data + r) ^ c), data ^ c);
+}
+
+
+/* --- Description for rs_mul_add Function --->
+ * Input: dest, src, len, coef
+ * Output: None
+ * Description: Adds coef * src to dest. A coefficient of 1 is a plain XOR.
+ */
+void rs_mul_add(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef)
+{
+    pthread_once(&rs_init_once, rs_init);
+
+    if(coef == 0)
+        return;
+    if(coef != 1)
+    {
+        rs_mul_fn(dest, src, len, coef);
+        return;
+    }
+    for(size_t i = 0; i < len; i++)
+        dest[i] ^= src[i];
+}
+
+
+/* --- Description for rs_mul_add_scalar Function --->
+ * Input: dest, src, len, coef
+ * Output: None
+ * Description: rs_mul_add through the portable kernel whatever the CPU,
+ * the reference the SSSE3 kernel is checked against.
+ */
+void rs_mul_add_scalar(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef)
+{
+    pthread_once(&rs_init_once, rs_init);
+    rs_mul_add_sw(dest, src, len, coef);
+}
+
+
+/* --- Description for rs_decode_matrix Function --->
+ * Input: data, parity, rows (data distinct shard numbers), matrix (data * data bytes)
+ * Output: Status (e_failure if out of memory)
+ * Description: Row j of the encoding matrix for shard rows[j] is a unit
+ * row for a data shard, the coefficient row for a parity shard. Inverting
+ * the rows picked (Gauss-Jordan) gives matrix, with data shard d equal to
+ * the sum over j of matrix[d][j] * shard rows[j].
+ */
+Status rs_decode_matrix(uint data, uint parity, const uint *rows, unsigned char *matrix)
+{
+    unsigned char *coef = malloc((size_t)parity * data + 1);
+    unsigned char *a = malloc((size_t)data * data);
+
+    if(coef == NULL || a == NULL)
+    {
+        perror("malloc");
+        free(coef);
+        free(a);
+        return e_failure;
+    }
+    rs_parity_coef(data, parity, coef);
+
+    memset(matrix, 0, (size_t)data * data);
+    for(uint j = 0; j < data; j++)
+    {
+        if(rows[j] < data)
+        {
+            memset(a + j * data, 0, data);
+            a[j * data + rows[j]] = 1;
+        }
+        else
+            memcpy(a + j * data, coef + (rows[j] - data) * data, data);
+        matrix[j * data + j] = 1;
+    }
+
+    Status ret = e_success;
+    for(uint col = 0; col < data && ret == e_success; col++)
+    {
+        uint pivot = col;
+        while(pivot < data && a[pivot * data + col] == 0)
+            pivot++;
+        if(pivot == data)           // cannot happen for distinct rows
+        {
+            ret = e_failure;
+            break;
+        }
+        for(uint k = 0; k < data && pivot != col; k++)
+        {
+            unsigned char t = a[col * data + k];
+            a[col * data + k] = a[pivot * data + k];
+            a[pivot * data + k] = t;
+            t = matrix[col * data + k];
+            matrix[col * data + k] = matrix[pivot * data + k];
+            matrix[pivot * data + k] = t;
+        }
+
+        unsigned char scale = gf_inv(a[col * data + col]);
+        for(uint k = 0; k < data; k++)
+        {
+            a[col * data + k] = gf_mul(a[col * data + k], scale);
+            matrix[col * data + k] = gf_mul(matrix[col * data + k], scale);
+        }
+        for(uint row = 0; row < data; row++)
+        {
+            unsigned char factor = a[row * data + col];
+            if(row == col || factor == 0)
+                continue;
+            rs_mul_add(a + row * data, a + col * data, data, factor);
+            rs_mul_add(matrix + row * data, matrix + col * data, data, factor);
+        }
+    }
+
+    free(coef);
+    free(a);
+    return ret;
+}
@@ -0,0 +1,36 @@
+#ifndef RS_H
+#define RS_H
+
+#include <stddef.h> //for size_t
+#include "types.h" // Contains user defined types
+
+/*
+ * Reed-Solomon erasure code over GF(2^8) (polynomial 0x11D) for the parity
+ * shards of a sharded payload. The code is systematic: the data shards are
+ * stored as they are and parity shard r is the sum over data shards c of
+ * coef[r][c] * data[c]. The coefficients form a Cauchy matrix whose columns
+ * are scaled so the first row is all ones, which keeps every square
+ * submatrix invertible: any data shards out of data + parity rebuild the
+ * payload, and a single parity shard is the plain XOR of the data shards.
+ * Blocks are multiplied with SSSE3 nibble lookups when the CPU has them.
+ */
+
+/* Largest data + parity shard count the coefficients allow */
+#define RS_MAX_SHARDS 256
+
+
+/* -- function prototypes for the erasure code */
+
+/* Fill the parity x data coefficient matrix, row by row */
+void rs_parity_coef(uint data, uint parity, unsigned char *coef);
+
+/* dest ^= coef * src, byte by byte in GF(2^8) */
+void rs_mul_add(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef);
+
+/* Same through the portable kernel */
+void rs_mul_add_scalar(unsigned char *dest, const unsigned char *src, size_t len, unsigned char coef);
+
+/* Matrix rebuilding the data shards from the shards numbered rows[0 .. data-1] */
+Status rs_decode_matrix(uint data, uint parity, const uint *rows, unsigned char *matrix);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include "scatter.h"
+#include "container.h"
+#include "types.h"
+
+
+/* --- Description for scatter_init Function --->
+ * Input: scatter, blocks, key (SCATTER_KEY_SIZE bytes)
+ * Output: None
+ * Description: The Feistel network works on 2 * half_bits bits, the
+ * smallest even width covering blocks, so at most 4 values are walked
+ * per output on average.
+ */
+void scatter_init(Scatter *scatter, uint64_t blocks, const unsigned char *key)
+{
+    uint bits = 2;
+
+    while(bits < 64 && (1ULL << bits) < blocks)
+        bits += 2;
+    scatter->blocks = blocks;
+    scatter->half_bits = bits / 2;
+    scatter->half_mask = (1ULL << scatter->half_bits) - 1;
+    for(int i = 0; i < SCATTER_ROUNDS; i++)
+        scatter->keys[i] = get_le(key + 8 * i, 8);
+}
+
+
+/* --- Description for scatter_round Function --->
+ * Input: half, key
+ * Output: 64 mixed bits (splitmix64 finaliser of half ^ key)
+ */
+static uint64_t scatter_round(uint64_t half, uint64_t key)
+{
+    uint64_t x = (half ^ key) * 0x9E3779B97F4A7C15ULL;
+
+    x = (x ^ x >> 30) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ x >> 27) * 0x94D049BB133111EBULL;
+    return x ^ x >> 31;
+}
+
+
+/* --- Description for scatter_index Function --->
+ * Input: scatter, index (< blocks)
+ * Output: physical block, also < blocks
+ * Description: Applies the Feistel network until the value falls inside
+ * [0, blocks). Starting inside the range, this walks the cycle of the
+ * wider permutation, which keeps the result a bijection.
+ */
+uint64_t scatter_index(const Scatter *scatter, uint64_t index)
+{
+    do
+    {
+        uint64_t left = index >> scatter->half_bits;
+        uint64_t right = index & scatter->half_mask;
+
+        for(int i = 0; i < SCATTER_ROUNDS; i++)
+        {
+            uint64_t next = left ^ (scatter_round(right, scatter->keys[i]) & scatter->half_mask);
+            left = right;
+            right = next;
+        }
+        index = left << scatter->half_bits | right;
+    } while(index >= scatter->blocks);
+
+    return index;
+}
@@ -0,0 +1,44 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Keyed pixel order for --scatter. The colour bytes after the header are cut
+ * in blocks of SCATTER_BLOCK_SIZE bytes, and logical block i of the payload
+ * is stored in physical block scatter_index(i). The permutation is a
+ * balanced Feistel network over the block numbers, with cycle walking to
+ * stay inside [0, blocks): it costs a few multiplications per block and no
+ * table, whatever the image size. Blocks keep the bytes of a cache line
+ * together, so walking the payload touches one line per block.
+ */
+
+/* Colour bytes moved together */
+#define SCATTER_BLOCK_SIZE 64
+
+/* Feistel rounds, one 64-bit key each */
+#define SCATTER_ROUNDS 4
+
+/* Key bytes used by scatter_init */
+#define SCATTER_KEY_SIZE (8 * SCATTER_ROUNDS)
+
+// Permutation of [0, blocks)
+typedef struct _Scatter
+{
+    uint64_t blocks;
+    uint half_bits;             // bits of each Feistel half
+    uint64_t half_mask;
+    uint64_t keys[SCATTER_ROUNDS];
+} Scatter;
+
+
+/* -- function prototypes for the keyed pixel order */
+
+/* Set up a permutation of blocks block numbers from SCATTER_KEY_SIZE key bytes */
+void scatter_init(Scatter *scatter, uint64_t blocks, const unsigned char *key);
+
+/* Physical block of logical block index */
+uint64_t scatter_index(const Scatter *scatter, uint64_t index);
+
+#endif
@@ -0,0 +1,534 @@
+#define _GNU_SOURCE     // unshare, accept4, ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "encode.h"
+#include "decode.h"
+#include "probe.h"
+#include "container.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "threadpool.h"
+#include "metrics.h"
+#include "types.h"
+
+// One accepted connection
+typedef struct _ServerClient
+{
+    int fd;
+} ServerClient;
+
+// Set by SIGINT / SIGTERM
+static volatile sig_atomic_t server_stop;
+
+// The worker thread has its own working directory
+static __thread int fs_unshared;
+
+
+/* --- Description for read_and_validate_server_args Function --->
+ * Input: argc, argv, serverInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -l <socket> [-j N]
+ * -j sets the number of jobs served at the same time (default 1).
+ */
+Status read_and_validate_server_args(int argc, char *argv[], ServerInfo *serverInfo)
+{
+    serverInfo->socket_fname = NULL;
+    serverInfo->jobs = 1;
+    serverInfo->argc = 0;
+    serverInfo->argv = NULL;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &serverInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)
+        {
+            if(parse_jobs(argv[i] + 2, &serverInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(argv[i][0] == '-' || serverInfo->socket_fname != NULL)
+        {
+            return e_failure;
+        }
+        else
+        {
+            serverInfo->socket_fname = argv[i];
+        }
+    }
+
+    return serverInfo->socket_fname != NULL ? e_success : e_failure;
+}
+
+
+/* --- Description for read_and_validate_client_args Function --->
+ * Input: argc, argv, serverInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -c <socket> <mode> [args]...
+ * Everything after the socket is forwarded as it is, the server checks it.
+ */
+Status read_and_validate_client_args(int argc, char *argv[], ServerInfo *serverInfo)
+{
+    if(argc < 4 || argv[3][0] != '-' || argc - 3 > SERVER_MAX_ARGS)
+        return e_failure;
+
+    serverInfo->socket_fname = argv[2];
+    serverInfo->jobs = 1;
+    serverInfo->argc = argc - 3;
+    serverInfo->argv = argv + 3;
+    return e_success;
+}
+
+
+/* --- Description for server_address Function --->
+ * Input: fname, addr
+ * Output: Status (e_failure if the path does not fit sun_path)
+ */
+static Status server_address(const char *fname, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(fname) >= sizeof(addr->sun_path))
+    {
+        fprintf(job_stderr(), "ERROR : Socket path %s is too long\n", fname);
+        return e_failure;
+    }
+    strcpy(addr->sun_path, fname);
+    return e_success;
+}
+
+
+/* --- Description for server_signal Function --->
+ * Input: sig
+ * Output: None
+ */
+static void server_signal(int sig)
+{
+    (void)sig;      // SIGINT and SIGTERM both stop the server
+    server_stop = 1;
+}
+
+
+/* --- Description for server_recv_request Function --->
+ * Input: fd (connection), request (SERVER_MAX_REQUEST bytes), len, fds (SERVER_NFDS, set to -1)
+ * Output: Status (e_failure for a malformed request)
+ * Description: Reads the whole request. The descriptors come with its first
+ * bytes, anything else than the SERVER_NFDS expected is closed. The caller
+ * closes the descriptors received, even on failure.
+ */
+static Status server_recv_request(int fd, unsigned char *request, size_t *len, int fds[SERVER_NFDS])
+{
+    size_t got = 0, want = 4;
+    int nfds = 0;
+
+    while(got < want)
+    {
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(int) * SERVER_NFDS)];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = { request + got, want - got };
+        struct msghdr msg = { 0 };
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if(n <= 0)
+            return e_failure;
+
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            int *passed = (int *)CMSG_DATA(cmsg);
+            for(size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+            {
+                if(nfds < SERVER_NFDS)
+                    fds[nfds++] = passed[i];
+                else
+                    close(passed[i]);
+            }
+        }
+
+        got += n;
+        if(got == 4)
+        {
+            want = 4 + get_le(request, 4);
+            if(want < 8 || want > SERVER_MAX_REQUEST)
+                return e_failure;
+        }
+    }
+
+    *len = got;
+    return nfds == SERVER_NFDS ? e_success : e_failure;
+}
+
+
+/* --- Description for server_run_job Function --->
+ * Input: argc, argv (command line of the job)
+ * Output: Status of the job
+ * Description: Runs an encode, decode or probe job like main does, with
+ * the INFO messages and reports going to the client.
+ */
+static Status server_run_job(int argc, char *argv[])
+{
+    Status ret = e_failure;
+
+    switch(check_operation_type(argc, argv))
+    {
+        case e_encode :
+        {
+            EncodeInfo encInfo;
+            if(read_and_validate_encode_args(argc, argv, &encInfo) == e_failure)
+            {
+                fprintf(job_stderr(), "ERROR : Invalid arguments for encoding\n");
+                metrics_report_refused("encode", argc > 2 ? argv[2] : NULL, NULL);
+                break;
+            }
+            ret = do_encoding(&encInfo);
+            metrics_report(&encInfo.metrics);
+            close_files(&encInfo);
+            info_printf(ret == e_success ? "INFO : ## Encoding Done Successfully ##\n" : "INFO : ## Encoding Failed ##\n");
+        }
+        break;
+
+        case e_decode :
+        {
+            DecodeInfo decInfo = { 0 };
+            if(read_and_validate_decode_args(argc, argv, &decInfo) == e_failure)
+            {
+                fprintf(job_stderr(), "ERROR : Invalid arguments for decoding\n");
+                metrics_report_refused("decode", argc > 2 ? argv[2] : NULL, NULL);
+                break;
+            }
+            ret = do_decoding(&decInfo);
+            metrics_report(&decInfo.metrics);
+            close_decode_files(&decInfo);
+            info_printf(ret == e_success ? "INFO : ## Decoding Done Successfully ##\n" : "INFO : ## Decoding Failed ##\n");
+        }
+        break;
+
+        case e_probe :
+        {
+            ProbeInfo probeInfo;
+            if(read_and_validate_probe_args(argc, argv, &probeInfo) == e_failure)
+            {
+                fprintf(job_stderr(), "ERROR : Invalid arguments for probe\n");
+                free(probeInfo.paths);
+                break;
+            }
+            ret = do_probe(&probeInfo);
+        }
+        break;
+
+        default :
+            fprintf(job_stderr(), "ERROR : The server runs -e, -d and -p jobs only\n");
+    }
+    return ret;
+}
+
+
+/* --- Description for server_run_request Function --->
+ * Input: request, len, fds (cwd, stdin, stdout, stderr of the client)
+ * Output: Status of the job
+ * Description: Splits the arguments, moves the worker thread to the
+ * working directory of the client and runs the job on its descriptors.
+ */
+static Status server_run_request(unsigned char *request, size_t len, int fds[SERVER_NFDS])
+{
+    ReportFormat format = get_le(request + 4, 4);
+    char *argv[SERVER_MAX_ARGS + 2] = { "stego" };
+    int argc = 1;
+
+    if(format > e_report_json)
+        return e_failure;
+    for(size_t pos = 8; pos < len; argc++)
+    {
+        char *arg = (char *)request + pos;
+        size_t n = strnlen(arg, len - pos);
+        if(n == len - pos || argc > SERVER_MAX_ARGS)
+            return e_failure;
+        argv[argc] = arg;
+        pos += n + 1;
+    }
+    argv[argc] = NULL;
+
+    // the other workers and the accept loop keep their own directory
+    if(!fs_unshared && unshare(CLONE_FS) == -1)
+    {
+        perror("unshare");
+        return e_failure;
+    }
+    fs_unshared = 1;
+    if(fchdir(fds[0]) == -1)
+    {
+        perror("fchdir");
+        return e_failure;
+    }
+    if(set_job_fds(fds[1], fds[2], fds[3]) == e_failure)
+        return e_failure;
+
+    metrics_set_thread_format(&format);
+    Status ret = server_run_job(argc, argv);
+    metrics_set_thread_format(NULL);
+    set_job_fds(-1, -1, -1);
+    return ret;
+}
+
+
+/* --- Description for serve_client Function --->
+ * Input: arg (ServerClient)
+ * Output: None
+ * Description: Pool task, one per connection: reads the request, runs the
+ * job, flushes its output and replies with its exit status.
+ */
+static void serve_client(void *arg)
+{
+    ServerClient *client = arg;
+    unsigned char *request = malloc(SERVER_MAX_REQUEST);
+    int fds[SERVER_NFDS] = { -1, -1, -1, -1 };
+    unsigned char status = e_failure;
+    size_t len;
+
+    if(request != NULL && server_recv_request(client->fd, request, &len, fds) == e_success)
+        status = server_run_request(request, len, fds);
+    send(client->fd, &status, 1, MSG_NOSIGNAL);
+
+    for(int i = 0; i < SERVER_NFDS; i++)
+        if(fds[i] != -1)
+            close(fds[i]);
+    close(client->fd);
+    free(request);
+    free(client);
+}
+
+
+/* --- Description for server_listen Function --->
+ * Input: fname
+ * Output: listening socket, -1 on failure
+ * Description: A socket file nobody answers on is left over from a server
+ * that died and is replaced, a live server or any other file is an error.
+ */
+static int server_listen(const char *fname)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if(server_address(fname, &addr) == e_failure)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        fprintf(job_stderr(), "ERROR : A server is already listening on %s\n", fname);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if(lstat(fname, &st) == 0 && (!S_ISSOCK(st.st_mode) || unlink(fname) == -1))
+    {
+        fprintf(job_stderr(), "ERROR : %s exists and is not a stale socket\n", fname);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+       chmod(fname, S_IRUSR | S_IWUSR) == -1 || listen(fd, SERVER_BACKLOG) == -1)
+    {
+        perror("bind");
+        fprintf(job_stderr(), "ERROR : Unable to listen on %s\n", fname);
+        if(fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/* --- Description for do_serve Function --->
+ * Input: serverInfo
+ * Output: Status (e_failure if the socket can't be set up)
+ * Description:
+ * 1. Listens on the socket, accessible to its owner only.
+ * 2. Hands every connection to a work-stealing pool of serverInfo->jobs
+ *    threads, which run the jobs through the same argument validation and
+ *    do_encoding / do_decoding / do_probe as the command line.
+ * 3. On SIGINT / SIGTERM stops accepting, lets the jobs already accepted
+ *    finish and removes the socket.
+ * SIGINT and SIGTERM are blocked everywhere but in ppoll, so a signal can't
+ * slip in between the check of server_stop and the wait. Error messages of
+ * the jobs that don't go to the client are the server's log.
+ */
+Status do_serve(ServerInfo *serverInfo)
+{
+    struct sigaction sa = { 0 };
+    sigset_t block, unblocked;
+
+    int fd = server_listen(serverInfo->socket_fname);
+    if(fd == -1)
+        return e_failure;
+
+    sa.sa_handler = server_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);   // clients may go away while their job writes
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &unblocked);
+
+    ThreadPool *pool = threadpool_create(serverInfo->jobs, e_pool_fifo);   // connections served in arrival order
+    if(pool == NULL)
+    {
+        fprintf(job_stderr(), "ERROR : Unable to start %u worker threads\n", serverInfo->jobs);
+        close(fd);
+        unlink(serverInfo->socket_fname);
+        return e_failure;
+    }
+    info_printf("INFO : Serving on %s, %u jobs at a time\n", serverInfo->socket_fname, serverInfo->jobs);
+    fflush(stdout);
+
+    Status ret = e_success;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while(!server_stop)
+    {
+        if(ppoll(&pfd, 1, NULL, &unblocked) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("ppoll");
+            ret = e_failure;
+            break;
+        }
+
+        int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if(conn == -1)
+            continue;       // client gone before it was accepted
+        ServerClient *client = malloc(sizeof(ServerClient));
+        if(client != NULL)
+            client->fd = conn;
+        if(client == NULL || threadpool_submit(pool, serve_client, client) == e_failure)
+        {
+            close(conn);
+            free(client);
+        }
+    }
+
+    close(fd);
+    unlink(serverInfo->socket_fname);
+    threadpool_destroy(pool);
+    pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
+    info_printf("INFO : Server on %s stopped\n", serverInfo->socket_fname);
+    return ret;
+}
+
+
+/* --- Description for do_client Function --->
+ * Input: serverInfo
+ * Output: Status (exit status of the job on the server)
+ * Description: Sends the arguments and the report format with the working
+ * directory, stdin, stdout and stderr of this process, and waits for the
+ * exit status. The job's output reaches stdout and stderr directly.
+ */
+Status do_client(ServerInfo *serverInfo)
+{
+    struct sockaddr_un addr;
+    unsigned char *request = malloc(SERVER_MAX_REQUEST);
+    size_t len = 8;
+    Status ret = e_failure;
+
+    if(request == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+    for(int i = 0; i < serverInfo->argc; i++)
+    {
+        size_t n = strlen(serverInfo->argv[i]) + 1;
+        if(len + n > SERVER_MAX_REQUEST)
+        {
+            fprintf(job_stderr(), "ERROR : Arguments are too long for the server\n");
+            free(request);
+            return e_failure;
+        }
+        memcpy(request + len, serverInfo->argv[i], n);
+        len += n;
+    }
+    put_le(request, len - 4, 4);
+    put_le(request + 4, metrics_format(), 4);
+
+    int fds[SERVER_NFDS] = { open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC), STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fds[0] == -1 || fd == -1 || server_address(serverInfo->socket_fname, &addr) == e_failure ||
+       connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("connect");
+        fprintf(job_stderr(), "ERROR : No server listening on %s\n", serverInfo->socket_fname);
+    }
+    else
+    {
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(fds))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = { request, len };
+        struct msghdr msg = { 0 };
+        unsigned char status;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        // the descriptors go with the first bytes, the rest follows plainly
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        size_t sent = n > 0 ? n : 0;
+        while(n > 0 && sent < len)
+        {
+            n = send(fd, request + sent, len - sent, MSG_NOSIGNAL);
+            sent += n > 0 ? n : 0;
+        }
+
+        if(sent != len || recv(fd, &status, 1, 0) != 1)
+            fprintf(job_stderr(), "ERROR : Server on %s closed the connection\n", serverInfo->socket_fname);
+        else
+            ret = status == e_success ? e_success : e_failure;
+    }
+
+    if(fds[0] != -1)
+        close(fds[0]);
+    if(fd != -1)
+        close(fd);
+    free(request);
+    return ret;
+}
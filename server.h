@@ -0,0 +1,61 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Server mode: a long running process serving encode, decode and probe
+ * jobs over a Unix domain socket, so small jobs don't pay for a process
+ * start each. The client mode forwards a command line to it:
+ *      -l <socket> [-j N]              serve, N jobs at a time, until SIGINT / SIGTERM
+ *      -c <socket> -e|-d|-p <args>...  run one job on the server, like the same
+ *                                      command line without "-c <socket>"
+ * A request is one message:
+ *      le32 length of what follows
+ *      le32 report format of the client (ReportFormat, -q / --json)
+ *      the arguments from the mode on, each NUL terminated
+ * sent with four descriptors of the client (SCM_RIGHTS): its working
+ * directory, stdin, stdout and stderr. The job runs on a worker thread of
+ * the server with that working directory (the thread has its own, see
+ * unshare(2)), "-" reads and writes the client's stdin and stdout, and the
+ * INFO messages and reports go to the client. The reply is one byte, the
+ * exit status of the job. The socket is made accessible to its owner only.
+ */
+
+/* Descriptors passed with a request: cwd, stdin, stdout, stderr */
+#define SERVER_NFDS 4
+
+/* Largest request, arguments included */
+#define SERVER_MAX_REQUEST (64 * 1024)
+
+/* Most arguments in a request */
+#define SERVER_MAX_ARGS 256
+
+/* Connections waiting to be accepted */
+#define SERVER_BACKLOG 64
+
+// Structure to hold server and client related information
+typedef struct _ServerInfo
+{
+    char *socket_fname;
+    uint jobs;          // worker threads (-j, server)
+    int argc;           // client: arguments to forward, from the mode on
+    char **argv;
+} ServerInfo;
+
+
+/* -- function prototypes for server and client modes */
+
+/* Read and validate server args from argv */
+Status read_and_validate_server_args(int argc, char *argv[], ServerInfo *serverInfo);
+
+/* Serve jobs on the socket until SIGINT / SIGTERM */
+Status do_serve(ServerInfo *serverInfo);
+
+/* Read and validate client args from argv */
+Status read_and_validate_client_args(int argc, char *argv[], ServerInfo *serverInfo);
+
+/* Run the job on the server, returns its exit status */
+Status do_client(ServerInfo *serverInfo);
+
+#endif
@@ -0,0 +1,756 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shard.h"
+#include "encode.h"
+#include "decode.h"
+#include "container.h"
+#include "crc32c.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "rs.h"
+#include "metrics.h"
+#include "types.h"
+
+// One image of a shard set
+typedef struct _ShardJob
+{
+    char *image_fname;      // cover (-s) or stego image (-m)
+    char *shard_fname;      // -s: temporary file holding the shard bytes
+    char *out_fname;        // -s: stego image written
+    FILE *fptr;             // -m: decoded shard bytes
+    ShardFields fields;
+    uint64_t size;          // shard bytes
+    char extn[MAX_FILE_SUFFIX];
+    Status status;
+    const char *note;       // -m: why a decoded shard is not used, NULL if it is
+} ShardJob;
+
+// State shared by the jobs of a set
+typedef struct _ShardSet
+{
+    ShardInfo *info;
+    ShardJob *jobs;         // one per image
+    ShardFields fields;     // fields common to the set (index unused)
+    uint64_t shard_size;    // bytes of every parity shard, and of the longest data shards
+} ShardSet;
+
+
+/* --- Description for shard_length Function --->
+ * Input: set (fields and shard_size set), index
+ * Output: bytes of shard index
+ * Description: Data shards hold consecutive slices of the payload, so the
+ * last ones may be shorter (or empty). Parity shards are full size.
+ */
+static uint64_t shard_length(const ShardSet *set, uint index)
+{
+    uint64_t start = index * set->shard_size;
+
+    if(index >= set->fields.data)
+        return set->shard_size;
+    if(start >= set->fields.payload_size)
+        return 0;
+    return set->fields.payload_size - start < set->shard_size ? set->fields.payload_size - start : set->shard_size;
+}
+
+
+/* --- Description for read_and_validate_shard_args Function --->
+ * Input: argc, argv, shardInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -s <secret_file> <output prefix> <cover.bmp>... [--parity M] [-j N]
+ * --depth, --compress, --key, --scatter, --mmap, --reflink, --stream and --uring are
+ * passed on to the encoding of every shard, and checked the same way -e
+ * checks them. The extension stored is the one of the secret file, or
+ * the one given with --extn (.bin for stdin).
+ */
+Status read_and_validate_shard_args(int argc, char *argv[], ShardInfo *shardInfo)
+{
+    int count = 0, size;
+
+    shardInfo->images = malloc(argc * sizeof(char *));
+    shardInfo->nimages = 0;
+    shardInfo->parity = 0;
+    shardInfo->extn = NULL;
+    shardInfo->noptions = 0;
+    shardInfo->key_fname = NULL;
+    shardInfo->output_fname = NULL;
+    shardInfo->jobs = 1;
+    if(shardInfo->images == NULL)
+        return e_failure;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--parity") == 0 && i + 1 < argc)
+        {
+            char *end;
+            long parity = strtol(argv[++i], &end, 10);
+            if(*argv[i] == '\0' || *end != '\0' || parity < 0 || parity >= MAX_SHARDS)
+                return e_failure;
+            shardInfo->parity = parity;
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &shardInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)
+        {
+            if(parse_jobs(argv[i] + 2, &shardInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strcmp(argv[i], "--extn") == 0 && i + 1 < argc && argv[i + 1][0] == '.')
+        {
+            shardInfo->extn = argv[++i];
+        }
+        else if((size = encode_option_size(argc, argv, i)) > 0)
+        {
+            if(shardInfo->noptions + size > MAX_SHARD_OPTIONS)
+                return e_failure;
+            for(int k = 0; k < size; k++)
+                shardInfo->options[shardInfo->noptions++] = argv[i + k];
+            i += size - 1;
+        }
+        else if(strncmp(argv[i], "--", 2) == 0)   // unknown option
+        {
+            return e_failure;
+        }
+        else if(count == 0)
+        {
+            shardInfo->secret_fname = argv[i];
+            count++;
+        }
+        else if(count == 1)
+        {
+            shardInfo->prefix = argv[i];
+            count++;
+        }
+        else
+        {
+            // covers are read by several jobs at once, stdin can't be one of them
+            if(strstr(argv[i], ".bmp") == NULL)
+                return e_failure;
+            shardInfo->images[shardInfo->nimages++] = argv[i];
+        }
+    }
+
+    if(count < 2 || shardInfo->nimages == 0 || shardInfo->nimages > MAX_SHARDS || shardInfo->parity >= shardInfo->nimages ||
+       strcmp(shardInfo->prefix, "-") == 0)
+        return e_failure;
+
+    // extension of the secret file name, like -e
+    if(shardInfo->extn == NULL)
+    {
+        const char *base = strrchr(shardInfo->secret_fname, '/');
+        shardInfo->extn = strchr(base ? base + 1 : shardInfo->secret_fname, '.');
+        if(shardInfo->extn == NULL && strcmp(shardInfo->secret_fname, "-") == 0)
+            shardInfo->extn = ".bin";
+    }
+    if(shardInfo->extn == NULL || strlen(shardInfo->extn) >= MAX_FILE_SUFFIX)
+        return e_failure;
+
+    // let the encoder check the options it is given
+    EncodeInfo encInfo;
+    char *check[3 + 3 + MAX_SHARD_OPTIONS] = { argv[0], "-e", "cover.bmp", "secret.bin", "stego.bmp" };
+    memcpy(check + 5, shardInfo->options, shardInfo->noptions * sizeof(char *));
+    return read_and_validate_encode_args(5 + shardInfo->noptions, check, &encInfo);
+}
+
+
+/* --- Description for read_and_validate_join_args Function --->
+ * Input: argc, argv, shardInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -m <stego.bmp>... [-o output file] [--key file] [-j N]
+ * The output file gets the extension stored with the payload, like -d,
+ * "-o -" writes the payload to stdout.
+ */
+Status read_and_validate_join_args(int argc, char *argv[], ShardInfo *shardInfo)
+{
+    shardInfo->images = malloc(argc * sizeof(char *));
+    shardInfo->nimages = 0;
+    shardInfo->parity = 0;
+    shardInfo->noptions = 0;
+    shardInfo->key_fname = NULL;
+    shardInfo->output_fname = NULL;
+    shardInfo->jobs = 1;
+    if(shardInfo->images == NULL)
+        return e_failure;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+            shardInfo->key_fname = argv[++i];
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            shardInfo->output_fname = argv[++i];
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &shardInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)
+        {
+            if(parse_jobs(argv[i] + 2, &shardInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(argv[i][0] == '-' || strstr(argv[i], ".bmp") == NULL)   // unknown option, stdin
+            return e_failure;
+        else
+            shardInfo->images[shardInfo->nimages++] = argv[i];
+    }
+
+    return shardInfo->nimages > 0 ? e_success : e_failure;
+}
+
+
+/* --- Description for shard_open_secret Function --->
+ * Input: fname
+ * Output: secret opened for reading, NULL on failure
+ * Description: The size must be known before the shards are cut, so a
+ * secret coming from a pipe is first copied to a temporary file.
+ */
+static FILE *shard_open_secret(const char *fname)
+{
+    FILE *fptr = strcmp(fname, "-") == 0 ? stdin : fopen(fname, "rb");
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", fname);
+        return NULL;
+    }
+    if(is_regular_file(fptr))
+        return fptr;
+
+    FILE *copy = tmpfile();
+    char buffer[64 * 1024];
+    size_t got;
+
+    while(copy != NULL && (got = fread(buffer, 1, sizeof(buffer), fptr)) > 0)
+    {
+        if(fwrite(buffer, 1, got, copy) != got)
+        {
+            fclose(copy);
+            copy = NULL;
+        }
+    }
+    if(copy == NULL || ferror(fptr))
+    {
+        perror("tmpfile");
+        if(copy != NULL)
+            fclose(copy);
+        copy = NULL;
+    }
+    if(fptr != stdin)
+        fclose(fptr);
+    return copy;
+}
+
+
+/* --- Description for shard_split Function --->
+ * Input: set (fields and shard_size set), fptr_secret, shards (one open file per shard)
+ * Output: Status
+ * Description:
+ * 1. Copies the payload slice of every data shard to its file, taking the
+ *    CRC of the whole payload on the way.
+ * 2. Reads the data shards back SHARD_BLOCK_SIZE bytes at a time, zero
+ *    padded to the shard size, and adds each block times its coefficient
+ *    into the parity blocks (see rs.h), which are then written out.
+ */
+static Status shard_split(ShardSet *set, FILE *fptr_secret, FILE **shards)
+{
+    uint data = set->fields.data, parity = set->fields.parity;
+    unsigned char *buffer = malloc(SHARD_BLOCK_SIZE);
+    unsigned char *blocks = malloc((size_t)parity * SHARD_BLOCK_SIZE + 1);
+    unsigned char *coef = malloc((size_t)parity * data + 1);
+    Status ret = e_success;
+    uint crc = 0;
+
+    if(buffer == NULL || blocks == NULL || coef == NULL)
+    {
+        perror("malloc");
+        ret = e_failure;
+    }
+
+    fseeko(fptr_secret, 0, SEEK_SET);
+    for(uint i = 0; i < data && ret == e_success; i++)
+    {
+        for(uint64_t left = shard_length(set, i); left > 0 && ret == e_success; )
+        {
+            size_t len = left < SHARD_BLOCK_SIZE ? left : SHARD_BLOCK_SIZE;
+            if(fread(buffer, 1, len, fptr_secret) != len || fwrite(buffer, 1, len, shards[i]) != len)
+                ret = e_failure;
+            crc = crc32c(crc, buffer, len);
+            left -= len;
+        }
+    }
+    set->fields.payload_crc = crc;
+
+    if(parity > 0 && ret == e_success)
+    {
+        rs_parity_coef(data, parity, coef);
+        for(uint i = 0; i < data; i++)
+            fseeko(shards[i], 0, SEEK_SET);
+    }
+    for(uint64_t offset = 0; parity > 0 && offset < set->shard_size && ret == e_success; offset += SHARD_BLOCK_SIZE)
+    {
+        size_t len = set->shard_size - offset < SHARD_BLOCK_SIZE ? set->shard_size - offset : SHARD_BLOCK_SIZE;
+
+        memset(blocks, 0, (size_t)parity * SHARD_BLOCK_SIZE);
+        for(uint i = 0; i < data; i++)
+        {
+            size_t got = fread(buffer, 1, len, shards[i]);     // short or empty past the end of the payload
+            memset(buffer + got, 0, len - got);
+            for(uint r = 0; r < parity; r++)
+                rs_mul_add(blocks + (size_t)r * SHARD_BLOCK_SIZE, buffer, len, coef[r * data + i]);
+        }
+        for(uint r = 0; r < parity; r++)
+            if(fwrite(blocks + (size_t)r * SHARD_BLOCK_SIZE, 1, len, shards[data + r]) != len)
+                ret = e_failure;
+    }
+
+    for(uint i = 0; i < data + parity; i++)
+        if(ferror(shards[i]) || fflush(shards[i]) != 0)
+            ret = e_failure;
+    free(buffer);
+    free(blocks);
+    free(coef);
+    return ret;
+}
+
+
+/* --- Description for shard_encode_chunk Function --->
+ * Input: ctx (ShardSet), chunk (shard number), worker
+ * Output: e_success, failures are recorded in the job
+ * Description: Encodes one shard through the same argument validation and
+ * do_encoding as -e, with the shard fields of the set.
+ */
+static Status shard_encode_chunk(void *ctx, size_t chunk, uint worker)
+{
+    ShardSet *set = ctx;
+    ShardJob *job = &set->jobs[chunk];
+    EncodeInfo encInfo;
+    char *argv[7 + MAX_SHARD_OPTIONS] = { "stego", "-e", job->image_fname, job->shard_fname, job->out_fname,
+                                          "--extn", set->info->extn };
+
+    (void)worker;
+    memcpy(argv + 7, set->info->options, set->info->noptions * sizeof(char *));
+    job->status = e_failure;
+    if(read_and_validate_encode_args(7 + set->info->noptions, argv, &encInfo) == e_success)
+    {
+        FILE *saved_stdout = silence_stdout();      // on the thread running the job
+        encInfo.shard = set->fields;
+        encInfo.shard.index = chunk;
+        job->status = do_encoding(&encInfo);
+        close_files(&encInfo);
+        restore_stdout(saved_stdout);
+    }
+    return e_success;
+}
+
+
+/* --- Description for do_shard Function --->
+ * Input: shardInfo
+ * Output: Status (e_failure if any shard could not be encoded)
+ * Description:
+ * 1. Cuts the payload in data shards and computes the parity shards into
+ *    temporary files, under a random set id.
+ * 2. Encodes the shards into their covers, shardInfo->jobs at a time, with
+ *    the INFO messages of the encoder discarded.
+ * 3. Prints one status line per shard and removes the temporary files.
+ */
+Status do_shard(ShardInfo *shardInfo)
+{
+    ShardSet set = { .info = shardInfo };
+    uint count = shardInfo->nimages;
+    Status ret = e_success;
+
+    set.jobs = calloc(count, sizeof(ShardJob));
+    FILE **shards = calloc(count, sizeof(FILE *));
+    FILE *fptr_secret = shard_open_secret(shardInfo->secret_fname);
+    if(set.jobs == NULL || shards == NULL || fptr_secret == NULL)
+    {
+        free(set.jobs);
+        free(shards);
+        if(fptr_secret != NULL)
+            fclose(fptr_secret);
+        return e_failure;
+    }
+
+    set.fields.payload_size = get_file_size(fptr_secret);
+    set.fields.data = count - shardInfo->parity;
+    set.fields.parity = shardInfo->parity;
+    set.shard_size = (set.fields.payload_size + set.fields.data - 1) / set.fields.data;
+    if(read_random_bytes(set.fields.set_id, SHARD_SET_ID_SIZE) == e_failure)
+        ret = e_failure;
+
+    for(uint i = 0; i < count && ret == e_success; i++)
+    {
+        ShardJob *job = &set.jobs[i];
+        job->image_fname = shardInfo->images[i];
+        job->size = shard_length(&set, i);
+        job->out_fname = malloc(strlen(shardInfo->prefix) + 16);
+        if(job->out_fname == NULL || (shards[i] = create_temp_file(&job->shard_fname)) == NULL)
+        {
+            fprintf(job_stderr(), "ERROR : Unable to create a temporary file for shard %u\n", i);
+            ret = e_failure;
+            break;
+        }
+        sprintf(job->out_fname, "%s_%u.bmp", shardInfo->prefix, i);
+    }
+
+    info_printf("INFO : Splitting %llu bytes in %u data and %u parity shards of %llu bytes\n",
+                (unsigned long long)set.fields.payload_size, set.fields.data, set.fields.parity,
+                (unsigned long long)set.shard_size);
+    if(ret == e_success && shard_split(&set, fptr_secret, shards) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed to write the shards\n");
+        ret = e_failure;
+    }
+    fclose(fptr_secret);
+    for(uint i = 0; i < count; i++)
+        if(shards[i] != NULL)
+            fclose(shards[i]);
+    free(shards);
+
+    if(ret == e_success)
+    {
+        info_printf("INFO : Encoding %u shards\n", count);
+        parallel_for(shardInfo->jobs, count, shard_encode_chunk, &set);
+
+        for(uint i = 0; i < count; i++)
+        {
+            ShardJob *job = &set.jobs[i];
+            if(job->status == e_failure)
+            {
+                ret = e_failure;
+                fprintf(job_stderr(), "FAIL shard %-3u %s %12llu bytes  %s -> %s\n", i,
+                        i < set.fields.data ? "data  " : "parity", (unsigned long long)job->size,
+                        job->image_fname, job->out_fname);
+            }
+            else
+                info_printf("OK   shard %-3u %s %12llu bytes  %s -> %s\n", i,
+                            i < set.fields.data ? "data  " : "parity", (unsigned long long)job->size,
+                            job->image_fname, job->out_fname);
+        }
+        if(ret == e_failure)
+            fprintf(job_stderr(), "ERROR : Some shards could not be encoded, the set is incomplete\n");
+    }
+
+    for(uint i = 0; i < count; i++)
+    {
+        if(set.jobs[i].shard_fname != NULL)
+            unlink(set.jobs[i].shard_fname);
+        free(set.jobs[i].shard_fname);
+        free(set.jobs[i].out_fname);
+    }
+    free(set.jobs);
+    return ret;
+}
+
+
+/* --- Description for shard_decode_chunk Function --->
+ * Input: ctx (ShardSet), chunk (image index), worker
+ * Output: e_success, failures are recorded in the job
+ * Description: Decodes the header of one image with the decoder's own
+ * functions, checks it holds a shard, and decodes the shard (chunk CRCs
+ * checked) into a temporary file.
+ */
+static Status shard_decode_chunk(void *ctx, size_t chunk, uint worker)
+{
+    ShardSet *set = ctx;
+    ShardJob *job = &set->jobs[chunk];
+    DecodeInfo decInfo = { 0 };
+
+    (void)worker;
+    decInfo.stego_image_fname = job->image_fname;
+    decInfo.secret_fname = job->image_fname;    // any name but "-"
+    decInfo.key_fname = set->info->key_fname;
+    decInfo.jobs = 1;
+
+    job->status = e_failure;
+    if(open_decode_files(&decInfo) == e_success && (decInfo.fptr_secret = tmpfile()) != NULL &&
+       decode_magic_string(&decInfo) == e_success && decode_file_extn_size(&decInfo) == e_success &&
+       decode_secret_file_extn(decInfo.extn_size, &decInfo) == e_success &&
+       decode_secret_file_size(&decInfo) == e_success && (decInfo.flags & CONTAINER_SHARDED) &&
+       decode_cipher_key(&decInfo) == e_success && decode_chunk_table(&decInfo) == e_success &&
+       decode_secret_file_data(&decInfo) == e_success && fflush(decInfo.fptr_secret) == 0)
+    {
+        job->fields = decInfo.shard;
+        job->size = decInfo.size_secret_file;
+        strcpy(job->extn, decInfo.extn_secret_file);
+        job->fptr = decInfo.fptr_secret;
+        decInfo.fptr_secret = NULL;     // kept open for the rebuild
+        job->status = e_success;
+    }
+    close_decode_files(&decInfo);
+    return e_success;
+}
+
+
+/* --- Description for shard_pick_set Function --->
+ * Input: set (images decoded), by_index (data + parity entries, filled)
+ * Output: number of shards usable
+ * Description: The first image decoded decides the set. Shards of other
+ * sets, duplicates and shards of the wrong size are left out.
+ */
+static uint shard_pick_set(ShardSet *set, ShardJob **by_index)
+{
+    ShardJob *first = NULL;
+    uint usable = 0;
+
+    for(uint i = 0; i < set->info->nimages; i++)
+    {
+        ShardJob *job = &set->jobs[i];
+        if(job->status == e_failure)
+            continue;
+        if(first == NULL)
+        {
+            first = job;
+            set->fields = job->fields;
+            set->shard_size = set->fields.payload_size / set->fields.data + (set->fields.payload_size % set->fields.data != 0);
+        }
+
+        if(memcmp(job->fields.set_id, set->fields.set_id, SHARD_SET_ID_SIZE) != 0 ||
+           job->fields.data != set->fields.data || job->fields.parity != set->fields.parity ||
+           job->fields.payload_size != set->fields.payload_size || job->fields.payload_crc != set->fields.payload_crc ||
+           strcmp(job->extn, first->extn) != 0)
+            job->note = "other set";
+        else if(by_index[job->fields.index] != NULL)
+            job->note = "duplicate";
+        else if(job->size != shard_length(set, job->fields.index))
+            job->note = "wrong size";
+        else
+        {
+            by_index[job->fields.index] = job;
+            usable++;
+        }
+    }
+    return usable;
+}
+
+
+/* --- Description for shard_rebuild Function --->
+ * Input: set, by_index (shards available), rebuilt (one entry per data shard, set for the missing ones)
+ * Output: Status
+ * Description: Nothing to do when every data shard was decoded. Otherwise
+ * picks the data shards present and parity shards for the others, inverts their rows of the code (see rs_decode_matrix) and
+ * computes every missing data shard SHARD_BLOCK_SIZE bytes at a time into
+ * a temporary file.
+ */
+static Status shard_rebuild(ShardSet *set, ShardJob **by_index, FILE **rebuilt)
+{
+    uint data = set->fields.data, parity = set->fields.parity;
+    uint *rows = malloc(data * sizeof(uint));
+    uint *missing = malloc(data * sizeof(uint));
+    unsigned char *matrix = malloc((size_t)data * data);
+    unsigned char *buffer = malloc(SHARD_BLOCK_SIZE);
+    unsigned char *blocks = malloc((size_t)parity * SHARD_BLOCK_SIZE + 1);
+    uint nrows = 0, nmissing = 0;
+    Status ret = e_success;
+
+    if(rows == NULL || missing == NULL || matrix == NULL || buffer == NULL || blocks == NULL)
+    {
+        perror("malloc");
+        ret = e_failure;
+    }
+
+    for(uint i = 0; i < data && ret == e_success; i++)
+    {
+        if(by_index[i] != NULL)
+            rows[nrows++] = i;
+        else
+            missing[nmissing++] = i;
+    }
+    for(uint i = data; i < data + parity && nrows < data && ret == e_success; i++)
+        if(by_index[i] != NULL)
+            rows[nrows++] = i;
+
+    if(ret == e_success && nmissing > 0)
+        ret = rs_decode_matrix(data, parity, rows, matrix);
+    for(uint m = 0; m < nmissing && ret == e_success; m++)
+        if((rebuilt[missing[m]] = tmpfile()) == NULL)
+        {
+            perror("tmpfile");
+            ret = e_failure;
+        }
+    for(uint j = 0; j < data && ret == e_success; j++)
+        fseeko(by_index[rows[j]]->fptr, 0, SEEK_SET);
+
+    for(uint64_t offset = 0; nmissing > 0 && offset < set->shard_size && ret == e_success; offset += SHARD_BLOCK_SIZE)
+    {
+        size_t len = set->shard_size - offset < SHARD_BLOCK_SIZE ? set->shard_size - offset : SHARD_BLOCK_SIZE;
+
+        memset(blocks, 0, (size_t)nmissing * SHARD_BLOCK_SIZE);
+        for(uint j = 0; j < data; j++)
+        {
+            size_t got = fread(buffer, 1, len, by_index[rows[j]]->fptr);    // data shards may be short
+            memset(buffer + got, 0, len - got);
+            for(uint m = 0; m < nmissing; m++)
+                rs_mul_add(blocks + (size_t)m * SHARD_BLOCK_SIZE, buffer, len, matrix[missing[m] * data + j]);
+        }
+        for(uint m = 0; m < nmissing; m++)
+        {
+            uint64_t length = shard_length(set, missing[m]);
+            size_t keep = length <= offset ? 0 : length - offset < len ? length - offset : len;
+            if(fwrite(blocks + (size_t)m * SHARD_BLOCK_SIZE, 1, keep, rebuilt[missing[m]]) != keep)
+                ret = e_failure;
+        }
+    }
+
+    if(ret == e_success && nmissing > 0)
+        info_printf("INFO : Rebuilt %u missing data shards from parity\n", nmissing);
+    free(rows);
+    free(missing);
+    free(matrix);
+    free(buffer);
+    free(blocks);
+    return ret;
+}
+
+
+/* --- Description for shard_write_payload Function --->
+ * Input: set, by_index, rebuilt, fptr_out
+ * Output: Status (e_failure on I/O errors or if the payload CRC does not match)
+ * Description: Writes the data shards one after the other, decoded or
+ * rebuilt, and checks the CRC of the whole payload.
+ */
+static Status shard_write_payload(ShardSet *set, ShardJob **by_index, FILE **rebuilt, FILE *fptr_out)
+{
+    unsigned char *buffer = malloc(SHARD_BLOCK_SIZE);
+    Status ret = buffer != NULL ? e_success : e_failure;
+    uint crc = 0;
+
+    for(uint i = 0; i < set->fields.data && ret == e_success; i++)
+    {
+        FILE *fptr = by_index[i] != NULL ? by_index[i]->fptr : rebuilt[i];
+        fseeko(fptr, 0, SEEK_SET);
+        for(uint64_t left = shard_length(set, i); left > 0 && ret == e_success; )
+        {
+            size_t len = left < SHARD_BLOCK_SIZE ? left : SHARD_BLOCK_SIZE;
+            if(fread(buffer, 1, len, fptr) != len || fwrite(buffer, 1, len, fptr_out) != len)
+                ret = e_failure;
+            crc = crc32c(crc, buffer, len);
+            left -= len;
+        }
+    }
+    free(buffer);
+
+    if(ret == e_success && crc != set->fields.payload_crc)
+    {
+        fprintf(job_stderr(), "ERROR : Checksum of the rebuilt payload does not match\n");
+        ret = e_failure;
+    }
+    return ret;
+}
+
+
+/* --- Description for shard_open_output Function --->
+ * Input: shardInfo, extn (stored with the payload)
+ * Output: output file, NULL on failure
+ * Description: Same naming as -d: the name given (or "decoded") up to its
+ * first dot, followed by the stored extension.
+ */
+static FILE *shard_open_output(ShardInfo *shardInfo, const char *extn)
+{
+    const char *name = shardInfo->output_fname != NULL ? shardInfo->output_fname : "decoded";
+    char *fname = malloc(strlen(name) + strlen(extn) + 1);
+    if(fname == NULL)
+        return NULL;
+    strcpy(fname, name);
+    char *dot = strchr(fname, '.');
+    strcpy(dot != NULL ? dot : fname + strlen(fname), extn);
+
+    FILE *fptr = fopen(fname, "wb");
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", fname);
+    }
+    else
+        info_printf("INFO : The final Decoded file with Extension : %s\n", fname);
+    free(fname);
+    return fptr;
+}
+
+
+/* --- Description for do_join Function --->
+ * Input: shardInfo
+ * Output: Status (e_failure unless the payload was rebuilt and its CRC matches)
+ * Description:
+ * 1. Decodes every image, shardInfo->jobs at a time. Images that fail to
+ *    decode (damaged, wrong key, not a shard) just count as missing.
+ * 2. Keeps the shards of one set and prints one line per image.
+ * 3. Rebuilds missing data shards from parity when needed.
+ * 4. Writes the payload and checks its CRC.
+ */
+Status do_join(ShardInfo *shardInfo)
+{
+    ShardSet set = { .info = shardInfo };
+    uint count = shardInfo->nimages;
+    Status ret = e_failure;
+    FILE *fptr_out = NULL;
+
+    // "-o -" writes the payload to stdout, keep the INFO messages off it
+    if(shardInfo->output_fname != NULL && strcmp(shardInfo->output_fname, "-") == 0 &&
+       (fptr_out = claim_stdout()) == NULL)
+        return e_failure;
+
+    set.jobs = calloc(count, sizeof(ShardJob));
+    if(set.jobs == NULL)
+    {
+        perror("calloc");
+        if(fptr_out != NULL)
+            fclose(fptr_out);
+        return e_failure;
+    }
+    for(uint i = 0; i < count; i++)
+        set.jobs[i].image_fname = shardInfo->images[i];
+
+    info_printf("INFO : Decoding %u images\n", count);
+    parallel_for(shardInfo->jobs, count, shard_decode_chunk, &set);
+
+    ShardJob *by_index[MAX_SHARDS] = { NULL };
+    FILE *rebuilt[MAX_SHARDS] = { NULL };
+    uint usable = shard_pick_set(&set, by_index);
+
+    for(uint i = 0; i < count; i++)
+    {
+        ShardJob *job = &set.jobs[i];
+        if(job->status == e_failure)
+            fprintf(job_stderr(), "FAIL %s  (not a decodable shard)\n", job->image_fname);
+        else if(job->note != NULL)
+            info_printf("SKIP %s  (shard %u, %s)\n", job->image_fname, job->fields.index, job->note);
+        else
+            info_printf("OK   %s  (shard %u of %u)\n", job->image_fname, job->fields.index,
+                        job->fields.data + job->fields.parity);
+    }
+
+    if(usable == 0)
+        fprintf(job_stderr(), "ERROR : No shard could be decoded\n");
+    else if(usable < set.fields.data)
+        fprintf(job_stderr(), "ERROR : Only %u of the %u shards needed are available\n", usable, set.fields.data);
+    else
+    {
+        const char *extn = NULL;
+        for(uint i = 0; extn == NULL; i++)
+            if(by_index[i] != NULL)
+                extn = by_index[i]->extn;
+
+        if(shard_rebuild(&set, by_index, rebuilt) == e_success &&
+           (fptr_out != NULL || (fptr_out = shard_open_output(shardInfo, extn)) != NULL))
+        {
+            info_printf("INFO : Writing %llu bytes\n", (unsigned long long)set.fields.payload_size);
+            ret = shard_write_payload(&set, by_index, rebuilt, fptr_out);
+        }
+    }
+    if(fptr_out != NULL && fclose(fptr_out) != 0)
+        ret = e_failure;
+
+    for(uint i = 0; i < MAX_SHARDS; i++)
+        if(rebuilt[i] != NULL)
+            fclose(rebuilt[i]);
+    for(uint i = 0; i < count; i++)
+        if(set.jobs[i].fptr != NULL)
+            fclose(set.jobs[i].fptr);
+    free(set.jobs);
+    return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Shard mode: spreads a payload too large for one cover over several.
+ *      -s <secret_file> <output prefix> <cover.bmp>... [--parity M] [encode options] [-j N]
+ *      -m <stego.bmp>... [-o output file] [--key file] [-j N]
+ * With n covers and M parity shards the payload is cut in n - M data shards
+ * of equal size (the last one may be shorter) and M parity shards of that
+ * size are computed with the erasure code of rs.h. Shard i goes into cover i
+ * as <output prefix>_<i>.bmp, in a container of its own flagged
+ * CONTAINER_SHARDED (see container.h), so every image is checked like any
+ * other stego image. -j images are encoded or decoded at once. -m takes the
+ * images of a set in any order and rebuilds the payload from any n - M of
+ * its shards, so up to M images may be lost or damaged.
+ */
+
+/* Bytes of every shard handled per step while splitting or rebuilding */
+#define SHARD_BLOCK_SIZE (1024 * 1024)
+
+/* Encode options passed on to every shard, with their values */
+#define MAX_SHARD_OPTIONS 12
+
+// Structure to hold shard mode information
+typedef struct _ShardInfo
+{
+    char *secret_fname;     // -s: payload to split ("-" for stdin)
+    char *prefix;           // -s: output images are <prefix>_<i>.bmp
+    char **images;          // covers (-s) or stego images (-m)
+    uint nimages;
+    uint parity;            // -s: parity shards (--parity)
+    char *extn;             // -s: extension stored with the payload
+    char *options[MAX_SHARD_OPTIONS];   // -s: --depth, --compress, --key, --scatter, I/O mode
+    int noptions;
+    char *key_fname;        // -m: key of encrypted shards (--key)
+    char *output_fname;     // -m: output file (-o), NULL for "decoded"
+    uint jobs;              // images encoded or decoded at once (-j)
+} ShardInfo;
+
+
+/* -- function prototypes for shard mode */
+
+/* Read and validate -s args from argv */
+Status read_and_validate_shard_args(int argc, char *argv[], ShardInfo *shardInfo);
+
+/* Read and validate -m args from argv */
+Status read_and_validate_join_args(int argc, char *argv[], ShardInfo *shardInfo);
+
+/* Split the payload and encode one shard into every cover */
+Status do_shard(ShardInfo *shardInfo);
+
+/* Decode the shards and rebuild the payload */
+Status do_join(ShardInfo *shardInfo);
+
+#endif
@@ -0,0 +1,584 @@
+#include <string.h>
+#include "stego.h"
+#include "common.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "types.h"
+
+/* Image bytes gathered at once from an image whose colour bytes are not contiguous */
+#define STEGO_WINDOW_SIZE (8 * LSB_BLOCK_SIZE)
+
+static const char *const error_strings[] = {
+    "success",
+    "bad argument",
+    "not a supported BMP image",
+    "image cannot hold the payload",
+    "no payload in the image",
+    "payload is damaged",
+    "payload is encrypted, a key is needed",
+    "wrong key",
+    "buffer too small",
+    "payload not supported by the library"
+};
+
+
+/* --- Description for stego_fail Function --->
+ * Input: image, error
+ * Output: e_failure
+ */
+static Status stego_fail(StegoImage *image, StegoError error)
+{
+    image->error = error;
+    return e_failure;
+}
+
+
+/* --- Description for stego_colour_copy Function --->
+ * Input: image, pos (colour byte), buf, n, store (1: buf to image, 0: image to buf)
+ * Output: None
+ * Description: Moves n colour bytes between the pixel array and buf, row by
+ * row in file order, leaving the row padding and the alpha bytes alone.
+ */
+static void stego_colour_copy(StegoImage *image, uint64_t pos, unsigned char *buf, size_t n, int store)
+{
+    const BmpInfo *bmp = &image->bmp;
+
+    while(n > 0)
+    {
+        size_t col = pos % bmp->row_bytes;
+        size_t take = bmp->row_bytes - col < n ? bmp->row_bytes - col : n;
+        unsigned char *line = image->data + bmp->data_offset + pos / bmp->row_bytes * bmp->stride;
+
+        if(bmp->bpp == 24 && store)
+            memcpy(line + col, buf, take);
+        else if(bmp->bpp == 24)
+            memcpy(buf, line + col, take);
+        else
+        {
+            for(size_t i = 0; i < take; i++)
+            {
+                unsigned char *byte = line + (col + i) / 3 * 4 + (col + i) % 3;
+                if(store)
+                    *byte = buf[i];
+                else
+                    buf[i] = *byte;
+            }
+        }
+        pos += take;
+        buf += take;
+        n -= take;
+    }
+}
+
+
+/* --- Description for stego_embed_run Function --->
+ * Input: image, pos, data, size (whole groups, or the padded end), depth
+ * Output: None
+ * Description: Embeds straight into the buffer when the colour bytes are
+ * contiguous, otherwise through a window gathered from and scattered back
+ * to the rows, one block at a time.
+ */
+static void stego_embed_run(StegoImage *image, uint64_t pos, const unsigned char *data, size_t size, uint depth)
+{
+    unsigned char window[STEGO_WINDOW_SIZE];
+    size_t step = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(depth);
+
+    if(bmp_is_linear(&image->bmp))
+    {
+        lsb_embed_depth(image->data + image->bmp.data_offset + pos, data, size, depth);
+        return;
+    }
+    for(size_t off = 0; off < size; off += step)
+    {
+        size_t want = size - off < step ? size - off : step;
+        size_t bytes = lsb_image_bytes(want, depth);
+
+        stego_colour_copy(image, pos + lsb_image_bytes(off, depth), window, bytes, 0);
+        lsb_embed_depth(window, data + off, want, depth);
+        stego_colour_copy(image, pos + lsb_image_bytes(off, depth), window, bytes, 1);
+    }
+}
+
+
+/* --- Description for stego_extract_run Function --->
+ * Input: data, image, pos, size, depth
+ * Output: None
+ * Description: Mirror of stego_embed_run.
+ */
+static void stego_extract_run(unsigned char *data, StegoImage *image, uint64_t pos, size_t size, uint depth)
+{
+    unsigned char window[STEGO_WINDOW_SIZE];
+    size_t step = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(depth);
+
+    if(bmp_is_linear(&image->bmp))
+    {
+        lsb_extract_depth(data, image->data + image->bmp.data_offset + pos, size, depth);
+        return;
+    }
+    for(size_t off = 0; off < size; off += step)
+    {
+        size_t want = size - off < step ? size - off : step;
+
+        stego_colour_copy(image, pos + lsb_image_bytes(off, depth), window, lsb_image_bytes(want, depth), 0);
+        lsb_extract_depth(data + off, window, want, depth);
+    }
+}
+
+
+/* --- Description for stego_embed Function --->
+ * Input: image, pos (colour byte), data, len, depth
+ * Output: None
+ * Description: Embeds len bytes and zero pads them to whole groups, so the
+ * next item starts on a group boundary (see container.h). The caller has
+ * checked that the image holds them.
+ */
+void stego_embed(StegoImage *image, uint64_t pos, const unsigned char *data, size_t len, uint depth)
+{
+    size_t whole = len - len % lsb_group_size(depth);
+
+    stego_embed_run(image, pos, data, whole, depth);
+    if(whole < len)
+    {
+        unsigned char tail[MAX_LSB_DEPTH] = { 0 };
+        memcpy(tail, data + whole, len - whole);
+        stego_embed_run(image, pos + lsb_image_bytes(whole, depth), tail, chunk_stored_size(len, depth) - whole, depth);
+    }
+}
+
+
+/* --- Description for stego_extract Function --->
+ * Input: data, image, pos, len, depth
+ * Output: None
+ * Description: Mirror of stego_embed, the padding is dropped.
+ */
+static void stego_extract(unsigned char *data, StegoImage *image, uint64_t pos, size_t len, uint depth)
+{
+    size_t whole = len - len % lsb_group_size(depth);
+
+    stego_extract_run(data, image, pos, whole, depth);
+    if(whole < len)
+    {
+        unsigned char tail[MAX_LSB_DEPTH];
+        stego_extract_run(tail, image, pos + lsb_image_bytes(whole, depth), chunk_stored_size(len, depth) - whole, depth);
+        memcpy(data + whole, tail, len - whole);
+    }
+}
+
+
+/* --- Description for stego_embed_chunk Function --->
+ * Input: image, pos, data, len, depth, cipher (NULL to store in clear), key_pos, entry
+ * Output: None
+ * Description: Embeds one stored chunk and fills the length and CRC of its
+ * entry. data is left as it is: encrypted chunks go through a block sized
+ * buffer, copied, encrypted, checksummed and embedded while still in cache.
+ * Chunks at different positions can be embedded by several threads at once.
+ */
+void stego_embed_chunk(StegoImage *image, uint64_t pos, const unsigned char *data, size_t len, uint depth,
+                       const ChaCha *cipher, uint64_t key_pos, ChunkEntry *entry)
+{
+    unsigned char block[LSB_BLOCK_SIZE];
+    size_t step = LSB_BLOCK_SIZE - LSB_BLOCK_SIZE % lsb_group_size(depth);
+    uint crc = 0;
+
+    if(cipher == NULL)
+    {
+        stego_embed(image, pos, data, len, depth);
+        crc = crc32c(0, data, len);
+    }
+    for(size_t off = 0; cipher != NULL && off < len; off += step)
+    {
+        size_t want = len - off < step ? len - off : step;
+
+        memcpy(block, data + off, want);
+        chacha20_xor(cipher, block, want, CIPHER_DATA_OFFSET + key_pos + off);
+        crc = crc32c(crc, block, want);
+        stego_embed(image, pos + lsb_image_bytes(off, depth), block, want, depth);
+    }
+
+    entry->length = len;
+    entry->crc = crc;
+}
+
+
+/* --- Description for stego_image_init Function --->
+ * Input: image, data (whole BMP file), size
+ * Output: Status
+ */
+Status stego_image_init(StegoImage *image, unsigned char *data, size_t size)
+{
+    memset(image, 0, sizeof(*image));
+    image->data = data;
+    image->size = size;
+    if(data == NULL || bmp_parse_header(data, size, &image->bmp) == e_failure || image->bmp.image_size > size)
+        return stego_fail(image, e_stego_bad_image);
+    return e_success;
+}
+
+
+/* --- Description for stego_header Function --->
+ * Input: image, options, size, header
+ * Output: Status
+ * Description: Checks the encode options and fills the header they give,
+ * without the key check.
+ */
+static Status stego_header(StegoImage *image, const StegoOptions *options, uint64_t size, ContainerHeader *header)
+{
+    const char *extn = options->extn != NULL ? options->extn : ".bin";
+
+    memset(header, 0, sizeof(*header));
+    header->depth = options->depth != 0 ? options->depth : MIN_LSB_DEPTH;
+    if(header->depth > MAX_LSB_DEPTH || strlen(extn) >= MAX_FILE_SUFFIX ||
+       (options->key != NULL && options->nonce == NULL))
+        return stego_fail(image, e_stego_bad_argument);
+    if(options->compress && (options->workspace == NULL || options->workspace_size < STEGO_WORKSPACE_SIZE))
+        return stego_fail(image, e_stego_short_buffer);
+
+    strcpy(header->extn, extn);
+    header->size = size;
+    header->chunk_size = PARALLEL_CHUNK_SIZE - PARALLEL_CHUNK_SIZE % lsb_group_size(header->depth);
+    if(options->compress)
+        header->flags |= CONTAINER_COMPRESSED;
+    if(options->key != NULL)
+    {
+        header->flags |= CONTAINER_ENCRYPTED;
+        memcpy(header->nonce, options->nonce, CHACHA_NONCE_SIZE);
+    }
+    return e_success;
+}
+
+
+/* --- Description for stego_capacity Function --->
+ * Input: image, options
+ * Output: payload bytes, 0 if the options are not usable
+ * Description: Every full chunk costs its table entry and its image bytes,
+ * the rest of the image holds one last, shorter chunk.
+ */
+uint64_t stego_capacity(const StegoImage *image, const StegoOptions *options)
+{
+    StegoImage copy = *image;
+    ContainerHeader header;
+    unsigned char bytes[MAX_HEADER_SIZE];
+
+    if(stego_header(&copy, options, 0, &header) == e_failure)
+        return 0;
+
+    uint64_t used = 8 * (uint64_t)container_header_pack(&header, bytes);
+    if(image->bmp.colour_bytes <= used)
+        return 0;
+
+    uint group = lsb_group_size(header.depth);
+    uint64_t left = image->bmp.colour_bytes - used;
+    uint64_t chunk_cost = 8 * CHUNK_ENTRY_SIZE + lsb_image_bytes(header.chunk_size, header.depth);
+    uint64_t capacity = left / chunk_cost * header.chunk_size;
+
+    left %= chunk_cost;
+    if(left > 8 * CHUNK_ENTRY_SIZE)
+        capacity += (left - 8 * CHUNK_ENTRY_SIZE) / lsb_image_bytes(group, header.depth) * group;
+    return capacity;
+}
+
+
+/* --- Description for stego_encode Function --->
+ * Input: image, payload, size, options
+ * Output: Status
+ * Description: Lays the payload out like -e: header and chunk table at
+ * depth 1, then the chunks at the chosen depth. Each entry is embedded as
+ * soon as its chunk is, so no table is held. With compression every chunk
+ * is compressed into the workspace and stored compressed when it shrinks;
+ * the room left is checked chunk by chunk, so a payload that turns out not
+ * to fit leaves the image partly written. Without it the image is checked
+ * up front and left untouched on failure.
+ */
+Status stego_encode(StegoImage *image, const unsigned char *payload, size_t size, const StegoOptions *options)
+{
+    ContainerHeader header;
+    ChaCha cipher;
+    unsigned char bytes[MAX_HEADER_SIZE];
+
+    if(payload == NULL && size > 0)
+        return stego_fail(image, e_stego_bad_argument);
+    if(stego_header(image, options, size, &header) == e_failure)
+        return e_failure;
+    if(options->key != NULL)
+    {
+        unsigned char check[4] = { 0 };
+        chacha20_init(&cipher, options->key, options->nonce);
+        chacha20_xor(&cipher, check, sizeof(check), 0);
+        header.key_check = get_le(check, 4);
+    }
+    if(!options->compress && size > stego_capacity(image, options))
+        return stego_fail(image, e_stego_too_small);
+
+    uint header_size = container_header_pack(&header, bytes);
+    uint64_t nchunks = (size + header.chunk_size - 1) / header.chunk_size;
+    uint64_t table_pos = 8 * (uint64_t)header_size;
+    uint64_t pos = table_pos + 8 * CHUNK_ENTRY_SIZE * nchunks;
+    if(pos > image->bmp.colour_bytes)
+        return stego_fail(image, e_stego_too_small);
+
+    for(uint64_t i = 0; i < nchunks; i++)
+    {
+        const unsigned char *data = payload + i * header.chunk_size;
+        size_t len = size - i * header.chunk_size < header.chunk_size ? size - i * header.chunk_size : header.chunk_size;
+        size_t packed_len = options->compress && len > 1 ? lz_compress(data, len, options->workspace, len - 1) : 0;
+        unsigned char entry_bytes[CHUNK_ENTRY_SIZE];
+        ChunkEntry entry;
+
+        if(packed_len > 0)
+        {
+            data = options->workspace;
+            len = packed_len;
+        }
+        if(image->bmp.colour_bytes - pos < lsb_image_bytes(chunk_stored_size(len, header.depth), header.depth))
+            return stego_fail(image, e_stego_too_small);
+        stego_embed_chunk(image, pos, data, len, header.depth, options->key != NULL ? &cipher : NULL,
+                          i * header.chunk_size, &entry);
+        entry.compressed = packed_len > 0;
+        chunk_entry_pack(&entry, entry_bytes);
+        stego_embed(image, table_pos + 8 * CHUNK_ENTRY_SIZE * i, entry_bytes, CHUNK_ENTRY_SIZE, 1);
+        pos += lsb_image_bytes(chunk_stored_size(len, header.depth), header.depth);
+    }
+
+    stego_embed(image, 0, bytes, header_size, 1);
+    image->error = e_stego_ok;
+    return e_success;
+}
+
+
+/* --- Description for stego_read_header Function --->
+ * Input: image, header, header_len
+ * Output: Status
+ * Description: Extracts and checks the header in the first colour bytes,
+ * telling a clean image and an older container from a damaged one.
+ */
+static Status stego_read_header(StegoImage *image, ContainerHeader *header, size_t *header_len)
+{
+    unsigned char bytes[MAX_HEADER_SIZE];
+    size_t len = image->bmp.colour_bytes / 8 < MAX_HEADER_SIZE ? image->bmp.colour_bytes / 8 : MAX_HEADER_SIZE;
+
+    stego_extract(bytes, image, 0, len, 1);
+    if(len < strlen(MAGIC_STRING) + 4 || memcmp(bytes, MAGIC_STRING, strlen(MAGIC_STRING)) != 0)
+        return stego_fail(image, e_stego_no_payload);
+    if(get_le(bytes + strlen(MAGIC_STRING), 4) >> VERSION_SHIFT != CONTAINER_VERSION)
+        return stego_fail(image, e_stego_unsupported);
+    if(container_header_unpack(header, bytes, len, header_len) == e_failure)
+        return stego_fail(image, e_stego_damaged);
+    return e_success;
+}
+
+
+/* --- Description for stego_inspect Function --->
+ * Input: image, payload
+ * Output: Status
+ */
+Status stego_inspect(StegoImage *image, StegoPayload *payload)
+{
+    ContainerHeader header;
+    size_t header_len;
+
+    if(stego_read_header(image, &header, &header_len) == e_failure)
+        return e_failure;
+    memcpy(payload->extn, header.extn, MAX_FILE_SUFFIX);
+    payload->depth = header.depth;
+    payload->flags = header.flags;
+    payload->size = header.size;
+    payload->chunk_size = header.chunk_size;
+    image->error = e_stego_ok;
+    return e_success;
+}
+
+
+/* --- Description for stego_decode_stored Function --->
+ * Input: image, options, header, cipher (NULL if not encrypted), entry, pos, key_pos, out, expected (payload bytes of the chunk)
+ * Output: Status
+ * Description: Extracts one stored chunk, checks its CRC, decrypts it and
+ * decompresses it when needed, leaving exactly expected bytes in out.
+ * Compressed chunks are extracted into the workspace.
+ */
+static Status stego_decode_stored(StegoImage *image, const StegoOptions *options, const ContainerHeader *header,
+                                  const ChaCha *cipher, const ChunkEntry *entry, uint64_t pos, uint64_t key_pos,
+                                  unsigned char *out, size_t expected)
+{
+    unsigned char *stored = entry->compressed ? options->workspace : out;
+    size_t raw_len;
+
+    if(entry->compressed && !(header->flags & CONTAINER_COMPRESSED))
+        return stego_fail(image, e_stego_damaged);
+    if(entry->compressed ? entry->length >= expected : entry->length != expected)
+        return stego_fail(image, e_stego_damaged);
+    if(entry->compressed && (options->workspace == NULL || options->workspace_size < entry->length))
+        return stego_fail(image, e_stego_short_buffer);
+    if(image->bmp.colour_bytes < pos ||
+       image->bmp.colour_bytes - pos < lsb_image_bytes(chunk_stored_size(entry->length, header->depth), header->depth))
+        return stego_fail(image, e_stego_damaged);
+
+    stego_extract(stored, image, pos, entry->length, header->depth);
+    if(crc32c(0, stored, entry->length) != entry->crc)
+        return stego_fail(image, e_stego_damaged);
+    if(cipher != NULL)
+        chacha20_xor(cipher, stored, entry->length, CIPHER_DATA_OFFSET + key_pos);
+    if(entry->compressed &&
+       (lz_decompress(stored, entry->length, out, expected, &raw_len) == e_failure || raw_len != expected))
+        return stego_fail(image, e_stego_damaged);
+    return e_success;
+}
+
+
+/* --- Description for stego_decode_chunks Function --->
+ * Input: image, options, header, cipher, header_len, out, capacity
+ * Output: Status
+ * Description: Reads the table one entry at a time, each entry right before
+ * its chunk.
+ */
+static Status stego_decode_chunks(StegoImage *image, const StegoOptions *options, const ContainerHeader *header,
+                                  const ChaCha *cipher, size_t header_len, unsigned char *out, size_t capacity)
+{
+    uint64_t nchunks = (header->size + header->chunk_size - 1) / header->chunk_size;
+    uint64_t table_pos = 8 * (uint64_t)header_len;
+    uint64_t pos = table_pos + 8 * CHUNK_ENTRY_SIZE * nchunks;
+
+    if(header->size > capacity)
+        return stego_fail(image, e_stego_short_buffer);
+    if(pos > image->bmp.colour_bytes)
+        return stego_fail(image, e_stego_damaged);
+
+    for(uint64_t i = 0; i < nchunks; i++)
+    {
+        uint64_t start = i * header->chunk_size;
+        size_t expected = header->size - start < header->chunk_size ? header->size - start : header->chunk_size;
+        unsigned char entry_bytes[CHUNK_ENTRY_SIZE];
+        ChunkEntry entry;
+
+        stego_extract(entry_bytes, image, table_pos + 8 * CHUNK_ENTRY_SIZE * i, CHUNK_ENTRY_SIZE, 1);
+        chunk_entry_unpack(&entry, entry_bytes);
+        if(stego_decode_stored(image, options, header, cipher, &entry, pos, start, out + start, expected) == e_failure)
+            return e_failure;
+        pos += lsb_image_bytes(chunk_stored_size(entry.length, header->depth), header->depth);
+    }
+    return e_success;
+}
+
+
+/* --- Description for stego_decode_frames Function --->
+ * Input: image, options, header, cipher, header_len, out, capacity, size
+ * Output: Status
+ * Description: Streamed payloads: every frame is its entry followed by its
+ * bytes, until an entry of length 0. Frames are full but for the last one.
+ */
+static Status stego_decode_frames(StegoImage *image, const StegoOptions *options, const ContainerHeader *header,
+                                  const ChaCha *cipher, size_t header_len, unsigned char *out, size_t capacity,
+                                  size_t *size)
+{
+    uint64_t pos = 8 * (uint64_t)header_len;
+    uint64_t entry_bytes_image = lsb_image_bytes(chunk_stored_size(CHUNK_ENTRY_SIZE, header->depth), header->depth);
+    size_t got = 0;
+
+    for(uint64_t index = 0; ; index++)
+    {
+        unsigned char entry_bytes[CHUNK_ENTRY_SIZE];
+        ChunkEntry entry;
+
+        if(image->bmp.colour_bytes < pos || image->bmp.colour_bytes - pos < entry_bytes_image)
+            return stego_fail(image, e_stego_damaged);
+        stego_extract(entry_bytes, image, pos, CHUNK_ENTRY_SIZE, header->depth);
+        chunk_entry_unpack(&entry, entry_bytes);
+        pos += entry_bytes_image;
+        if(entry.length == 0)
+            break;
+
+        // a compressed frame does not tell its raw length, only the last one may be short
+        size_t expected = entry.compressed ? header->chunk_size : entry.length;
+        if(entry.length > header->chunk_size)
+            return stego_fail(image, e_stego_damaged);
+        if(capacity - got < expected)
+        {
+            if(!entry.compressed)
+                return stego_fail(image, e_stego_short_buffer);
+            expected = capacity - got;
+        }
+        if(entry.compressed)
+        {
+            size_t raw_len;
+            if(options->workspace == NULL || options->workspace_size < entry.length)
+                return stego_fail(image, e_stego_short_buffer);
+            if(image->bmp.colour_bytes - pos < lsb_image_bytes(chunk_stored_size(entry.length, header->depth), header->depth))
+                return stego_fail(image, e_stego_damaged);
+            stego_extract(options->workspace, image, pos, entry.length, header->depth);
+            if(crc32c(0, options->workspace, entry.length) != entry.crc)
+                return stego_fail(image, e_stego_damaged);
+            if(cipher != NULL)
+                chacha20_xor(cipher, options->workspace, entry.length, CIPHER_DATA_OFFSET + index * header->chunk_size);
+            if(lz_decompress(options->workspace, entry.length, out + got, expected, &raw_len) == e_failure)
+                return stego_fail(image, capacity - got < header->chunk_size ? e_stego_short_buffer : e_stego_damaged);
+            expected = raw_len;
+        }
+        else if(stego_decode_stored(image, options, header, cipher, &entry, pos, index * header->chunk_size,
+                                    out + got, expected) == e_failure)
+            return e_failure;
+        got += expected;
+        pos += lsb_image_bytes(chunk_stored_size(entry.length, header->depth), header->depth);
+    }
+    *size = got;
+    return e_success;
+}
+
+
+/* --- Description for stego_decode Function --->
+ * Input: image, options (key and workspace), out, capacity, size
+ * Output: Status
+ * Description: Checks the header and the key before anything else, then
+ * decodes chunk by chunk into out, every chunk checked against its CRC.
+ * On failure out holds the chunks decoded so far.
+ */
+Status stego_decode(StegoImage *image, const StegoOptions *options, unsigned char *out, size_t capacity, size_t *size)
+{
+    ContainerHeader header;
+    ChaCha cipher;
+    size_t header_len;
+
+    if(out == NULL && capacity > 0)
+        return stego_fail(image, e_stego_bad_argument);
+    if(stego_read_header(image, &header, &header_len) == e_failure)
+        return e_failure;
+    if(header.flags & (CONTAINER_SCATTERED | CONTAINER_SHARDED))
+        return stego_fail(image, e_stego_unsupported);
+
+    if(header.flags & CONTAINER_ENCRYPTED)
+    {
+        unsigned char check[4] = { 0 };
+        if(options->key == NULL)
+            return stego_fail(image, e_stego_need_key);
+        chacha20_init(&cipher, options->key, header.nonce);
+        chacha20_xor(&cipher, check, sizeof(check), 0);
+        if(get_le(check, 4) != header.key_check)
+            return stego_fail(image, e_stego_wrong_key);
+    }
+
+    const ChaCha *key = header.flags & CONTAINER_ENCRYPTED ? &cipher : NULL;
+    if(header.flags & CONTAINER_STREAMED)
+    {
+        if(stego_decode_frames(image, options, &header, key, header_len, out, capacity, size) == e_failure)
+            return e_failure;
+    }
+    else
+    {
+        if(stego_decode_chunks(image, options, &header, key, header_len, out, capacity) == e_failure)
+            return e_failure;
+        *size = header.size;
+    }
+    image->error = e_stego_ok;
+    return e_success;
+}
+
+
+/* --- Description for stego_error_string Function --->
+ * Input: error
+ * Output: message, never NULL
+ */
+const char *stego_error_string(StegoError error)
+{
+    if((uint)error >= sizeof(error_strings) / sizeof(error_strings[0]))
+        return "unknown error";
+    return error_strings[error];
+}
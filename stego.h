@@ -0,0 +1,106 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h> //for size_t
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "container.h"
+#include "chacha20.h"
+#include "parallel.h"
+
+/*
+ * libstego: encode and decode payloads in BMP images held in memory.
+ * The image is a whole BMP file in a caller buffer, modified in place by
+ * stego_encode (copy the cover first to keep it). Payloads are plain
+ * buffers. Nothing is allocated and no file or stdio call is made: the
+ * caller draws the nonce of encrypted payloads and lends the scratch
+ * buffer compression needs. Images written here decode with -d and the
+ * other way around, byte for byte the same as -e for the same options.
+ *      StegoImage image;
+ *      StegoOptions options = { .depth = 1, .extn = ".txt" };
+ *      if(stego_image_init(&image, bmp, bmp_size) == e_failure ||
+ *         stego_encode(&image, payload, size, &options) == e_failure)
+ *          puts(stego_error_string(image.error));
+ * Not supported (e_stego_unsupported): version 0 images, keyed block order
+ * (--scatter) and shards (-s), use the CLI for those. An archive (-a)
+ * decodes to its raw bytes, table of contents first.
+ */
+
+/* Scratch bytes compression needs, one chunk (see StegoOptions.workspace) */
+#define STEGO_WORKSPACE_SIZE PARALLEL_CHUNK_SIZE
+
+typedef enum
+{
+    e_stego_ok,
+    e_stego_bad_argument,   // options or buffers the call cannot use
+    e_stego_bad_image,      // not a supported BMP, or shorter than its header claims
+    e_stego_too_small,      // image cannot hold the payload
+    e_stego_no_payload,     // no magic string
+    e_stego_damaged,        // header or data fails its checks
+    e_stego_need_key,       // payload is encrypted, no key given
+    e_stego_wrong_key,      // key check does not match
+    e_stego_short_buffer,   // output or workspace too small
+    e_stego_unsupported     // see above
+} StegoError;
+
+// Caller buffer holding a whole BMP file
+typedef struct _StegoImage
+{
+    unsigned char *data;
+    size_t size;
+    BmpInfo bmp;            // layout, set by stego_image_init
+    StegoError error;       // reason of the last e_failure
+} StegoImage;
+
+// Options of an encode or decode
+typedef struct _StegoOptions
+{
+    uint depth;                     // encode: LSBs per image byte, 1 to 4 (0 means 1)
+    const char *extn;               // encode: extension recorded, ".bin" if NULL
+    const unsigned char *key;       // CHACHA_KEY_SIZE bytes, NULL to store in clear
+    const unsigned char *nonce;     // encode with a key: CHACHA_NONCE_SIZE fresh random bytes
+    int compress;                   // encode: compress the chunks (needs workspace)
+    unsigned char *workspace;       // STEGO_WORKSPACE_SIZE bytes, for compression (encode and decode)
+    size_t workspace_size;
+} StegoOptions;
+
+// Header of the payload found in an image
+typedef struct _StegoPayload
+{
+    char extn[MAX_FILE_SUFFIX];
+    uint depth;
+    uint flags;                     // CONTAINER_* flags
+    uint64_t size;                  // payload bytes, 0 if streamed (size known once decoded)
+    uint chunk_size;
+} StegoPayload;
+
+
+/* -- function prototypes for the library */
+
+/* Check and describe the BMP file in data */
+Status stego_image_init(StegoImage *image, unsigned char *data, size_t size);
+
+/* Largest payload stego_encode can store uncompressed with options */
+uint64_t stego_capacity(const StegoImage *image, const StegoOptions *options);
+
+/* Encode size bytes of payload into the image */
+Status stego_encode(StegoImage *image, const unsigned char *payload, size_t size, const StegoOptions *options);
+
+/* Read and check the header of the payload, without decoding it */
+Status stego_inspect(StegoImage *image, StegoPayload *payload);
+
+/* Decode the payload into out (capacity bytes), its length goes to size */
+Status stego_decode(StegoImage *image, const StegoOptions *options, unsigned char *out, size_t capacity, size_t *size);
+
+/* Embed len bytes at depth from colour byte pos, zero padded to whole groups */
+void stego_embed(StegoImage *image, uint64_t pos, const unsigned char *data, size_t len, uint depth);
+
+/* Embed one chunk, encrypted at keystream byte CIPHER_DATA_OFFSET + key_pos when cipher is set */
+void stego_embed_chunk(StegoImage *image, uint64_t pos, const unsigned char *data, size_t len, uint depth,
+                       const ChaCha *cipher, uint64_t key_pos, ChunkEntry *entry);
+
+/* Message for an error */
+const char *stego_error_string(StegoError error);
+
+#endif
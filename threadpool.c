@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "threadpool.h"
+#include "types.h"
+
+// One queued task
+typedef struct _Task
+{
+    TaskFn fn;
+    void *arg;
+} Task;
+
+// Per worker double ended queue, pushed at the bottom, a LIFO owner takes from the bottom, thieves from the top
+typedef struct _TaskDeque
+{
+    Task *tasks;
+    size_t top;         // oldest task
+    size_t bottom;      // one past the newest task
+    size_t capacity;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+// Per worker argument
+typedef struct _PoolWorker
+{
+    ThreadPool *pool;
+    uint index;
+} PoolWorker;
+
+struct _ThreadPool
+{
+    uint nthreads;
+    PoolOrder order;        // of the tasks a worker takes from its own deque
+    pthread_t *threads;
+    PoolWorker *workers;
+    TaskDeque *deques;
+    uint next_deque;        // round robin target of threadpool_submit
+
+    pthread_mutex_t lock;   // protects the counters below
+    pthread_cond_t work_cv; // signalled when tasks are queued or on stop
+    pthread_cond_t idle_cv; // signalled when unfinished drops to 0
+    size_t queued;          // tasks sitting in deques
+    size_t unfinished;      // tasks submitted and not yet finished
+    int stop;
+};
+
+
+/* --- Description for deque_push Function --->
+ * Input: deque, task
+ * Output: Status
+ * Description: Pushes a task at the bottom, growing the ring as needed.
+ */
+static Status deque_push(TaskDeque *deque, Task task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom - deque->top == deque->capacity)
+    {
+        size_t capacity = deque->capacity ? 2 * deque->capacity : 64;
+        Task *tasks = malloc(capacity * sizeof(Task));
+        if(tasks == NULL)
+        {
+            pthread_mutex_unlock(&deque->lock);
+            return e_failure;
+        }
+        for(size_t i = deque->top; i < deque->bottom; i++)
+            tasks[i - deque->top] = deque->tasks[i % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->bottom -= deque->top;
+        deque->top = 0;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom++ % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->lock);
+    return e_success;
+}
+
+
+/* --- Description for deque_take Function --->
+ * Input: deque, task, oldest (0: newest task, taken by a LIFO owner, 1: oldest task)
+ * Output: 1 if a task was taken
+ */
+static int deque_take(TaskDeque *deque, Task *task, int oldest)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom != deque->top)
+    {
+        if(oldest)
+            *task = deque->tasks[deque->top++ % deque->capacity];
+        else
+            *task = deque->tasks[--deque->bottom % deque->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+
+/* --- Description for pool_worker Function --->
+ * Input: arg (PoolWorker)
+ * Output: NULL
+ * Description: Runs tasks of the own deque in the pool's order, then steals
+ * the oldest tasks of the other workers, and sleeps when no task is queued
+ * anywhere.
+ */
+static void *pool_worker(void *arg)
+{
+    PoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    Task task;
+
+    while(1)
+    {
+        int found = deque_take(&pool->deques[worker->index], &task, pool->order == e_pool_fifo);
+        for(uint i = 1; !found && i < pool->nthreads; i++)
+            found = deque_take(&pool->deques[(worker->index + i) % pool->nthreads], &task, 1);
+
+        pthread_mutex_lock(&pool->lock);
+        if(!found)
+        {
+            if(pool->queued == 0)
+            {
+                if(pool->stop)
+                {
+                    pthread_mutex_unlock(&pool->lock);
+                    return NULL;
+                }
+                pthread_cond_wait(&pool->work_cv, &pool->lock);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->unfinished == 0)
+            pthread_cond_broadcast(&pool->idle_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+/* --- Description for threadpool_create Function --->
+ * Input: nthreads, order
+ * Output: pool, NULL on failure
+ */
+ThreadPool *threadpool_create(uint nthreads, PoolOrder order)
+{
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if(pool == NULL)
+        return NULL;
+
+    if(nthreads == 0)
+        nthreads = 1;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    pool->workers = calloc(nthreads, sizeof(PoolWorker));
+    pool->deques = calloc(nthreads, sizeof(TaskDeque));
+    if(pool->threads == NULL || pool->workers == NULL || pool->deques == NULL)
+    {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    pool->order = order;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->idle_cv, NULL);
+    for(uint i = 0; i < nthreads; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+    // deques exist for every worker before any thread may try to steal
+    pool->nthreads = nthreads;
+    uint started = 0;
+    for(; started < nthreads; started++)
+    {
+        pool->workers[started].pool = pool;
+        pool->workers[started].index = started;
+        if(pthread_create(&pool->threads[started], NULL, pool_worker, &pool->workers[started]) != 0)
+            break;
+    }
+    if(started < nthreads)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->nthreads = started;     // only join the threads that exist
+        pthread_mutex_unlock(&pool->lock);
+        threadpool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+
+/* --- Description for threadpool_submit Function --->
+ * Input: pool, fn, arg
+ * Output: Status
+ * Description: Queues the task on the next deque (round robin) and wakes
+ * a sleeping worker.
+ */
+Status threadpool_submit(ThreadPool *pool, TaskFn fn, void *arg)
+{
+    Task task = { fn, arg };
+    uint target = pool->next_deque++ % pool->nthreads;
+
+    // counted before the push so a worker never takes an uncounted task
+    pthread_mutex_lock(&pool->lock);
+    pool->unfinished++;
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if(deque_push(&pool->deques[target], task) == e_failure)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->unfinished--;
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+        return e_failure;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+    return e_success;
+}
+
+
+/* --- Description for threadpool_wait Function --->
+ * Input: pool
+ * Output: None
+ */
+void threadpool_wait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while(pool->unfinished > 0)
+        pthread_cond_wait(&pool->idle_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/* --- Description for threadpool_destroy Function --->
+ * Input: pool
+ * Output: None
+ */
+void threadpool_destroy(ThreadPool *pool)
+{
+    threadpool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(uint i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for(uint i = 0; i < pool->nthreads; i++)
+    {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->idle_cv);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
@@ -0,0 +1,41 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Work-stealing thread pool.
+ * Every worker owns a task deque. Tasks are spread over the deques when
+ * submitted, a worker runs its own tasks newest first (e_pool_lifo) or
+ * oldest first (e_pool_fifo) and, once its deque is empty, steals the
+ * oldest task of another worker.
+ */
+
+/* Task run by the pool */
+typedef void (*TaskFn)(void *arg);
+
+/* Order of the tasks a worker takes from its own deque */
+typedef enum
+{
+    e_pool_lifo,    // newest first: jobs known up front, whose order doesn't matter (batch)
+    e_pool_fifo     // oldest first: no task waits behind later ones (server connections)
+} PoolOrder;
+
+typedef struct _ThreadPool ThreadPool;
+
+
+/* -- function prototypes for the thread pool */
+
+/* Start a pool of nthreads workers */
+ThreadPool *threadpool_create(uint nthreads, PoolOrder order);
+
+/* Queue fn(arg) on the pool */
+Status threadpool_submit(ThreadPool *pool, TaskFn fn, void *arg);
+
+/* Wait until every submitted task has finished */
+void threadpool_wait(ThreadPool *pool);
+
+/* Stop the workers and free the pool (pending tasks are run first) */
+void threadpool_destroy(ThreadPool *pool);
+
+#endif
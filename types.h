@@ -15,6 +15,18 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_extract,
+    e_probe,
+    e_shard,
+    e_join,
+    e_archive,
+    e_list,
+    e_unpack,
+    e_update,
+    e_serve,
+    e_client,
+    e_analyze,
     e_unsupported
 } OperationType;
 
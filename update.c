@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "update.h"
+#include "encode.h"
+#include "decode.h"
+#include "container.h"
+#include "fileio.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "parallel.h"
+#include "metrics.h"
+#include "types.h"
+
+
+/* --- Description for read_and_validate_update_args Function --->
+ * Input: argc, argv, updateInfo
+ * Output: Status (e_success / e_failure)
+ * Description: Usage: -r <stego.bmp> <secret_file> [--append] [--extn .ext] [--key file] [-j N]
+ * The image is rewritten in place, so it can't be a pipe.
+ */
+Status read_and_validate_update_args(int argc, char *argv[], UpdateInfo *updateInfo)
+{
+    int count = 0;
+
+    updateInfo->image_fname = NULL;
+    updateInfo->secret_fname = NULL;
+    updateInfo->append = 0;
+    updateInfo->extn = NULL;
+    updateInfo->key_fname = NULL;
+    updateInfo->jobs = 1;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--append") == 0)
+            updateInfo->append = 1;
+        else if(strcmp(argv[i], "--extn") == 0 && i + 1 < argc && argv[i + 1][0] == '.')
+            updateInfo->extn = argv[++i];
+        else if(strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+            updateInfo->key_fname = argv[++i];
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_jobs(argv[++i], &updateInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0)    // -jN
+        {
+            if(parse_jobs(argv[i] + 2, &updateInfo->jobs) == e_failure)
+                return e_failure;
+        }
+        else if(strncmp(argv[i], "--", 2) == 0)   // unknown option
+            return e_failure;
+        else if(count == 0)
+            updateInfo->image_fname = argv[count++, i];
+        else if(count == 1)
+            updateInfo->secret_fname = argv[count++, i];
+        else
+            return e_failure;
+    }
+
+    if(count < 2 || strstr(updateInfo->image_fname, ".bmp") == NULL)
+        return e_failure;
+    if(updateInfo->extn != NULL && strlen(updateInfo->extn) >= MAX_FILE_SUFFIX)
+        return e_failure;
+    return e_success;
+}
+
+
+/* --- Description for update_open Function --->
+ * Input: updateInfo, decInfo
+ * Output: Status
+ * Description: Decodes the header and chunk table of the image with the
+ * decoder's own functions, checking the key of an encrypted payload.
+ * Images without a container and shards of a set can't be updated.
+ */
+static Status update_open(UpdateInfo *updateInfo, DecodeInfo *decInfo)
+{
+    decInfo->stego_image_fname = updateInfo->image_fname;
+    decInfo->secret_fname = updateInfo->image_fname;    // any name but "-"
+    decInfo->key_fname = updateInfo->key_fname;
+    decInfo->jobs = 1;
+
+    if(open_decode_files(decInfo) == e_failure)
+        return e_failure;
+    info_printf("INFO : Decoding Header\n");
+    if(decode_magic_string(decInfo) == e_failure || decode_file_extn_size(decInfo) == e_failure ||
+       decode_secret_file_extn(decInfo->extn_size, decInfo) == e_failure ||
+       decode_secret_file_size(decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed Decoding of the header\n");
+        return e_failure;
+    }
+    if(decInfo->version == 0)
+    {
+        fprintf(job_stderr(), "ERROR : %s predates the container format, encode it again with -e\n", updateInfo->image_fname);
+        return e_failure;
+    }
+    if(decInfo->flags & CONTAINER_SHARDED)
+    {
+        fprintf(job_stderr(), "ERROR : The image holds shard %u of a set of %u, which can't be updated alone\n",
+                decInfo->shard.index, decInfo->shard.data + decInfo->shard.parity);
+        return e_failure;
+    }
+    if(decode_cipher_key(decInfo) == e_failure || decode_chunk_table(decInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : Failed Decoding of the header\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+
+/* --- Description for update_copy Function --->
+ * Input: updateInfo (secret_fname), dest
+ * Output: Status
+ * Description: Copies the new bytes (file or stdin) to the end of dest.
+ */
+static Status update_copy(UpdateInfo *updateInfo, FILE *dest)
+{
+    FILE *src = strcmp(updateInfo->secret_fname, "-") == 0 ? stdin : fopen(updateInfo->secret_fname, "rb");
+    char buffer[64 * 1024];
+    Status ret = e_success;
+    size_t got;
+
+    if(src == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", updateInfo->secret_fname);
+        return e_failure;
+    }
+    while((got = fread(buffer, 1, sizeof(buffer), src)) > 0)
+        if(fwrite(buffer, 1, got, dest) != got)
+        {
+            ret = e_failure;
+            break;
+        }
+    if(ferror(src) || fflush(dest) != 0)
+        ret = e_failure;
+    if(src != stdin)
+        fclose(src);
+    return ret;
+}
+
+
+/* --- Description for update_walk_frames Function --->
+ * Input: decInfo (header decoded, frames), frames, last, last_pos, end_pos
+ * Output: Status (e_failure for a damaged entry or a payload running off the image)
+ * Description: Reads the frame entries only, skipping the data between
+ * them, to count the frames and find the colour bytes of the last frame
+ * and of the ending entry.
+ */
+static Status update_walk_frames(DecodeInfo *decInfo, uint64_t *frames, ChunkEntry *last, uint64_t *last_pos,
+                                 uint64_t *end_pos)
+{
+    size_t entry_size = chunk_stored_size(CHUNK_ENTRY_SIZE, decInfo->depth);
+    unsigned char bytes[CHUNK_ENTRY_SIZE + MAX_LSB_DEPTH] = { 0 };
+    ChunkEntry entry;
+
+    *frames = 0;
+    if(bmp_rows_seek(&decInfo->rows, decInfo->data_pos) == e_failure)
+        return e_failure;
+    for(;;)
+    {
+        uint64_t pos = decInfo->rows.pos;
+        if(decode_data_at_depth(bytes, entry_size, decInfo->depth, &decInfo->rows) == e_failure)
+            return e_failure;
+        chunk_entry_unpack(&entry, bytes);
+        if(entry.length == 0)               // End of the payload
+        {
+            *end_pos = pos;
+            return e_success;
+        }
+        if(entry.length > decInfo->chunk_size)
+            return e_failure;
+
+        *last = entry;
+        *last_pos = pos;
+        (*frames)++;
+        if(bmp_rows_seek(&decInfo->rows, decInfo->rows.pos +
+                         lsb_image_bytes(chunk_stored_size(entry.length, decInfo->depth), decInfo->depth)) == e_failure)
+            return e_failure;
+    }
+}
+
+
+/* --- Description for update_frames_image_bytes Function --->
+ * Input: size (payload bytes), chunk_size, depth
+ * Output: colour bytes of size bytes of frames and the ending entry
+ * Description: Counts every frame uncompressed, which is as large as a
+ * frame can get.
+ */
+static uint64_t update_frames_image_bytes(uint64_t size, size_t chunk_size, uint depth)
+{
+    uint64_t entry = lsb_image_bytes(chunk_stored_size(CHUNK_ENTRY_SIZE, depth), depth);
+    uint64_t full = size / chunk_size, rest = size % chunk_size;
+    uint64_t bytes = full * (entry + lsb_image_bytes(chunk_stored_size(chunk_size, depth), depth)) + entry;
+
+    if(rest > 0)
+        bytes += entry + lsb_image_bytes(chunk_stored_size(rest, depth), depth);
+    return bytes;
+}
+
+
+/* --- Description for update_append_frames Function --->
+ * Input: updateInfo, decInfo (header decoded, frames, linear and in file order)
+ * Output: Status
+ * Description:
+ * 1. Walks the frame entries to the end of the payload.
+ * 2. Every frame but the last holds a whole chunk (decode_frames_range
+ *    relies on it), so a short or compressed last frame is decoded and
+ *    written again with the new bytes after it.
+ * 3. Checks the capacity, then embeds the new frames and the ending entry
+ *    in place, keyed with the image's own nonce.
+ */
+static Status update_append_frames(UpdateInfo *updateInfo, DecodeInfo *decInfo)
+{
+    uint64_t frames, last_pos = 0, end_pos;
+    ChunkEntry last = { 0 };
+
+    info_printf("INFO : Finding the end of the payload\n");
+    if(update_walk_frames(decInfo, &frames, &last, &last_pos, &end_pos) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : The payload is damaged\n");
+        return e_failure;
+    }
+
+    char *temp_fname = NULL;
+    FILE *temp = create_temp_file(&temp_fname);
+    uint64_t index = frames, pos = end_pos;
+    Status ret = temp != NULL ? e_success : e_failure;
+
+    if(ret == e_success && frames > 0 && (last.compressed || last.length < decInfo->chunk_size))
+    {
+        index = frames - 1;
+        pos = last_pos;
+        decInfo->fptr_secret = temp;
+        ret = decode_secret_bytes(decInfo, index * decInfo->chunk_size, UINT64_MAX);
+        decInfo->fptr_secret = NULL;
+        if(ret == e_failure)
+            fprintf(job_stderr(), "ERROR : The last frame of the payload is damaged\n");
+    }
+    if(ret == e_success)
+        ret = update_copy(updateInfo, temp);
+
+    uint64_t size = ret == e_success ? get_file_size(temp) : 0;
+    if(ret == e_success && pos + update_frames_image_bytes(size, decInfo->chunk_size, decInfo->depth) > decInfo->bmp.colour_bytes)
+    {
+        fprintf(job_stderr(), "ERROR : Image cannot hold the appended data\n");
+        ret = e_failure;
+    }
+
+    EncodeInfo encInfo;
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.fptr_secret = temp;
+    encInfo.depth = decInfo->depth;
+    encInfo.chunk_size = decInfo->chunk_size;
+    encInfo.flags = decInfo->flags;
+    encInfo.compress = (decInfo->flags & CONTAINER_COMPRESSED) != 0;
+    encInfo.cipher = decInfo->cipher;
+    if(ret == e_success && (encInfo.fptr_stego_image = fopen(updateInfo->image_fname, "r+b")) == NULL)
+    {
+        perror("fopen");
+        ret = e_failure;
+    }
+    if(ret == e_success)
+    {
+        info_printf("INFO : Writing %llu bytes from frame %llu on\n", (unsigned long long)size, (unsigned long long)index);
+        ret = encode_frames_at_offset(&encInfo, index, decInfo->bmp.data_offset + pos);
+    }
+
+    if(encInfo.fptr_stego_image != NULL && fclose(encInfo.fptr_stego_image) != 0)
+        ret = e_failure;
+    if(temp != NULL)
+        fclose(temp);
+    if(temp_fname != NULL)
+        unlink(temp_fname);
+    free(temp_fname);
+    return ret;
+}
+
+
+/* --- Description for update_fits_last_chunk Function --->
+ * Input: updateInfo (secret_fname a file), decInfo (header and chunk table decoded)
+ * Output: 1 if update_append_chunk can add the file: the payload has a
+ * table, is neither compressed nor scattered, the image is linear and the
+ * file fits in the room left in the last chunk
+ */
+static int update_fits_last_chunk(UpdateInfo *updateInfo, DecodeInfo *decInfo)
+{
+    FILE *src;
+    uint64_t size;
+
+    if((decInfo->flags & (CONTAINER_STREAMED | CONTAINER_COMPRESSED | CONTAINER_SCATTERED)) ||
+       !bmp_is_linear(&decInfo->bmp) || decInfo->nchunks == 0 || (src = fopen(updateInfo->secret_fname, "rb")) == NULL)
+        return 0;
+    size = get_file_size(src);
+    fclose(src);
+    return size <= decInfo->chunk_size - decInfo->table[decInfo->nchunks - 1].length;
+}
+
+
+/* --- Description for update_append_chunk Function --->
+ * Input: updateInfo (secret_fname a file), decInfo (update_fits_last_chunk)
+ * Output: Status
+ * Description: A new chunk would grow the chunk table and move every chunk
+ * after it, but bytes that fit in the room left in the last chunk only
+ * change that chunk, its table entry and the header:
+ * 1. Decodes the stored bytes of the last chunk's partial group, if any,
+ *    and adds the new bytes after them, encrypted at their place.
+ * 2. Embeds that group on, then the entry with the new length and the CRC
+ *    continued over the new bytes, then the header with the new size and
+ *    its checksum, in place with the image's own nonce.
+ */
+static Status update_append_chunk(UpdateInfo *updateInfo, DecodeInfo *decInfo)
+{
+    uint64_t last = decInfo->nchunks - 1;
+    ChunkEntry *entry = &decInfo->table[last];
+    size_t group = lsb_group_size(decInfo->depth);
+    size_t keep = entry->length % group;            // stored bytes of the partial group
+    uint64_t group_pos = decInfo->data_pos + last * lsb_image_bytes(chunk_stored_size(decInfo->chunk_size, decInfo->depth),
+                         decInfo->depth) + lsb_image_bytes(entry->length - keep, decInfo->depth);
+    FILE *src = fopen(updateInfo->secret_fname, "rb");
+    size_t size = src != NULL ? get_file_size(src) : 0;
+
+    if(src == NULL)
+    {
+        perror("fopen");
+        fprintf(job_stderr(), "ERROR : Unable to open file %s\n", updateInfo->secret_fname);
+        return e_failure;
+    }
+
+    size_t stored = chunk_stored_size(keep + size, decInfo->depth);
+    unsigned char *bytes = calloc(1, stored + group);
+    Status ret = bytes != NULL ? e_success : e_failure;
+
+    if(ret == e_success && keep > 0 && (bmp_rows_seek(&decInfo->rows, group_pos) == e_failure ||
+       decode_data_at_depth(bytes, group, decInfo->depth, &decInfo->rows) == e_failure))
+    {
+        fprintf(job_stderr(), "ERROR : The last chunk of the payload is damaged\n");
+        ret = e_failure;
+    }
+    if(ret == e_success && fread(bytes + keep, 1, size, src) != size)
+    {
+        perror("fread");
+        ret = e_failure;
+    }
+    fclose(src);
+    memset(bytes + keep + size, 0, stored - keep - size);
+    if(ret == e_success && group_pos + lsb_image_bytes(stored, decInfo->depth) > decInfo->bmp.colour_bytes)
+    {
+        fprintf(job_stderr(), "ERROR : Image cannot hold the appended data\n");
+        ret = e_failure;
+    }
+
+    EncodeInfo encInfo;
+    memset(&encInfo, 0, sizeof(encInfo));
+    strcpy(encInfo.extn_secret_file, decInfo->extn_secret_file);
+    encInfo.depth = decInfo->depth;
+    encInfo.size_secret_file = decInfo->size_secret_file + size;
+    encInfo.flags = decInfo->flags;
+    encInfo.chunk_size = decInfo->chunk_size;
+    encInfo.cipher = decInfo->cipher;
+    memcpy(encInfo.nonce, decInfo->nonce, CHACHA_NONCE_SIZE);
+    if(ret == e_success && (encInfo.fptr_stego_image = fopen(updateInfo->image_fname, "r+b")) == NULL)
+    {
+        perror("fopen");
+        ret = e_failure;
+    }
+
+    if(ret == e_success)
+    {
+        unsigned char packed[CHUNK_ENTRY_SIZE], header[MAX_HEADER_SIZE];
+        int fd = fileno(encInfo.fptr_stego_image);
+        uint header_size = encode_header_to_buffer(&encInfo, header);
+        off_t offset = decInfo->bmp.data_offset + group_pos;
+
+        if(decInfo->flags & CONTAINER_ENCRYPTED)
+            chacha20_xor(&decInfo->cipher, bytes + keep, size,
+                         CIPHER_DATA_OFFSET + last * decInfo->chunk_size + entry->length);
+        entry->crc = crc32c(entry->crc, bytes + keep, size);
+        entry->length += size;
+        chunk_entry_pack(entry, packed);
+
+        info_printf("INFO : Adding %llu bytes to chunk %llu\n", (unsigned long long)size, (unsigned long long)last);
+        ret = encode_data_at_offset(bytes, stored, decInfo->depth, fd, fd, &offset);
+        offset = decInfo->bmp.data_offset + decInfo->data_pos - 8 * (decInfo->nchunks - last) * CHUNK_ENTRY_SIZE;
+        if(ret == e_success)
+            ret = encode_data_at_offset(packed, CHUNK_ENTRY_SIZE, 1, fd, fd, &offset);
+        offset = decInfo->bmp.data_offset;
+        if(ret == e_success)
+            ret = encode_data_at_offset(header, header_size, 1, fd, fd, &offset);
+    }
+
+    if(encInfo.fptr_stego_image != NULL && fclose(encInfo.fptr_stego_image) != 0)
+        ret = e_failure;
+    free(bytes);
+    return ret;
+}
+
+
+/* --- Description for update_rewrite Function --->
+ * Input: updateInfo, decInfo (header decoded)
+ * Output: Status
+ * Description: Encodes the new payload over the image itself with the
+ * image's depth, compression, key and scatter (see EncodeInfo.in_place).
+ * Appending decodes the current payload first, stdin is read up front, so
+ * the encoder knows the size and checks the capacity before writing.
+ */
+static Status update_rewrite(UpdateInfo *updateInfo, DecodeInfo *decInfo)
+{
+    char *secret_fname = updateInfo->secret_fname;
+    char *temp_fname = NULL;
+    Status ret = e_success;
+
+    if(updateInfo->append || strcmp(secret_fname, "-") == 0)
+    {
+        FILE *temp = create_temp_file(&temp_fname);
+        if(temp == NULL)
+            ret = e_failure;
+        if(ret == e_success && updateInfo->append)
+        {
+            info_printf("INFO : Decoding the current payload\n");
+            decInfo->fptr_secret = temp;
+            ret = decode_secret_bytes(decInfo, 0, decInfo->flags & CONTAINER_STREAMED ? UINT64_MAX : decInfo->size_secret_file);
+            decInfo->fptr_secret = NULL;
+            if(ret == e_failure)
+                fprintf(job_stderr(), "ERROR : The payload is damaged\n");
+        }
+        if(ret == e_success)
+            ret = update_copy(updateInfo, temp);
+        if(temp != NULL)
+            fclose(temp);
+        secret_fname = temp_fname;
+    }
+
+    char depth[4], jobs[12];
+    char *argv[16] = { "stego", "-e", updateInfo->image_fname, secret_fname, updateInfo->image_fname, "--depth", depth,
+                       "--extn", updateInfo->extn != NULL ? updateInfo->extn : decInfo->extn_secret_file, "-j", jobs };
+    int argc = 11;
+
+    snprintf(depth, sizeof(depth), "%u", decInfo->depth);
+    snprintf(jobs, sizeof(jobs), "%u", updateInfo->jobs);
+    if(decInfo->flags & CONTAINER_COMPRESSED)
+        argv[argc++] = "--compress";
+    if(decInfo->flags & CONTAINER_ENCRYPTED)
+    {
+        argv[argc++] = "--key";
+        argv[argc++] = updateInfo->key_fname;
+    }
+    if(decInfo->flags & CONTAINER_SCATTERED)
+        argv[argc++] = "--scatter";
+
+    EncodeInfo encInfo;
+    if(ret == e_success && read_and_validate_encode_args(argc, argv, &encInfo) == e_failure)
+    {
+        fprintf(job_stderr(), "ERROR : The image's extension %s can't be kept, give one with --extn\n", argv[8]);
+        ret = e_failure;
+    }
+    if(ret == e_success)
+    {
+        encInfo.in_place = 1;
+        ret = do_encoding(&encInfo);
+        close_files(&encInfo);
+    }
+
+    if(temp_fname != NULL)
+        unlink(temp_fname);
+    free(temp_fname);
+    return ret;
+}
+
+
+/* --- Description for do_update Function --->
+ * Input: updateInfo
+ * Output: Status
+ * Description: Decodes the header, then appends in place when the payload
+ * is stored over colour bytes in file order: new frames after the last
+ * one, or new bytes in the room left in the last chunk of a table. The
+ * payload is rewritten in place otherwise.
+ */
+Status do_update(UpdateInfo *updateInfo)
+{
+    DecodeInfo decInfo = { 0 };
+    Status ret = update_open(updateInfo, &decInfo);
+
+    if(ret == e_success && updateInfo->extn != NULL && updateInfo->append &&
+       strcmp(updateInfo->extn, decInfo.extn_secret_file) != 0)
+    {
+        fprintf(job_stderr(), "ERROR : Appending keeps the extension %s\n", decInfo.extn_secret_file);
+        ret = e_failure;
+    }
+    if(ret == e_success && updateInfo->append && (decInfo.flags & CONTAINER_ARCHIVE))
+    {
+        fprintf(job_stderr(), "ERROR : The image holds an archive, build it again with -a\n");
+        ret = e_failure;
+    }
+
+    // bytes appended to a table from stdin are read up front, their size decides how they are added
+    char *temp_fname = NULL;
+    if(ret == e_success && updateInfo->append && !(decInfo.flags & CONTAINER_STREAMED) &&
+       strcmp(updateInfo->secret_fname, "-") == 0)
+    {
+        FILE *temp = create_temp_file(&temp_fname);
+        ret = temp != NULL ? update_copy(updateInfo, temp) : e_failure;
+        if(temp != NULL)
+            fclose(temp);
+        updateInfo->secret_fname = temp_fname;
+    }
+
+    if(ret == e_success && updateInfo->append && (decInfo.flags & CONTAINER_STREAMED) &&
+       !(decInfo.flags & CONTAINER_SCATTERED) && bmp_is_linear(&decInfo.bmp))
+        ret = update_append_frames(updateInfo, &decInfo);
+    else if(ret == e_success && updateInfo->append && update_fits_last_chunk(updateInfo, &decInfo))
+        ret = update_append_chunk(updateInfo, &decInfo);
+    else if(ret == e_success)
+    {
+        info_printf(updateInfo->append ? "INFO : The new bytes can't be added in place, rewriting the payload in place\n" :
+                                         "INFO : Rewriting the payload in place\n");
+        ret = update_rewrite(updateInfo, &decInfo);
+    }
+
+    close_decode_files(&decInfo);
+    if(temp_fname != NULL)
+        unlink(temp_fname);
+    free(temp_fname);
+    return ret;
+}
@@ -0,0 +1,44 @@
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Update mode: changes the payload of a stego image in place.
+ *      -r <stego.bmp> <secret_file> [--append] [--extn .ext] [--key file] [-j N]
+ * The image is opened read-write and only the colour bytes holding the new
+ * payload are rewritten, the rest of the file is left as it is. The payload
+ * keeps the depth, compression, encryption and scatter of the image (the key
+ * must be the one it was encoded with) and its extension unless --extn is
+ * given.
+ * Without --append the secret file replaces the payload. With --append it is
+ * added at the end: a payload stored in frames (secret read from a pipe) is
+ * extended from its last frame on, so only the new bytes are written. A
+ * payload with a table takes bytes that fit in its last chunk in place, with
+ * its table entry and header patched. New chunks would grow the table and
+ * move the data after it, so those payloads, compressed ones, and scattered
+ * or padded images are decoded and rewritten whole.
+ * The image is left untouched if the new payload doesn't fit.
+ */
+
+// Structure to hold update mode information
+typedef struct _UpdateInfo
+{
+    char *image_fname;      // stego image updated
+    char *secret_fname;     // new payload or bytes to append ("-" for stdin)
+    int append;             // --append
+    char *extn;             // --extn, NULL to keep the image's extension
+    char *key_fname;        // --key, needed when the payload is encrypted
+    uint jobs;              // -j
+} UpdateInfo;
+
+
+/* -- function prototypes for update mode */
+
+/* Read and validate -r args from argv */
+Status read_and_validate_update_args(int argc, char *argv[], UpdateInfo *updateInfo);
+
+/* Replace or append to the payload of the image in place */
+Status do_update(UpdateInfo *updateInfo);
+
+#endif